@@ -0,0 +1,548 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Throughput and latency benchmarks for SFTPClient against an in-process loopback server.
+//
+// With --rtt-ms the client reaches the server through WanProxy, once per listed RTT, so the
+// same suite shows how chunk size, pipelining depth and parallel streams behave on long links.
+//
+// Every measurement is written as one JSON object per line. When --baseline points at the
+// output of an earlier run, each result is compared against it and the process exits with
+// status 2 if any metric dropped by more than --tolerance.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "sftpclient.h"
+#include "sftpserverfixture.h"
+#include "wanproxy.h"
+
+namespace {
+
+struct Config {
+    std::vector<uint64_t> fileSizes{1 << 20, 16 << 20, 128 << 20};
+    std::vector<uint64_t> chunkSizes{8 * 1024, 16 * 1024, 32 * 1024};
+    std::vector<uint64_t> lsEntries{10000, 100000};
+    std::vector<uint64_t> streams{1};
+    std::vector<uint64_t> depths{1, 16, 64};
+    std::vector<uint64_t> rttMs;
+    cts::WanProfile link;
+    uint64_t statOps = 20000;
+    unsigned int repeat = 3;
+    std::string jsonPath;
+    std::string baselinePath;
+    double tolerance = 0.10;
+};
+
+struct Result {
+    std::string benchmark;
+    std::vector<std::pair<std::string, uint64_t>> params;
+    std::string metric;
+    double value;
+
+    std::string id() const {
+        std::string id = benchmark;
+        for (const auto& param : params) {
+            id += "/" + param.first + "=" + std::to_string(param.second);
+        }
+        return id;
+    }
+
+    std::string toJson() const {
+        std::ostringstream out;
+        out << "{\"id\":\"" << id() << "\",\"benchmark\":\"" << benchmark << "\"";
+        for (const auto& param : params) {
+            out << ",\"" << param.first << "\":" << param.second;
+        }
+        out << ",\"metric\":\"" << metric << "\",\"value\":" << std::fixed << value << "}";
+        return out.str();
+    }
+};
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(const Clock::time_point& start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double median(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+bool parseSize(const std::string& text, uint64_t& value) {
+    char* end = nullptr;
+    value = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+
+    switch (*end) {
+        case 'K':
+        case 'k':
+            value <<= 10;
+            break;
+        case 'M':
+        case 'm':
+            value <<= 20;
+            break;
+        case 'G':
+        case 'g':
+            value <<= 30;
+            break;
+        case '\0':
+            return true;
+        default:
+            return false;
+    }
+
+    return end[1] == '\0';
+}
+
+bool parseSizeList(const std::string& text, std::vector<uint64_t>& values) {
+    values.clear();
+    std::istringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        uint64_t value = 0;
+        if (!parseSize(item, value)) {
+            return false;
+        }
+        values.push_back(value);
+    }
+
+    return !values.empty();
+}
+
+void printUsage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [options]\n"
+              << "  --sizes=LIST       file sizes for put/get (default 1M,16M,128M)\n"
+              << "  --chunks=LIST      chunk sizes for put/get (default 8K,16K,32K)\n"
+              << "  --ls-entries=LIST  directory sizes for ls (default 10000,100000)\n"
+              << "  --streams=LIST     parallel connections for put/get (default 1)\n"
+              << "  --depths=LIST      requests in flight per transfer (default 1,16,64)\n"
+              << "  --stat-ops=N       number of stat calls (default 20000)\n"
+              << "  --repeat=N         runs per measurement, the median is reported (default 3)\n"
+              << "  --json=PATH        write results to PATH instead of stdout\n"
+              << "  --baseline=PATH    compare against an earlier --json output\n"
+              << "  --tolerance=F      allowed relative drop vs the baseline, 0..1 (default 0.10)\n"
+              << "  --rtt-ms=LIST      run everything through a WAN proxy once per RTT\n"
+              << "  --jitter-ms=N      proxy jitter per direction\n"
+              << "  --bandwidth=N[KMG] proxy bandwidth cap in bits per second\n"
+              << "  --loss=F           proxy retransmission probability per segment, 0..1\n";
+}
+
+bool parseArgs(int argc, char** argv, Config& config) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto eq = arg.find('=');
+        const std::string key = arg.substr(0, eq);
+        const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        uint64_t number = 0;
+        bool ok = true;
+        if (key == "--sizes") {
+            ok = parseSizeList(value, config.fileSizes);
+        } else if (key == "--chunks") {
+            ok = parseSizeList(value, config.chunkSizes);
+        } else if (key == "--ls-entries") {
+            ok = parseSizeList(value, config.lsEntries);
+        } else if (key == "--streams") {
+            ok = parseSizeList(value, config.streams) &&
+                 std::find(config.streams.begin(), config.streams.end(), 0u) ==
+                     config.streams.end();
+        } else if (key == "--depths") {
+            ok = parseSizeList(value, config.depths) &&
+                 std::find(config.depths.begin(), config.depths.end(), 0u) ==
+                     config.depths.end();
+        } else if (key == "--rtt-ms") {
+            ok = parseSizeList(value, config.rttMs);
+        } else if (key == "--jitter-ms") {
+            ok = parseSize(value, number);
+            config.link.jitter = std::chrono::milliseconds(number);
+        } else if (key == "--bandwidth") {
+            ok = cts::parseBandwidth(value, config.link.bandwidthBitsPerSec);
+        } else if (key == "--loss") {
+            ok = cts::parseFraction(value, config.link.lossRate);
+        } else if (key == "--stat-ops") {
+            ok = parseSize(value, config.statOps);
+        } else if (key == "--repeat") {
+            ok = parseSize(value, number) && number > 0;
+            config.repeat = static_cast<unsigned int>(number);
+        } else if (key == "--json") {
+            config.jsonPath = value;
+        } else if (key == "--baseline") {
+            config.baselinePath = value;
+        } else if (key == "--tolerance") {
+            ok = cts::parseFraction(value, config.tolerance);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << "Invalid argument: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool writeRandomFile(const std::string& path, uint64_t size) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+
+    // xorshift output is incompressible, so compression never flatters the numbers.
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    std::vector<uint64_t> block(8192);
+    uint64_t remaining = size;
+    while (remaining > 0) {
+        for (auto& word : block) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            word = state;
+        }
+
+        const auto bytes = std::min<uint64_t>(remaining, block.size() * sizeof(uint64_t));
+        file.write(reinterpret_cast<const char*>(block.data()),
+                   static_cast<std::streamsize>(bytes));
+        remaining -= bytes;
+    }
+
+    return static_cast<bool>(file);
+}
+
+bool reportError(const std::string& what, const cts::SFTPError& err) {
+    std::cerr << what << " failed: " << err.getSSHErrorCode() << " " << err.getSFTPErrorCode()
+              << " " << err.getSSHErrorMsg() << std::endl;
+    return false;
+}
+
+// Runs one transfer per client concurrently and returns the aggregate bytes per second.
+template <typename Transfer>
+bool timeParallel(std::vector<cts::SFTPClient>& clients, size_t streams, uint64_t bytesPerStream,
+                  const char* what, Transfer transfer, std::vector<double>& samples) {
+    std::vector<cts::SFTPError> errors(streams);
+    std::vector<std::thread> threads;
+
+    const auto start = Clock::now();
+    for (size_t i = 0; i < streams; ++i) {
+        threads.emplace_back([&, i] { errors[i] = transfer(clients[i], i); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    const double elapsed = secondsSince(start);
+
+    for (const auto& err : errors) {
+        if (!err.isOk()) {
+            return reportError(what, err);
+        }
+    }
+
+    samples.push_back(static_cast<double>(bytesPerStream * streams) / elapsed);
+    return true;
+}
+
+bool benchTransfers(std::vector<cts::SFTPClient>& clients, const std::string& workDir,
+                    const Config& config, uint64_t rttMs, uint64_t depth,
+                    std::vector<Result>& results) {
+    const std::string localSrc = workDir + "/transfer.src";
+    const std::string localDst = workDir + "/transfer.dst";
+    const std::string remote = workDir + "/transfer.remote";
+
+    for (const auto size : config.fileSizes) {
+        if (!writeRandomFile(localSrc, size)) {
+            std::cerr << "Failed to create " << localSrc << std::endl;
+            return false;
+        }
+
+        for (const auto streams : config.streams) {
+            for (const auto chunk : config.chunkSizes) {
+                const auto chunkSize = static_cast<unsigned int>(chunk);
+                const auto put = [&](cts::SFTPClient& client, size_t i) {
+                    return client.put(localSrc, remote + std::to_string(i), chunkSize);
+                };
+                const auto get = [&](cts::SFTPClient& client, size_t i) {
+                    return client.get(localDst + std::to_string(i), remote + std::to_string(i),
+                                      chunkSize);
+                };
+
+                std::vector<double> putSamples;
+                std::vector<double> getSamples;
+                for (unsigned int run = 0; run < config.repeat; ++run) {
+                    if (!timeParallel(clients, streams, size, "put", put, putSamples) ||
+                        !timeParallel(clients, streams, size, "get", get, getSamples)) {
+                        return false;
+                    }
+                }
+
+                const std::vector<std::pair<std::string, uint64_t>> params = {
+                    {"size", size},       {"chunk", chunk},  {"depth", depth},
+                    {"streams", streams}, {"rtt_ms", rttMs}};
+                results.push_back({"put", params, "bytes_per_sec", median(putSamples)});
+                results.push_back({"get", params, "bytes_per_sec", median(getSamples)});
+            }
+        }
+    }
+
+    ::unlink(localSrc.c_str());
+    for (size_t i = 0; i < clients.size(); ++i) {
+        ::unlink((localDst + std::to_string(i)).c_str());
+        ::unlink((remote + std::to_string(i)).c_str());
+    }
+    return true;
+}
+
+bool benchLs(cts::SFTPClient& client, const std::string& workDir, const Config& config,
+             uint64_t rttMs, std::vector<Result>& results) {
+    for (const auto entries : config.lsEntries) {
+        const std::string dir = workDir + "/ls_" + std::to_string(entries);
+        if (::mkdir(dir.c_str(), 0700) < 0) {
+            std::cerr << "Failed to create " << dir << std::endl;
+            return false;
+        }
+
+        // The server shares our filesystem, so populate the directory locally.
+        for (uint64_t i = 0; i < entries; ++i) {
+            const std::string path = dir + "/f" + std::to_string(i);
+            const int fd = ::open(path.c_str(), O_CREAT | O_WRONLY, 0600);
+            if (fd < 0) {
+                std::cerr << "Failed to create " << path << std::endl;
+                return false;
+            }
+            ::close(fd);
+        }
+
+        std::vector<double> samples;
+        for (unsigned int run = 0; run < config.repeat; ++run) {
+            const auto start = Clock::now();
+            const auto listing = client.ls(dir);
+            if (!listing.first.isOk()) {
+                return reportError("ls", listing.first);
+            }
+            samples.push_back(static_cast<double>(listing.second.size()) / secondsSince(start));
+        }
+
+        results.push_back(
+            {"ls", {{"entries", entries}, {"rtt_ms", rttMs}}, "entries_per_sec", median(samples)});
+
+        for (uint64_t i = 0; i < entries; ++i) {
+            ::unlink((dir + "/f" + std::to_string(i)).c_str());
+        }
+        ::rmdir(dir.c_str());
+    }
+
+    return true;
+}
+
+bool benchStat(cts::SFTPClient& client, const std::string& workDir, const Config& config,
+               uint64_t rttMs, std::vector<Result>& results) {
+    if (config.statOps == 0) {
+        return true;
+    }
+
+    const std::string path = workDir + "/stat.target";
+    if (!writeRandomFile(path, 4096)) {
+        std::cerr << "Failed to create " << path << std::endl;
+        return false;
+    }
+
+    std::vector<double> samples;
+    for (unsigned int run = 0; run < config.repeat; ++run) {
+        const auto start = Clock::now();
+        for (uint64_t i = 0; i < config.statOps; ++i) {
+            const auto attrs = client.stat(path);
+            if (!attrs.first.isOk()) {
+                return reportError("stat", attrs.first);
+            }
+        }
+        samples.push_back(static_cast<double>(config.statOps) / secondsSince(start));
+    }
+
+    results.push_back(
+        {"stat", {{"ops", config.statOps}, {"rtt_ms", rttMs}}, "ops_per_sec", median(samples)});
+
+    ::unlink(path.c_str());
+    return true;
+}
+
+std::map<std::string, double> readBaseline(const std::string& path) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        const std::string idKey = "\"id\":\"";
+        const std::string valueKey = "\"value\":";
+        const auto idPos = line.find(idKey);
+        const auto valuePos = line.find(valueKey);
+        if (idPos == std::string::npos || valuePos == std::string::npos) {
+            continue;
+        }
+
+        const auto idStart = idPos + idKey.size();
+        const auto idEnd = line.find('"', idStart);
+        baseline[line.substr(idStart, idEnd - idStart)] =
+            std::strtod(line.c_str() + valuePos + valueKey.size(), nullptr);
+    }
+
+    return baseline;
+}
+
+// All metrics are "higher is better", so a regression is a drop below the tolerated fraction.
+bool checkBaseline(const std::vector<Result>& results, const Config& config) {
+    const auto baseline = readBaseline(config.baselinePath);
+    bool ok = true;
+    for (const auto& result : results) {
+        const auto it = baseline.find(result.id());
+        if (it == baseline.end() || it->second <= 0) {
+            continue;
+        }
+
+        const double change = result.value / it->second - 1.0;
+        if (change < -config.tolerance) {
+            std::cerr << "REGRESSION " << result.id() << ": " << result.value << " vs baseline "
+                      << it->second << " (" << change * 100.0 << "%)" << std::endl;
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Config config;
+    if (!parseArgs(argc, argv, config)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    char workDirTemplate[] = "/tmp/sftpbench.XXXXXX";
+    if (!::mkdtemp(workDirTemplate)) {
+        std::cerr << "Failed to create a work directory" << std::endl;
+        return 1;
+    }
+    const std::string workDir = workDirTemplate;
+
+    cts::SFTPServerFixture server("bench", "bench");
+    if (!server.start()) {
+        std::cerr << "Failed to start the SFTP server: " << server.error() << std::endl;
+        return 1;
+    }
+
+    // Without --rtt-ms everything runs directly against the server, reported as rtt_ms=0.
+    std::vector<uint64_t> rtts = config.rttMs;
+    const bool proxied = !rtts.empty();
+    if (!proxied) {
+        rtts.push_back(0);
+    }
+
+    const auto maxStreams = *std::max_element(config.streams.begin(), config.streams.end());
+
+    std::vector<Result> results;
+    bool ok = true;
+    for (const auto rttMs : rtts) {
+        cts::WanProfile link = config.link;
+        link.rtt = std::chrono::milliseconds(rttMs);
+
+        cts::WanProxy proxy("127.0.0.1", server.port(), link);
+        if (proxied && !proxy.start()) {
+            std::cerr << "Failed to start the WAN proxy: " << proxy.error() << std::endl;
+            ok = false;
+            break;
+        }
+        const uint16_t port = proxied ? proxy.port() : server.port();
+
+        // Pipelining depth is a connection option, so every depth gets fresh connections.
+        std::vector<cts::SFTPClient> clients(static_cast<size_t>(maxStreams));
+        for (const auto depth : config.depths) {
+            cts::ConnectOptions options;
+            options.maxInFlightRequests = static_cast<unsigned int>(depth);
+
+            for (auto& client : clients) {
+                const auto err = client.connect("127.0.0.1", server.user(), server.password(),
+                                                options, port, false);
+                if (!err.isOk()) {
+                    ok = reportError("connect", err);
+                    break;
+                }
+            }
+
+            ok = ok && benchTransfers(clients, workDir, config, rttMs, depth, results);
+            if (!ok) {
+                break;
+            }
+        }
+
+        ok = ok && benchLs(clients.front(), workDir, config, rttMs, results) &&
+             benchStat(clients.front(), workDir, config, rttMs, results);
+
+        clients.clear();
+        proxy.stop();
+        if (!ok) {
+            break;
+        }
+    }
+
+    server.stop();
+    ::rmdir(workDir.c_str());
+
+    std::ofstream jsonFile;
+    if (!config.jsonPath.empty()) {
+        jsonFile.open(config.jsonPath, std::ios::trunc);
+    }
+    std::ostream& out = config.jsonPath.empty() ? std::cout : jsonFile;
+    for (const auto& result : results) {
+        out << result.toJson() << "\n";
+    }
+    out.flush();
+
+    if (!ok) {
+        return 1;
+    }
+
+    if (!config.baselinePath.empty() && !checkBaseline(results, config)) {
+        return 2;
+    }
+
+    return 0;
+}
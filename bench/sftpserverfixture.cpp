@@ -0,0 +1,225 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpserverfixture.h"
+
+#include <arpa/inet.h>
+#include <libssh/callbacks.h>
+#include <libssh/sftp.h>
+#include <libssh/sftpserver.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+
+namespace {
+
+struct ChannelState {
+    ssh_channel channel = nullptr;
+    sftp_session sftp = nullptr;
+    ssh_channel_callbacks_struct callbacks = {};
+};
+
+struct SessionState {
+    const cts::SFTPServerFixture* fixture = nullptr;
+    std::vector<std::unique_ptr<ChannelState>> channels;
+};
+
+int authPassword(ssh_session, const char* user, const char* password, void* userdata) {
+    const auto* state = static_cast<SessionState*>(userdata);
+    if (state->fixture->user() == user && state->fixture->password() == password) {
+        return SSH_AUTH_SUCCESS;
+    }
+
+    return SSH_AUTH_DENIED;
+}
+
+ssh_channel openSessionChannel(ssh_session session, void* userdata) {
+    auto* state = static_cast<SessionState*>(userdata);
+
+    std::unique_ptr<ChannelState> channelState(new ChannelState());
+    channelState->channel = ssh_channel_new(session);
+    if (!channelState->channel) {
+        return nullptr;
+    }
+
+    // libssh's default SFTP server keeps its sftp_session behind the userdata pointer.
+    channelState->callbacks.userdata = &channelState->sftp;
+    channelState->callbacks.channel_data_function = sftp_channel_default_data_callback;
+    channelState->callbacks.channel_subsystem_request_function =
+        sftp_channel_default_subsystem_request;
+    ssh_callbacks_init(&channelState->callbacks);
+    ssh_set_channel_callbacks(channelState->channel, &channelState->callbacks);
+
+    state->channels.push_back(std::move(channelState));
+    return state->channels.back()->channel;
+}
+
+}  // namespace
+
+cts::SFTPServerFixture::SFTPServerFixture(const std::string& user, const std::string& password)
+    : m_user(user), m_password(password) {}
+
+cts::SFTPServerFixture::~SFTPServerFixture() { stop(); }
+
+bool cts::SFTPServerFixture::start() {
+    ssh_key hostKey = nullptr;
+    if (ssh_pki_generate(SSH_KEYTYPE_ED25519, 0, &hostKey) != SSH_OK) {
+        m_error = "Failed to generate a host key";
+        return false;
+    }
+
+    m_bind = ssh_bind_new();
+    if (!m_bind) {
+        ssh_key_free(hostKey);
+        m_error = "Failed to create ssh bind";
+        return false;
+    }
+
+    // The bind takes ownership of the imported key.
+    if (ssh_bind_options_set(m_bind, SSH_BIND_OPTIONS_IMPORT_KEY, hostKey) != SSH_OK) {
+        ssh_key_free(hostKey);
+        m_error = std::string("Failed to import host key: ") + ssh_get_error(m_bind);
+        return false;
+    }
+
+    m_listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listenFd < 0) {
+        m_error = "Failed to create listening socket";
+        return false;
+    }
+
+    const int reuse = 1;
+    ::setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    socklen_t addrLen = sizeof(addr);
+    if (::bind(m_listenFd, reinterpret_cast<sockaddr*>(&addr), addrLen) < 0 ||
+        ::listen(m_listenFd, SOMAXCONN) < 0 ||
+        ::getsockname(m_listenFd, reinterpret_cast<sockaddr*>(&addr), &addrLen) < 0) {
+        m_error = "Failed to listen on the loopback interface";
+        return false;
+    }
+
+    m_port = ntohs(addr.sin_port);
+    m_stopping = false;
+    m_acceptThread = std::thread(&SFTPServerFixture::acceptLoop, this);
+
+    return true;
+}
+
+void cts::SFTPServerFixture::stop() {
+    m_stopping = true;
+
+    if (m_acceptThread.joinable()) {
+        m_acceptThread.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        for (auto& thread : m_sessionThreads) {
+            thread.join();
+        }
+        m_sessionThreads.clear();
+    }
+
+    if (m_listenFd >= 0) {
+        ::close(m_listenFd);
+        m_listenFd = -1;
+    }
+
+    if (m_bind) {
+        ssh_bind_free(m_bind);
+        m_bind = nullptr;
+    }
+}
+
+void cts::SFTPServerFixture::acceptLoop() {
+    while (!m_stopping) {
+        pollfd pfd = {m_listenFd, POLLIN, 0};
+        if (::poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+
+        const int fd = ::accept(m_listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+
+        ssh_session session = ssh_new();
+        if (!session) {
+            ::close(fd);
+            continue;
+        }
+
+        if (ssh_bind_accept_fd(m_bind, session, fd) != SSH_OK) {
+            ssh_free(session);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        m_sessionThreads.emplace_back(&SFTPServerFixture::serveSession, this, session);
+    }
+}
+
+void cts::SFTPServerFixture::serveSession(ssh_session session) {
+    SessionState state;
+    state.fixture = this;
+
+    ssh_server_callbacks_struct serverCallbacks = {};
+    serverCallbacks.userdata = &state;
+    serverCallbacks.auth_password_function = authPassword;
+    serverCallbacks.channel_open_request_session_function = openSessionChannel;
+    ssh_callbacks_init(&serverCallbacks);
+    ssh_set_server_callbacks(session, &serverCallbacks);
+
+    if (ssh_handle_key_exchange(session) == SSH_OK) {
+        ssh_set_auth_methods(session, SSH_AUTH_METHOD_PASSWORD);
+
+        ssh_event event = ssh_event_new();
+        ssh_event_add_session(event, session);
+
+        while (!m_stopping) {
+            if (ssh_event_dopoll(event, 100) == SSH_ERROR) {
+                break;  // Client went away
+            }
+        }
+
+        ssh_event_remove_session(event, session);
+        ssh_event_free(event);
+    }
+
+    for (auto& channelState : state.channels) {
+        if (channelState->sftp) {
+            sftp_server_free(channelState->sftp);
+        }
+    }
+
+    ssh_disconnect(session);
+    ssh_free(session);
+}
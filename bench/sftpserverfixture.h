@@ -0,0 +1,83 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_SERVER_FIXTURE_H
+#define SFTP_SERVER_FIXTURE_H
+
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cts {
+
+// An SFTP server running inside the calling process on the loopback interface. It serves the
+// local filesystem through libssh's default SFTP server implementation, accepts a single
+// user/password pair and uses a freshly generated host key, so benchmarks need no external
+// services or key files.
+class SFTPServerFixture {
+   public:
+    SFTPServerFixture(const std::string& user, const std::string& password);
+    ~SFTPServerFixture();
+
+    bool start();
+
+    void stop();
+
+    uint16_t port() const { return m_port; }
+
+    const std::string& user() const { return m_user; }
+
+    const std::string& password() const { return m_password; }
+
+    const std::string& error() const { return m_error; }
+
+   private:
+    SFTPServerFixture(const SFTPServerFixture&) = delete;
+    SFTPServerFixture& operator=(const SFTPServerFixture&) = delete;
+
+    void acceptLoop();
+
+    void serveSession(ssh_session session);
+
+    std::string m_user;
+    std::string m_password;
+    std::string m_error;
+
+    ssh_bind m_bind = nullptr;
+    int m_listenFd = -1;
+    uint16_t m_port = 0;
+
+    std::atomic<bool> m_stopping{false};
+    std::thread m_acceptThread;
+    std::mutex m_sessionsMutex;
+    std::vector<std::thread> m_sessionThreads;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_SERVER_FIXTURE_H */
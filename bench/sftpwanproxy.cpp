@@ -0,0 +1,117 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Standalone WAN emulator: forwards a local port to an SFTP server while adding latency,
+// jitter, a bandwidth cap and retransmission stalls, e.g.
+//
+//   sftpwanproxy --target=sftp.example.com:22 --listen=2222 --rtt-ms=40 --bandwidth=100M
+
+#include <signal.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "wanproxy.h"
+
+namespace {
+
+void printUsage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " --target=HOST:PORT [options]\n"
+              << "  --listen=PORT      local port to listen on (default: any free port)\n"
+              << "  --rtt-ms=N         round trip time added by the link\n"
+              << "  --jitter-ms=N      uniform jitter applied to each direction\n"
+              << "  --bandwidth=N[KMG] bandwidth cap in bits per second\n"
+              << "  --loss=F           probability that a segment needs a retransmission, 0..1\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string targetHost;
+    unsigned long targetPort = 0;
+    unsigned long listenPort = 0;
+    cts::WanProfile profile;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto eq = arg.find('=');
+        const std::string key = arg.substr(0, eq);
+        const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        bool ok = true;
+        if (key == "--target") {
+            const auto colon = value.rfind(':');
+            ok = colon != std::string::npos;
+            if (ok) {
+                targetHost = value.substr(0, colon);
+                targetPort = std::strtoul(value.c_str() + colon + 1, nullptr, 10);
+            }
+        } else if (key == "--listen") {
+            listenPort = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (key == "--rtt-ms") {
+            profile.rtt = std::chrono::microseconds(
+                static_cast<int64_t>(std::strtod(value.c_str(), nullptr) * 1000));
+        } else if (key == "--jitter-ms") {
+            profile.jitter = std::chrono::microseconds(
+                static_cast<int64_t>(std::strtod(value.c_str(), nullptr) * 1000));
+        } else if (key == "--bandwidth") {
+            ok = cts::parseBandwidth(value, profile.bandwidthBitsPerSec);
+        } else if (key == "--loss") {
+            ok = cts::parseFraction(value, profile.lossRate);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << "Invalid argument: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (targetHost.empty() || targetPort == 0 || targetPort > 65535 || listenPort > 65535) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Block the termination signals before any thread starts so only sigwait() sees them.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    cts::WanProxy proxy(targetHost, static_cast<uint16_t>(targetPort), profile);
+    if (!proxy.start(static_cast<uint16_t>(listenPort))) {
+        std::cerr << proxy.error() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Listening on 127.0.0.1:" << proxy.port() << std::endl;
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+
+    proxy.stop();
+    return 0;
+}
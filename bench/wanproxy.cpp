@@ -0,0 +1,427 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "wanproxy.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <condition_variable>
+#include <deque>
+#include <random>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kSegmentSize = 16 * 1024;
+constexpr size_t kMinQueuedBytes = 16 * 1024 * 1024;
+constexpr std::chrono::milliseconds kMinRetransmitTimeout(200);
+
+bool sendAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        const auto sent = ::send(fd, data, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        len -= static_cast<size_t>(sent);
+    }
+
+    return true;
+}
+
+}  // namespace
+
+bool cts::parseBandwidth(const std::string& text, uint64_t& bitsPerSec) {
+    char* end = nullptr;
+    const double value = std::strtod(text.c_str(), &end);
+    if (end == text.c_str() || value < 0) {
+        return false;
+    }
+
+    double scale = 1;
+    switch (*end) {
+        case 'K':
+        case 'k':
+            scale = 1e3;
+            ++end;
+            break;
+        case 'M':
+        case 'm':
+            scale = 1e6;
+            ++end;
+            break;
+        case 'G':
+        case 'g':
+            scale = 1e9;
+            ++end;
+            break;
+        default:
+            break;
+    }
+
+    if (*end != '\0') {
+        return false;
+    }
+
+    bitsPerSec = static_cast<uint64_t>(value * scale);
+    return true;
+}
+
+bool cts::parseFraction(const std::string& text, double& fraction) {
+    char* end = nullptr;
+    const double value = std::strtod(text.c_str(), &end);
+    // The negated comparison also rejects NaN.
+    if (end == text.c_str() || *end != '\0' || !(value >= 0 && value <= 1)) {
+        return false;
+    }
+
+    fraction = value;
+    return true;
+}
+
+// One direction of a proxied connection. The reader stamps every segment with the time it
+// would arrive at the far end of the emulated link, the writer releases it at that time.
+class cts::WanProxy::Pipe {
+   public:
+    Pipe(int from, int to, const WanProfile& profile, uint32_t seed)
+        : m_from(from), m_to(to), m_profile(profile), m_random(seed) {
+        const auto bdp = m_profile.bandwidthBitsPerSec / 8 *
+                         static_cast<uint64_t>(m_profile.rtt.count()) / 1000000;
+        m_maxQueuedBytes = std::max<size_t>(kMinQueuedBytes, static_cast<size_t>(2 * bdp));
+    }
+
+    ~Pipe() {
+        stop();
+        if (m_reader.joinable()) {
+            m_reader.join();
+        }
+        if (m_writer.joinable()) {
+            m_writer.join();
+        }
+    }
+
+    void start() {
+        m_reader = std::thread(&Pipe::readLoop, this);
+        m_writer = std::thread(&Pipe::writeLoop, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_cv.notify_all();
+        ::shutdown(m_from, SHUT_RDWR);
+        ::shutdown(m_to, SHUT_RDWR);
+    }
+
+    bool done() const { return m_readerDone && m_writerDone; }
+
+   private:
+    struct Segment {
+        Clock::time_point deliverAt;
+        std::vector<char> data;  // Empty marks end of stream
+    };
+
+    Clock::duration oneWayDelay() {
+        auto delay = std::chrono::duration_cast<Clock::duration>(m_profile.rtt / 2);
+        if (m_profile.jitter.count() > 0) {
+            std::uniform_int_distribution<int64_t> dist(-m_profile.jitter.count(),
+                                                        m_profile.jitter.count());
+            delay += std::chrono::microseconds(dist(m_random));
+        }
+
+        return std::max(delay, Clock::duration::zero());
+    }
+
+    Clock::time_point deliveryTime(size_t bytes) {
+        auto now = Clock::now();
+
+        auto departure = now;
+        if (m_profile.bandwidthBitsPerSec > 0) {
+            // In nanoseconds, so that ACK sized segments still occupy the link.
+            const auto txNanos = static_cast<uint64_t>(bytes) * 8 * 1000000000 /
+                                 m_profile.bandwidthBitsPerSec;
+            m_linkFreeAt = std::max(m_linkFreeAt, now) +
+                           std::chrono::duration_cast<Clock::duration>(
+                               std::chrono::nanoseconds(static_cast<int64_t>(txNanos)));
+            departure = m_linkFreeAt;
+        }
+
+        auto deliverAt = departure + oneWayDelay();
+        if (m_profile.lossRate > 0.0 && m_lossDist(m_random) < m_profile.lossRate) {
+            deliverAt += std::max<Clock::duration>(kMinRetransmitTimeout, m_profile.rtt);
+        }
+
+        // TCP delivers in order, so jitter or a retransmission delays everything behind it.
+        m_lastDeliverAt = std::max(m_lastDeliverAt, deliverAt);
+        return m_lastDeliverAt;
+    }
+
+    void push(Segment segment) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&] {
+            return m_stopped || m_queuedBytes + segment.data.size() <= m_maxQueuedBytes;
+        });
+        if (m_stopped) {
+            return;
+        }
+
+        m_queuedBytes += segment.data.size();
+        m_queue.push_back(std::move(segment));
+        m_cv.notify_all();
+    }
+
+    void readLoop() {
+        while (true) {
+            std::vector<char> data(kSegmentSize);
+            const auto received = ::recv(m_from, data.data(), data.size(), 0);
+            if (received <= 0) {
+                push({Clock::now(), {}});
+                break;
+            }
+
+            data.resize(static_cast<size_t>(received));
+            const auto deliverAt = deliveryTime(data.size());
+            push({deliverAt, std::move(data)});
+        }
+
+        m_readerDone = true;
+    }
+
+    void writeLoop() {
+        while (true) {
+            Segment segment;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [&] { return m_stopped || !m_queue.empty(); });
+                if (m_stopped) {
+                    break;
+                }
+
+                const auto deliverAt = m_queue.front().deliverAt;
+                if (m_cv.wait_until(lock, deliverAt, [&] { return m_stopped; })) {
+                    break;
+                }
+
+                segment = std::move(m_queue.front());
+                m_queue.pop_front();
+                m_queuedBytes -= segment.data.size();
+                m_cv.notify_all();
+            }
+
+            if (segment.data.empty()) {
+                ::shutdown(m_to, SHUT_WR);
+                break;
+            }
+
+            if (!sendAll(m_to, segment.data.data(), segment.data.size())) {
+                // Nothing drains the queue any more, so a reader waiting for room must not
+                // wait for it.
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stopped = true;
+                }
+                m_cv.notify_all();
+                ::shutdown(m_from, SHUT_RD);
+                break;
+            }
+        }
+
+        m_writerDone = true;
+    }
+
+    int m_from;
+    int m_to;
+    WanProfile m_profile;
+    std::mt19937 m_random;
+    std::uniform_real_distribution<double> m_lossDist{0.0, 1.0};
+
+    Clock::time_point m_linkFreeAt;
+    Clock::time_point m_lastDeliverAt;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Segment> m_queue;
+    size_t m_queuedBytes = 0;
+    size_t m_maxQueuedBytes = kMinQueuedBytes;
+    bool m_stopped = false;
+
+    std::atomic<bool> m_readerDone{false};
+    std::atomic<bool> m_writerDone{false};
+    std::thread m_reader;
+    std::thread m_writer;
+};
+
+struct cts::WanProxy::Connection {
+    Connection(int client, int server, const WanProfile& profile, uint32_t seed)
+        : clientFd(client),
+          serverFd(server),
+          upstream(new Pipe(client, server, profile, seed)),
+          downstream(new Pipe(server, client, profile, seed + 1)) {
+        upstream->start();
+        downstream->start();
+    }
+
+    ~Connection() {
+        upstream.reset();
+        downstream.reset();
+        ::close(clientFd);
+        ::close(serverFd);
+    }
+
+    bool done() const { return upstream->done() && downstream->done(); }
+
+    int clientFd;
+    int serverFd;
+    std::unique_ptr<Pipe> upstream;
+    std::unique_ptr<Pipe> downstream;
+};
+
+cts::WanProxy::WanProxy(const std::string& targetHost, uint16_t targetPort,
+                        const WanProfile& profile)
+    : m_targetHost(targetHost), m_targetPort(targetPort), m_profile(profile) {}
+
+cts::WanProxy::~WanProxy() { stop(); }
+
+bool cts::WanProxy::start(uint16_t listenPort) {
+    m_listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listenFd < 0) {
+        m_error = "Failed to create listening socket";
+        return false;
+    }
+
+    const int reuse = 1;
+    ::setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(listenPort);
+
+    socklen_t addrLen = sizeof(addr);
+    if (::bind(m_listenFd, reinterpret_cast<sockaddr*>(&addr), addrLen) < 0 ||
+        ::listen(m_listenFd, SOMAXCONN) < 0 ||
+        ::getsockname(m_listenFd, reinterpret_cast<sockaddr*>(&addr), &addrLen) < 0) {
+        m_error = "Failed to listen on port " + std::to_string(listenPort);
+        return false;
+    }
+
+    m_port = ntohs(addr.sin_port);
+    m_stopping = false;
+    m_acceptThread = std::thread(&WanProxy::acceptLoop, this);
+
+    return true;
+}
+
+void cts::WanProxy::stop() {
+    m_stopping = true;
+
+    if (m_acceptThread.joinable()) {
+        m_acceptThread.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_connectionsMutex);
+        m_connections.clear();
+    }
+
+    if (m_listenFd >= 0) {
+        ::close(m_listenFd);
+        m_listenFd = -1;
+    }
+}
+
+void cts::WanProxy::acceptLoop() {
+    uint32_t seed = 1;
+
+    while (!m_stopping) {
+        {
+            std::lock_guard<std::mutex> lock(m_connectionsMutex);
+            m_connections.erase(
+                std::remove_if(m_connections.begin(), m_connections.end(),
+                               [](const std::unique_ptr<Connection>& c) { return c->done(); }),
+                m_connections.end());
+        }
+
+        pollfd pfd = {m_listenFd, POLLIN, 0};
+        if (::poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+
+        const int clientFd = ::accept(m_listenFd, nullptr, nullptr);
+        if (clientFd < 0) {
+            continue;
+        }
+
+        const int serverFd = connectToTarget();
+        if (serverFd < 0) {
+            ::close(clientFd);
+            continue;
+        }
+
+        // Latency comes from the emulated link, not from Nagle on the loopback hops.
+        const int noDelay = 1;
+        ::setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        ::setsockopt(serverFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        std::lock_guard<std::mutex> lock(m_connectionsMutex);
+        m_connections.emplace_back(new Connection(clientFd, serverFd, m_profile, seed));
+        seed += 2;
+    }
+}
+
+int cts::WanProxy::connectToTarget() const {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* result = nullptr;
+    if (::getaddrinfo(m_targetHost.c_str(), std::to_string(m_targetPort).c_str(), &hints,
+                      &result) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (auto* ai = result; ai; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+
+    ::freeaddrinfo(result);
+    return fd;
+}
@@ -0,0 +1,96 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_WAN_PROXY_H
+#define SFTP_WAN_PROXY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cts {
+
+// Link characteristics applied independently to each direction of a proxied connection.
+struct WanProfile {
+    std::chrono::microseconds rtt{0};
+    std::chrono::microseconds jitter{0};
+    uint64_t bandwidthBitsPerSec = 0;  // 0 means unlimited
+    double lossRate = 0.0;             // probability that a segment needs a retransmission
+};
+
+// Parses a bandwidth such as "100M" (decimal K/M/G suffixes) into bits per second.
+bool parseBandwidth(const std::string& text, uint64_t& bitsPerSec);
+
+// Parses a fraction such as "0.05", which must lie between 0 and 1 inclusive.
+bool parseFraction(const std::string& text, double& fraction);
+
+// A loopback TCP proxy that forwards every accepted connection to a fixed target while
+// emulating a WAN link: half the RTT (plus jitter) is added in each direction, data leaves at
+// no more than the configured bandwidth, and "lost" segments are held back for a
+// retransmission timeout. TCP never drops bytes, so loss shows up the way the application sees
+// it: as a stall that blocks everything behind the lost segment.
+class WanProxy {
+   public:
+    WanProxy(const std::string& targetHost, uint16_t targetPort, const WanProfile& profile);
+    ~WanProxy();
+
+    bool start(uint16_t listenPort = 0);
+
+    void stop();
+
+    uint16_t port() const { return m_port; }
+
+    const std::string& error() const { return m_error; }
+
+   private:
+    WanProxy(const WanProxy&) = delete;
+    WanProxy& operator=(const WanProxy&) = delete;
+
+    class Pipe;
+    struct Connection;
+
+    void acceptLoop();
+
+    int connectToTarget() const;
+
+    std::string m_targetHost;
+    uint16_t m_targetPort;
+    WanProfile m_profile;
+    std::string m_error;
+
+    int m_listenFd = -1;
+    uint16_t m_port = 0;
+
+    std::atomic<bool> m_stopping{false};
+    std::thread m_acceptThread;
+    std::mutex m_connectionsMutex;
+    std::vector<std::unique_ptr<Connection>> m_connections;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_WAN_PROXY_H */
@@ -0,0 +1,66 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "../single_header/sftpclientpp.h"
+
+#include <signal.h>
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace cts;
+
+// Keeps SFTP sessions open for short lived processes until SIGINT or SIGTERM:
+//     ./broker /run/user/1000/sftp.sock [idle seconds]
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <socket path> [idle seconds]" << std::endl;
+        return 1;
+    }
+
+    // Blocked in every thread, so only the waiter below sees them.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    const auto idleTimeout = std::chrono::seconds(argc > 2 ? std::atoi(argv[2]) : 300);
+    SFTPBroker broker(argv[1], ConnectOptions::bulk(), idleTimeout);
+
+    SFTPError ret = broker.listen();
+    if (!ret.isOk()) {
+        std::cerr << "Failed to start: " << ret.getSSHErrorMsg() << std::endl;
+        return 1;
+    }
+
+    std::thread waiter([&]() {
+        int signal = 0;
+        sigwait(&signals, &signal);
+        broker.stop();
+    });
+
+    ret = broker.run();
+    waiter.join();
+
+    return ret.isOk() ? 0 : 1;
+}
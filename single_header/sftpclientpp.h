@@ -45,12 +45,93 @@
 #endif
 
 #include <algorithm>  // min
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>     // remove, rename
+#include <cstdlib>    // calloc
+#include <cstring>
+#include <deque>
+#include <errno.h>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#include <malloc.h>  // _aligned_malloc
+#endif
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>   // IPPROTO_TCP
+#include <netinet/tcp.h>  // TCP_KEEPIDLE, TCP_KEEPINTVL, TCP_KEEPCNT
+#include <sys/socket.h>   // setsockopt, SO_SNDBUF, SO_RCVBUF, SO_KEEPALIVE
+#endif
+
+#ifdef _WIN32
+#include <direct.h>  // _mkdir
+#endif
+
+#ifdef SFTPCLIENTPP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>  // MoveFileExA
+#endif
+
+#ifdef _WIN32
+#include <windows.h>  // CreateFileMapping, MapViewOfFile
+#else
+#include <fcntl.h>     // open
+#include <sys/mman.h>  // mmap, munmap
+#include <sys/stat.h>  // fstat
+#include <unistd.h>    // close
+#endif
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>  // chmod, lstat
+#include <sys/un.h>    // sockaddr_un
+#include <unistd.h>    // close, getcwd, unlink
+#endif
+
 namespace cts {
 
 class SFTPAttributes {
@@ -83,6 +164,9 @@ class SFTPAttributes {
 
 class SFTPError {
    public:
+    // SFTP error codes outside the protocol's range, for failures raised by this library.
+    enum : int { kCancelled = 0x10000, kChecksumMismatch = 0x10001 };
+
     SFTPError(const int sshCode = SSH_OK, const int sftpCode = SSH_FX_OK,
               const std::string& sshMsg = "")
         : m_sshCode(sshCode), m_sftpCode(sftpCode), m_sshErrorMsg(sshMsg) {}
@@ -93,6 +177,11 @@ class SFTPError {
 
     int getSFTPErrorCode() const { return m_sftpCode; }
 
+    bool isCancelled() const { return m_sftpCode == kCancelled; }
+
+    // The transferred data hashed differently from the file the server has.
+    bool isChecksumMismatch() const { return m_sftpCode == kChecksumMismatch; }
+
     std::string getSSHErrorMsg() const { return m_sshErrorMsg; }
 
    private:
@@ -101,353 +190,8917 @@ class SFTPError {
     std::string m_sshErrorMsg;
 };
 
-class SFTPClient {
-   public:
-    SFTPClient() = default;
-    ~SFTPClient();
+struct CpuFeatures {
+    bool aes = false;     // AES-NI or the ARMv8 AES instructions
+    bool clmul = false;   // Carry-less multiply (PCLMULQDQ / PMULL), makes GHASH fast
+    bool sha256 = false;  // SHA-NI or the ARMv8 SHA2 instructions
+    bool crc32c = false;  // SSE4.2 or the ARMv8 CRC32 instructions
+    bool sse41 = false;   // Used next to SHA-NI on x86
+};
 
-    SFTPClient(SFTPClient&&) = default;
+// Comma separated algorithm lists in the format accepted by SSH_OPTIONS_CIPHERS_* and
+// SSH_OPTIONS_HMAC_*.
+struct CipherPreference {
+    std::string ciphers;
+    std::string macs;
+};
 
-    SFTPClient& operator=(SFTPClient&&) = default;
+// What a connected session actually agreed on with the server.
+struct NegotiatedAlgorithms {
+    std::string kex;
+    std::string cipherIn;
+    std::string cipherOut;
+    std::string macIn;
+    std::string macOut;
+};
 
-    SFTPError connect(const std::string& host, const std::string& user, const std::string& pw,
-                      const uint16_t port = 22, const bool onlyKnownServers = true);
+// Both are computed on first use and cached for the lifetime of the process.
+const CpuFeatures& detectCpuFeatures();
 
-    void disconnect();
+const CipherPreference& preferredCiphers();
 
-    SFTPError put(const std::string& localFileName, const std::string& remoteFileName,
-                  unsigned int chunkSize = kDefaultChunkSize) const;
+// Estimates the size deflate would shrink data to, as a fraction of the original (1.0 means
+// incompressible). Meant for samples of a few hundred KiB; known compressed formats are
+// recognised by their signature and reported as 1.0 without scanning.
+double estimateCompressionRatio(const char* data, size_t size);
 
-    SFTPError get(const std::string& localFileName, const std::string& remoteFileName,
-                  unsigned int chunkSize = kDefaultChunkSize) const;
+enum class ChecksumAlgorithm { None, Crc32c, Sha256 };
 
-    SFTPError mkdir(const std::string& remoteDir, const mode_t permissions) const;
+// Incremental CRC32C or SHA-256. CRC32C uses the SSE4.2 crc32 instruction and SHA-256 the SHA
+// extensions when the CPU has them, with portable code otherwise.
+class Checksum {
+   public:
+    explicit Checksum(const ChecksumAlgorithm algorithm = ChecksumAlgorithm::None);
 
-    std::pair<SFTPError, std::vector<SFTPAttributes>> ls(const std::string& remoteDir) const;
+    void update(const char* data, const size_t size);
 
-    SFTPError rename(const std::string& oldRemoteName, const std::string& newRemoteName) const;
+    // Lowercase hex, the same as sha256sum prints; CRC32C as its 8 digit big endian value.
+    // Ends the computation, further updates are ignored.
+    std::string hexDigest();
 
-    SFTPError rm(const std::string& remoteFileName) const;
+    ChecksumAlgorithm algorithm() const { return m_algorithm; }
 
-    SFTPError rmdir(const std::string& remoteDirName) const;
+   private:
+    void compressBlocks(const uint8_t* data, const size_t blocks);
 
-    std::pair<SFTPError, SFTPAttributes> stat(const std::string& remotePath) const;
+    ChecksumAlgorithm m_algorithm;
+    bool m_finished = false;
 
-   private:
-    SFTPClient& operator=(const SFTPClient&) = delete;
-    SFTPClient(const SFTPClient&) = delete;
+    uint32_t m_crc = 0xFFFFFFFF;
 
-    struct SSHSessionDeleter {
-        void operator()(ssh_session session) const;
-    };
+    uint32_t m_state[8];
+    uint8_t m_block[64];
+    size_t m_blockSize = 0;
+    uint64_t m_length = 0;
+};
 
-    struct SFTPSessionDeleter {
-        void operator()(sftp_session session) const;
-    };
+// Has the server hash a file: through the check-file extension when it offers it, otherwise
+// by running sha256sum (or shasum) on a separate channel of the session. Only SHA-256 can be
+// computed remotely; when neither way works the error code is SSH_FX_OP_UNSUPPORTED.
+std::pair<SFTPError, std::string> remoteChecksum(ssh_session session, sftp_session sftp,
+                                                 const std::string& remoteFileName,
+                                                 const ChecksumAlgorithm algorithm);
 
-    struct SFTPFileDeleter {
-        void operator()(sftp_file file) const;
-    };
+// Whether every byte of data is zero, checked 64 bytes at a time with SSE2 or NEON.
+bool isAllZero(const char* data, const size_t size);
 
-    using SSHSessionPtr = std::unique_ptr<ssh_session_struct, SSHSessionDeleter>;
-    using SFTPSessionPtr = std::unique_ptr<sftp_session_struct, SFTPSessionDeleter>;
+// The data segments of a local file as SEEK_DATA and SEEK_HOLE report them. Platforms and file
+// systems without them show the whole file as one segment.
+class SparseFileMap {
+   public:
+    explicit SparseFileMap(const std::string& fileName);
+    ~SparseFileMap();
 
-    SSHSessionPtr m_sshSession;
-    SFTPSessionPtr m_sftpSession;
+    // The first segment that ends after offset, as [start, end). Without hole support end is
+    // UINT64_MAX. Returns false when only a hole, or nothing, follows offset.
+    bool nextData(const uint64_t offset, uint64_t& start, uint64_t& end) const;
+
+    uint64_t size() const { return m_size; }
+
+   private:
+    SparseFileMap(const SparseFileMap&) = delete;
+    SparseFileMap& operator=(const SparseFileMap&) = delete;
 
-    static constexpr unsigned int kDefaultChunkSize = 16 * 1024;
-    static constexpr unsigned int kMaxChunkSize = 32 * 1024;
+    int m_fd = -1;
+    uint64_t m_size = 0;
 };
 
-SFTPClient::~SFTPClient() { disconnect(); }
+// Deallocates [offset, offset + length) of a local file without changing its size. Returns
+// false where the platform or file system cannot, the caller then writes the zeros.
+bool punchHole(const std::string& fileName, const uint64_t offset, const uint64_t length);
 
-SFTPError SFTPClient::connect(const std::string& host, const std::string& user,
-                              const std::string& pw, const uint16_t port,
-                              const bool onlyKnownServers) {
-    m_sshSession = SSHSessionPtr(ssh_new());
-    if (!m_sshSession) {
-        return SFTPError(SSH_ERROR, SSH_FX_OK, "Failed to create ssh session.");
-    }
+// Fixed capacity queue for exactly one producer thread and one consumer thread, without locks.
+// Each side only writes its own index, and the other side's index is cached so that most
+// calls touch no shared cache line at all. A consumer that finds the ring empty for longer
+// than a few yields sleeps until push() or wake(), so an idle side costs no wakeups.
+template <typename T>
+class SPSCRing {
+   public:
+    // The capacity is rounded up to a power of two.
+    explicit SPSCRing(const size_t capacity)
+        : m_slots(roundUp(capacity)), m_mask(m_slots.size() - 1) {}
 
-    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_HOST, host.c_str());
-    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_PORT, &port);
-    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_USER, user.c_str());
+    // Producer only. False while the ring is full.
+    bool tryPush(const T& value) {
+        const size_t tail = m_tail.value.load(std::memory_order_relaxed);
+        if (tail - m_tail.cached == m_slots.size()) {
+            m_tail.cached = m_head.value.load(std::memory_order_acquire);
+            if (tail - m_tail.cached == m_slots.size()) {
+                return false;
+            }
+        }
 
-    int rc = ssh_connect(m_sshSession.get());
-    if (rc != SSH_OK) {
-        return SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get()));
+        m_slots[tail & m_mask] = value;
+        m_tail.value.store(tail + 1, std::memory_order_release);
+        return true;
     }
 
-    if (onlyKnownServers) {
-        const auto res = ssh_session_is_known_server(m_sshSession.get());
-        if (res != SSH_KNOWN_HOSTS_OK) {
-            return SFTPError(ssh_get_error_code(m_sshSession.get()),
-                             sftp_get_error(m_sftpSession.get()),
-                             ssh_get_error(m_sshSession.get()));
+    // Producer only. tryPush() that wakes a consumer sleeping in pop().
+    bool push(const T& value) {
+        if (!tryPush(value)) {
+            return false;
         }
+        wake();
+        return true;
     }
 
-    rc = ssh_userauth_password(m_sshSession.get(), nullptr, pw.c_str());
-    if (rc != SSH_AUTH_SUCCESS) {
-        return SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get()));
-    }
+    // Consumer only. False while the ring is empty.
+    bool tryPop(T& value) {
+        const size_t head = m_head.value.load(std::memory_order_relaxed);
+        if (head == m_head.cached) {
+            m_head.cached = m_tail.value.load(std::memory_order_acquire);
+            if (head == m_head.cached) {
+                return false;
+            }
+        }
 
-    m_sftpSession = SFTPSessionPtr(sftp_new(m_sshSession.get()));
-    if (!m_sftpSession) {
-        return SFTPError(ssh_get_error_code(m_sshSession.get()), SSH_FX_FAILURE,
-                         "Failed to create a new sftp session.");
+        value = m_slots[head & m_mask];
+        m_head.value.store(head + 1, std::memory_order_release);
+        return true;
     }
 
-    rc = sftp_init(m_sftpSession.get());
-    if (rc < 0) {
-        return SFTPError(ssh_get_error_code(m_sshSession.get()),
-                         sftp_get_error(m_sftpSession.get()), ssh_get_error(m_sshSession.get()));
+    // Consumer only. Waits for a value until stopped() returns true, then takes what was
+    // pushed before it stopped, if anything. Whoever makes stopped() true calls wake().
+    template <typename Stopped>
+    bool pop(T& value, Stopped stopped) {
+        for (unsigned int round = 0;; ++round) {
+            if (tryPop(value)) {
+                return true;
+            }
+            if (stopped()) {
+                return tryPop(value);
+            }
+
+            if (round < kSpinRounds) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // The fences pair with the one in wake(): either the producer sees a sleeper, or
+            // the predicate sees what it pushed.
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_wakeup.wait(lock, [&]() { return !empty() || stopped(); });
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
     }
 
-    return SFTPError();
-}
+    // Wakes a consumer sleeping in pop(), to look at the ring and stopped() again.
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_wakeup.notify_all();
+        }
+    }
 
-void SFTPClient::disconnect() {
-    m_sftpSession.reset();
-    m_sshSession.reset();
-}
+   private:
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
 
-SFTPError SFTPClient::put(const std::string& localFileName, const std::string& remoteFileName,
-                          unsigned int chunkSize) const {
-    if (!m_sftpSession || !m_sshSession) {
-        return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+    // Consumer only.
+    bool empty() const {
+        return m_head.value.load(std::memory_order_relaxed) ==
+               m_tail.value.load(std::memory_order_acquire);
     }
 
-    if (chunkSize < 1) {
-        chunkSize = kDefaultChunkSize;
+    static size_t roundUp(const size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
     }
 
-    chunkSize = std::min(chunkSize, kMaxChunkSize);
+    std::vector<T> m_slots;
+    const size_t m_mask;
 
-    std::ifstream file(localFileName, std::ios::binary);
-    if (!file) {
-        return SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
-                         "Failed to open local file: " + localFileName);
-    }
+    // One side's index and its cached copy of the other side's, on a cache line of their own.
+    // Padded rather than aligned, as heap allocation only honours alignas from C++17 on.
+    struct Index {
+        char padding[64];
+        std::atomic<size_t> value{0};
+        size_t cached = 0;
+    };
 
-    auto remoteFilePtr = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
-        sftp_open(m_sftpSession.get(), remoteFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
-                  S_IRUSR | S_IWUSR));
+    Index m_tail;  // Written by the producer
+    Index m_head;  // Written by the consumer
 
-    if (!remoteFilePtr.get()) {
-        return SFTPError(ssh_get_error_code(m_sshSession.get()),
-                         sftp_get_error(m_sftpSession.get()), ssh_get_error(m_sshSession.get()));
-    }
+    // Yields before the consumer goes to sleep, which covers the common short wait.
+    static constexpr unsigned int kSpinRounds = 64;
 
-    std::vector<char> buffer(chunkSize);
-    size_t totalBytes = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::atomic<unsigned int> m_sleepers{0};
+};
 
-    while (file) {
-        file.read(buffer.data(), chunkSize);
-        auto bytesRead = file.gcount();
+// Chunk buffers shared by every transfer in the process. Sizes are rounded up to a power of
+// two and buffers are page aligned, as unbuffered and direct I/O want them. Released buffers
+// are kept for the next transfer instead of being freed, up to kMaxKeptBytes per size, so a
+// process that keeps transferring stops allocating without holding on to what a burst of
+// parallel transfers needed.
+class SFTPBufferPool {
+   public:
+    static constexpr size_t kAlignment = 4096;
 
-        if (bytesRead == 0) {
-            break;  // End of file
-        }
+    // Enough for a couple of transfers at the largest tuned chunk sizes.
+    static constexpr size_t kMaxKeptBytes = 16 * 1024 * 1024;
 
-        auto bytesWritten = sftp_write(remoteFilePtr.get(), buffer.data(), bytesRead);
-        if (bytesWritten < 0) {
-            return SFTPError(ssh_get_error_code(m_sshSession.get()),
-                             sftp_get_error(m_sftpSession.get()),
-                             "Failed to write to remote file [" + remoteFileName + "] " +
-                                 ssh_get_error(m_sshSession.get()));
-        }
+    static SFTPBufferPool& shared();
 
-        totalBytes += bytesWritten;
-    }
+    SFTPBufferPool() = default;
+    ~SFTPBufferPool();
 
-    return SFTPError();
-}
+    // At least size bytes, or nullptr when memory runs out.
+    char* acquire(const size_t size);
 
-SFTPError SFTPClient::get(const std::string& localFileName, const std::string& remoteFileName,
-                          unsigned int chunkSize) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+    // Returns a buffer from acquire() with the size it was asked for.
+    void release(char* buffer, const size_t size);
+
+   private:
+    SFTPBufferPool(const SFTPBufferPool&) = delete;
+    SFTPBufferPool& operator=(const SFTPBufferPool&) = delete;
+
+    static size_t sizeClass(const size_t size);
+
+    std::mutex m_mutex;
+    std::map<size_t, std::vector<char*>> m_free;
+};
+
+// A buffer from a SFTPBufferPool, given back when it goes out of scope.
+class PooledBuffer {
+   public:
+    PooledBuffer() = default;
+    PooledBuffer(SFTPBufferPool& pool, const size_t size)
+        : m_pool(&pool), m_data(pool.acquire(size)), m_size(m_data ? size : 0) {}
+    ~PooledBuffer() { reset(); }
+
+    PooledBuffer(PooledBuffer&& other) noexcept { *this = std::move(other); }
+
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept {
+        if (this != &other) {
+            reset();
+            m_pool = other.m_pool;
+            m_data = other.m_data;
+            m_size = other.m_size;
+            other.m_data = nullptr;
+            other.m_size = 0;
+        }
+        return *this;
     }
 
-    if (chunkSize < 1) {
-        chunkSize = kDefaultChunkSize;
+    char* data() const { return m_data; }
+
+    size_t size() const { return m_size; }
+
+    void reset() {
+        if (m_data) {
+            m_pool->release(m_data, m_size);
+            m_data = nullptr;
+            m_size = 0;
+        }
     }
 
-    chunkSize = std::min(chunkSize, kMaxChunkSize);
+   private:
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
 
-    auto remoteFilePtr = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
-        sftp_open(m_sftpSession.get(), remoteFileName.c_str(), O_RDONLY, S_IRUSR));
+    SFTPBufferPool* m_pool = nullptr;
+    char* m_data = nullptr;
+    size_t m_size = 0;
+};
 
-    if (!remoteFilePtr.get()) {
-        return SFTPError(ssh_get_error_code(m_sshSession.get()),
-                         sftp_get_error(m_sftpSession.get()),
-                         "Failed to open remote file [" + remoteFileName + "] " +
-                             ssh_get_error(m_sshSession.get()));
+// The slots a reader thread fills for its caller, each a Chunk whose data points at a buffer
+// from SFTPBufferPool::shared(). Filled slots go to the caller through one SPSCRing and come
+// back through another once the caller asks for the next, so the buffers are reused in turn.
+template <typename Chunk>
+class SFTPChunkRing {
+   public:
+    static constexpr size_t kDepth = 8;
+
+    SFTPChunkRing() = default;
+
+    // Gives every slot a buffer of bufferSize, false when memory runs out.
+    bool allocate(const size_t bufferSize) {
+        m_chunks.resize(kDepth);
+        for (size_t slot = 0; slot < kDepth; ++slot) {
+            m_buffers.emplace_back(SFTPBufferPool::shared(), bufferSize);
+            if (!m_buffers.back().data()) {
+                return false;
+            }
+            m_chunks[slot].data = m_buffers.back().data();
+            m_free.tryPush(slot);
+        }
+        return true;
     }
 
-    std::ofstream file(localFileName, std::ios::binary);
-    if (!file) {
-        return SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
-                         "Failed to open local file: " + localFileName);
+    char* buffer(const size_t slot) { return m_buffers[slot].data(); }
+    Chunk& chunk(const size_t slot) { return m_chunks[slot]; }
+
+    // Reader thread only. Waits for a slot the caller is done with, false once stopped.
+    bool takeFreeSlot(size_t& slot) {
+        const auto stopped = [this]() { return m_stop.load(std::memory_order_relaxed); };
+        return m_free.pop(slot, stopped) && !stopped();
     }
 
-    std::vector<char> buffer(chunkSize);
-    size_t totalBytes = 0;
+    // Reader thread only. Hands a filled slot to the caller.
+    void publish(const size_t slot) { m_filled.push(slot); }
 
-    while (true) {
-        auto bytesRead = sftp_read(remoteFilePtr.get(), buffer.data(), chunkSize);
+    // Reader thread only. No more slots follow, and what the reader wrote before is visible
+    // to the caller once next() returned nullptr.
+    void finish() {
+        m_done.store(true, std::memory_order_release);
+        m_filled.wake();
+    }
 
-        if (bytesRead < 0) {
-            return SFTPError(ssh_get_error_code(m_sshSession.get()),
-                             sftp_get_error(m_sftpSession.get()),
-                             "Failed to read from remote file [" + remoteFileName + "] " +
-                                 ssh_get_error(m_sshSession.get()));
+    // Caller only. Gives back the last chunk and waits for the next, nullptr once the reader
+    // finished and every chunk was taken.
+    const Chunk* next() {
+        if (m_current != kNoSlot) {
+            m_free.push(m_current);  // Never full, there are only kDepth slots
+            m_current = kNoSlot;
         }
 
-        if (bytesRead == 0) {
-            break;  // End of file
+        size_t slot = kNoSlot;
+        if (!m_filled.pop(slot, [this]() { return m_done.load(std::memory_order_acquire); })) {
+            return nullptr;
         }
 
-        file.write(buffer.data(), bytesRead);
-        if (!file) {
-            return SFTPError(SSH_OK, SSH_FX_FAILURE,
-                             "Failed to write to local file [" + localFileName + "]");
-        }
+        m_current = slot;
+        return &m_chunks[slot];
+    }
 
-        totalBytes += bytesRead;
+    // Caller only. Makes takeFreeSlot() return false, for a reader that should stop early.
+    void stop() {
+        m_stop = true;
+        m_free.wake();
     }
 
-    return SFTPError();
-}
+    bool stopped() const { return m_stop.load(std::memory_order_relaxed); }
 
-SFTPError SFTPClient::mkdir(const std::string& remoteDir, const mode_t permissions) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
-    }
+   private:
+    SFTPChunkRing(const SFTPChunkRing&) = delete;
+    SFTPChunkRing& operator=(const SFTPChunkRing&) = delete;
 
-    int rc = sftp_mkdir(m_sftpSession.get(), remoteDir.c_str(), permissions);
-    if (rc < 0) {
-        return SFTPError(rc, sftp_get_error(m_sftpSession.get()),
-                         ssh_get_error(m_sshSession.get()));
-    }
+    static constexpr size_t kNoSlot = ~size_t(0);
 
-    return SFTPError();
-}
+    std::vector<PooledBuffer> m_buffers;
+    std::vector<Chunk> m_chunks;
+    SPSCRing<size_t> m_filled{kDepth};
+    SPSCRing<size_t> m_free{kDepth};
+    size_t m_current = kNoSlot;
 
-std::pair<SFTPError, std::vector<SFTPAttributes>> SFTPClient::ls(
-    const std::string& remoteDir) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return {SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
-    }
+    std::atomic<bool> m_done{false};
+    std::atomic<bool> m_stop{false};
+};
 
-    auto dir = std::unique_ptr<sftp_dir_struct, decltype(&sftp_closedir)>(
-        sftp_opendir(m_sftpSession.get(), remoteDir.c_str()), sftp_closedir);
+// Reads a local file for put() on a thread of its own, so the disk reads ahead while the
+// network side waits for the server. Chunks reach the caller through a SFTPChunkRing. Data
+// already in memory, such as a file mapping SFTPFanOut shares between hosts, is handed out in
+// place without a thread.
+class SFTPFileReader {
+   public:
+    struct Chunk {
+        const char* data = nullptr;
+        uint64_t offset = 0;
+        size_t length = 0;
 
-    if (!dir) {
-        return {
-            SFTPError(ssh_get_error_code(m_sftpSession.get()), sftp_get_error(m_sftpSession.get()),
-                      "Failed to open directory: " + remoteDir),
-            {}};
-    }
+        // Only set for sparse reads.
+        bool zeros = false;
+    };
 
-    std::vector<SFTPAttributes> attributesList;
+    // file is already positioned at offset. Sparse reads skip the holes SparseFileMap finds.
+    // checksum is fed every byte from offset on, holes included, before the caller sees it.
+    SFTPFileReader(std::ifstream&& file, const std::string& fileName, const uint64_t offset,
+                   const size_t chunkSize, const size_t maxChunkSize, const bool sparse,
+                   Checksum& checksum);
 
-    while (sftp_attributes attributes = sftp_readdir(m_sftpSession.get(), dir.get())) {
-        attributesList.emplace_back(attributes);
-    }
+    // Hands out [offset, size) of data, which stays valid until the reader is destroyed.
+    SFTPFileReader(const char* data, const uint64_t size, const uint64_t offset,
+                   const size_t chunkSize, const size_t maxChunkSize, const bool sparse,
+                   Checksum& checksum);
 
-    if (!sftp_dir_eof(dir.get())) {
-        return {
-            SFTPError(ssh_get_error_code(m_sftpSession.get()), sftp_get_error(m_sftpSession.get()),
-                      "Failed to read directory: " + remoteDir),
-            {}};
-    }
+    ~SFTPFileReader();
 
-    return {SFTPError(SSH_OK, SSH_FX_OK), std::move(attributesList)};
-}
+    // For chunks not read yet, capped at maxChunkSize.
+    void setChunkSize(const size_t chunkSize);
 
-SFTPError SFTPClient::rename(const std::string& oldRemoteName,
-                             const std::string& newRemoteName) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
-    }
+    // The next chunk in file order, valid until the next call. nullptr at the end of the file
+    // or when reading failed, see error().
+    const Chunk* next();
 
-    int rc = sftp_rename(m_sftpSession.get(), oldRemoteName.c_str(), newRemoteName.c_str());
-    if (rc < 0) {
-        return SFTPError(ssh_get_error_code(m_sshSession.get()),
-                         sftp_get_error(m_sftpSession.get()), ssh_get_error(m_sshSession.get()));
-    }
+    SFTPError error() const { return m_error; }
 
-    return SFTPError();
-}
+    // The offset after the last byte, a trailing hole included, once next() returned nullptr.
+    uint64_t end() const { return m_end; }
 
-SFTPError SFTPClient::rm(const std::string& remoteFileName) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
-    }
+   private:
+    SFTPFileReader(const SFTPFileReader&) = delete;
+    SFTPFileReader& operator=(const SFTPFileReader&) = delete;
 
-    int rc = sftp_unlink(m_sftpSession.get(), remoteFileName.c_str());
-    if (rc < 0) {
-        return SFTPError(ssh_get_error_code(m_sshSession.get()),
-                         sftp_get_error(m_sftpSession.get()),
-                         "Failed to remove remote file [" + remoteFileName + "] " +
-                             ssh_get_error(m_sshSession.get()));
-    }
+    void run();
 
-    return SFTPError();
-}
+    // Only for readers over memory, which have no thread.
+    bool m_inMemory = false;
+    const char* m_memory = nullptr;
+    uint64_t m_memorySize = 0;
+    uint64_t m_memoryOffset = 0;
+    Chunk m_memoryChunk;
 
-SFTPError SFTPClient::rmdir(const std::string& remoteDir) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
-    }
+    std::ifstream m_file;
+    const std::string m_fileName;
+    const uint64_t m_offset;
+    const size_t m_maxChunkSize;
+    const bool m_sparse;
+    Checksum& m_checksum;
+    std::atomic<size_t> m_chunkSize;
 
-    int rc = sftp_rmdir(m_sftpSession.get(), remoteDir.c_str());
-    if (rc < 0) {
-        return SFTPError(
-            ssh_get_error_code(m_sshSession.get()), sftp_get_error(m_sftpSession.get()),
-            "Failed to remove remote dir [" + remoteDir + "] " + ssh_get_error(m_sshSession.get()));
-    }
+    // m_error and m_end are published by m_ring.finish().
+    SFTPChunkRing<Chunk> m_ring;
+    SFTPError m_error;
+    uint64_t m_end = 0;
 
-    return SFTPError();
-}
+    std::thread m_thread;
+};
 
-std::pair<SFTPError, SFTPAttributes> SFTPClient::stat(const std::string& remotePath) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return {SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
-    }
+// Writes what get() receives to the local file on a thread of its own, so the network side
+// goes straight back to the server. Buffers travel through a pair of SPSCRings as in
+// SFTPChunkRing, but from the caller to the writer.
+class SFTPFileWriter {
+   public:
+    // file is already positioned at offset. Sparse writes leave chunks of zeros unwritten and
+    // punch holes for them below localSize, where the file may hold older data. checksum is
+    // fed the chunks that arrive in order from hashedOffset on.
+    SFTPFileWriter(std::ofstream&& file, const std::string& fileName, const uint64_t offset,
+                   const size_t bufferSize, const bool sparse, const uint64_t localSize,
+                   Checksum& checksum, const uint64_t hashedOffset);
+    ~SFTPFileWriter();
 
-    sftp_attributes attr = sftp_lstat(m_sftpSession.get(), remotePath.c_str());
-    if (!attr) {
-        return {
-            SFTPError(ssh_get_error_code(m_sshSession.get()), sftp_get_error(m_sftpSession.get()),
-                      "Failed to stat remote dir [" + remotePath + "] " +
-                          ssh_get_error(m_sshSession.get())),
-            {}};
-    }
+    // A buffer of bufferSize for the next chunk, nullptr once writing failed.
+    char* buffer();
 
-    std::cout << "In stat() " << attr->name;
+    // Queues what the last buffer() received, which belongs at offset.
+    void submit(const uint64_t offset, const size_t length);
 
-    return {SFTPError(), {attr}};
-}
+    // Waits until everything queued is written and the file has its full size, then returns
+    // the first error.
+    SFTPError finish();
 
-void SFTPClient::SSHSessionDeleter::operator()(ssh_session session) const {
-    if (session) {
-        ssh_disconnect(session);
-        ssh_free(session);
-    }
-}
+    // How far the file was hashed in order, once finish() returned.
+    uint64_t hashedOffset() const { return m_hashedOffset; }
 
-void SFTPClient::SFTPSessionDeleter::operator()(sftp_session session) const {
-    if (session) {
-        sftp_free(session);
-    }
-}
+   private:
+    SFTPFileWriter(const SFTPFileWriter&) = delete;
+    SFTPFileWriter& operator=(const SFTPFileWriter&) = delete;
 
-void SFTPClient::SFTPFileDeleter::operator()(sftp_file file) const {
-    if (file) {
-        sftp_close(file);
+    struct Chunk {
+        uint64_t offset = 0;
+        size_t length = 0;
+    };
+
+    void run();
+
+    void write(const char* data, const Chunk& chunk);
+
+    void fail(const std::string& what);
+
+    static constexpr size_t kDepth = 8;
+    static constexpr size_t kNoSlot = ~size_t(0);
+
+    std::ofstream m_file;
+    const std::string m_fileName;
+    const bool m_sparse;
+    const uint64_t m_localSize;
+    Checksum& m_checksum;
+
+    // Only touched by the writer thread until finish().
+    uint64_t m_writeOffset;
+    uint64_t m_hashedOffset;
+    uint64_t m_highestWritten = 0;
+    uint64_t m_zerosEnd = 0;
+    SFTPError m_error;
+
+    std::vector<PooledBuffer> m_buffers;
+    std::vector<Chunk> m_chunks;
+    SPSCRing<size_t> m_filled{kDepth};
+    SPSCRing<size_t> m_free{kDepth};
+    size_t m_current = kNoSlot;
+
+    std::atomic<bool> m_failed{false};
+    std::atomic<bool> m_closing{false};
+
+    std::thread m_thread;
+};
+
+// How SFTPClient recovers from a lost connection. After a failure that took the connection
+// down it reconnects with the parameters of the last connect(), waiting initialBackoff before
+// the first attempt and multiplying the wait after every further one. Idempotent operations
+// are then run again and put()/get() resume from the last offset the server acknowledged;
+// mkdir(), rename(), rm() and rmdir() only reconnect and return the original error, as the
+// server may already have carried them out.
+struct RetryPolicy {
+    // Total attempts per operation, 1 disables reconnecting.
+    unsigned int maxAttempts = 1;
+
+    std::chrono::milliseconds initialBackoff{500};
+    std::chrono::milliseconds maxBackoff{30000};
+    double backoffMultiplier = 2.0;
+};
+
+// Transport and transfer tuning applied by SFTPClient::connect(). A default constructed
+// ConnectOptions keeps the libssh and operating system defaults; the presets below trade
+// them for throughput or latency.
+struct ConnectOptions {
+    enum class Compression { Off, On, Adaptive };
+
+    // Disable Nagle's algorithm so small requests are not held back behind unacknowledged data.
+    bool tcpNoDelay = false;
+
+    // SO_SNDBUF / SO_RCVBUF in bytes, 0 keeps the operating system default. On Linux an
+    // explicit size turns off TCP buffer autotuning, which grows the buffers to several MiB on
+    // its own, and is clamped to net.core.wmem_max / rmem_max (about 208 KiB out of the box).
+    // Only set these where those limits were raised or autotuning is unavailable.
+    int socketSendBufferSize = 0;
+    int socketReceiveBufferSize = 0;
+
+    // Rekey after this many bytes or seconds, 0 keeps the libssh default for the cipher.
+    uint64_t rekeyDataLimit = 0;
+    uint32_t rekeyTimeLimit = 0;
+
+    // Chunk size used by put()/get() when the call does not pass one. It is capped by the
+    // server's read/write limits.
+    unsigned int chunkSize = 16 * 1024;
+
+    // SFTP read/write requests kept outstanding per transfer. Together with chunkSize this is
+    // the amount of data in flight, which has to cover the bandwidth-delay product of the link.
+    unsigned int maxInFlightRequests = 1;
+
+    // Files that putFiles()/getFiles() keep open at once when they go through SFTP, each with
+    // its own maxInFlightRequests. Opening and closing one file overlaps the data of the others,
+    // so small files do not cost a round trip each.
+    unsigned int maxFilesInFlight = 16;
+
+    // Let put()/get() measure round trip time and throughput while they run and size chunks and
+    // outstanding requests to the bandwidth-delay product, see SFTPAutoTuner. chunkSize and
+    // maxInFlightRequests are then only the starting point, and a chunk size passed to the call
+    // turns tuning off for that call.
+    bool autoTune = false;
+
+    // Order ciphers and MACs by what this CPU runs fastest, see preferredCiphers(). The choice
+    // is made once per process.
+    bool autoSelectCiphers = false;
+
+    // Explicit comma separated cipher and MAC lists, e.g. "aes128-gcm@openssh.com". They take
+    // precedence over autoSelectCiphers.
+    std::string ciphers;
+    std::string macs;
+
+    // SSH transport compression. Adaptive opens a second, compressed session next to the plain
+    // one and sends a file over it when a sample of its first blocks is estimated to shrink
+    // below compressionThreshold; smaller files and incompressible data use the plain session.
+    Compression compression = Compression::Off;
+
+    // zlib level from 1 (fastest) to 9 (smallest), 0 keeps the libssh default.
+    int compressionLevel = 0;
+
+    double compressionThreshold = 0.8;
+    uint64_t compressionMinFileSize = 1024 * 1024;
+
+    // TCP keepalive: the first probe after keepAliveIdle idle seconds, then one every
+    // keepAliveInterval seconds, giving up after keepAliveCount unanswered probes. Keeps NAT
+    // mappings open and notices a dead peer long before TCP's own timeouts. 0 leaves keepalive
+    // off.
+    int keepAliveIdle = 0;
+    int keepAliveInterval = 10;
+    int keepAliveCount = 3;
+
+    // Upper bound in seconds for any single blocking libssh call, 0 keeps the libssh default.
+    long operationTimeout = 0;
+
+    RetryPolicy retry;
+
+    // Multi-GB transfers over high bandwidth-delay links.
+    static ConnectOptions bulk() {
+        ConnectOptions options;
+        options.tcpNoDelay = true;
+        options.rekeyDataLimit = 16ull * 1024 * 1024 * 1024;
+        options.chunkSize = 256 * 1024;
+        options.maxInFlightRequests = 64;
+        options.maxFilesInFlight = 64;
+        options.autoTune = true;
+        options.autoSelectCiphers = true;
+        options.keepAliveIdle = 60;
+        options.operationTimeout = 300;
+        options.retry.maxAttempts = 5;
+        return options;
+    }
+
+    // Many small operations where each round trip counts.
+    static ConnectOptions interactive() {
+        ConnectOptions options;
+        options.tcpNoDelay = true;
+        options.chunkSize = 32 * 1024;
+        options.maxInFlightRequests = 4;
+        options.maxFilesInFlight = 32;
+        return options;
+    }
+
+    // Low latency, high bandwidth local networks.
+    static ConnectOptions lan() {
+        ConnectOptions options;
+        options.tcpNoDelay = true;
+        options.chunkSize = 128 * 1024;
+        options.maxInFlightRequests = 16;
+        options.maxFilesInFlight = 32;
+        options.autoSelectCiphers = true;
+        return options;
+    }
+};
+
+// Sets the options that have to be in place before ssh_connect(). compress turns on transport
+// compression regardless of options.compression.
+SFTPError applySessionOptions(ssh_session session, const ConnectOptions& options,
+                              const bool compress);
+
+// Sets the socket options, once ssh_connect() has created the socket.
+void applySocketOptions(ssh_session session, const ConnectOptions& options);
+
+// What one SFTPClient::put() or SFTPClient::get() moved, for TransferOptions::onStats.
+struct TransferStats {
+    uint64_t bytes = 0;      // File data, without what resumeOffset skipped
+    uint64_t wireBytes = 0;  // What crossed the channel for it, below bytes when compressed
+    bool zstd = false;       // Went through zstd over an exec channel
+    std::chrono::milliseconds elapsed{0};
+
+    // wireBytes / bytes, 1.0 for data sent as is.
+    double compressionRatio() const {
+        return bytes > 0 ? static_cast<double>(wireBytes) / static_cast<double>(bytes) : 1.0;
+    }
+};
+
+// Per call settings for SFTPClient::put() and SFTPClient::get().
+struct TransferOptions {
+    // 0 uses ConnectOptions::chunkSize.
+    unsigned int chunkSize = 0;
+
+    // Called after every chunk the server acknowledged, with the bytes transferred so far.
+    // Returning false stops the transfer with an SFTPError for which isCancelled() is true.
+    // zstd transfers, see below, report 0 until the whole file arrived.
+    std::function<bool(uint64_t transferred)> progress;
+
+    // Continue an earlier transfer of the same file from this offset instead of starting over.
+    // put() then keeps the remote file and get() the local one, and both skip what lies before
+    // it.
+    uint64_t resumeOffset = 0;
+
+    // Hash the file while it streams through put() or get(), so no second pass over it is
+    // needed. onChecksum receives the hex digest of the whole file once the transfer is done.
+    ChecksumAlgorithm checksum = ChecksumAlgorithm::None;
+    std::function<void(const std::string& digest)> onChecksum;
+
+    // Compare the digest with the server's hash of the remote file, see remoteChecksum(). A
+    // difference fails with an SFTPError for which isChecksumMismatch() is true. Servers that
+    // cannot hash the file, and CRC32C, which no server computes, skip the comparison.
+    bool verifyChecksum = false;
+
+    // Keep sparse files sparse. put() skips the holes SEEK_DATA/SEEK_HOLE find in the local
+    // file and chunks that are all zeros, seeking the remote handle past them, and get()
+    // leaves or punches holes for chunks of zeros instead of writing them.
+    bool sparse = false;
+
+    // Stream the file through zstd over an exec channel instead of SFTP, for links where
+    // bandwidth rather than CPU is the limit. put() compresses on zstdThreads cores, 0 using all
+    // of them, for a zstd process on the server that writes the remote file. get() has zstd on
+    // the server compress with as many threads and decompresses locally. Levels run from 1 to
+    // 19. The transfer falls back to SFTP when the server has no zstd, the library was built
+    // without libzstd, resumeOffset is set or get() is asked to keep the file sparse. A zstd
+    // transfer cannot be resumed: progress reports 0 until it is complete, and after a failure
+    // it starts over, also under a RetryPolicy.
+    bool zstd = false;
+    int zstdLevel = 3;
+    unsigned int zstdThreads = 0;
+
+    // Called when put(), putBuffer() or get() returns, also after a failure, with what it
+    // transferred.
+    std::function<void(const TransferStats& stats)> onStats;
+};
+
+// The outcome for one file of a multi-file transfer.
+struct FileTransferResult {
+    std::string path;
+    SFTPError error;
+};
+
+// Sizes the requests of one transfer to the bandwidth-delay product of the link.
+//
+// Completions are grouped into rounds of roughly one window of data. Starting from the
+// configured window, it doubles every round while throughput keeps growing by a quarter or
+// more; once three rounds pass without such growth the window follows twice the product of
+// the best recent throughput and the lowest round trip time seen. The window is spent on
+// chunks as large as the server allows, with at least a few of them in flight.
+//
+// The last window per host is remembered for the lifetime of the process, so later transfers
+// to the same host start from it instead of probing again.
+class SFTPAutoTuner {
+   public:
+    struct Tuning {
+        unsigned int chunkSize = 0;
+        unsigned int maxInFlight = 0;
+        std::chrono::microseconds rtt{0};
+        double bytesPerSecond = 0;
+    };
+
+    // host identifies the peer in the cache, maxChunkSize is the server's read/write limit.
+    SFTPAutoTuner(const std::string& host, const unsigned int initialChunkSize,
+                  const unsigned int initialInFlight, const unsigned int maxChunkSize);
+
+    // Stores the current window for the host.
+    ~SFTPAutoTuner();
+
+    // A request of length bytes completed rtt after it was sent.
+    void onCompleted(const size_t length, const std::chrono::microseconds rtt);
+
+    unsigned int chunkSize() const { return m_chunkSize; }
+
+    unsigned int maxInFlight() const { return m_maxInFlight; }
+
+    // The last tuning stored for host, zeroed if there is none.
+    static Tuning cached(const std::string& host);
+
+   private:
+    SFTPAutoTuner(const SFTPAutoTuner&) = delete;
+    SFTPAutoTuner& operator=(const SFTPAutoTuner&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    void endRound(const Clock::time_point now);
+
+    void setWindow(const uint64_t window);
+
+    static constexpr unsigned int kMinChunkSize = 16 * 1024;
+    static constexpr unsigned int kMinInFlight = 4;
+    static constexpr unsigned int kMaxInFlight = 256;
+    static constexpr uint64_t kMaxWindow = 256ull * 1024 * 1024;
+    static constexpr size_t kRateRounds = 8;
+    static constexpr unsigned int kStartupPlateauRounds = 3;
+
+    const std::string m_host;
+    const unsigned int m_maxChunkSize;
+
+    unsigned int m_chunkSize;
+    unsigned int m_maxInFlight;
+    uint64_t m_window;
+
+    bool m_probing = true;
+    unsigned int m_plateauRounds = 0;
+    double m_bestProbeRate = 0;
+    std::deque<double> m_roundRates;  // The last kRateRounds rounds
+    std::chrono::microseconds m_minRtt{0};
+
+    Clock::time_point m_roundStart;
+    uint64_t m_roundBytes = 0;
+    uint64_t m_roundTarget;
+};
+
+// Builds one SFTP version 3 packet: the length prefix, the type byte and, for everything but
+// SSH_FXP_INIT, the request id. All integers are big endian.
+class SFTPPacketWriter {
+   public:
+    explicit SFTPPacketWriter(const uint8_t type);
+    SFTPPacketWriter(const uint8_t type, const uint32_t id);
+
+    SFTPPacketWriter& putUint8(const uint8_t value);
+    SFTPPacketWriter& putUint32(const uint32_t value);
+    SFTPPacketWriter& putUint64(const uint64_t value);
+    SFTPPacketWriter& putString(const std::string& value);
+    SFTPPacketWriter& putString(const char* data, const size_t size);
+
+    // Only the permissions attribute, which is all OPEN and MKDIR need.
+    SFTPPacketWriter& putPermissions(const uint32_t permissions);
+
+    SFTPPacketWriter& putEmptyAttributes();
+
+    // The version 3 fields of attributes, as SFTPPacketReader::getAttributes() reads them.
+    SFTPPacketWriter& putAttributes(const sftp_attributes_struct& attributes);
+
+    // Fills in the length prefix and hands over the packet.
+    std::string finish();
+
+   private:
+    std::string m_buffer;
+};
+
+// Reads the body of one packet, after the length prefix. Every get fails instead of reading
+// past the end, so a truncated or malicious packet cannot overrun the buffer.
+class SFTPPacketReader {
+   public:
+    SFTPPacketReader(const char* data, const size_t size) : m_data(data), m_size(size) {}
+
+    bool getUint8(uint8_t& value);
+    bool getUint32(uint32_t& value);
+    bool getUint64(uint64_t& value);
+    bool getString(std::string& value);
+
+    // Points into the packet instead of copying, for SSH_FXP_DATA payloads.
+    bool getStringView(const char*& data, uint32_t& size);
+
+    // Fills the fields a version 3 server sends; the caller owns the strings it allocates.
+    bool getAttributes(sftp_attributes_struct& attributes);
+
+    bool atEnd() const { return m_offset == m_size; }
+
+   private:
+    const char* m_data;
+    size_t m_size;
+    size_t m_offset = 0;
+};
+
+// Starts a read of the length bytes at offset that a short read left out, then seeks file back
+// to nextOffset for the reads that follow. Later requests already cover their own ranges, so
+// only this tail is fetched again. aio is only set when everything succeeded.
+bool beginTailRead(sftp_file file, const uint64_t offset, const size_t length,
+                   const uint64_t nextOffset, sftp_aio* aio);
+
+// Reads a remote file for relay() on a thread of its own, keeping maxInFlight read requests
+// outstanding, so the source server keeps sending while the destination is being written.
+// Chunks reach the caller through a SFTPChunkRing and may arrive out of order after a short
+// read.
+class SFTPRemoteReader {
+   public:
+    struct Chunk {
+        const char* data = nullptr;
+        uint64_t offset = 0;
+        size_t length = 0;
+    };
+
+    // Only the reader's thread uses file and its session until the reader is destroyed.
+    SFTPRemoteReader(ssh_session sshSession, sftp_session sftpSession, sftp_file file,
+                     const std::string& fileName, const size_t chunkSize,
+                     const size_t maxInFlight);
+    ~SFTPRemoteReader();
+
+    // Blocks for the next chunk, which stays valid until the following call. nullptr at the
+    // end of the file or on error.
+    const Chunk* next();
+
+    // Valid once next() returned nullptr.
+    const SFTPError& error() const { return m_error; }
+
+   private:
+    SFTPRemoteReader(const SFTPRemoteReader&) = delete;
+    SFTPRemoteReader& operator=(const SFTPRemoteReader&) = delete;
+
+    void run();
+
+    void fail();
+
+    static constexpr size_t kNoSlot = ~size_t(0);
+
+    ssh_session m_sshSession;
+    sftp_session m_sftpSession;
+    sftp_file m_file;
+    const std::string m_fileName;
+    const size_t m_chunkSize;
+    const size_t m_maxInFlight;
+
+    // m_error is published by m_ring.finish().
+    SFTPChunkRing<Chunk> m_ring;
+    SFTPError m_error;
+
+    std::thread m_thread;
+};
+
+// Closes and frees channels opened next to libssh's SFTP session.
+struct SSHChannelDeleter {
+    void operator()(ssh_channel channel) const;
+};
+
+using SSHChannelPtr = std::unique_ptr<ssh_channel_struct, SSHChannelDeleter>;
+
+// Single quotes value for the POSIX shell that runs exec channel commands.
+std::string shellQuote(const std::string& value);
+
+// A channel running command in the user's shell on the server, or null if it could not start.
+SSHChannelPtr openExecChannel(ssh_session session, const std::string& command);
+
+// Receives the stdout data of an exec channel. Returning false fails the read or write.
+using ExecOutputSink = std::function<bool(const char* data, size_t size)>;
+
+// Takes whatever stdout and stderr data already arrived, without waiting. Unread output would
+// close the channel window and stall the remote process, and with it our writes. stderr is
+// collected into errors, up to 1 MiB.
+bool pollExecChannel(ssh_channel channel, const ExecOutputSink& onOutput, std::string& errors);
+
+// Writes data to the command's stdin, polling its output between writes.
+bool writeExecChannel(ssh_channel channel, const char* data, size_t size,
+                      const ExecOutputSink& onOutput, std::string& errors);
+
+// Reads the command's output until it closes stdout.
+bool readExecChannel(ssh_channel channel, const ExecOutputSink& onOutput, std::string& errors);
+
+// The command's exit status once readExecChannel() saw its output end, -1 when the server
+// reported none or a signal ended the command.
+int execChannelExitStatus(ssh_channel channel);
+
+// Whether command runs on the server and exits with status 0.
+bool remoteCommandSucceeds(ssh_session session, const std::string& command);
+
+// A second SFTP channel on an SSH session that already carries libssh's SFTP session, spoken
+// to directly with SFTPPacketWriter and SFTPPacketReader. libssh's SFTP API cannot send
+// extended requests it does not know, so extensions such as check-file and copy-data go over
+// one of these. request() is synchronous; send() and receive() keep several requests
+// outstanding, as long as the replies they wait for fit into the channel window.
+class SFTPSideChannel {
+   public:
+    explicit SFTPSideChannel(ssh_session session) : m_session(session) {}
+
+    // Opens the channel, starts the sftp subsystem and exchanges versions.
+    SFTPError open();
+
+    // Whether the server listed the extension in its version packet.
+    bool hasExtension(const std::string& name) const { return m_extensions.count(name) > 0; }
+
+    uint32_t nextId() { return m_nextId++; }
+
+    // Sends a packet built with the id from nextId() and reads its reply: type and, in body,
+    // everything after the request id.
+    SFTPError request(const std::string& packet, uint8_t& type, std::string& body);
+
+    // Queues a packet without waiting for its reply.
+    SFTPError send(const std::string& packet);
+
+    // Reads the next reply, whichever request it answers.
+    SFTPError receive(uint32_t& id, uint8_t& type, std::string& body);
+
+    // Sends a request that is answered with SSH_FXP_STATUS and returns that status.
+    SFTPError requestStatus(const std::string& packet);
+
+    // SSH_FXP_OPEN with SSH_FXF_* flags.
+    SFTPError openFile(const std::string& path, const uint32_t flags, const uint32_t permissions,
+                       std::string& handle);
+
+    SFTPError closeFile(const std::string& handle);
+
+    // The error an SSH_FXP_STATUS reply stands for, or a protocol error for any other reply.
+    static SFTPError statusError(const uint8_t type, SFTPPacketReader& reader);
+
+    // Longest read to ask for, so that its SSH_FXP_DATA reply stays below kMaxPacketSize.
+    static constexpr uint32_t kMaxDataLength = 255 * 1024;
+
+   private:
+    SFTPSideChannel(const SFTPSideChannel&) = delete;
+    SFTPSideChannel& operator=(const SFTPSideChannel&) = delete;
+
+    SFTPError channelError(const std::string& what) const;
+
+    bool readFully(char* data, uint32_t size);
+
+    bool readPacket(std::string& body);
+
+    bool writePacket(const std::string& packet);
+
+    // Larger replies are treated as a broken stream rather than allocated.
+    static constexpr uint32_t kMaxPacketSize = 256 * 1024;
+
+    ssh_session m_session;
+    SSHChannelPtr m_channel;
+    std::map<std::string, std::string> m_extensions;
+    uint32_t m_nextId = 1;
+};
+
+// Writes a POSIX ustar archive to a sink as it is produced, buffering small writes. Names that
+// do not fit the ustar fields and files of 8 GiB or more get a pax extended header.
+class TarWriter {
+   public:
+    // Returns false when the data could not be delivered.
+    using Sink = std::function<bool(const char* data, size_t size)>;
+
+    explicit TarWriter(Sink sink);
+
+    // Starts a regular file; exactly size bytes must follow through writeData(), which pads
+    // the entry once the last of them arrived.
+    bool beginFile(const std::string& name, const uint64_t size, const uint32_t mode,
+                   const int64_t mtime);
+
+    bool writeData(const char* data, const size_t size);
+
+    // Writes the end of archive marker and flushes.
+    bool finish();
+
+   private:
+    bool writeHeader(const std::string& name, const std::string& prefix, const uint64_t size,
+                     const uint32_t mode, const int64_t mtime, const char type);
+
+    bool append(const char* data, const size_t size);
+
+    // Zeros up to the next block boundary after an entry of size bytes.
+    bool pad(const uint64_t size);
+
+    bool flush();
+
+    Sink m_sink;
+    std::string m_buffer;
+    uint64_t m_entrySize = 0;
+    uint64_t m_remaining = 0;
+    bool m_failed = false;
+
+    static constexpr size_t kBlockSize = 512;
+    static constexpr size_t kFlushSize = 64 * 1024;
+};
+
+// Parses a ustar, pax or GNU tar archive pushed to it in pieces of any size.
+class TarReader {
+   public:
+    struct Entry {
+        std::string name;
+        char type = '0';  // '0' regular file, '5' directory, ...
+        uint64_t size = 0;
+        uint32_t mode = 0;
+    };
+
+    // Each callback returns false to stop parsing. onData only sees the contents of regular
+    // files, and onEnd follows the last of it.
+    TarReader(std::function<bool(const Entry&)> onEntry,
+              std::function<bool(const char* data, size_t size)> onData,
+              std::function<bool()> onEnd);
+
+    // False on a malformed archive or when a callback stopped parsing.
+    bool feed(const char* data, size_t size);
+
+    // The end of archive marker was seen.
+    bool finished() const { return m_state == State::Finished; }
+
+   private:
+    enum class State { Header, FileData, MetaData, Skip, Finished, Failed };
+
+    bool parseHeader();
+
+    void parsePaxRecords();
+
+    bool endData();
+
+    std::function<bool(const Entry&)> m_onEntry;
+    std::function<bool(const char*, size_t)> m_onData;
+    std::function<bool()> m_onEnd;
+
+    static constexpr size_t kBlockSize = 512;
+
+    State m_state = State::Header;
+    char m_header[kBlockSize];
+    size_t m_headerSize = 0;
+    unsigned int m_zeroBlocks = 0;
+
+    char m_metaType = 0;  // 'x' or 'L' while their data is collected in m_meta
+    std::string m_meta;
+    std::string m_nextName;  // From a pax or GNU long name header, for the next entry
+    uint64_t m_nextSize = 0;
+    bool m_hasNextSize = false;
+
+    uint64_t m_remaining = 0;  // Data bytes left in the current entry
+    uint64_t m_padding = 0;
+};
+
+// Creates the missing local directories above path.
+bool createParentDirectories(const std::string& path);
+
+// Whether the session can run tar through an exec channel.
+bool remoteTarAvailable(ssh_session session);
+
+// Streams the files at localDir/path as one tar archive into a tar process that unpacks it in
+// remoteDir, creating it and any missing parents. Per file errors come from what the remote
+// tar reports. When tar exits with an error, the files it did not name are failed too and the
+// returned error is set, as it is when the stream itself failed.
+std::pair<SFTPError, std::vector<FileTransferResult>> tarPut(
+    ssh_session session, const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir);
+
+// Has the remote tar pack remoteDir/path for every path into one stream and unpacks it into
+// localDir. Only the requested paths are written, whatever else the archive holds.
+std::pair<SFTPError, std::vector<FileTransferResult>> tarGet(
+    ssh_session session, const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir);
+
+// Whether the library was built with libzstd (SFTPCLIENTPP_HAVE_ZSTD), which the zstd transfer
+// mode of TransferOptions needs.
+bool zstdSupported();
+
+// Whether the session can run zstd through an exec channel.
+bool remoteZstdAvailable(ssh_session session);
+
+// Compresses localFileName with libzstd's multi-threaded streaming compressor, which works on
+// chunks of the file in parallel on options.zstdThreads cores, and streams the frame into a
+// zstd process on the server that writes remoteFileName. checksum is fed the file as it is
+// read. options.progress gets 0 while the stream runs, since a cut off frame leaves nothing on
+// the server to resume from, and the file size once zstd there exited cleanly. A failed
+// transfer has to start over. elapsed is left to the caller.
+std::pair<SFTPError, TransferStats> zstdPut(ssh_session session, const std::string& localFileName,
+                                            const std::string& remoteFileName,
+                                            const TransferOptions& options, Checksum& checksum);
+
+// Has zstd on the server compress remoteFileName and decompresses the stream into
+// localFileName, feeding checksum as the data is written. The data lands in
+// localFileName.zstdpart first, which replaces localFileName only after a complete stream and
+// is removed otherwise. options.progress gets 0 until then and the file size after, so a
+// failed transfer has to start over.
+std::pair<SFTPError, TransferStats> zstdGet(ssh_session session, const std::string& localFileName,
+                                            const std::string& remoteFileName,
+                                            const TransferOptions& options, Checksum& checksum);
+
+// Transfers many files over one SFTP side channel with their opens, reads or writes and closes
+// overlapping: up to ConnectOptions::maxFilesInFlight files are open at once, each with up to
+// maxInFlightRequests chunks outstanding, so the link stays busy while single files wait for
+// their round trips. The replies still outstanding are kept below kMaxBytesInFlight, which
+// fits into the channel window, so the blocking channel never waits on itself.
+class SFTPBatchTransfer {
+   public:
+    // maxReadLength and maxWriteLength are the server's limits, see limits@openssh.com.
+    SFTPBatchTransfer(ssh_session session, const ConnectOptions& options,
+                      const uint32_t maxReadLength, const uint32_t maxWriteLength);
+
+    // Opens the side channel, which servers that allow a single channel per session refuse.
+    SFTPError open();
+
+    // localDir/path to remoteDir/path for each path, creating missing remote directories.
+    std::pair<SFTPError, std::vector<FileTransferResult>> put(
+        const std::string& localDir, const std::vector<std::string>& paths,
+        const std::string& remoteDir);
+
+    // remoteDir/path to localDir/path for each path, creating missing local directories.
+    std::pair<SFTPError, std::vector<FileTransferResult>> get(
+        const std::string& localDir, const std::vector<std::string>& paths,
+        const std::string& remoteDir);
+
+   private:
+    SFTPBatchTransfer(const SFTPBatchTransfer&) = delete;
+    SFTPBatchTransfer& operator=(const SFTPBatchTransfer&) = delete;
+
+    // Called with the response type and a reader positioned after the request id.
+    using ResponseHandler = std::function<void(uint8_t type, SFTPPacketReader& reader)>;
+
+    struct File;
+
+    std::pair<SFTPError, std::vector<FileTransferResult>> run(
+        const std::string& localDir, const std::vector<std::string>& paths,
+        const std::string& remoteDir, const bool upload);
+
+    // Creates the remote directories above the files, one level of depth per round trip.
+    void createRemoteDirectories(const std::vector<std::string>& remoteFileNames);
+
+    void startFile(const std::shared_ptr<File>& file);
+
+    void pumpPut(const std::shared_ptr<File>& file);
+
+    void pumpGet(const std::shared_ptr<File>& file);
+
+    void readChunk(const std::shared_ptr<File>& file, const uint64_t offset,
+                   const uint32_t length);
+
+    void closeFile(const std::shared_ptr<File>& file);
+
+    void finishFile(const std::shared_ptr<File>& file, const SFTPError& err);
+
+    SFTPPacketWriter request(const uint8_t type) { return SFTPPacketWriter(type, m_nextId); }
+
+    void send(SFTPPacketWriter& packet, ResponseHandler handler);
+
+    // Reads one reply and runs its handler.
+    void receive();
+
+    static constexpr uint32_t kMaxBytesInFlight = 1024 * 1024;
+
+    SFTPSideChannel m_channel;
+    SFTPError m_error;
+    bool m_upload = true;
+
+    uint32_t m_configuredChunkSize;
+    uint32_t m_maxReadLength;
+    uint32_t m_maxWriteLength;
+    uint32_t m_chunkSize = 0;
+    unsigned int m_maxInFlight;
+    unsigned int m_maxFiles;
+
+    uint32_t m_nextId = 1;
+    std::unordered_map<uint32_t, ResponseHandler> m_handlers;
+    std::vector<std::shared_ptr<File>> m_open;
+    std::vector<FileTransferResult> m_results;
+    uint64_t m_bytesInFlight = 0;
+};
+
+class SFTPBrokerConnection;
+
+class SFTPClient {
+   public:
+    SFTPClient() = default;
+    ~SFTPClient();
+
+    SFTPClient(SFTPClient&&) = default;
+
+    SFTPClient& operator=(SFTPClient&&) = default;
+
+    SFTPError connect(const std::string& host, const std::string& user, const std::string& pw,
+                      const uint16_t port = 22, const bool onlyKnownServers = true);
+
+    SFTPError connect(const std::string& host, const std::string& user, const std::string& pw,
+                      const ConnectOptions& options, const uint16_t port = 22,
+                      const bool onlyKnownServers = true);
+
+    // Broker mode: put(), get(), mkdir(), ls(), rename(), copy(), rm(), rmdir() and stat() are
+    // forwarded to the SFTPBroker listening on socketPath, which lends this process a session
+    // to user@host:port that is already authenticated when it has one idle. Other operations
+    // report an invalid session in broker mode.
+    SFTPError connectThroughBroker(const std::string& socketPath, const std::string& host,
+                                   const std::string& user, const std::string& pw,
+                                   const uint16_t port = 22, const bool onlyKnownServers = true);
+
+    void disconnect();
+
+    NegotiatedAlgorithms negotiatedAlgorithms() const;
+
+    // A chunkSize of 0 uses ConnectOptions::chunkSize.
+    SFTPError put(const std::string& localFileName, const std::string& remoteFileName,
+                  unsigned int chunkSize = 0) const;
+
+    SFTPError get(const std::string& localFileName, const std::string& remoteFileName,
+                  unsigned int chunkSize = 0) const;
+
+    SFTPError put(const std::string& localFileName, const std::string& remoteFileName,
+                  const TransferOptions& options) const;
+
+    SFTPError get(const std::string& localFileName, const std::string& remoteFileName,
+                  const TransferOptions& options) const;
+
+    // Uploads size bytes from memory, which has to stay valid and unchanged until the call
+    // returns. SFTPFanOut sends one mapping of a file to many hosts with it.
+    SFTPError putBuffer(const char* data, const uint64_t size, const std::string& remoteFileName,
+                        const TransferOptions& options = TransferOptions()) const;
+
+    // Transfer many files in one call: localDir/path to or from remoteDir/path for each of the
+    // relative paths. When the server runs commands, all of them travel as one tar stream over
+    // an exec channel, so small files no longer cost an open, write and close round trip each.
+    // Otherwise SFTPBatchTransfer keeps ConnectOptions::maxFilesInFlight files open at once on a
+    // second SFTP channel. The results follow the order of paths, the returned error only
+    // reports a failure of the transfer as a whole.
+    std::pair<SFTPError, std::vector<FileTransferResult>> putFiles(
+        const std::string& localDir, const std::vector<std::string>& paths,
+        const std::string& remoteDir) const;
+
+    std::pair<SFTPError, std::vector<FileTransferResult>> getFiles(
+        const std::string& localDir, const std::vector<std::string>& paths,
+        const std::string& remoteDir) const;
+
+    SFTPError mkdir(const std::string& remoteDir, const mode_t permissions) const;
+
+    std::pair<SFTPError, std::vector<SFTPAttributes>> ls(const std::string& remoteDir) const;
+
+    SFTPError rename(const std::string& oldRemoteName, const std::string& newRemoteName) const;
+
+    // Copies a remote file to another remote path on the server itself, through the copy-data
+    // extension when the server has it (OpenSSH since 9.0) and otherwise by pipelined reads
+    // and writes through this client, never touching local disk. recursive copies directories
+    // with their contents and recreates the symbolic links inside them instead of following.
+    SFTPError copy(const std::string& remoteSrc, const std::string& remoteDst,
+                   const bool recursive = false) const;
+
+    // Streams remoteSrc on this client's server to remoteDst on destination's server through
+    // a few chunk buffers, never touching local disk. Reads from this server run on their own
+    // thread while writes go to the other one. recursive relays a directory as copy() does.
+    SFTPError relay(const SFTPClient& destination, const std::string& remoteSrc,
+                    const std::string& remoteDst, const bool recursive = false) const;
+
+    SFTPError rm(const std::string& remoteFileName) const;
+
+    SFTPError rmdir(const std::string& remoteDirName) const;
+
+    std::pair<SFTPError, SFTPAttributes> stat(const std::string& remotePath) const;
+
+    // The server's hex digest of a remote file, see remoteChecksum().
+    std::pair<SFTPError, std::string> checksum(
+        const std::string& remoteFileName,
+        const ChecksumAlgorithm algorithm = ChecksumAlgorithm::Sha256) const;
+
+   private:
+    SFTPClient& operator=(const SFTPClient&) = delete;
+    SFTPClient(const SFTPClient&) = delete;
+
+    struct SSHSessionDeleter {
+        void operator()(ssh_session session) const;
+    };
+
+    struct SFTPSessionDeleter {
+        void operator()(sftp_session session) const;
+    };
+
+    struct SFTPFileDeleter {
+        void operator()(sftp_file file) const;
+    };
+
+    struct SFTPAioDeleter {
+        void operator()(sftp_aio aio) const;
+    };
+
+    using SSHSessionPtr = std::unique_ptr<ssh_session_struct, SSHSessionDeleter>;
+    using SFTPSessionPtr = std::unique_ptr<sftp_session_struct, SFTPSessionDeleter>;
+    using SFTPAioPtr = std::unique_ptr<sftp_aio_struct, SFTPAioDeleter>;
+
+    SFTPError openSessions(const std::string& pw) const;
+
+    SFTPError openSession(const std::string& pw, const bool compress, SSHSessionPtr& sshSession,
+                          SFTPSessionPtr& sftpSession) const;
+
+    SFTPError reconnect() const;
+
+    bool connectionLost(const SFTPError& err) const;
+
+    // How far one operation got through a RetryPolicy.
+    struct RetryState {
+        explicit RetryState(const RetryPolicy& policy) : backoff(policy.initialBackoff) {}
+
+        unsigned int attempt = 1;
+        std::chrono::milliseconds backoff;
+    };
+
+    // After err lost the connection, backs off and reconnects until that works or the attempts
+    // run out. True when the operation can run again.
+    bool reconnectAfter(const SFTPError& err, RetryState& retry) const;
+
+    template <typename Operation>
+    auto withRetry(const bool idempotent, Operation operation) const -> decltype(operation());
+
+    static const SFTPError& errorOf(const SFTPError& err) { return err; }
+
+    template <typename T>
+    static const SFTPError& errorOf(const std::pair<SFTPError, T>& result) {
+        return result.first;
+    }
+
+    // What putFrom() uploads: a local file, or memory when data is set.
+    struct PutSource {
+        std::string fileName;
+        const char* data = nullptr;
+        uint64_t size = 0;
+    };
+
+    // offset is where the transfer starts and, on return, how far the server acknowledged it.
+    SFTPError putFrom(const PutSource& source, const std::string& remoteFileName,
+                      const TransferOptions& options, uint64_t& offset) const;
+
+    SFTPError getFrom(const std::string& localFileName, const std::string& remoteFileName,
+                      const TransferOptions& options, uint64_t& offset) const;
+
+    // Whether put(), or get() when download is set, goes through zstd instead of SFTP.
+    bool useZstd(const TransferOptions& options, const bool download) const;
+
+    // What the server can run over an exec channel, asked once per session.
+    enum class RemoteTool { Unknown, Available, Missing };
+
+    // Runs probe on the first call after the sessions were opened and then remembers its
+    // answer in known.
+    bool remoteToolAvailable(RemoteTool& known, bool (*probe)(ssh_session session)) const;
+
+    static void reportStats(const TransferOptions& options, TransferStats stats,
+                            const std::chrono::steady_clock::time_point start);
+
+    // Reports the digest through options.onChecksum and compares it with the server's.
+    SFTPError finishChecksum(const std::string& remoteFileName, Checksum& checksum,
+                             const TransferOptions& options) const;
+
+    // Feeds bytes [from, to) of a local file to checksum, for data that did not stream past it.
+    static SFTPError hashLocalFile(const std::string& localFileName, const uint64_t from,
+                                   const uint64_t to, Checksum& checksum);
+
+    // Writes go to destination, which is *this for copy(). channel is null when the server
+    // lacks copy-data or the copy goes to another server. destinationFailed, when given, is set
+    // if the error came from destination rather than this client.
+    SFTPError copyPath(const SFTPClient& destination, const std::string& remoteSrc,
+                       const std::string& remoteDst, const sftp_attributes_struct& attributes,
+                       const bool recursive, SFTPSideChannel* channel,
+                       bool* destinationFailed) const;
+
+    SFTPError copyData(SFTPSideChannel& channel, const std::string& remoteSrc,
+                       const std::string& remoteDst, const uint32_t permissions) const;
+
+    SFTPError copyPipelined(const std::string& remoteSrc, const std::string& remoteDst,
+                            const uint32_t permissions) const;
+
+    SFTPError relayFile(const SFTPClient& destination, const std::string& remoteSrc,
+                        const std::string& remoteDst, const uint32_t permissions,
+                        bool* destinationFailed) const;
+
+    // Creates the missing remote directories above remoteFileName; known lists those that
+    // already exist so a batch does not ask twice.
+    void createRemoteParents(const std::string& remoteFileName,
+                             std::set<std::string>& known) const;
+
+    void readServerLimits();
+
+    // Identifies the server in the SFTPAutoTuner cache.
+    std::string tunerKey() const;
+
+    // Mutable so that const operations can reconnect under a RetryPolicy.
+    mutable SSHSessionPtr m_sshSession;
+    mutable SFTPSessionPtr m_sftpSession;
+
+    // Only open with Compression::Adaptive.
+    mutable SSHSessionPtr m_compressedSshSession;
+    mutable SFTPSessionPtr m_compressedSftpSession;
+
+    ConnectOptions m_options;
+    std::string m_host;
+    std::string m_user;
+    uint16_t m_port = 22;
+    bool m_onlyKnownServers = true;
+
+    // Only kept when the RetryPolicy allows reconnecting.
+    std::string m_password;
+
+    // Only set in broker mode, which has no sessions of its own.
+    std::shared_ptr<SFTPBrokerConnection> m_broker;
+
+    unsigned int m_maxReadLength = kFallbackMaxChunkSize;
+    unsigned int m_maxWriteLength = kFallbackMaxChunkSize;
+
+    // Reset whenever the sessions are opened again.
+    mutable RemoteTool m_remoteTar = RemoteTool::Unknown;
+    mutable RemoteTool m_remoteZstd = RemoteTool::Unknown;
+
+    // libssh's limit for servers that do not announce limits@openssh.com.
+    static constexpr unsigned int kFallbackMaxChunkSize = 32 * 1024;
+
+    static constexpr size_t kCompressionSampleSize = 256 * 1024;
+
+    // Largest chunk the disk pipeline buffers for tuned transfers, whose chunk size changes.
+    static constexpr unsigned int kMaxPooledChunkSize = 1024 * 1024;
+};
+
+// An SFTP client that never blocks on the network, so one thread can drive thousands of
+// sessions from its own poll/epoll loop. Watch fd() for readability, and for writability while
+// wantsWrite() is true, and call process() whenever either fires. Re-check wantsWrite() after
+// process() and after starting an operation.
+//
+// Operations can be started at any time, also before the session is ready, and any number of
+// them run concurrently. Their callbacks run from inside process(); they may start further
+// operations but must not disconnect or destroy the client.
+//
+// SFTP is spoken directly over an SSH channel rather than through libssh's sftp API, whose
+// calls block. Host name resolution in connect() and local file reads and writes, one chunk at
+// a time, still block.
+class SFTPNonBlockingClient {
+   public:
+    enum class State {
+        Disconnected,
+        Connecting,
+        Authenticating,
+        OpeningChannel,
+        StartingSubsystem,
+        Initializing,
+        Ready,
+        Failed
+    };
+
+    using Callback = std::function<void(const SFTPError&)>;
+    using StatCallback = std::function<void(const SFTPError&, const SFTPAttributes&)>;
+    using LsCallback = std::function<void(const SFTPError&, const std::vector<SFTPAttributes>&)>;
+
+    SFTPNonBlockingClient() = default;
+    ~SFTPNonBlockingClient();
+
+    // Starts connecting and returns without waiting for the server.
+    SFTPError connect(const std::string& host, const std::string& user, const std::string& pw,
+                      const ConnectOptions& options = ConnectOptions(), const uint16_t port = 22,
+                      const bool onlyKnownServers = true);
+
+    // Outstanding operations are dropped without calling their callbacks.
+    void disconnect();
+
+    // -1 until connect() has created the socket.
+    int fd() const;
+
+    bool wantsRead() const;
+
+    bool wantsWrite() const;
+
+    // Advances the handshake and every outstanding operation as far as possible without
+    // blocking. Returns the error that ended the session, if any.
+    SFTPError process();
+
+    State state() const { return m_state; }
+
+    size_t pendingOperations() const { return m_handlers.size() + m_queued.size(); }
+
+    void put(const std::string& localFileName, const std::string& remoteFileName, Callback done);
+
+    void get(const std::string& localFileName, const std::string& remoteFileName, Callback done);
+
+    void mkdir(const std::string& remoteDir, const mode_t permissions, Callback done);
+
+    void ls(const std::string& remoteDir, LsCallback done);
+
+    void rename(const std::string& oldRemoteName, const std::string& newRemoteName,
+                Callback done);
+
+    void rm(const std::string& remoteFileName, Callback done);
+
+    void rmdir(const std::string& remoteDirName, Callback done);
+
+    void stat(const std::string& remotePath, StatCallback done);
+
+   private:
+    SFTPNonBlockingClient(const SFTPNonBlockingClient&) = delete;
+    SFTPNonBlockingClient& operator=(const SFTPNonBlockingClient&) = delete;
+
+    struct SSHSessionDeleter {
+        void operator()(ssh_session session) const;
+    };
+
+    struct SSHChannelDeleter {
+        void operator()(ssh_channel channel) const;
+    };
+
+    using SSHSessionPtr = std::unique_ptr<ssh_session_struct, SSHSessionDeleter>;
+    using SSHChannelPtr = std::unique_ptr<ssh_channel_struct, SSHChannelDeleter>;
+
+    // Called with the response type and a reader positioned after the request id.
+    using ResponseHandler = std::function<void(uint8_t type, SFTPPacketReader& reader)>;
+
+    struct PutTransfer;
+    struct GetTransfer;
+    struct Listing;
+
+    bool advanceHandshake();
+
+    void handleVersion(SFTPPacketReader& reader);
+
+    void becomeReady();
+
+    void fail(const SFTPError& err);
+
+    void flushOutbox();
+
+    void readIncoming();
+
+    void dispatch(const char* data, const size_t size);
+
+    uint32_t send(SFTPPacketWriter& packet, ResponseHandler handler);
+
+    SFTPPacketWriter request(const uint8_t type) { return SFTPPacketWriter(type, m_nextId); }
+
+    void start(std::function<void()> operation);
+
+    void pumpPut(const std::shared_ptr<PutTransfer>& transfer);
+
+    void pumpGet(const std::shared_ptr<GetTransfer>& transfer);
+
+    void readChunk(const std::shared_ptr<GetTransfer>& transfer, const uint64_t offset,
+                   const uint32_t length);
+
+    void readDirectory(const std::shared_ptr<Listing>& listing);
+
+    void closeHandle(const std::string& handle, Callback done);
+
+    static SFTPError statusError(const uint8_t type, SFTPPacketReader& reader);
+
+    SSHSessionPtr m_sshSession;
+    SSHChannelPtr m_channel;
+    State m_state = State::Disconnected;
+    SFTPError m_error;
+
+    ConnectOptions m_options;
+    bool m_onlyKnownServers = true;
+
+    // Kept only until authentication has finished.
+    std::string m_password;
+
+    std::string m_inbox;
+    std::string m_outbox;
+    size_t m_outboxOffset = 0;
+
+    uint32_t m_nextId = 1;
+    std::unordered_map<uint32_t, ResponseHandler> m_handlers;
+    std::deque<std::function<void()>> m_queued;
+
+    uint32_t m_maxReadLength = kFallbackMaxChunkSize;
+    uint32_t m_maxWriteLength = kFallbackMaxChunkSize;
+
+    // libssh's limit for servers that do not announce limits@openssh.com.
+    static constexpr uint32_t kFallbackMaxChunkSize = 32 * 1024;
+
+    // Larger packets are treated as a protocol error rather than buffered.
+    static constexpr uint32_t kMaxPacketLength = 16 * 1024 * 1024;
+};
+
+// Shared cancellation flag. Copies refer to the same flag, so the caller keeps one copy and
+// passes another along with the operation.
+class CancellationToken {
+   public:
+    CancellationToken() : m_cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void cancel() const { m_cancelled->store(true); }
+
+    bool isCancelled() const { return m_cancelled->load(); }
+
+   private:
+    std::shared_ptr<std::atomic<bool>> m_cancelled;
+};
+
+// Runs SFTPClient operations on a pool of worker threads, each with its own session, and
+// returns their results as futures. Operations wait in a bounded queue: once it is full the
+// *Async() calls block until a worker takes one, so producers cannot run ahead of the
+// network without limit.
+//
+// A cancelled operation that has not started yet completes with an error for which
+// isCancelled() is true; a transfer already running stops after its current chunk.
+class SFTPAsyncClient {
+   public:
+    SFTPAsyncClient() = default;
+    ~SFTPAsyncClient();
+
+    // Opens one session per worker and starts the workers. Fails, with no worker running, if
+    // any session cannot be opened.
+    SFTPError connect(const std::string& host, const std::string& user, const std::string& pw,
+                      const ConnectOptions& options = ConnectOptions(),
+                      const unsigned int workers = 4, const size_t maxQueueDepth = 64,
+                      const uint16_t port = 22, const bool onlyKnownServers = true);
+
+    // Waits for running operations; queued ones complete as cancelled.
+    void disconnect();
+
+    std::future<SFTPError> putAsync(const std::string& localFileName,
+                                    const std::string& remoteFileName,
+                                    const CancellationToken& token = CancellationToken(),
+                                    const TransferOptions& options = TransferOptions());
+
+    std::future<SFTPError> getAsync(const std::string& localFileName,
+                                    const std::string& remoteFileName,
+                                    const CancellationToken& token = CancellationToken(),
+                                    const TransferOptions& options = TransferOptions());
+
+    std::future<SFTPError> mkdirAsync(const std::string& remoteDir, const mode_t permissions,
+                                      const CancellationToken& token = CancellationToken());
+
+    std::future<std::pair<SFTPError, std::vector<SFTPAttributes>>> lsAsync(
+        const std::string& remoteDir, const CancellationToken& token = CancellationToken());
+
+    std::future<SFTPError> renameAsync(const std::string& oldRemoteName,
+                                       const std::string& newRemoteName,
+                                       const CancellationToken& token = CancellationToken());
+
+    std::future<SFTPError> copyAsync(const std::string& remoteSrc, const std::string& remoteDst,
+                                     const bool recursive = false,
+                                     const CancellationToken& token = CancellationToken());
+
+    std::future<SFTPError> rmAsync(const std::string& remoteFileName,
+                                   const CancellationToken& token = CancellationToken());
+
+    std::future<SFTPError> rmdirAsync(const std::string& remoteDirName,
+                                      const CancellationToken& token = CancellationToken());
+
+    std::future<std::pair<SFTPError, SFTPAttributes>> statAsync(
+        const std::string& remotePath, const CancellationToken& token = CancellationToken());
+
+   private:
+    SFTPAsyncClient(const SFTPAsyncClient&) = delete;
+    SFTPAsyncClient& operator=(const SFTPAsyncClient&) = delete;
+
+    // Called with the worker's client, or with nullptr when the operation is dropped.
+    using Job = std::function<void(const SFTPClient*)>;
+
+    template <typename Result>
+    std::future<Result> submit(const CancellationToken& token,
+                               std::function<Result(const SFTPClient&)> operation);
+
+    static SFTPError& errorOf(SFTPError& err) { return err; }
+
+    template <typename T>
+    static SFTPError& errorOf(std::pair<SFTPError, T>& result) {
+        return result.first;
+    }
+
+    static TransferOptions cancellable(const TransferOptions& options,
+                                       const CancellationToken& token);
+
+    void workerLoop(const SFTPClient& client);
+
+    std::vector<std::unique_ptr<SFTPClient>> m_clients;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<Job> m_queue;
+    size_t m_maxQueueDepth = 64;
+    bool m_stopping = false;
+};
+
+// Uploads one local file to many hosts at once. The file is mapped into memory a single time
+// and every host reads its chunks from that mapping, so the disk is read once however many
+// hosts there are. Each host has its own session and worker thread and takes chunks at the
+// pace its window allows, so a slow host holds back only itself.
+class SFTPFanOut {
+   public:
+    struct Target {
+        std::string host;
+        std::string user;
+        std::string password;
+        std::string remoteFileName;
+        uint16_t port = 22;
+    };
+
+    struct Result {
+        std::string host;
+        SFTPError error;
+        uint64_t bytes = 0;  // Acknowledged by the host, also when it failed part way
+        std::chrono::milliseconds connectTime{0};
+        std::chrono::milliseconds transferTime{0};
+    };
+
+    explicit SFTPFanOut(const ConnectOptions& options = ConnectOptions(),
+                        const unsigned int maxConcurrentHosts = 32,
+                        const bool onlyKnownServers = true);
+
+    // Results are in the order of targets. The returned error is only set when the local
+    // file could not be read, a failed host is reported in its own Result. The callbacks in
+    // options are called from the host threads, but never two at once, so they need not be
+    // thread-safe. progress reports each host's own offset, so values from different hosts
+    // interleave, and onStats is called once per host that connected.
+    std::pair<SFTPError, std::vector<Result>> put(
+        const std::string& localFileName, const std::vector<Target>& targets,
+        const TransferOptions& options = TransferOptions()) const;
+
+   private:
+    ConnectOptions m_options;
+    unsigned int m_maxConcurrentHosts;
+    bool m_onlyKnownServers;
+};
+
+class SFTPPacketReader;
+
+// Keeps authenticated sessions open for short lived processes, in the spirit of OpenSSH's
+// ControlMaster. Processes reach it over a Unix domain socket through
+// SFTPClient::connectThroughBroker(), which costs a local connect instead of a key exchange
+// and authentication. Each process leases one session of its host for as long as it stays
+// connected; sessions go back to the pool afterwards and close after idleTimeout unused.
+//
+// The socket is created readable and writable by its owner only. A pooled session is only
+// handed to a process that presents the password it was opened with. Not available on Windows.
+class SFTPBroker {
+   public:
+    explicit SFTPBroker(const std::string& socketPath,
+                        const ConnectOptions& options = ConnectOptions(),
+                        const std::chrono::seconds idleTimeout = std::chrono::seconds(300));
+    ~SFTPBroker();
+
+    // Creates the socket, replacing a stale one left by an earlier broker. Fails when a broker
+    // still listens there or the path holds something other than a socket.
+    SFTPError listen();
+
+    // Serves processes on the calling thread, each on a thread of its own, until stop().
+    SFTPError run();
+
+    // Callable from any thread. Connected processes are disconnected once their current
+    // operation is done.
+    void stop();
+
+    // Open sessions, leased or idle.
+    size_t sessionCount() const;
+
+   private:
+    SFTPBroker(const SFTPBroker&) = delete;
+    SFTPBroker& operator=(const SFTPBroker&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Session {
+        std::unique_ptr<SFTPClient> client;
+        std::string password;
+        bool onlyKnownServers = true;
+        Clock::time_point idleSince;
+    };
+
+    void serve(const int fd);
+
+    // Runs one request on client and returns the reply. reusable is cleared once the session
+    // is lost, so it does not go back to the pool.
+    std::string handle(const uint8_t type, SFTPPacketReader& reader, const SFTPClient& client,
+                       bool& reusable);
+
+    // An idle session of user@host:port opened with password that still answers, or a newly
+    // connected one.
+    std::pair<SFTPError, Session> lease(const std::string& key, const std::string& host,
+                                        const std::string& user, const std::string& password,
+                                        const uint16_t port, const bool onlyKnownServers);
+
+    void release(const std::string& key, Session session, const bool reusable);
+
+    void closeIdleSessions();
+
+    void joinFinished();
+
+    const std::string m_socketPath;
+    const ConnectOptions m_options;
+    const std::chrono::seconds m_idleTimeout;
+
+    int m_listenFd = -1;
+    std::atomic<bool> m_stopping{false};
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::vector<Session>> m_idle;
+    size_t m_leased = 0;
+    std::map<int, std::thread> m_clients;  // By socket, closed once the thread is joined
+    std::vector<int> m_finished;
+};
+
+// One process's connection to a SFTPBroker, used by SFTPClient in broker mode. Local file
+// names are sent as absolute paths, since the broker runs in another working directory.
+class SFTPBrokerConnection {
+   public:
+    explicit SFTPBrokerConnection(const std::string& socketPath);
+    ~SFTPBrokerConnection();
+
+    // Leases a session to user@host:port, which the broker opens if it has none idle.
+    SFTPError open(const std::string& host, const std::string& user, const std::string& pw,
+                   const uint16_t port, const bool onlyKnownServers);
+
+    // TransferOptions::progress is not called through a broker, onChecksum is.
+    SFTPError put(const std::string& localFileName, const std::string& remoteFileName,
+                  const TransferOptions& options);
+
+    SFTPError get(const std::string& localFileName, const std::string& remoteFileName,
+                  const TransferOptions& options);
+
+    SFTPError mkdir(const std::string& remoteDir, const uint32_t permissions);
+
+    std::pair<SFTPError, std::vector<SFTPAttributes>> ls(const std::string& remoteDir);
+
+    SFTPError rename(const std::string& oldRemoteName, const std::string& newRemoteName);
+
+    SFTPError copy(const std::string& remoteSrc, const std::string& remoteDst,
+                   const bool recursive);
+
+    SFTPError rm(const std::string& remoteFileName);
+
+    SFTPError rmdir(const std::string& remoteDir);
+
+    std::pair<SFTPError, SFTPAttributes> stat(const std::string& remotePath);
+
+   private:
+    SFTPBrokerConnection(const SFTPBrokerConnection&) = delete;
+    SFTPBrokerConnection& operator=(const SFTPBrokerConnection&) = delete;
+
+    SFTPError transfer(const uint8_t type, const std::string& localFileName,
+                       const std::string& remoteFileName, const TransferOptions& options);
+
+    // Sends request and returns the status of the reply. readResult, when given, reads the
+    // rest of a successful reply, and of a failed one too with resultOnFailure.
+    SFTPError call(const std::string& request,
+                   const std::function<bool(SFTPPacketReader&)>& readResult,
+                   const bool resultOnFailure = false);
+
+    const std::string m_socketPath;
+    int m_fd = -1;
+    std::mutex m_mutex;  // One request at a time on the socket
+};
+
+// Thread safe token bucket rate limiter in bytes per second. consume() takes what it needs
+// even when that leaves the bucket in debt and then sleeps the debt off, so chunks larger
+// than the burst size still pass and concurrent callers share the rate fairly.
+class TokenBucket {
+   public:
+    // A rate of 0 means unlimited. The burst defaults to a quarter second at full rate.
+    explicit TokenBucket(const double bytesPerSecond = 0, const double burstBytes = 0);
+
+    void setRate(const double bytesPerSecond, const double burstBytes = 0);
+
+    double rate() const;
+
+    void consume(const uint64_t bytes);
+
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    void refill(const Clock::time_point now);
+
+    mutable std::mutex m_mutex;
+    double m_rate = 0;
+    double m_burst = 0;
+    double m_tokens = 0;
+    Clock::time_point m_lastRefill = Clock::now();
+};
+
+// Queues put()/get() jobs per host and runs them on that host's sessions, highest priority
+// first and in submission order within a priority. Bandwidth is capped by token buckets, one
+// for all hosts and one per host, charged after every acknowledged chunk.
+//
+// When a job arrives while every session of its host is busy with lower priority work, the
+// lowest priority running transfer is preempted: it stops after its current chunk, goes back
+// to the queue and later resumes where it stopped.
+class SFTPTransferScheduler {
+   public:
+    enum class Direction { Put, Get };
+
+    struct Job {
+        std::string host;  // As passed to addHost()
+        Direction direction = Direction::Put;
+        std::string localFileName;
+        std::string remoteFileName;
+        int priority = 0;  // Higher runs first
+    };
+
+    struct Result {
+        SFTPError error;
+        std::chrono::milliseconds queueTime{0};  // Total wait, including after preemptions
+        std::chrono::milliseconds transferTime{0};
+        uint64_t bytes = 0;
+        unsigned int preemptions = 0;
+    };
+
+    struct Metrics {
+        size_t queued = 0;
+        size_t running = 0;
+        uint64_t completed = 0;
+        uint64_t preemptions = 0;
+        std::chrono::milliseconds totalQueueTime{0};
+        std::chrono::milliseconds maxQueueTime{0};
+    };
+
+    // A bandwidth of 0 is unlimited.
+    explicit SFTPTransferScheduler(const double globalBytesPerSecond = 0);
+    ~SFTPTransferScheduler();
+
+    // Opens sessions to host, each served by one worker thread.
+    SFTPError addHost(const std::string& host, const std::string& user, const std::string& pw,
+                      const ConnectOptions& options = ConnectOptions(),
+                      const unsigned int sessions = 2, const double bytesPerSecond = 0,
+                      const uint16_t port = 22, const bool onlyKnownServers = true);
+
+    void setGlobalBandwidth(const double bytesPerSecond);
+
+    void setHostBandwidth(const std::string& host, const double bytesPerSecond);
+
+    std::future<Result> submit(const Job& job);
+
+    Metrics metrics() const;
+
+    // Queued jobs complete as cancelled, running ones stop after their current chunk.
+    void stop();
+
+   private:
+    SFTPTransferScheduler(const SFTPTransferScheduler&) = delete;
+    SFTPTransferScheduler& operator=(const SFTPTransferScheduler&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Job job;
+        uint64_t sequence = 0;
+        std::promise<Result> promise;
+        Clock::time_point enqueuedAt;
+        Result result;
+        std::atomic<bool> preempt{false};
+    };
+
+    struct EntryOrder {
+        bool operator()(const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) const {
+            if (a->job.priority != b->job.priority) {
+                return a->job.priority < b->job.priority;
+            }
+            return a->sequence > b->sequence;
+        }
+    };
+
+    struct Host {
+        std::vector<std::unique_ptr<SFTPClient>> clients;
+        std::vector<std::thread> workers;
+        TokenBucket bucket;
+        std::priority_queue<std::shared_ptr<Entry>, std::vector<std::shared_ptr<Entry>>,
+                            EntryOrder>
+            queue;
+        std::vector<std::shared_ptr<Entry>> running;
+    };
+
+    void preemptFor(Host& host, const int priority);
+
+    void workerLoop(Host& host, const SFTPClient& client);
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_workAvailable;
+    std::map<std::string, std::unique_ptr<Host>> m_hosts;
+    TokenBucket m_globalBucket;
+    std::atomic<bool> m_stopping{false};
+    uint64_t m_nextSequence = 0;
+    Metrics m_metrics;
+};
+
+namespace {
+
+CpuFeatures queryCpuFeatures() {
+    CpuFeatures features;
+
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+#if defined(_MSC_VER)
+    int regs[4] = {};
+    __cpuid(regs, 1);
+    ecx = static_cast<unsigned int>(regs[2]);
+#else
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+#endif
+    features.aes = (ecx & (1u << 25)) != 0;
+    features.clmul = (ecx & (1u << 1)) != 0;
+    features.sse41 = (ecx & (1u << 19)) != 0;
+    features.crc32c = (ecx & (1u << 20)) != 0;
+
+    ebx = 0;
+#if defined(_MSC_VER)
+    __cpuidex(regs, 7, 0);
+    ebx = static_cast<unsigned int>(regs[1]);
+#else
+    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+#endif
+    features.sha256 = (ebx & (1u << 29)) != 0;
+#elif defined(__aarch64__) && defined(__linux__)
+    const auto hwcap = getauxval(AT_HWCAP);
+    features.aes = (hwcap & (1ul << 3)) != 0;    // HWCAP_AES
+    features.clmul = (hwcap & (1ul << 4)) != 0;  // HWCAP_PMULL
+    features.sha256 = (hwcap & (1ul << 6)) != 0;  // HWCAP_SHA2
+    features.crc32c = (hwcap & (1ul << 7)) != 0;  // HWCAP_CRC32
+#elif defined(__aarch64__) && defined(__APPLE__)
+    // Every Apple silicon core implements the ARMv8 crypto extensions.
+    features.aes = features.clmul = features.sha256 = features.crc32c = true;
+#endif
+
+    return features;
+}
+
+CipherPreference orderCiphers(const CpuFeatures& cpu) {
+    CipherPreference preference;
+
+    // With AES and carry-less multiply in hardware AES-GCM is the fastest AEAD by a wide margin.
+    // Without both, chacha20-poly1305 wins: software AES is slow and leaks timing, and GHASH
+    // without carry-less multiply is slower still. AES-128 beats AES-256 by the four rounds it
+    // saves.
+    if (cpu.aes && cpu.clmul) {
+        preference.ciphers =
+            "aes128-gcm@openssh.com,aes256-gcm@openssh.com,chacha20-poly1305@openssh.com,"
+            "aes128-ctr,aes256-ctr,aes192-ctr";
+    } else {
+        preference.ciphers =
+            "chacha20-poly1305@openssh.com,aes128-ctr,aes256-ctr,aes192-ctr,"
+            "aes128-gcm@openssh.com,aes256-gcm@openssh.com";
+    }
+
+    // MACs only matter when the server picks a non-AEAD cipher. SHA-256 instructions make
+    // SHA-256 the fastest; in software SHA-512 processes more bytes per round on 64-bit CPUs.
+    if (cpu.sha256 || sizeof(void*) < 8) {
+        preference.macs =
+            "hmac-sha2-256-etm@openssh.com,hmac-sha2-512-etm@openssh.com,"
+            "hmac-sha2-256,hmac-sha2-512,hmac-sha1-etm@openssh.com,hmac-sha1";
+    } else {
+        preference.macs =
+            "hmac-sha2-512-etm@openssh.com,hmac-sha2-256-etm@openssh.com,"
+            "hmac-sha2-512,hmac-sha2-256,hmac-sha1-etm@openssh.com,hmac-sha1";
+    }
+
+    return preference;
+}
+
+}  // namespace
+
+const CpuFeatures& detectCpuFeatures() {
+    static const CpuFeatures features = queryCpuFeatures();
+    return features;
+}
+
+const CipherPreference& preferredCiphers() {
+    static const CipherPreference preference = orderCiphers(detectCpuFeatures());
+    return preference;
+}
+
+namespace {
+
+bool hasCompressedSignature(const unsigned char* data, size_t size) {
+    struct Signature {
+        const char* bytes;
+        size_t length;
+    };
+
+    static const Signature signatures[] = {
+        {"\x1f\x8b", 2},                  // gzip
+        {"PK\x03\x04", 4},                // zip and the formats built on it
+        {"\x28\xb5\x2f\xfd", 4},          // zstd
+        {"\xfd" "7zXZ\x00", 6},           // xz
+        {"BZh", 3},                       // bzip2
+        {"7z\xbc\xaf\x27\x1c", 6},        // 7-Zip
+        {"\x04\x22\x4d\x18", 4},          // lz4 frame
+        {"\x89PNG", 4},                   // png
+        {"\xff\xd8\xff", 3},              // jpeg
+    };
+
+    for (const auto& signature : signatures) {
+        if (size >= signature.length && std::memcmp(data, signature.bytes, signature.length) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}  // namespace
+
+double estimateCompressionRatio(const char* data, size_t size) {
+    if (size == 0) {
+        return 1.0;
+    }
+
+    const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+    if (hasCompressedSignature(bytes, size)) {
+        return 1.0;
+    }
+
+    // A greedy LZ77 pass over a deflate sized window finds the repetition zlib exploits, and
+    // the order-0 entropy of what is left approximates its Huffman stage.
+    constexpr size_t kMinMatch = 4;
+    constexpr size_t kMaxMatch = 258;
+    constexpr size_t kWindow = 32 * 1024;
+    constexpr unsigned int kHashBits = 14;
+    constexpr uint32_t kEmpty = UINT32_MAX;
+
+    std::vector<uint32_t> lastPosition(size_t(1) << kHashBits, kEmpty);
+    std::array<size_t, 256> literalCounts{};
+    size_t literals = 0;
+    size_t matches = 0;
+    size_t pos = 0;
+
+    while (pos + kMinMatch <= size) {
+        uint32_t word;
+        std::memcpy(&word, bytes + pos, sizeof(word));
+        const uint32_t hash = (word * 2654435761u) >> (32 - kHashBits);
+        const uint32_t candidate = lastPosition[hash];
+        lastPosition[hash] = static_cast<uint32_t>(pos);
+
+        if (candidate != kEmpty && pos - candidate <= kWindow &&
+            std::memcmp(bytes + candidate, bytes + pos, kMinMatch) == 0) {
+            size_t length = kMinMatch;
+            while (pos + length < size && length < kMaxMatch &&
+                   bytes[candidate + length] == bytes[pos + length]) {
+                ++length;
+            }
+            ++matches;
+            pos += length;
+            continue;
+        }
+
+        ++literalCounts[bytes[pos]];
+        ++literals;
+        ++pos;
+    }
+
+    for (; pos < size; ++pos) {
+        ++literalCounts[bytes[pos]];
+        ++literals;
+    }
+
+    double literalBits = 0.0;
+    for (const auto count : literalCounts) {
+        if (count > 0) {
+            const double frequency = static_cast<double>(count);
+            literalBits -= frequency * std::log2(frequency / static_cast<double>(literals));
+        }
+    }
+
+    // A length/distance pair costs deflate roughly three bytes.
+    const double estimatedSize = literalBits / 8.0 + static_cast<double>(matches) * 3.0;
+
+    return std::min(1.0, estimatedSize / static_cast<double>(size));
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define SFTP_CHECKSUM_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define SFTP_CHECKSUM_ARM_CRC 1
+#endif
+
+#if defined(_MSC_VER)
+#define SFTP_CHECKSUM_TARGET(features)
+#else
+#define SFTP_CHECKSUM_TARGET(features) __attribute__((target(features)))
+#endif
+
+namespace {
+
+// CRC32C, the Castagnoli polynomial in its reflected form.
+constexpr uint32_t kCrc32cPolynomial = 0x82F63B78;
+
+struct Crc32cTables {
+    uint32_t table[8][256];
+
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ ((crc & 1) ? kCrc32cPolynomial : 0);
+            }
+            table[0][i] = crc;
+        }
+
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+uint32_t loadLittleEndian32(const uint8_t* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+// Slicing by 8: one table lookup per input byte, but eight independent ones per step.
+uint32_t crc32cPortable(uint32_t crc, const uint8_t* data, size_t size) {
+    static const Crc32cTables tables;
+    const auto& t = tables.table;
+
+    while (size >= 8) {
+        const uint32_t low = crc ^ loadLittleEndian32(data);
+        const uint32_t high = loadLittleEndian32(data + 4);
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^
+              t[4][low >> 24] ^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^
+              t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        data += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0) {
+        crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(SFTP_CHECKSUM_X86)
+SFTP_CHECKSUM_TARGET("sse4.2")
+uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t size) {
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+
+    crc = static_cast<uint32_t>(crc64);
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+
+    return crc;
+}
+#elif defined(SFTP_CHECKSUM_ARM_CRC)
+uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t size) {
+    while (size >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+        data += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0) {
+        crc = __crc32cb(crc, *data++);
+    }
+
+    return crc;
+}
+#endif
+
+const uint32_t kSha256Constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+    0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+    0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+    0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+    0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+    0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+    0xc67178f2};
+
+uint32_t rotateRight(const uint32_t value, const int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+void sha256Portable(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    for (; blocks > 0; --blocks, data += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = uint32_t(data[4 * i]) << 24 | uint32_t(data[4 * i + 1]) << 16 |
+                   uint32_t(data[4 * i + 2]) << 8 | uint32_t(data[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            const uint32_t s0 =
+                rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 =
+                rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int i = 0; i < 64; ++i) {
+            const uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+            const uint32_t choose = (e & f) ^ (~e & g);
+            const uint32_t t1 = h + s1 + choose + kSha256Constants[i] + w[i];
+            const uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+            const uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+            const uint32_t t2 = s0 + majority;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#if defined(SFTP_CHECKSUM_X86)
+// The SHA extensions keep the state as ABEF and CDGH and do two rounds per sha256rnds2. The
+// loop below is unrolled by the compiler; in group i the message schedule for group i + 1 is
+// finished with sha256msg2 and the one for group i + 3 started with sha256msg1.
+SFTP_CHECKSUM_TARGET("sha,sse4.1")
+void sha256Hardware(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);            // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);      // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);   // CDGH
+
+    for (; blocks > 0; --blocks, data += 64) {
+        const __m128i savedState0 = state0;
+        const __m128i savedState1 = state1;
+        __m128i message[4];
+
+        for (int i = 0; i < 16; ++i) {
+            if (i < 4) {
+                message[i] = _mm_shuffle_epi8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)), byteSwap);
+            }
+
+            __m128i rounds = _mm_add_epi32(
+                message[i & 3],
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(&kSha256Constants[4 * i])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, rounds);
+
+            if (i >= 3 && i <= 14) {
+                tmp = _mm_alignr_epi8(message[i & 3], message[(i - 1) & 3], 4);
+                message[(i + 1) & 3] = _mm_add_epi32(message[(i + 1) & 3], tmp);
+                message[(i + 1) & 3] = _mm_sha256msg2_epu32(message[(i + 1) & 3], message[i & 3]);
+            }
+
+            rounds = _mm_shuffle_epi32(rounds, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, rounds);
+
+            if (i >= 1 && i <= 12) {
+                message[(i - 1) & 3] = _mm_sha256msg1_epu32(message[(i - 1) & 3], message[i & 3]);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, savedState0);
+        state1 = _mm_add_epi32(state1, savedState1);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);        // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);     // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);  // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);     // HGFE
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+#endif
+
+SFTPError channelError(ssh_session session, const std::string& what) {
+    return SFTPError(ssh_get_error_code(session), SSH_FX_FAILURE,
+                     what + " " + ssh_get_error(session));
+}
+
+SFTPError unsupported(const std::string& what) {
+    return SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED, what);
+}
+
+bool offersCheckFile(sftp_session sftp, const std::string& algorithm) {
+    const unsigned int count = sftp_extensions_get_count(sftp);
+    for (unsigned int i = 0; i < count; ++i) {
+        const char* name = sftp_extensions_get_name(sftp, i);
+        const char* data = sftp_extensions_get_data(sftp, i);
+        if (name && data && std::string(name) == "check-file" &&
+            ("," + std::string(data) + ",").find("," + algorithm + ",") != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::pair<SFTPError, std::string> checkFile(ssh_session session,
+                                            const std::string& remoteFileName) {
+    SFTPSideChannel channel(session);
+    auto err = channel.open();
+    if (!err.isOk()) {
+        return {err, ""};
+    }
+
+    const auto request = SFTPPacketWriter(SSH_FXP_EXTENDED, channel.nextId())
+                             .putString("check-file-name")
+                             .putString(remoteFileName)
+                             .putString("sha256")
+                             .putUint64(0)  // From the start
+                             .putUint64(0)  // To the end
+                             .putUint32(0)  // One hash for the whole range
+                             .finish();
+
+    uint8_t type = 0;
+    std::string body;
+    err = channel.request(request, type, body);
+    if (!err.isOk()) {
+        return {err, ""};
+    }
+
+    SFTPPacketReader reader(body.data(), body.size());
+    if (type == SSH_FXP_STATUS) {
+        return {SFTPSideChannel::statusError(type, reader), ""};
+    }
+
+    std::string extension, algorithm;
+    if (type != SSH_FXP_EXTENDED_REPLY || !reader.getString(extension) ||
+        !reader.getString(algorithm) || algorithm != "sha256") {
+        return {unsupported("Unexpected check-file reply"), ""};
+    }
+
+    static const char kHexDigits[] = "0123456789abcdef";
+    std::string digest;
+    uint8_t byte = 0;
+    while (reader.getUint8(byte)) {
+        digest += kHexDigits[byte >> 4];
+        digest += kHexDigits[byte & 0xF];
+    }
+
+    if (digest.size() != 64) {
+        return {unsupported("Unexpected check-file hash length"), ""};
+    }
+
+    return {SFTPError(), digest};
+}
+
+std::pair<SFTPError, std::string> hashCommand(ssh_session session,
+                                              const std::string& remoteFileName) {
+    SSHChannelPtr channel(ssh_channel_new(session));
+    if (!channel || ssh_channel_open_session(channel.get()) != SSH_OK) {
+        return {channelError(session, "Failed to open a channel for sha256sum"), ""};
+    }
+
+    const auto path = shellQuote(remoteFileName);
+    const auto command =
+        "sha256sum -- " + path + " 2>/dev/null || shasum -a 256 -- " + path + " 2>/dev/null";
+    if (ssh_channel_request_exec(channel.get(), command.c_str()) != SSH_OK) {
+        return {unsupported("The server does not run commands"), ""};
+    }
+
+    std::string output;
+    char buffer[512];
+    int bytesRead = 0;
+    while (output.size() < 4096 &&
+           (bytesRead = ssh_channel_read(channel.get(), buffer, sizeof(buffer), 0)) > 0) {
+        output.append(buffer, static_cast<size_t>(bytesRead));
+    }
+
+    if (bytesRead < 0) {
+        return {channelError(session, "Failed to read the sha256sum output"), ""};
+    }
+
+    // sha256sum escapes names with a backslash or newline and marks the line with a leading '\'.
+    const size_t start = !output.empty() && output[0] == '\\' ? 1 : 0;
+    if (output.size() < start + 64 ||
+        output.find_first_not_of("0123456789abcdef", start) != start + 64) {
+        return {unsupported("Neither sha256sum nor shasum is available on the server"), ""};
+    }
+
+    return {SFTPError(), output.substr(start, 64)};
+}
+
+}  // namespace
+
+Checksum::Checksum(const ChecksumAlgorithm algorithm)
+    : m_algorithm(algorithm),
+      m_state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab,
+              0x5be0cd19},
+      m_block() {}
+
+void Checksum::update(const char* data, const size_t size) {
+    if (m_finished || size == 0) {
+        return;
+    }
+
+    const auto* bytes = reinterpret_cast<const uint8_t*>(data);
+
+    if (m_algorithm == ChecksumAlgorithm::Crc32c) {
+#if defined(SFTP_CHECKSUM_X86) || defined(SFTP_CHECKSUM_ARM_CRC)
+        static const bool hardware = detectCpuFeatures().crc32c;
+        m_crc = hardware ? crc32cHardware(m_crc, bytes, size) : crc32cPortable(m_crc, bytes, size);
+#else
+        m_crc = crc32cPortable(m_crc, bytes, size);
+#endif
+        return;
+    }
+
+    if (m_algorithm != ChecksumAlgorithm::Sha256) {
+        return;
+    }
+
+    size_t remaining = size;
+    m_length += size;
+
+    if (m_blockSize > 0) {
+        const size_t count = std::min(remaining, sizeof(m_block) - m_blockSize);
+        std::memcpy(m_block + m_blockSize, bytes, count);
+        m_blockSize += count;
+        bytes += count;
+        remaining -= count;
+
+        if (m_blockSize < sizeof(m_block)) {
+            return;
+        }
+        compressBlocks(m_block, 1);
+        m_blockSize = 0;
+    }
+
+    // Whole blocks are hashed straight from the caller's buffer.
+    const size_t blocks = remaining / 64;
+    compressBlocks(bytes, blocks);
+    bytes += blocks * 64;
+    remaining -= blocks * 64;
+
+    std::memcpy(m_block, bytes, remaining);
+    m_blockSize = remaining;
+}
+
+std::string Checksum::hexDigest() {
+    static const char kHexDigits[] = "0123456789abcdef";
+    std::string digest;
+
+    if (m_algorithm == ChecksumAlgorithm::Crc32c) {
+        m_finished = true;
+        const uint32_t crc = ~m_crc;
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            digest += kHexDigits[(crc >> shift) & 0xF];
+        }
+        return digest;
+    }
+
+    if (m_algorithm != ChecksumAlgorithm::Sha256) {
+        return digest;
+    }
+
+    if (!m_finished) {
+        const uint64_t bits = m_length * 8;
+        const uint8_t padding = 0x80;
+        update(reinterpret_cast<const char*>(&padding), 1);
+
+        const uint8_t zero = 0;
+        while (m_blockSize != 56) {
+            update(reinterpret_cast<const char*>(&zero), 1);
+        }
+
+        uint8_t length[8];
+        for (int i = 0; i < 8; ++i) {
+            length[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        }
+        update(reinterpret_cast<const char*>(length), sizeof(length));
+        m_finished = true;
+    }
+
+    for (const uint32_t word : m_state) {
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            digest += kHexDigits[(word >> shift) & 0xF];
+        }
+    }
+    return digest;
+}
+
+void Checksum::compressBlocks(const uint8_t* data, const size_t blocks) {
+    if (blocks == 0) {
+        return;
+    }
+
+#if defined(SFTP_CHECKSUM_X86)
+    static const bool hardware = detectCpuFeatures().sha256 && detectCpuFeatures().sse41;
+    if (hardware) {
+        sha256Hardware(m_state, data, blocks);
+        return;
+    }
+#endif
+    sha256Portable(m_state, data, blocks);
+}
+
+std::pair<SFTPError, std::string> remoteChecksum(ssh_session session, sftp_session sftp,
+                                                 const std::string& remoteFileName,
+                                                 const ChecksumAlgorithm algorithm) {
+    if (algorithm != ChecksumAlgorithm::Sha256) {
+        return {unsupported("The server can only compute SHA-256"), ""};
+    }
+
+    if (offersCheckFile(sftp, "sha256")) {
+        const auto result = checkFile(session, remoteFileName);
+        if (result.first.getSFTPErrorCode() != SSH_FX_OP_UNSUPPORTED) {
+            return result;
+        }
+    }
+
+    return hashCommand(session, remoteFileName);
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SFTP_SPARSE_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SFTP_SPARSE_NEON 1
+#endif
+
+bool isAllZero(const char* data, const size_t size) {
+    size_t i = 0;
+
+#if defined(SFTP_SPARSE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= size; i += 64) {
+        const auto* block = reinterpret_cast<const __m128i*>(data + i);
+        const __m128i any = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128(block), _mm_loadu_si128(block + 1)),
+            _mm_or_si128(_mm_loadu_si128(block + 2), _mm_loadu_si128(block + 3)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF) {
+            return false;
+        }
+    }
+#elif defined(SFTP_SPARSE_NEON)
+    for (; i + 64 <= size; i += 64) {
+        const auto* block = reinterpret_cast<const uint8_t*>(data + i);
+        const uint8x16_t any = vorrq_u8(vorrq_u8(vld1q_u8(block), vld1q_u8(block + 16)),
+                                        vorrq_u8(vld1q_u8(block + 32), vld1q_u8(block + 48)));
+        if (vmaxvq_u8(any) != 0) {
+            return false;
+        }
+    }
+#endif
+
+    for (; i < size; ++i) {
+        if (data[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SparseFileMap::SparseFileMap(const std::string& fileName) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    m_fd = ::open(fileName.c_str(), O_RDONLY);
+    struct stat status;
+    if (m_fd >= 0 && fstat(m_fd, &status) == 0) {
+        m_size = static_cast<uint64_t>(status.st_size);
+    }
+#else
+    (void)fileName;
+#endif
+}
+
+SparseFileMap::~SparseFileMap() {
+#ifndef _WIN32
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+#endif
+}
+
+bool SparseFileMap::nextData(const uint64_t offset, uint64_t& start, uint64_t& end) const {
+    start = offset;
+    end = std::numeric_limits<uint64_t>::max();
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    if (m_fd < 0) {
+        return true;
+    }
+
+    const off_t data = lseek(m_fd, static_cast<off_t>(offset), SEEK_DATA);
+    if (data < 0) {
+        // ENXIO: nothing but a hole up to the end of the file. Anything else means the file
+        // system cannot tell, and everything counts as data.
+        return errno != ENXIO;
+    }
+
+    const off_t hole = lseek(m_fd, data, SEEK_HOLE);
+    start = static_cast<uint64_t>(data);
+    if (hole > data) {
+        end = static_cast<uint64_t>(hole);
+    }
+#endif
+
+    return true;
+}
+
+bool punchHole(const std::string& fileName, const uint64_t offset, const uint64_t length) {
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    const int fd = ::open(fileName.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    const bool punched = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                   static_cast<off_t>(offset), static_cast<off_t>(length)) == 0;
+    ::close(fd);
+    return punched;
+#else
+    (void)fileName;
+    (void)offset;
+    (void)length;
+    return false;
+#endif
+}
+
+namespace {
+
+char* allocateAligned(const size_t size) {
+#ifdef _WIN32
+    return static_cast<char*>(_aligned_malloc(size, SFTPBufferPool::kAlignment));
+#else
+    void* memory = nullptr;
+    if (posix_memalign(&memory, SFTPBufferPool::kAlignment, size) != 0) {
+        return nullptr;
+    }
+    return static_cast<char*>(memory);
+#endif
+}
+
+void freeAligned(char* buffer) {
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    std::free(buffer);
+#endif
+}
+
+}  // namespace
+
+SFTPBufferPool& SFTPBufferPool::shared() {
+    static SFTPBufferPool pool;
+    return pool;
+}
+
+SFTPBufferPool::~SFTPBufferPool() {
+    for (auto& sizeClass : m_free) {
+        for (char* buffer : sizeClass.second) {
+            freeAligned(buffer);
+        }
+    }
+}
+
+char* SFTPBufferPool::acquire(const size_t size) {
+    const auto rounded = sizeClass(size);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& buffers = m_free[rounded];
+        if (!buffers.empty()) {
+            char* buffer = buffers.back();
+            buffers.pop_back();
+            return buffer;
+        }
+    }
+
+    return allocateAligned(rounded);
+}
+
+void SFTPBufferPool::release(char* buffer, const size_t size) {
+    if (!buffer) {
+        return;
+    }
+
+    const auto rounded = sizeClass(size);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& buffers = m_free[rounded];
+        if ((buffers.size() + 1) * rounded <= kMaxKeptBytes) {
+            buffers.push_back(buffer);
+            return;
+        }
+    }
+
+    freeAligned(buffer);
+}
+
+size_t SFTPBufferPool::sizeClass(const size_t size) {
+    size_t rounded = kAlignment;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+SFTPFileReader::SFTPFileReader(std::ifstream&& file, const std::string& fileName,
+                               const uint64_t offset, const size_t chunkSize,
+                               const size_t maxChunkSize, const bool sparse, Checksum& checksum)
+    : m_file(std::move(file)),
+      m_fileName(fileName),
+      m_offset(offset),
+      m_maxChunkSize(std::max<size_t>(maxChunkSize, 1)),
+      m_sparse(sparse),
+      m_checksum(checksum),
+      m_chunkSize(std::max<size_t>(std::min(chunkSize, m_maxChunkSize), 1)) {
+    if (!m_ring.allocate(m_maxChunkSize)) {
+        m_error = SFTPError(SSH_OK, SSH_FX_FAILURE, "Out of memory for read buffers");
+        m_ring.finish();
+        return;
+    }
+
+    m_thread = std::thread(&SFTPFileReader::run, this);
+}
+
+SFTPFileReader::SFTPFileReader(const char* data, const uint64_t size, const uint64_t offset,
+                               const size_t chunkSize, const size_t maxChunkSize, const bool sparse,
+                               Checksum& checksum)
+    : m_inMemory(true),
+      m_memory(data),
+      m_memorySize(size),
+      m_memoryOffset(std::min(offset, size)),
+      m_offset(offset),
+      m_maxChunkSize(std::max<size_t>(maxChunkSize, 1)),
+      m_sparse(sparse),
+      m_checksum(checksum),
+      m_chunkSize(std::max<size_t>(std::min(chunkSize, m_maxChunkSize), 1)) {}
+
+SFTPFileReader::~SFTPFileReader() {
+    m_ring.stop();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void SFTPFileReader::setChunkSize(const size_t chunkSize) {
+    m_chunkSize = std::max<size_t>(std::min(chunkSize, m_maxChunkSize), 1);
+}
+
+const SFTPFileReader::Chunk* SFTPFileReader::next() {
+    if (m_inMemory) {
+        if (m_memoryOffset >= m_memorySize) {
+            m_end = m_memorySize;
+            return nullptr;
+        }
+
+        auto& chunk = m_memoryChunk;
+        chunk.data = m_memory + m_memoryOffset;
+        chunk.offset = m_memoryOffset;
+        chunk.length =
+            size_t(std::min<uint64_t>(m_chunkSize.load(), m_memorySize - m_memoryOffset));
+        chunk.zeros = m_sparse && isAllZero(chunk.data, chunk.length);
+        m_checksum.update(chunk.data, chunk.length);
+        m_memoryOffset += chunk.length;
+        return &chunk;
+    }
+
+    return m_ring.next();
+}
+
+void SFTPFileReader::run() {
+    std::unique_ptr<SparseFileMap> sparseMap;
+    if (m_sparse) {
+        sparseMap.reset(new SparseFileMap(m_fileName));
+    }
+
+    // Holes are hashed as the zeros they read as.
+    static const char kZeros[64 * 1024] = {};
+
+    uint64_t offset = m_offset;
+    uint64_t segmentEnd = m_sparse ? offset : std::numeric_limits<uint64_t>::max();
+    size_t slot = 0;
+
+    while (true) {
+        if (offset >= segmentEnd) {
+            uint64_t dataStart = 0;
+            const bool last = !sparseMap->nextData(offset, dataStart, segmentEnd);
+            if (last) {
+                dataStart = std::max(offset, sparseMap->size());
+            }
+
+            for (uint64_t at = offset; at < dataStart; at += sizeof(kZeros)) {
+                m_checksum.update(kZeros,
+                                  size_t(std::min<uint64_t>(sizeof(kZeros), dataStart - at)));
+            }
+            offset = dataStart;
+
+            if (last) {
+                break;
+            }
+
+            m_file.seekg(static_cast<std::streamoff>(offset));
+            if (!m_file) {
+                m_error = SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                    "Failed to read from local file [" + m_fileName + "]");
+                break;
+            }
+        }
+
+        if (!m_ring.takeFreeSlot(slot)) {
+            break;
+        }
+
+        auto& chunk = m_ring.chunk(slot);
+        const auto length = std::min<uint64_t>(m_chunkSize.load(), segmentEnd - offset);
+        m_file.read(m_ring.buffer(slot), static_cast<std::streamsize>(length));
+        const auto bytesRead = static_cast<size_t>(m_file.gcount());
+        const bool endOfFile = !m_file;
+
+        if (m_file.bad()) {
+            m_error = SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                "Failed to read from local file [" + m_fileName + "]");
+            break;
+        }
+
+        if (bytesRead == 0) {
+            break;
+        }
+
+        m_checksum.update(chunk.data, bytesRead);
+        chunk.offset = offset;
+        chunk.length = bytesRead;
+        chunk.zeros = m_sparse && isAllZero(chunk.data, bytesRead);
+        offset += bytesRead;
+        m_ring.publish(slot);
+
+        if (endOfFile) {
+            break;
+        }
+    }
+
+    m_end = offset;
+    m_ring.finish();
+}
+
+SFTPFileWriter::SFTPFileWriter(std::ofstream&& file, const std::string& fileName,
+                               const uint64_t offset, const size_t bufferSize, const bool sparse,
+                               const uint64_t localSize, Checksum& checksum,
+                               const uint64_t hashedOffset)
+    : m_file(std::move(file)),
+      m_fileName(fileName),
+      m_sparse(sparse),
+      m_localSize(localSize),
+      m_checksum(checksum),
+      m_writeOffset(offset),
+      m_hashedOffset(hashedOffset),
+      m_highestWritten(offset),
+      m_chunks(kDepth) {
+    for (size_t slot = 0; slot < kDepth; ++slot) {
+        m_buffers.emplace_back(SFTPBufferPool::shared(), std::max<size_t>(bufferSize, 1));
+        if (!m_buffers.back().data()) {
+            m_error = SFTPError(SSH_OK, SSH_FX_FAILURE, "Out of memory for write buffers");
+            m_failed = true;
+            return;
+        }
+        m_free.tryPush(slot);
+    }
+
+    m_thread = std::thread(&SFTPFileWriter::run, this);
+}
+
+SFTPFileWriter::~SFTPFileWriter() { finish(); }
+
+char* SFTPFileWriter::buffer() {
+    if (m_current == kNoSlot &&
+        !m_free.pop(m_current, [this]() { return m_failed.load(std::memory_order_acquire); })) {
+        return nullptr;
+    }
+    return m_buffers[m_current].data();
+}
+
+void SFTPFileWriter::submit(const uint64_t offset, const size_t length) {
+    if (m_current == kNoSlot) {
+        return;
+    }
+
+    m_chunks[m_current].offset = offset;
+    m_chunks[m_current].length = length;
+    m_filled.push(m_current);  // Never full, there are only kDepth slots
+    m_current = kNoSlot;
+}
+
+SFTPError SFTPFileWriter::finish() {
+    m_closing.store(true, std::memory_order_release);
+    m_filled.wake();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    return m_error;
+}
+
+void SFTPFileWriter::run() {
+    // Chunks submitted before finish() was called are still written.
+    size_t slot = 0;
+    while (m_filled.pop(slot, [this]() { return m_closing.load(std::memory_order_acquire); })) {
+        write(m_buffers[slot].data(), m_chunks[slot]);
+        m_free.push(slot);
+    }
+
+    if (!m_error.isOk()) {
+        return;
+    }
+
+    // A file that ends in skipped zeros gets its size from a single zero byte at the end.
+    if (m_zerosEnd > 0 && m_zerosEnd == m_highestWritten) {
+        m_file.seekp(static_cast<std::streamoff>(m_zerosEnd - 1));
+        m_file.put(0);
+    }
+
+    m_file.flush();
+    if (!m_file) {
+        fail("Failed to write to local file [" + m_fileName + "]");
+    }
+}
+
+void SFTPFileWriter::write(const char* data, const Chunk& chunk) {
+    if (!m_error.isOk()) {
+        return;  // Buffers keep cycling so the network side never waits on a failed writer
+    }
+
+    const auto end = chunk.offset + chunk.length;
+
+    if (m_sparse && isAllZero(data, chunk.length) &&
+        (chunk.offset >= m_localSize ||
+         punchHole(m_fileName, chunk.offset, chunk.length))) {
+        m_zerosEnd = std::max(m_zerosEnd, end);
+    } else {
+        if (chunk.offset != m_writeOffset) {
+            m_file.seekp(static_cast<std::streamoff>(chunk.offset));
+        }
+
+        m_file.write(data, static_cast<std::streamsize>(chunk.length));
+        if (!m_file) {
+            fail("Failed to write to local file [" + m_fileName + "]");
+            return;
+        }
+        m_writeOffset = end;
+    }
+    m_highestWritten = std::max(m_highestWritten, end);
+
+    if (chunk.offset == m_hashedOffset) {
+        m_checksum.update(data, chunk.length);
+        m_hashedOffset = end;
+    }
+}
+
+void SFTPFileWriter::fail(const std::string& what) {
+    m_error = SFTPError(SSH_OK, SSH_FX_FAILURE, what);
+    m_failed.store(true, std::memory_order_release);
+    m_free.wake();
+}
+
+bool beginTailRead(sftp_file file, const uint64_t offset, const size_t length,
+                   const uint64_t nextOffset, sftp_aio* aio) {
+    sftp_aio tail = nullptr;
+    if (sftp_seek64(file, offset) < 0 || sftp_aio_begin_read(file, length, &tail) < 0) {
+        return false;
+    }
+    if (sftp_seek64(file, nextOffset) < 0) {
+        sftp_aio_free(tail);
+        return false;
+    }
+    *aio = tail;
+    return true;
+}
+
+SFTPRemoteReader::SFTPRemoteReader(ssh_session sshSession, sftp_session sftpSession, sftp_file file,
+                                   const std::string& fileName, const size_t chunkSize,
+                                   const size_t maxInFlight)
+    : m_sshSession(sshSession),
+      m_sftpSession(sftpSession),
+      m_file(file),
+      m_fileName(fileName),
+      m_chunkSize(std::max<size_t>(chunkSize, 1)),
+      m_maxInFlight(std::max<size_t>(maxInFlight, 1)) {
+    if (!m_ring.allocate(m_chunkSize)) {
+        m_error = SFTPError(SSH_OK, SSH_FX_FAILURE, "Out of memory for read buffers");
+        m_ring.finish();
+        return;
+    }
+
+    m_thread = std::thread(&SFTPRemoteReader::run, this);
+}
+
+SFTPRemoteReader::~SFTPRemoteReader() {
+    m_ring.stop();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+const SFTPRemoteReader::Chunk* SFTPRemoteReader::next() {
+    return m_ring.next();
+}
+
+void SFTPRemoteReader::run() {
+    struct PendingRead {
+        sftp_aio aio;
+        uint64_t offset;
+        size_t length;
+    };
+
+    std::deque<PendingRead> reads;
+    uint64_t nextOffset = 0;
+    bool endOfFile = false;
+    size_t slot = kNoSlot;  // Kept for the next read when a read returns nothing
+
+    while (!m_ring.stopped()) {
+        while (!endOfFile && reads.size() < m_maxInFlight) {
+            sftp_aio aio = nullptr;
+            if (sftp_aio_begin_read(m_file, m_chunkSize, &aio) < 0) {
+                fail();
+                break;
+            }
+            reads.push_back({aio, nextOffset, m_chunkSize});
+            nextOffset += m_chunkSize;
+        }
+
+        if (!m_error.isOk() || reads.empty() ||
+            (slot == kNoSlot && !m_ring.takeFreeSlot(slot))) {
+            break;
+        }
+
+        PendingRead request = reads.front();
+        reads.pop_front();
+
+        auto& chunk = m_ring.chunk(slot);
+        const auto bytesRead =
+            sftp_aio_wait_read(&request.aio, m_ring.buffer(slot), m_chunkSize);
+        if (bytesRead <= 0) {
+            if (bytesRead < 0) {
+                fail();
+                break;
+            }
+            endOfFile = true;
+            continue;
+        }
+
+        chunk.offset = request.offset;
+        chunk.length = static_cast<size_t>(bytesRead);
+        m_ring.publish(slot);
+        slot = kNoSlot;
+
+        if (chunk.length < request.length) {
+            const auto tail = request.offset + chunk.length;
+            const auto remaining = request.length - chunk.length;
+            sftp_aio aio = nullptr;
+            if (!beginTailRead(m_file, tail, remaining, nextOffset, &aio)) {
+                fail();
+                break;
+            }
+            reads.push_back({aio, tail, remaining});
+        }
+    }
+
+    for (auto& request : reads) {
+        sftp_aio_free(request.aio);
+    }
+
+    m_ring.finish();
+}
+
+void SFTPRemoteReader::fail() {
+    m_error = SFTPError(ssh_get_error_code(m_sshSession), sftp_get_error(m_sftpSession),
+                        "Failed to read from remote file [" + m_fileName + "] " +
+                                 ssh_get_error(m_sshSession));
+}
+
+SFTPError applySessionOptions(ssh_session session, const ConnectOptions& options,
+                                       const bool compress) {
+    if (options.tcpNoDelay) {
+        const int noDelay = 1;
+        ssh_options_set(session, SSH_OPTIONS_NODELAY, &noDelay);
+    }
+
+    if (options.rekeyDataLimit > 0) {
+        ssh_options_set(session, SSH_OPTIONS_REKEY_DATA, &options.rekeyDataLimit);
+    }
+
+    if (options.rekeyTimeLimit > 0) {
+        ssh_options_set(session, SSH_OPTIONS_REKEY_TIME, &options.rekeyTimeLimit);
+    }
+
+    if (options.operationTimeout > 0) {
+        ssh_options_set(session, SSH_OPTIONS_TIMEOUT, &options.operationTimeout);
+    }
+
+    if (compress) {
+        ssh_options_set(session, SSH_OPTIONS_COMPRESSION, "yes");
+        if (options.compressionLevel > 0) {
+            ssh_options_set(session, SSH_OPTIONS_COMPRESSION_LEVEL, &options.compressionLevel);
+        }
+    }
+
+    std::string ciphers = options.ciphers;
+    std::string macs = options.macs;
+
+    if (options.autoSelectCiphers) {
+        const auto& preference = preferredCiphers();
+        if (ciphers.empty()) {
+            ciphers = preference.ciphers;
+        }
+        if (macs.empty()) {
+            macs = preference.macs;
+        }
+    }
+
+    // libssh drops names it does not support and only fails if none are left.
+    if (!ciphers.empty() &&
+        (ssh_options_set(session, SSH_OPTIONS_CIPHERS_C_S, ciphers.c_str()) < 0 ||
+         ssh_options_set(session, SSH_OPTIONS_CIPHERS_S_C, ciphers.c_str()) < 0)) {
+        return SFTPError(SSH_ERROR, SSH_FX_OK, ssh_get_error(session));
+    }
+
+    if (!macs.empty() &&
+        (ssh_options_set(session, SSH_OPTIONS_HMAC_C_S, macs.c_str()) < 0 ||
+         ssh_options_set(session, SSH_OPTIONS_HMAC_S_C, macs.c_str()) < 0)) {
+        return SFTPError(SSH_ERROR, SSH_FX_OK, ssh_get_error(session));
+    }
+
+    return SFTPError();
+}
+
+void applySocketOptions(ssh_session session, const ConnectOptions& options) {
+    const auto fd = ssh_get_fd(session);
+
+    // Larger buffers let TCP keep a full bandwidth-delay product in flight, where the kernel
+    // does not size them better itself.
+    if (options.socketSendBufferSize > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+                   reinterpret_cast<const char*>(&options.socketSendBufferSize),
+                   sizeof(options.socketSendBufferSize));
+    }
+
+    if (options.socketReceiveBufferSize > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+                   reinterpret_cast<const char*>(&options.socketReceiveBufferSize),
+                   sizeof(options.socketReceiveBufferSize));
+    }
+
+    if (options.keepAliveIdle > 0) {
+        const int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, reinterpret_cast<const char*>(&enable),
+                   sizeof(enable));
+#if defined(TCP_KEEPIDLE)
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE,
+                   reinterpret_cast<const char*>(&options.keepAliveIdle),
+                   sizeof(options.keepAliveIdle));
+#elif defined(TCP_KEEPALIVE)  // macOS
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPALIVE,
+                   reinterpret_cast<const char*>(&options.keepAliveIdle),
+                   sizeof(options.keepAliveIdle));
+#endif
+#if defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL,
+                   reinterpret_cast<const char*>(&options.keepAliveInterval),
+                   sizeof(options.keepAliveInterval));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT,
+                   reinterpret_cast<const char*>(&options.keepAliveCount),
+                   sizeof(options.keepAliveCount));
+#endif
+    }
+}
+
+namespace {
+
+std::mutex& tunerCacheMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::map<std::string, SFTPAutoTuner::Tuning>& tunerCache() {
+    static std::map<std::string, SFTPAutoTuner::Tuning> tunings;
+    return tunings;
+}
+
+}  // namespace
+
+SFTPAutoTuner::SFTPAutoTuner(const std::string& host, const unsigned int initialChunkSize,
+                             const unsigned int initialInFlight, const unsigned int maxChunkSize)
+    : m_host(host), m_maxChunkSize(std::max(maxChunkSize, 1u)) {
+    const auto known = cached(host);
+    if (known.chunkSize > 0) {
+        // The link was measured before, start from there and only follow changes.
+        m_probing = false;
+        m_minRtt = known.rtt;
+        setWindow(uint64_t(known.chunkSize) * known.maxInFlight);
+    } else {
+        setWindow(uint64_t(std::max(initialChunkSize, 1u)) * std::max(initialInFlight, 1u));
+    }
+
+    m_roundStart = Clock::now();
+    m_roundTarget = m_window;
+}
+
+SFTPAutoTuner::~SFTPAutoTuner() {
+    if (m_roundRates.empty()) {
+        return;  // Too short to learn anything
+    }
+
+    Tuning tuning;
+    tuning.chunkSize = m_chunkSize;
+    tuning.maxInFlight = m_maxInFlight;
+    tuning.rtt = m_minRtt;
+    tuning.bytesPerSecond = *std::max_element(m_roundRates.begin(), m_roundRates.end());
+
+    std::lock_guard<std::mutex> lock(tunerCacheMutex());
+    tunerCache()[m_host] = tuning;
+}
+
+void SFTPAutoTuner::onCompleted(const size_t length, const std::chrono::microseconds rtt) {
+    if (rtt.count() > 0 && (m_minRtt.count() == 0 || rtt < m_minRtt)) {
+        m_minRtt = rtt;
+    }
+
+    m_roundBytes += length;
+    if (m_roundBytes >= m_roundTarget) {
+        endRound(Clock::now());
+    }
+}
+
+SFTPAutoTuner::Tuning SFTPAutoTuner::cached(const std::string& host) {
+    std::lock_guard<std::mutex> lock(tunerCacheMutex());
+    const auto it = tunerCache().find(host);
+    return it != tunerCache().end() ? it->second : Tuning();
+}
+
+void SFTPAutoTuner::endRound(const Clock::time_point now) {
+    const auto elapsed = std::chrono::duration<double>(now - m_roundStart).count();
+    if (elapsed <= 0) {
+        return;
+    }
+
+    const double rate = static_cast<double>(m_roundBytes) / elapsed;
+    m_roundRates.push_back(rate);
+    if (m_roundRates.size() > kRateRounds) {
+        m_roundRates.pop_front();
+    }
+
+    if (m_probing) {
+        if (rate >= m_bestProbeRate * 1.25) {
+            m_plateauRounds = 0;
+            m_bestProbeRate = rate;
+            setWindow(m_window * 2);
+        } else if (++m_plateauRounds >= kStartupPlateauRounds) {
+            m_probing = false;
+        }
+    }
+
+    if (!m_probing) {
+        const double bestRate = *std::max_element(m_roundRates.begin(), m_roundRates.end());
+        const double rtt = std::chrono::duration<double>(m_minRtt).count();
+        setWindow(static_cast<uint64_t>(2 * bestRate * rtt));
+    }
+
+    m_roundStart = now;
+    m_roundBytes = 0;
+    m_roundTarget = m_window;
+}
+
+void SFTPAutoTuner::setWindow(const uint64_t window) {
+    m_window = std::min(std::max(window, uint64_t(kMinChunkSize) * kMinInFlight),
+                        uint64_t(kMaxWindow));
+
+    // Large requests cost the server fewer round trips per byte, but the window has to be
+    // split into enough of them to keep the pipe full while each one is answered.
+    const auto chunk = std::max<uint64_t>(m_window / kMinInFlight, kMinChunkSize);
+    m_chunkSize = static_cast<unsigned int>(std::min<uint64_t>(chunk, m_maxChunkSize));
+
+    const auto inFlight = (m_window + m_chunkSize - 1) / m_chunkSize;
+    m_maxInFlight = static_cast<unsigned int>(
+        std::min<uint64_t>(std::max<uint64_t>(inFlight, kMinInFlight), kMaxInFlight));
+}
+
+SFTPClient::~SFTPClient() { disconnect(); }
+
+SFTPError SFTPClient::connect(const std::string& host, const std::string& user,
+                              const std::string& pw, const uint16_t port,
+                              const bool onlyKnownServers) {
+    return connect(host, user, pw, ConnectOptions(), port, onlyKnownServers);
+}
+
+SFTPError SFTPClient::connect(const std::string& host, const std::string& user,
+                              const std::string& pw, const ConnectOptions& options,
+                              const uint16_t port, const bool onlyKnownServers) {
+    disconnect();
+    m_options = options;
+    m_host = host;
+    m_user = user;
+    m_port = port;
+    m_onlyKnownServers = onlyKnownServers;
+
+    if (options.retry.maxAttempts > 1) {
+        m_password = pw;
+    }
+
+    const auto err = openSessions(pw);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    readServerLimits();
+
+    return SFTPError();
+}
+
+SFTPError SFTPClient::connectThroughBroker(const std::string& socketPath, const std::string& host,
+                                           const std::string& user, const std::string& pw,
+                                           const uint16_t port, const bool onlyKnownServers) {
+    disconnect();
+
+    std::shared_ptr<SFTPBrokerConnection> broker(new SFTPBrokerConnection(socketPath));
+    const auto err = broker->open(host, user, pw, port, onlyKnownServers);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    m_host = host;
+    m_user = user;
+    m_port = port;
+    m_onlyKnownServers = onlyKnownServers;
+    m_broker = std::move(broker);
+
+    return SFTPError();
+}
+
+void SFTPClient::disconnect() {
+    m_broker.reset();
+    m_compressedSftpSession.reset();
+    m_compressedSshSession.reset();
+    m_sftpSession.reset();
+    m_sshSession.reset();
+    m_password.clear();
+}
+
+template <typename Operation>
+auto SFTPClient::withRetry(const bool idempotent, Operation operation) const
+    -> decltype(operation()) {
+    auto result = operation();
+    RetryState retry(m_options.retry);
+    // Operations that are not idempotent reconnect but do not run again.
+    while (reconnectAfter(errorOf(result), retry) && idempotent) {
+        result = operation();
+    }
+    return result;
+}
+
+bool SFTPClient::reconnectAfter(const SFTPError& err, RetryState& retry) const {
+    if (err.isOk() || !connectionLost(err)) {
+        return false;
+    }
+
+    while (retry.attempt < m_options.retry.maxAttempts) {
+        ++retry.attempt;
+        std::this_thread::sleep_for(retry.backoff);
+        retry.backoff = std::min(m_options.retry.maxBackoff,
+                                 std::chrono::duration_cast<std::chrono::milliseconds>(
+                                     retry.backoff * m_options.retry.backoffMultiplier));
+        if (reconnect().isOk()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+NegotiatedAlgorithms SFTPClient::negotiatedAlgorithms() const {
+    NegotiatedAlgorithms algorithms;
+    if (!m_sshSession) {
+        return algorithms;
+    }
+
+    const auto toString = [](const char* name) { return name ? std::string(name) : std::string(); };
+
+    algorithms.kex = toString(ssh_get_kex_algo(m_sshSession.get()));
+    algorithms.cipherIn = toString(ssh_get_cipher_in(m_sshSession.get()));
+    algorithms.cipherOut = toString(ssh_get_cipher_out(m_sshSession.get()));
+    algorithms.macIn = toString(ssh_get_hmac_in(m_sshSession.get()));
+    algorithms.macOut = toString(ssh_get_hmac_out(m_sshSession.get()));
+
+    return algorithms;
+}
+
+SFTPError SFTPClient::put(const std::string& localFileName, const std::string& remoteFileName,
+                          unsigned int chunkSize) const {
+    TransferOptions options;
+    options.chunkSize = chunkSize;
+    return put(localFileName, remoteFileName, options);
+}
+
+SFTPError SFTPClient::get(const std::string& localFileName, const std::string& remoteFileName,
+                          unsigned int chunkSize) const {
+    TransferOptions options;
+    options.chunkSize = chunkSize;
+    return get(localFileName, remoteFileName, options);
+}
+
+SFTPError SFTPClient::put(const std::string& localFileName, const std::string& remoteFileName,
+                          const TransferOptions& options) const {
+    if (m_broker) {
+        return m_broker->put(localFileName, remoteFileName, options);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    TransferStats stats;
+    SFTPError err;
+    if (useZstd(options, false)) {
+        err = withRetry(true, [&]() {
+            Checksum checksum(options.checksum);
+            const auto result =
+                zstdPut(m_sshSession.get(), localFileName, remoteFileName, options, checksum);
+            stats = result.second;
+            if (!result.first.isOk()) {
+                stats.bytes = 0;  // Nothing to resume from
+            }
+            return result.first.isOk() ? finishChecksum(remoteFileName, checksum, options)
+                                       : result.first;
+        });
+    } else {
+        PutSource source;
+        source.fileName = localFileName;
+        uint64_t offset = options.resumeOffset;
+        err = withRetry(true, [&]() { return putFrom(source, remoteFileName, options, offset); });
+        stats.bytes = offset > options.resumeOffset ? offset - options.resumeOffset : 0;
+        stats.wireBytes = stats.bytes;
+    }
+
+    reportStats(options, stats, start);
+    return err;
+}
+
+SFTPError SFTPClient::get(const std::string& localFileName, const std::string& remoteFileName,
+                          const TransferOptions& options) const {
+    if (m_broker) {
+        return m_broker->get(localFileName, remoteFileName, options);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    TransferStats stats;
+    SFTPError err;
+    if (useZstd(options, true)) {
+        err = withRetry(true, [&]() {
+            Checksum checksum(options.checksum);
+            const auto result =
+                zstdGet(m_sshSession.get(), localFileName, remoteFileName, options, checksum);
+            stats = result.second;
+            if (!result.first.isOk()) {
+                stats.bytes = 0;  // Nothing to resume from
+            }
+            return result.first.isOk() ? finishChecksum(remoteFileName, checksum, options)
+                                       : result.first;
+        });
+    } else {
+        uint64_t offset = options.resumeOffset;
+        err = withRetry(true, [&]() {
+            return getFrom(localFileName, remoteFileName, options, offset);
+        });
+        stats.bytes = offset > options.resumeOffset ? offset - options.resumeOffset : 0;
+        stats.wireBytes = stats.bytes;
+    }
+
+    reportStats(options, stats, start);
+    return err;
+}
+
+SFTPError SFTPClient::putBuffer(const char* data, const uint64_t size,
+                                const std::string& remoteFileName,
+                                const TransferOptions& options) const {
+    const auto start = std::chrono::steady_clock::now();
+    PutSource source;
+    source.data = data;
+    source.size = size;
+    uint64_t offset = options.resumeOffset;
+    const auto err =
+        withRetry(true, [&]() { return putFrom(source, remoteFileName, options, offset); });
+
+    TransferStats stats;
+    stats.bytes = offset > options.resumeOffset ? offset - options.resumeOffset : 0;
+    stats.wireBytes = stats.bytes;
+    reportStats(options, stats, start);
+    return err;
+}
+
+SFTPError SFTPClient::putFrom(const PutSource& source, const std::string& remoteFileName,
+                              const TransferOptions& options, uint64_t& offset) const {
+    if (!m_sftpSession || !m_sshSession) {
+        return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+    }
+
+    unsigned int chunkSize = options.chunkSize > 0 ? options.chunkSize : m_options.chunkSize;
+    chunkSize = std::min(chunkSize, m_maxWriteLength);
+    size_t maxInFlight = std::max(m_options.maxInFlightRequests, 1u);
+
+    std::unique_ptr<SFTPAutoTuner> tuner;
+    if (m_options.autoTune && options.chunkSize == 0) {
+        tuner.reset(new SFTPAutoTuner(tunerKey(), chunkSize, unsigned(maxInFlight),
+                                      m_maxWriteLength));
+        chunkSize = tuner->chunkSize();
+        maxInFlight = tuner->maxInFlight();
+    }
+
+    const std::string& localFileName = source.fileName;
+    std::ifstream file;
+    if (!source.data) {
+        file.open(localFileName, std::ios::binary);
+        if (!file) {
+            return SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                             "Failed to open local file: " + localFileName);
+        }
+    }
+
+    ssh_session sshSession = m_sshSession.get();
+    sftp_session sftpSession = m_sftpSession.get();
+
+    if (m_compressedSftpSession) {
+        uint64_t fileSize = source.size;
+        if (!source.data) {
+            file.seekg(0, std::ios::end);
+            fileSize = static_cast<uint64_t>(std::max<std::streamoff>(file.tellg(), 0));
+            file.seekg(0);
+        }
+
+        if (fileSize > 0 && fileSize >= m_options.compressionMinFileSize) {
+            const char* sample = source.data;
+            size_t sampleSize = size_t(std::min<uint64_t>(fileSize, kCompressionSampleSize));
+            std::vector<char> buffer;
+            if (!source.data) {
+                buffer.resize(kCompressionSampleSize);
+                file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                sample = buffer.data();
+                sampleSize = static_cast<size_t>(file.gcount());
+                file.clear();
+                file.seekg(0);
+            }
+
+            if (estimateCompressionRatio(sample, sampleSize) <
+                m_options.compressionThreshold) {
+                sshSession = m_compressedSshSession.get();
+                sftpSession = m_compressedSftpSession.get();
+            }
+        }
+    }
+
+    const int accessType = offset > 0 ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC;
+    auto remoteFilePtr = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+        sftp_open(sftpSession, remoteFileName.c_str(), accessType, S_IRUSR | S_IWUSR));
+
+    if (!remoteFilePtr.get()) {
+        return SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                         ssh_get_error(sshSession));
+    }
+
+    if (offset > 0) {
+        if (!source.data) {
+            file.seekg(static_cast<std::streamoff>(offset));
+        }
+        if (!file || sftp_seek64(remoteFilePtr.get(), offset) < 0) {
+            return SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                             "Failed to resume transfer to remote file [" + remoteFileName +
+                                      "] " + ssh_get_error(sshSession));
+        }
+    }
+
+    Checksum checksum(options.checksum);
+    if (options.checksum != ChecksumAlgorithm::None && offset > 0) {
+        if (source.data) {
+            checksum.update(source.data, size_t(std::min(offset, source.size)));
+        } else {
+            const auto err = hashLocalFile(localFileName, 0, offset, checksum);
+            if (!err.isOk()) {
+                return err;
+            }
+        }
+    }
+
+    struct PendingWrite {
+        SFTPAioPtr aio;
+        size_t length;
+        uint64_t end;
+        std::chrono::steady_clock::time_point sentAt;
+    };
+
+    const auto writeError = [&]() {
+        return SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                         "Failed to write to remote file [" + remoteFileName + "] " +
+                                  ssh_get_error(sshSession));
+    };
+
+    // The disk side reads ahead on its own thread and hashes as it goes. Sparse reads come
+    // without the holes, and chunks of zeros are skipped here by seeking past them.
+    const size_t bufferSize =
+        tuner ? std::min(m_maxWriteLength, unsigned(kMaxPooledChunkSize)) : chunkSize;
+    std::unique_ptr<SFTPFileReader> reader(
+        source.data ? new SFTPFileReader(source.data, source.size, offset, chunkSize, bufferSize,
+                                         options.sparse, checksum)
+                    : new SFTPFileReader(std::move(file), localFileName, offset, chunkSize,
+                                         bufferSize, options.sparse, checksum));
+    uint64_t remoteOffset = offset;
+
+    std::deque<PendingWrite> pending;
+    bool endOfFile = false;
+
+    while (true) {
+        while (!endOfFile && pending.size() < maxInFlight) {
+            const auto* chunk = reader->next();
+            if (!chunk) {
+                if (!reader->error().isOk()) {
+                    return reader->error();
+                }
+                endOfFile = true;
+                break;
+            }
+
+            if (chunk->offset != remoteOffset &&
+                sftp_seek64(remoteFilePtr.get(), chunk->offset) < 0) {
+                return writeError();
+            }
+            remoteOffset = chunk->offset + chunk->length;
+
+            if (chunk->zeros) {
+                continue;
+            }
+
+            // libssh copies the data into the request, so the chunk can go back to the reader.
+            sftp_aio aio = nullptr;
+            if (sftp_aio_begin_write(remoteFilePtr.get(), chunk->data, chunk->length, &aio) <
+                0) {
+                return writeError();
+            }
+            pending.push_back(
+                {SFTPAioPtr(aio), chunk->length, remoteOffset, std::chrono::steady_clock::now()});
+        }
+
+        if (pending.empty()) {
+            break;
+        }
+
+        PendingWrite request = std::move(pending.front());
+        pending.pop_front();
+
+        // sftp_aio_wait_write() frees the request whether it succeeds or not
+        sftp_aio aio = request.aio.release();
+
+        if (sftp_aio_wait_write(&aio) < 0) {
+            return writeError();
+        }
+
+        // Writes are answered in order, so everything before this one has landed too, including
+        // what a sparse transfer skipped.
+        offset = request.end;
+
+        if (tuner) {
+            tuner->onCompleted(request.length,
+                               std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::steady_clock::now() - request.sentAt));
+            reader->setChunkSize(tuner->chunkSize());
+            maxInFlight = tuner->maxInFlight();
+        }
+
+        if (options.progress && !options.progress(offset)) {
+            return SFTPError(SSH_OK, SFTPError::kCancelled, "Transfer cancelled");
+        }
+    }
+
+    // A file that ends in skipped zeros gets its size from a single zero byte at the end.
+    if (reader->end() > offset) {
+        const char zero = 0;
+        if (sftp_seek64(remoteFilePtr.get(), reader->end() - 1) < 0 ||
+            sftp_write(remoteFilePtr.get(), &zero, 1) != 1) {
+            return writeError();
+        }
+        offset = reader->end();
+    }
+
+    return finishChecksum(remoteFileName, checksum, options);
+}
+
+SFTPError SFTPClient::getFrom(const std::string& localFileName, const std::string& remoteFileName,
+                              const TransferOptions& options, uint64_t& offset) const {
+    if (!m_sftpSession.get() || !m_sshSession.get()) {
+        return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+    }
+
+    unsigned int chunkSize = options.chunkSize > 0 ? options.chunkSize : m_options.chunkSize;
+    chunkSize = std::min(chunkSize, m_maxReadLength);
+    size_t maxInFlight = std::max(m_options.maxInFlightRequests, 1u);
+
+    std::unique_ptr<SFTPAutoTuner> tuner;
+    if (m_options.autoTune && options.chunkSize == 0) {
+        tuner.reset(new SFTPAutoTuner(tunerKey(), chunkSize, unsigned(maxInFlight),
+                                      m_maxReadLength));
+        chunkSize = tuner->chunkSize();
+        maxInFlight = tuner->maxInFlight();
+    }
+
+    auto remoteFilePtr = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+        sftp_open(m_sftpSession.get(), remoteFileName.c_str(), O_RDONLY, S_IRUSR));
+
+    if (!remoteFilePtr.get()) {
+        return SFTPError(ssh_get_error_code(m_sshSession.get()),
+                         sftp_get_error(m_sftpSession.get()),
+                         "Failed to open remote file [" + remoteFileName + "] " +
+                                  ssh_get_error(m_sshSession.get()));
+    }
+
+    // A resumed transfer keeps what an earlier attempt already wrote.
+    const auto mode =
+        offset > 0 ? std::ios::binary | std::ios::in | std::ios::out : std::ios::binary;
+    std::ofstream file(localFileName, mode);
+    if (!file) {
+        return SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                         "Failed to open local file: " + localFileName);
+    }
+
+    // Sparse transfers leave chunks of zeros unwritten. Only where an earlier attempt left data
+    // does a hole have to be punched.
+    uint64_t localSize = 0;
+    if (options.sparse && offset > 0) {
+        file.seekp(0, std::ios::end);
+        localSize = static_cast<uint64_t>(std::max<std::streamoff>(file.tellp(), 0));
+    }
+
+    struct PendingRead {
+        SFTPAioPtr aio;
+        uint64_t offset;
+        size_t length;
+        std::chrono::steady_clock::time_point sentAt;
+    };
+
+    ssh_session sshSession = m_sshSession.get();
+    sftp_session sftpSession = m_sftpSession.get();
+
+    const auto readError = [&]() {
+        return SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                         "Failed to read from remote file [" + remoteFileName + "] " +
+                                  ssh_get_error(sshSession));
+    };
+
+    if (offset > 0) {
+        file.seekp(static_cast<std::streamoff>(offset));
+        if (!file || sftp_seek64(remoteFilePtr.get(), offset) < 0) {
+            return readError();
+        }
+    }
+
+    // Chunks are hashed as they arrive in order. One that lands after a gap left by a short
+    // read is not, and everything past the gap is read back from disk at the end instead.
+    Checksum checksum(options.checksum);
+    uint64_t hashedOffset = 0;
+    if (options.checksum != ChecksumAlgorithm::None && offset > 0) {
+        const auto err = hashLocalFile(localFileName, 0, offset, checksum);
+        if (!err.isOk()) {
+            return err;
+        }
+        hashedOffset = offset;
+    }
+
+    // Adaptive compression decides on the first blocks of the file, read over the plain
+    // session. They are kept, and the transfer continues after them on whichever session wins.
+    uint64_t startOffset = offset;
+
+    if (offset == 0 && m_compressedSftpSession) {
+        sftp_attributes attributes = sftp_fstat(remoteFilePtr.get());
+        const uint64_t fileSize = attributes ? attributes->size : 0;
+        sftp_attributes_free(attributes);
+
+        if (fileSize >= m_options.compressionMinFileSize) {
+            std::vector<char> sample(kCompressionSampleSize);
+            size_t sampleSize = 0;
+
+            while (sampleSize < sample.size()) {
+                const auto count = std::min(sample.size() - sampleSize, size_t(m_maxReadLength));
+                const auto bytesRead =
+                    sftp_read(remoteFilePtr.get(), sample.data() + sampleSize, count);
+                if (bytesRead < 0) {
+                    return readError();
+                }
+                if (bytesRead == 0) {
+                    break;
+                }
+                sampleSize += static_cast<size_t>(bytesRead);
+            }
+
+            file.write(sample.data(), static_cast<std::streamsize>(sampleSize));
+            if (!file) {
+                return SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                 "Failed to write to local file [" + localFileName + "]");
+            }
+            startOffset = sampleSize;
+            offset = sampleSize;
+            checksum.update(sample.data(), sampleSize);
+            hashedOffset = sampleSize;
+
+            if (estimateCompressionRatio(sample.data(), sampleSize) <
+                m_options.compressionThreshold) {
+                auto compressedFilePtr = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+                    sftp_open(m_compressedSftpSession.get(), remoteFileName.c_str(), O_RDONLY,
+                              S_IRUSR));
+
+                if (compressedFilePtr) {
+                    remoteFilePtr = std::move(compressedFilePtr);
+                    sshSession = m_compressedSshSession.get();
+                    sftpSession = m_compressedSftpSession.get();
+                }
+            }
+
+            if (sftp_seek64(remoteFilePtr.get(), startOffset) < 0) {
+                return readError();
+            }
+        }
+    }
+
+    // Received chunks go to disk on a thread of their own, which also hashes and leaves holes
+    // for sparse transfers, while this one goes straight back to the server.
+    const size_t bufferSize =
+        tuner ? std::min(m_maxReadLength, unsigned(kMaxPooledChunkSize)) : chunkSize;
+    chunkSize = std::min(chunkSize, unsigned(bufferSize));
+    SFTPFileWriter writer(std::move(file), localFileName, startOffset, bufferSize, options.sparse,
+                          localSize, checksum, hashedOffset);
+
+    std::deque<PendingRead> pending;
+    uint64_t nextOffset = startOffset;
+    uint64_t highestWritten = startOffset;
+    bool endOfFile = false;
+
+    while (true) {
+        while (!endOfFile && pending.size() < maxInFlight) {
+            sftp_aio aio = nullptr;
+            if (sftp_aio_begin_read(remoteFilePtr.get(), chunkSize, &aio) < 0) {
+                return readError();
+            }
+            pending.push_back(
+                {SFTPAioPtr(aio), nextOffset, chunkSize, std::chrono::steady_clock::now()});
+            nextOffset += chunkSize;
+        }
+
+        if (pending.empty()) {
+            break;
+        }
+
+        PendingRead request = std::move(pending.front());
+        pending.pop_front();
+
+        char* buffer = writer.buffer();
+        if (!buffer) {
+            return writer.finish();
+        }
+
+        // sftp_aio_wait_read() frees the request whether it succeeds or not
+        sftp_aio aio = request.aio.release();
+        const auto bytesRead = sftp_aio_wait_read(&aio, buffer, bufferSize);
+
+        if (bytesRead < 0) {
+            return readError();
+        }
+
+        if (bytesRead == 0) {
+            endOfFile = true;  // Requests past the end keep returning 0 until drained
+            continue;
+        }
+
+        const auto received = static_cast<size_t>(bytesRead);
+        writer.submit(request.offset, received);
+        highestWritten = std::max(highestWritten, request.offset + received);
+
+        if (tuner) {
+            tuner->onCompleted(received, std::chrono::duration_cast<std::chrono::microseconds>(
+                                             std::chrono::steady_clock::now() - request.sentAt));
+            chunkSize = std::min(tuner->chunkSize(), unsigned(bufferSize));
+            maxInFlight = tuner->maxInFlight();
+        }
+
+        // A server may return less than requested before the end of the file.
+        if (received < request.length) {
+            const auto remaining = request.length - received;
+            const auto receivedEnd = request.offset + received;
+            if (!beginTailRead(remoteFilePtr.get(), receivedEnd, remaining, nextOffset, &aio)) {
+                return readError();
+            }
+            pending.push_back(
+                {SFTPAioPtr(aio), receivedEnd, remaining, std::chrono::steady_clock::now()});
+        }
+
+        // Every byte below the lowest outstanding request is on disk or queued for it, and the
+        // writer drains its queue before getFrom() returns, also after an error.
+        offset = highestWritten;
+        for (const auto& outstanding : pending) {
+            offset = std::min(offset, outstanding.offset);
+        }
+
+        if (options.progress && !options.progress(offset)) {
+            return SFTPError(SSH_OK, SFTPError::kCancelled, "Transfer cancelled");
+        }
+    }
+
+    const auto writeError = writer.finish();
+    if (!writeError.isOk()) {
+        return writeError;
+    }
+    hashedOffset = writer.hashedOffset();
+
+    if (options.checksum != ChecksumAlgorithm::None && hashedOffset < highestWritten) {
+        const auto err = hashLocalFile(localFileName, hashedOffset, highestWritten, checksum);
+        if (!err.isOk()) {
+            return err;
+        }
+    }
+
+    return finishChecksum(remoteFileName, checksum, options);
+}
+
+std::pair<SFTPError, std::vector<FileTransferResult>> SFTPClient::putFiles(
+    const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) const {
+    if (!m_sftpSession || !m_sshSession) {
+        return {SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
+    }
+
+    if (remoteToolAvailable(m_remoteTar, remoteTarAvailable)) {
+        return tarPut(m_sshSession.get(), localDir, paths, remoteDir);
+    }
+
+    SFTPBatchTransfer batch(m_sshSession.get(), m_options, m_maxReadLength, m_maxWriteLength);
+    if (batch.open().isOk()) {
+        return batch.put(localDir, paths, remoteDir);
+    }
+
+    // Servers that allow a single channel per session
+    std::vector<FileTransferResult> results;
+    std::set<std::string> known;
+    for (const auto& path : paths) {
+        const auto remoteFileName = remoteDir.empty() ? path : remoteDir + "/" + path;
+        createRemoteParents(remoteFileName, known);
+        results.push_back(
+            {path, put(localDir.empty() ? path : localDir + "/" + path, remoteFileName)});
+    }
+
+    return {SFTPError(), results};
+}
+
+std::pair<SFTPError, std::vector<FileTransferResult>> SFTPClient::getFiles(
+    const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) const {
+    if (!m_sftpSession || !m_sshSession) {
+        return {SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
+    }
+
+    if (remoteToolAvailable(m_remoteTar, remoteTarAvailable)) {
+        return tarGet(m_sshSession.get(), localDir, paths, remoteDir);
+    }
+
+    SFTPBatchTransfer batch(m_sshSession.get(), m_options, m_maxReadLength, m_maxWriteLength);
+    if (batch.open().isOk()) {
+        return batch.get(localDir, paths, remoteDir);
+    }
+
+    std::vector<FileTransferResult> results;
+    for (const auto& path : paths) {
+        const auto localFileName = localDir.empty() ? path : localDir + "/" + path;
+        createParentDirectories(localFileName);
+        results.push_back(
+            {path, get(localFileName, remoteDir.empty() ? path : remoteDir + "/" + path)});
+    }
+
+    return {SFTPError(), results};
+}
+
+SFTPError SFTPClient::mkdir(const std::string& remoteDir, const mode_t permissions) const {
+    if (m_broker) {
+        return m_broker->mkdir(remoteDir, static_cast<uint32_t>(permissions));
+    }
+
+    return withRetry(false, [&]() -> SFTPError {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        int rc = sftp_mkdir(m_sftpSession.get(), remoteDir.c_str(), permissions);
+        if (rc < 0) {
+            return SFTPError(rc, sftp_get_error(m_sftpSession.get()),
+                             ssh_get_error(m_sshSession.get()));
+        }
+
+        return SFTPError();
+    });
+}
+
+std::pair<SFTPError, std::vector<SFTPAttributes>> SFTPClient::ls(
+    const std::string& remoteDir) const {
+    if (m_broker) {
+        return m_broker->ls(remoteDir);
+    }
+
+    return withRetry(true, [&]() -> std::pair<SFTPError, std::vector<SFTPAttributes>> {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return {SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
+        }
+
+        auto dir = std::unique_ptr<sftp_dir_struct, decltype(&sftp_closedir)>(
+            sftp_opendir(m_sftpSession.get(), remoteDir.c_str()), sftp_closedir);
+
+        if (!dir) {
+            return {SFTPError(ssh_get_error_code(m_sftpSession.get()),
+                              sftp_get_error(m_sftpSession.get()),
+                              "Failed to open directory: " + remoteDir),
+                    {}};
+        }
+
+        std::vector<SFTPAttributes> attributesList;
+
+        while (sftp_attributes attributes = sftp_readdir(m_sftpSession.get(), dir.get())) {
+            attributesList.emplace_back(attributes);
+        }
+
+        if (!sftp_dir_eof(dir.get())) {
+            return {SFTPError(ssh_get_error_code(m_sftpSession.get()),
+                              sftp_get_error(m_sftpSession.get()),
+                              "Failed to read directory: " + remoteDir),
+                    {}};
+        }
+
+        return {SFTPError(SSH_OK, SSH_FX_OK), std::move(attributesList)};
+    });
+}
+
+SFTPError SFTPClient::rename(const std::string& oldRemoteName,
+                             const std::string& newRemoteName) const {
+    if (m_broker) {
+        return m_broker->rename(oldRemoteName, newRemoteName);
+    }
+
+    return withRetry(false, [&]() -> SFTPError {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        int rc = sftp_rename(m_sftpSession.get(), oldRemoteName.c_str(), newRemoteName.c_str());
+        if (rc < 0) {
+            return SFTPError(ssh_get_error_code(m_sshSession.get()),
+                             sftp_get_error(m_sftpSession.get()),
+                             ssh_get_error(m_sshSession.get()));
+        }
+
+        return SFTPError();
+    });
+}
+
+SFTPError SFTPClient::copy(const std::string& remoteSrc, const std::string& remoteDst,
+                           const bool recursive) const {
+    if (m_broker) {
+        return m_broker->copy(remoteSrc, remoteDst, recursive);
+    }
+
+    if (remoteSrc == remoteDst || (recursive && remoteDst.compare(0, remoteSrc.size() + 1,
+                                                                  remoteSrc + "/") == 0)) {
+        return SFTPError(SSH_OK, SSH_FX_FAILURE,
+                         "Cannot copy [" + remoteSrc + "] onto or into itself");
+    }
+
+    // Copying again overwrites the same destination, so a lost connection simply starts over.
+    return withRetry(true, [&]() -> SFTPError {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        const SFTPAttributes attributes(sftp_stat(m_sftpSession.get(), remoteSrc.c_str()));
+        if (!attributes.get()) {
+            return SFTPError(ssh_get_error_code(m_sshSession.get()),
+                             sftp_get_error(m_sftpSession.get()),
+                             "Failed to stat remote file [" + remoteSrc + "] " +
+                                      ssh_get_error(m_sshSession.get()));
+        }
+
+        // One side channel serves every file of a recursive copy.
+        std::unique_ptr<SFTPSideChannel> channel;
+        if (sftp_extension_supported(m_sftpSession.get(), "copy-data", "1")) {
+            channel.reset(new SFTPSideChannel(m_sshSession.get()));
+            if (!channel->open().isOk() || !channel->hasExtension("copy-data")) {
+                channel.reset();
+            }
+        }
+
+        return copyPath(*this, remoteSrc, remoteDst, *attributes.get(), recursive, channel.get(),
+                        nullptr);
+    });
+}
+
+SFTPError SFTPClient::relay(const SFTPClient& destination, const std::string& remoteSrc,
+                            const std::string& remoteDst, const bool recursive) const {
+    if (&destination == this) {
+        return copy(remoteSrc, remoteDst, recursive);
+    }
+
+    bool destinationFailed = false;
+    const auto relayOnce = [&]() -> SFTPError {
+        destinationFailed = !destination.m_sftpSession.get() || !destination.m_sshSession.get();
+        if (!m_sftpSession.get() || !m_sshSession.get() || destinationFailed) {
+            return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        const SFTPAttributes attributes(sftp_stat(m_sftpSession.get(), remoteSrc.c_str()));
+        if (!attributes.get()) {
+            return SFTPError(ssh_get_error_code(m_sshSession.get()),
+                             sftp_get_error(m_sftpSession.get()),
+                             "Failed to stat remote file [" + remoteSrc + "] " +
+                                      ssh_get_error(m_sshSession.get()));
+        }
+
+        return copyPath(destination, remoteSrc, remoteDst, *attributes.get(), recursive, nullptr,
+                        &destinationFailed);
+    };
+
+    // Relaying again overwrites the same destination, so it can start over after either side
+    // reconnected. Only the side the error came from reconnects, within its own retry policy.
+    auto result = relayOnce();
+    RetryState sourceRetry(m_options.retry);
+    RetryState destinationRetry(destination.m_options.retry);
+    while (destinationFailed ? destination.reconnectAfter(result, destinationRetry)
+                             : reconnectAfter(result, sourceRetry)) {
+        result = relayOnce();
+    }
+    return result;
+}
+
+SFTPError SFTPClient::rm(const std::string& remoteFileName) const {
+    if (m_broker) {
+        return m_broker->rm(remoteFileName);
+    }
+
+    return withRetry(false, [&]() -> SFTPError {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        int rc = sftp_unlink(m_sftpSession.get(), remoteFileName.c_str());
+        if (rc < 0) {
+            return SFTPError(ssh_get_error_code(m_sshSession.get()),
+                             sftp_get_error(m_sftpSession.get()),
+                             "Failed to remove remote file [" + remoteFileName + "] " +
+                                      ssh_get_error(m_sshSession.get()));
+        }
+
+        return SFTPError();
+    });
+}
+
+SFTPError SFTPClient::rmdir(const std::string& remoteDir) const {
+    if (m_broker) {
+        return m_broker->rmdir(remoteDir);
+    }
+
+    return withRetry(false, [&]() -> SFTPError {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        int rc = sftp_rmdir(m_sftpSession.get(), remoteDir.c_str());
+        if (rc < 0) {
+            return SFTPError(ssh_get_error_code(m_sshSession.get()),
+                             sftp_get_error(m_sftpSession.get()),
+                             "Failed to remove remote dir [" + remoteDir + "] " +
+                                      ssh_get_error(m_sshSession.get()));
+        }
+
+        return SFTPError();
+    });
+}
+
+std::pair<SFTPError, SFTPAttributes> SFTPClient::stat(
+    const std::string& remotePath) const {
+    if (m_broker) {
+        return m_broker->stat(remotePath);
+    }
+
+    return withRetry(true, [&]() -> std::pair<SFTPError, SFTPAttributes> {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return {SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
+        }
+
+        sftp_attributes attr = sftp_lstat(m_sftpSession.get(), remotePath.c_str());
+        if (!attr) {
+            return {SFTPError(ssh_get_error_code(m_sshSession.get()),
+                              sftp_get_error(m_sftpSession.get()),
+                              "Failed to stat remote dir [" + remotePath + "] " +
+                                       ssh_get_error(m_sshSession.get())),
+                    {}};
+        }
+
+        return {SFTPError(), {attr}};
+    });
+}
+
+std::pair<SFTPError, std::string> SFTPClient::checksum(
+    const std::string& remoteFileName, const ChecksumAlgorithm algorithm) const {
+    return withRetry(true, [&]() -> std::pair<SFTPError, std::string> {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return {SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), ""};
+        }
+
+        return remoteChecksum(m_sshSession.get(), m_sftpSession.get(), remoteFileName, algorithm);
+    });
+}
+
+SFTPError SFTPClient::openSessions(const std::string& pw) const {
+    // A new session may land on another server behind the same name.
+    m_remoteTar = RemoteTool::Unknown;
+    m_remoteZstd = RemoteTool::Unknown;
+
+    const bool compress = m_options.compression == ConnectOptions::Compression::On;
+    const auto err = openSession(pw, compress, m_sshSession, m_sftpSession);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    // Without the compressed session every transfer simply stays on the plain one.
+    if (m_options.compression == ConnectOptions::Compression::Adaptive &&
+        !openSession(pw, true, m_compressedSshSession, m_compressedSftpSession).isOk()) {
+        m_compressedSftpSession.reset();
+        m_compressedSshSession.reset();
+    }
+
+    return SFTPError();
+}
+
+SFTPError SFTPClient::openSession(const std::string& pw, const bool compress,
+                                  SSHSessionPtr& sshSession, SFTPSessionPtr& sftpSession) const {
+    sshSession = SSHSessionPtr(ssh_new());
+    if (!sshSession) {
+        return SFTPError(SSH_ERROR, SSH_FX_OK, "Failed to create ssh session.");
+    }
+
+    // libssh reads the port as an unsigned int
+    const unsigned int sshPort = m_port;
+
+    ssh_options_set(sshSession.get(), SSH_OPTIONS_HOST, m_host.c_str());
+    ssh_options_set(sshSession.get(), SSH_OPTIONS_PORT, &sshPort);
+    ssh_options_set(sshSession.get(), SSH_OPTIONS_USER, m_user.c_str());
+
+    const auto err = applySessionOptions(sshSession.get(), m_options, compress);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    int rc = ssh_connect(sshSession.get());
+    if (rc != SSH_OK) {
+        return SFTPError(rc, SSH_FX_OK, ssh_get_error(sshSession.get()));
+    }
+
+    applySocketOptions(sshSession.get(), m_options);
+
+    if (m_onlyKnownServers) {
+        const auto res = ssh_session_is_known_server(sshSession.get());
+        if (res != SSH_KNOWN_HOSTS_OK) {
+            return SFTPError(ssh_get_error_code(sshSession.get()),
+                             sftp_get_error(sftpSession.get()), ssh_get_error(sshSession.get()));
+        }
+    }
+
+    rc = ssh_userauth_password(sshSession.get(), nullptr, pw.c_str());
+    if (rc != SSH_AUTH_SUCCESS) {
+        return SFTPError(rc, SSH_FX_OK, ssh_get_error(sshSession.get()));
+    }
+
+    sftpSession = SFTPSessionPtr(sftp_new(sshSession.get()));
+    if (!sftpSession) {
+        return SFTPError(ssh_get_error_code(sshSession.get()), SSH_FX_FAILURE,
+                         "Failed to create a new sftp session.");
+    }
+
+    rc = sftp_init(sftpSession.get());
+    if (rc < 0) {
+        return SFTPError(ssh_get_error_code(sshSession.get()), sftp_get_error(sftpSession.get()),
+                         ssh_get_error(sshSession.get()));
+    }
+
+    return SFTPError();
+}
+
+SFTPError SFTPClient::reconnect() const {
+    m_compressedSftpSession.reset();
+    m_compressedSshSession.reset();
+    m_sftpSession.reset();
+    m_sshSession.reset();
+
+    return openSessions(m_password);
+}
+
+bool SFTPClient::connectionLost(const SFTPError& err) const {
+    if (err.getSFTPErrorCode() == SSH_FX_NO_CONNECTION ||
+        err.getSFTPErrorCode() == SSH_FX_CONNECTION_LOST) {
+        return true;
+    }
+
+    const auto sessionDown = [](ssh_session session) {
+        return !ssh_is_connected(session) ||
+               (ssh_get_status(session) & (SSH_CLOSED | SSH_CLOSED_ERROR)) != 0 ||
+               ssh_get_error_code(session) == SSH_FATAL;
+    };
+
+    return !m_sshSession || sessionDown(m_sshSession.get()) ||
+           (m_compressedSshSession && sessionDown(m_compressedSshSession.get()));
+}
+
+bool SFTPClient::useZstd(const TransferOptions& options, const bool download) const {
+    if (!options.zstd || options.resumeOffset > 0 || (download && options.sparse) ||
+        !m_sshSession || !zstdSupported()) {
+        return false;
+    }
+    return remoteToolAvailable(m_remoteZstd, remoteZstdAvailable);
+}
+
+bool SFTPClient::remoteToolAvailable(RemoteTool& known, bool (*probe)(ssh_session session)) const {
+    if (known == RemoteTool::Unknown) {
+        known = probe(m_sshSession.get()) ? RemoteTool::Available : RemoteTool::Missing;
+    }
+    return known == RemoteTool::Available;
+}
+
+void SFTPClient::reportStats(const TransferOptions& options, TransferStats stats,
+                             const std::chrono::steady_clock::time_point start) {
+    if (options.onStats) {
+        stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        options.onStats(stats);
+    }
+}
+
+SFTPError SFTPClient::finishChecksum(const std::string& remoteFileName, Checksum& checksum,
+                                     const TransferOptions& options) const {
+    if (checksum.algorithm() == ChecksumAlgorithm::None) {
+        return SFTPError();
+    }
+
+    const auto digest = checksum.hexDigest();
+    if (options.onChecksum) {
+        options.onChecksum(digest);
+    }
+
+    if (!options.verifyChecksum) {
+        return SFTPError();
+    }
+
+    const auto remote = remoteChecksum(m_sshSession.get(), m_sftpSession.get(), remoteFileName,
+                                       checksum.algorithm());
+    if (remote.first.getSFTPErrorCode() == SSH_FX_OP_UNSUPPORTED) {
+        return SFTPError();  // Nothing to compare with
+    }
+
+    if (!remote.first.isOk()) {
+        return remote.first;
+    }
+
+    if (remote.second != digest) {
+        return SFTPError(SSH_OK, SFTPError::kChecksumMismatch,
+                         "Checksum mismatch for remote file [" + remoteFileName +
+                                  "]: local " + digest + ", remote " + remote.second);
+    }
+
+    return SFTPError();
+}
+
+SFTPError SFTPClient::hashLocalFile(const std::string& localFileName, const uint64_t from,
+                                    const uint64_t to, Checksum& checksum) {
+    std::ifstream file(localFileName, std::ios::binary);
+    file.seekg(static_cast<std::streamoff>(from));
+
+    std::vector<char> buffer(256 * 1024);
+    uint64_t position = from;
+
+    while (file && position < to) {
+        const auto count = static_cast<size_t>(std::min<uint64_t>(buffer.size(), to - position));
+        file.read(buffer.data(), static_cast<std::streamsize>(count));
+        const auto bytesRead = static_cast<size_t>(file.gcount());
+        checksum.update(buffer.data(), bytesRead);
+        position += bytesRead;
+    }
+
+    if (position < to) {
+        return SFTPError(SSH_OK, SSH_FX_FAILURE,
+                         "Failed to read local file [" + localFileName + "] for checksum");
+    }
+
+    return SFTPError();
+}
+
+SFTPError SFTPClient::copyPath(const SFTPClient& destination, const std::string& remoteSrc,
+                               const std::string& remoteDst,
+                               const sftp_attributes_struct& attributes, const bool recursive,
+                               SFTPSideChannel* channel, bool* destinationFailed) const {
+    sftp_session sftpSession = m_sftpSession.get();
+    ssh_session sshSession = m_sshSession.get();
+    sftp_session dstSftpSession = destination.m_sftpSession.get();
+    ssh_session dstSshSession = destination.m_sshSession.get();
+    const uint32_t permissions = attributes.permissions & 07777;
+
+    const auto error = [&](const std::string& what) {
+        return SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                         what + " " + ssh_get_error(sshSession));
+    };
+
+    const auto dstError = [&](const std::string& what) {
+        if (destinationFailed) {
+            *destinationFailed = true;
+        }
+        return SFTPError(ssh_get_error_code(dstSshSession), sftp_get_error(dstSftpSession),
+                         what + " " + ssh_get_error(dstSshSession));
+    };
+
+    if (attributes.type == SSH_FILEXFER_TYPE_REGULAR) {
+        if (&destination != this) {
+            return relayFile(destination, remoteSrc, remoteDst, permissions, destinationFailed);
+        }
+        if (channel) {
+            const auto err = copyData(*channel, remoteSrc, remoteDst, permissions);
+            if (err.getSFTPErrorCode() != SSH_FX_OP_UNSUPPORTED) {
+                return err;
+            }
+        }
+        return copyPipelined(remoteSrc, remoteDst, permissions);
+    }
+
+    if (attributes.type == SSH_FILEXFER_TYPE_SYMLINK) {
+        char* target = sftp_readlink(sftpSession, remoteSrc.c_str());
+        if (!target) {
+            return error("Failed to read remote link [" + remoteSrc + "]");
+        }
+        const std::string linkTarget(target);
+        ssh_string_free_char(target);
+
+        if (sftp_symlink(dstSftpSession, linkTarget.c_str(), remoteDst.c_str()) < 0) {
+            return dstError("Failed to create remote link [" + remoteDst + "]");
+        }
+        return SFTPError();
+    }
+
+    if (attributes.type != SSH_FILEXFER_TYPE_DIRECTORY) {
+        return SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED,
+                         "Cannot copy special file [" + remoteSrc + "]");
+    }
+
+    if (!recursive) {
+        return SFTPError(SSH_OK, SSH_FX_FAILURE,
+                         "[" + remoteSrc + "] is a directory, copy it recursively");
+    }
+
+    // The owner needs write access to fill the directory; the original mode is restored after.
+    const uint32_t writablePermissions = permissions | 0700;
+    if (sftp_mkdir(dstSftpSession, remoteDst.c_str(), static_cast<mode_t>(writablePermissions)) <
+        0) {
+        const SFTPAttributes existing(sftp_stat(dstSftpSession, remoteDst.c_str()));
+        if (!existing.get() || existing.get()->type != SSH_FILEXFER_TYPE_DIRECTORY) {
+            return dstError("Failed to create remote directory [" + remoteDst + "]");
+        }
+    }
+
+    // The listing is read completely first so no directory handle stays open while recursing.
+    std::vector<SFTPAttributes> entries;
+    {
+        auto dir = std::unique_ptr<sftp_dir_struct, decltype(&sftp_closedir)>(
+            sftp_opendir(sftpSession, remoteSrc.c_str()), sftp_closedir);
+        if (!dir) {
+            return error("Failed to open remote directory [" + remoteSrc + "]");
+        }
+
+        while (sftp_attributes entry = sftp_readdir(sftpSession, dir.get())) {
+            entries.emplace_back(entry);
+        }
+
+        if (!sftp_dir_eof(dir.get())) {
+            return error("Failed to read remote directory [" + remoteSrc + "]");
+        }
+    }
+
+    for (const auto& entry : entries) {
+        const std::string name = entry.get()->name ? entry.get()->name : "";
+        if (name.empty() || name == "." || name == "..") {
+            continue;
+        }
+
+        const auto err = copyPath(destination, remoteSrc + "/" + name, remoteDst + "/" + name,
+                                  *entry.get(), true, channel, destinationFailed);
+        if (!err.isOk()) {
+            return err;
+        }
+    }
+
+    if (writablePermissions != permissions &&
+        sftp_chmod(dstSftpSession, remoteDst.c_str(), static_cast<mode_t>(permissions)) < 0) {
+        return dstError("Failed to set permissions of remote directory [" + remoteDst + "]");
+    }
+
+    return SFTPError();
+}
+
+SFTPError SFTPClient::copyData(SFTPSideChannel& channel, const std::string& remoteSrc,
+                               const std::string& remoteDst, const uint32_t permissions) const {
+    std::string srcHandle, dstHandle;
+    auto err = channel.openFile(remoteSrc, SSH_FXF_READ, 0, srcHandle);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    err = channel.openFile(remoteDst, SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC, permissions,
+                           dstHandle);
+    if (!err.isOk()) {
+        channel.closeFile(srcHandle);
+        return err;
+    }
+
+    err = channel.requestStatus(SFTPPacketWriter(SSH_FXP_EXTENDED, channel.nextId())
+                                    .putString("copy-data")
+                                    .putString(srcHandle)
+                                    .putUint64(0)  // Read from the start
+                                    .putUint64(0)  // Up to the end of the file
+                                    .putString(dstHandle)
+                                    .putUint64(0)  // Write from the start
+                                    .finish());
+
+    channel.closeFile(srcHandle);
+    const auto closeErr = channel.closeFile(dstHandle);
+
+    return err.isOk() ? closeErr : err;
+}
+
+SFTPError SFTPClient::copyPipelined(const std::string& remoteSrc, const std::string& remoteDst,
+                                    const uint32_t permissions) const {
+    sftp_session sftpSession = m_sftpSession.get();
+    ssh_session sshSession = m_sshSession.get();
+
+    const auto error = [&](const std::string& what) {
+        return SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                         what + " " + ssh_get_error(sshSession));
+    };
+
+    auto srcFile = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+        sftp_open(sftpSession, remoteSrc.c_str(), O_RDONLY, 0));
+    if (!srcFile) {
+        return error("Failed to open remote file [" + remoteSrc + "]");
+    }
+
+    auto dstFile = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+        sftp_open(sftpSession, remoteDst.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                  static_cast<mode_t>(permissions)));
+    if (!dstFile) {
+        return error("Failed to open remote file [" + remoteDst + "]");
+    }
+
+    const size_t chunkSize =
+        std::max(std::min({m_options.chunkSize, m_maxReadLength, m_maxWriteLength}), 1u);
+    const size_t maxInFlight = std::max(m_options.maxInFlightRequests, 1u);
+
+    struct PendingRead {
+        SFTPAioPtr aio;
+        uint64_t offset;
+        size_t length;
+    };
+
+    // Reads and writes share the in-flight budget; each completed read is written straight
+    // back, and libssh copies the data when the write is queued.
+    std::vector<char> buffer(chunkSize);
+    std::deque<PendingRead> reads;
+    std::deque<SFTPAioPtr> writes;
+    uint64_t nextOffset = 0;
+    uint64_t writeOffset = 0;
+    bool endOfFile = false;
+
+    const auto waitWrite = [&]() {
+        sftp_aio aio = writes.front().release();
+        writes.pop_front();
+        return sftp_aio_wait_write(&aio) >= 0;  // Frees the request either way
+    };
+
+    while (true) {
+        while (!endOfFile && reads.size() + writes.size() < maxInFlight) {
+            sftp_aio aio = nullptr;
+            if (sftp_aio_begin_read(srcFile.get(), chunkSize, &aio) < 0) {
+                return error("Failed to read from remote file [" + remoteSrc + "]");
+            }
+            reads.push_back({SFTPAioPtr(aio), nextOffset, chunkSize});
+            nextOffset += chunkSize;
+        }
+
+        if (reads.empty()) {
+            break;
+        }
+
+        PendingRead request = std::move(reads.front());
+        reads.pop_front();
+
+        sftp_aio aio = request.aio.release();
+        const auto bytesRead = sftp_aio_wait_read(&aio, buffer.data(), buffer.size());
+        if (bytesRead < 0) {
+            return error("Failed to read from remote file [" + remoteSrc + "]");
+        }
+
+        if (bytesRead == 0) {
+            endOfFile = true;
+            continue;
+        }
+
+        const auto received = static_cast<size_t>(bytesRead);
+        if (request.offset != writeOffset && sftp_seek64(dstFile.get(), request.offset) < 0) {
+            return error("Failed to seek in remote file [" + remoteDst + "]");
+        }
+
+        if (sftp_aio_begin_write(dstFile.get(), buffer.data(), received, &aio) < 0) {
+            return error("Failed to write to remote file [" + remoteDst + "]");
+        }
+        writes.emplace_back(aio);
+        writeOffset = request.offset + received;
+
+        if (received < request.length) {
+            const auto remaining = request.length - received;
+            if (!beginTailRead(srcFile.get(), writeOffset, remaining, nextOffset, &aio)) {
+                return error("Failed to read from remote file [" + remoteSrc + "]");
+            }
+            reads.push_back({SFTPAioPtr(aio), writeOffset, remaining});
+        }
+
+        while (!writes.empty() && reads.size() + writes.size() >= maxInFlight) {
+            if (!waitWrite()) {
+                return error("Failed to write to remote file [" + remoteDst + "]");
+            }
+        }
+    }
+
+    while (!writes.empty()) {
+        if (!waitWrite()) {
+            return error("Failed to write to remote file [" + remoteDst + "]");
+        }
+    }
+
+    return SFTPError();
+}
+
+SFTPError SFTPClient::relayFile(const SFTPClient& destination, const std::string& remoteSrc,
+                                const std::string& remoteDst, const uint32_t permissions,
+                                bool* destinationFailed) const {
+    sftp_session dstSftpSession = destination.m_sftpSession.get();
+    ssh_session dstSshSession = destination.m_sshSession.get();
+
+    const auto dstError = [&](const std::string& what) {
+        if (destinationFailed) {
+            *destinationFailed = true;
+        }
+        return SFTPError(ssh_get_error_code(dstSshSession), sftp_get_error(dstSftpSession),
+                         what + " " + ssh_get_error(dstSshSession));
+    };
+
+    auto srcFile = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+        sftp_open(m_sftpSession.get(), remoteSrc.c_str(), O_RDONLY, 0));
+    if (!srcFile) {
+        return SFTPError(ssh_get_error_code(m_sshSession.get()),
+                         sftp_get_error(m_sftpSession.get()),
+                         "Failed to open remote file [" + remoteSrc + "] " +
+                                  ssh_get_error(m_sshSession.get()));
+    }
+
+    auto dstFile = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+        sftp_open(dstSftpSession, remoteDst.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                  static_cast<mode_t>(permissions)));
+    if (!dstFile) {
+        return dstError("Failed to open remote file [" + remoteDst + "]");
+    }
+
+    const size_t chunkSize = std::max(
+        std::min({m_options.chunkSize, m_maxReadLength, destination.m_maxWriteLength}), 1u);
+    const size_t maxWrites = std::max(destination.m_options.maxInFlightRequests, 1u);
+
+    // Declared after the files so the reader's thread stops before the source is closed.
+    // libssh copies the data when a write is queued, so each chunk goes straight back.
+    SFTPRemoteReader reader(m_sshSession.get(), m_sftpSession.get(), srcFile.get(), remoteSrc,
+                            chunkSize, m_options.maxInFlightRequests);
+    std::deque<SFTPAioPtr> writes;
+    uint64_t writeOffset = 0;
+
+    const auto waitWrite = [&]() {
+        sftp_aio aio = writes.front().release();
+        writes.pop_front();
+        return sftp_aio_wait_write(&aio) >= 0;  // Frees the request either way
+    };
+
+    while (const auto* chunk = reader.next()) {
+        if (chunk->offset != writeOffset && sftp_seek64(dstFile.get(), chunk->offset) < 0) {
+            return dstError("Failed to seek in remote file [" + remoteDst + "]");
+        }
+
+        sftp_aio aio = nullptr;
+        if (sftp_aio_begin_write(dstFile.get(), chunk->data, chunk->length, &aio) < 0) {
+            return dstError("Failed to write to remote file [" + remoteDst + "]");
+        }
+        writes.emplace_back(aio);
+        writeOffset = chunk->offset + chunk->length;
+
+        while (writes.size() >= maxWrites) {
+            if (!waitWrite()) {
+                return dstError("Failed to write to remote file [" + remoteDst + "]");
+            }
+        }
+    }
+
+    if (!reader.error().isOk()) {
+        return reader.error();
+    }
+
+    while (!writes.empty()) {
+        if (!waitWrite()) {
+            return dstError("Failed to write to remote file [" + remoteDst + "]");
+        }
+    }
+
+    return SFTPError();
+}
+
+void SFTPClient::createRemoteParents(const std::string& remoteFileName,
+                                     std::set<std::string>& known) const {
+    for (auto slash = remoteFileName.find('/', 1); slash != std::string::npos;
+         slash = remoteFileName.find('/', slash + 1)) {
+        const auto dir = remoteFileName.substr(0, slash);
+        if (known.insert(dir).second) {
+            // Fails harmlessly for directories that already exist.
+            sftp_mkdir(m_sftpSession.get(), dir.c_str(), 0755);
+        }
+    }
+}
+
+void SFTPClient::readServerLimits() {
+    m_maxReadLength = kFallbackMaxChunkSize;
+    m_maxWriteLength = kFallbackMaxChunkSize;
+
+    sftp_limits_t limits = sftp_limits(m_sftpSession.get());
+    if (!limits) {
+        return;
+    }
+
+    const uint64_t maxChunk = std::numeric_limits<unsigned int>::max();
+    if (limits->max_read_length > 0) {
+        m_maxReadLength = static_cast<unsigned int>(std::min(limits->max_read_length, maxChunk));
+    }
+
+    if (limits->max_write_length > 0) {
+        m_maxWriteLength =
+            static_cast<unsigned int>(std::min(limits->max_write_length, maxChunk));
+    }
+
+    sftp_limits_free(limits);
+}
+
+std::string SFTPClient::tunerKey() const {
+    return m_host + ":" + std::to_string(m_port);
+}
+
+void SFTPClient::SSHSessionDeleter::operator()(ssh_session session) const {
+    if (session) {
+        ssh_disconnect(session);
+        ssh_free(session);
+    }
+}
+
+void SFTPClient::SFTPSessionDeleter::operator()(sftp_session session) const {
+    if (session) {
+        sftp_free(session);
+    }
+}
+
+void SFTPClient::SFTPFileDeleter::operator()(sftp_file file) const {
+    if (file) {
+        sftp_close(file);
+    }
+}
+
+void SFTPClient::SFTPAioDeleter::operator()(sftp_aio aio) const {
+    if (aio) {
+        sftp_aio_free(aio);
+    }
+}
+
+SFTPPacketWriter::SFTPPacketWriter(const uint8_t type) {
+    m_buffer.reserve(64);
+    putUint32(0);  // Length, filled in by finish()
+    putUint8(type);
+}
+
+SFTPPacketWriter::SFTPPacketWriter(const uint8_t type, const uint32_t id)
+    : SFTPPacketWriter(type) {
+    putUint32(id);
+}
+
+SFTPPacketWriter& SFTPPacketWriter::putUint8(const uint8_t value) {
+    m_buffer.push_back(static_cast<char>(value));
+    return *this;
+}
+
+SFTPPacketWriter& SFTPPacketWriter::putUint32(const uint32_t value) {
+    const char bytes[] = {static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+                          static_cast<char>(value >> 8), static_cast<char>(value)};
+    m_buffer.append(bytes, sizeof(bytes));
+    return *this;
+}
+
+SFTPPacketWriter& SFTPPacketWriter::putUint64(const uint64_t value) {
+    putUint32(static_cast<uint32_t>(value >> 32));
+    putUint32(static_cast<uint32_t>(value));
+    return *this;
+}
+
+SFTPPacketWriter& SFTPPacketWriter::putString(const std::string& value) {
+    return putString(value.data(), value.size());
+}
+
+SFTPPacketWriter& SFTPPacketWriter::putString(const char* data, const size_t size) {
+    putUint32(static_cast<uint32_t>(size));
+    m_buffer.append(data, size);
+    return *this;
+}
+
+SFTPPacketWriter& SFTPPacketWriter::putPermissions(const uint32_t permissions) {
+    putUint32(SSH_FILEXFER_ATTR_PERMISSIONS);
+    putUint32(permissions);
+    return *this;
+}
+
+SFTPPacketWriter& SFTPPacketWriter::putEmptyAttributes() {
+    putUint32(0);
+    return *this;
+}
+
+SFTPPacketWriter& SFTPPacketWriter::putAttributes(
+    const sftp_attributes_struct& attributes) {
+    const uint32_t flags = attributes.flags &
+                           (SSH_FILEXFER_ATTR_SIZE | SSH_FILEXFER_ATTR_UIDGID |
+                            SSH_FILEXFER_ATTR_PERMISSIONS | SSH_FILEXFER_ATTR_ACMODTIME);
+    putUint32(flags);
+
+    if (flags & SSH_FILEXFER_ATTR_SIZE) {
+        putUint64(attributes.size);
+    }
+
+    if (flags & SSH_FILEXFER_ATTR_UIDGID) {
+        putUint32(attributes.uid);
+        putUint32(attributes.gid);
+    }
+
+    if (flags & SSH_FILEXFER_ATTR_PERMISSIONS) {
+        putUint32(attributes.permissions);
+    }
+
+    if (flags & SSH_FILEXFER_ATTR_ACMODTIME) {
+        putUint32(attributes.atime);
+        putUint32(attributes.mtime);
+    }
+
+    return *this;
+}
+
+std::string SFTPPacketWriter::finish() {
+    const auto length = static_cast<uint32_t>(m_buffer.size() - 4);
+    m_buffer[0] = static_cast<char>(length >> 24);
+    m_buffer[1] = static_cast<char>(length >> 16);
+    m_buffer[2] = static_cast<char>(length >> 8);
+    m_buffer[3] = static_cast<char>(length);
+    return std::move(m_buffer);
+}
+
+bool SFTPPacketReader::getUint8(uint8_t& value) {
+    if (m_size - m_offset < 1) {
+        return false;
+    }
+
+    value = static_cast<uint8_t>(m_data[m_offset]);
+    m_offset += 1;
+    return true;
+}
+
+bool SFTPPacketReader::getUint32(uint32_t& value) {
+    if (m_size - m_offset < 4) {
+        return false;
+    }
+
+    const auto* bytes = reinterpret_cast<const unsigned char*>(m_data + m_offset);
+    value = static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 |
+            static_cast<uint32_t>(bytes[2]) << 8 | static_cast<uint32_t>(bytes[3]);
+    m_offset += 4;
+    return true;
+}
+
+bool SFTPPacketReader::getUint64(uint64_t& value) {
+    uint32_t high = 0;
+    uint32_t low = 0;
+    if (!getUint32(high) || !getUint32(low)) {
+        return false;
+    }
+
+    value = static_cast<uint64_t>(high) << 32 | low;
+    return true;
+}
+
+bool SFTPPacketReader::getString(std::string& value) {
+    const char* data = nullptr;
+    uint32_t size = 0;
+    if (!getStringView(data, size)) {
+        return false;
+    }
+
+    value.assign(data, size);
+    return true;
+}
+
+bool SFTPPacketReader::getStringView(const char*& data, uint32_t& size) {
+    if (!getUint32(size) || m_size - m_offset < size) {
+        return false;
+    }
+
+    data = m_data + m_offset;
+    m_offset += size;
+    return true;
+}
+
+bool SFTPPacketReader::getAttributes(sftp_attributes_struct& attributes) {
+    if (!getUint32(attributes.flags)) {
+        return false;
+    }
+
+    if ((attributes.flags & SSH_FILEXFER_ATTR_SIZE) && !getUint64(attributes.size)) {
+        return false;
+    }
+
+    if ((attributes.flags & SSH_FILEXFER_ATTR_UIDGID) &&
+        (!getUint32(attributes.uid) || !getUint32(attributes.gid))) {
+        return false;
+    }
+
+    if ((attributes.flags & SSH_FILEXFER_ATTR_PERMISSIONS) && !getUint32(attributes.permissions)) {
+        return false;
+    }
+
+    if (attributes.flags & SSH_FILEXFER_ATTR_ACMODTIME) {
+        if (!getUint32(attributes.atime) || !getUint32(attributes.mtime)) {
+            return false;
+        }
+        attributes.atime64 = attributes.atime;
+        attributes.mtime64 = attributes.mtime;
+    }
+
+    // Extended attributes are skipped, nothing in this library uses them.
+    if (attributes.flags & SSH_FILEXFER_ATTR_EXTENDED) {
+        uint32_t count = 0;
+        if (!getUint32(count)) {
+            return false;
+        }
+
+        std::string ignored;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!getString(ignored) || !getString(ignored)) {
+                return false;
+            }
+        }
+        attributes.flags &= ~static_cast<uint32_t>(SSH_FILEXFER_ATTR_EXTENDED);
+    }
+
+    // Version 3 has no type field, libssh derives it from the permissions the same way.
+    attributes.type = SSH_FILEXFER_TYPE_UNKNOWN;
+    if (attributes.flags & SSH_FILEXFER_ATTR_PERMISSIONS) {
+        switch (attributes.permissions & 0170000) {
+            case 0100000:
+                attributes.type = SSH_FILEXFER_TYPE_REGULAR;
+                break;
+            case 0040000:
+                attributes.type = SSH_FILEXFER_TYPE_DIRECTORY;
+                break;
+            case 0120000:
+                attributes.type = SSH_FILEXFER_TYPE_SYMLINK;
+                break;
+            default:
+                attributes.type = SSH_FILEXFER_TYPE_SPECIAL;
+                break;
+        }
+    }
+
+    return true;
+}
+
+SFTPError SFTPSideChannel::open() {
+    m_channel.reset(ssh_channel_new(m_session));
+    if (!m_channel || ssh_channel_open_session(m_channel.get()) != SSH_OK ||
+        ssh_channel_request_subsystem(m_channel.get(), "sftp") != SSH_OK) {
+        return channelError("Failed to open an SFTP channel");
+    }
+
+    std::string body;
+    if (!writePacket(SFTPPacketWriter(SSH_FXP_INIT).putUint32(3).finish()) ||
+        !readPacket(body)) {
+        return channelError("SFTP version exchange failed");
+    }
+
+    SFTPPacketReader reader(body.data(), body.size());
+    uint8_t type = 0;
+    uint32_t version = 0;
+    if (!reader.getUint8(type) || type != SSH_FXP_VERSION || !reader.getUint32(version)) {
+        return SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed SFTP version packet");
+    }
+
+    std::string name, data;
+    while (reader.getString(name) && reader.getString(data)) {
+        m_extensions[name] = data;
+    }
+
+    return SFTPError();
+}
+
+SFTPError SFTPSideChannel::request(const std::string& packet, uint8_t& type, std::string& body) {
+    auto err = send(packet);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    uint32_t id = 0;
+    err = receive(id, type, body);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    if (id != m_nextId - 1) {
+        return SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Unexpected SFTP reply");
+    }
+
+    return SFTPError();
+}
+
+SFTPError SFTPSideChannel::send(const std::string& packet) {
+    if (!writePacket(packet)) {
+        return channelError("SFTP request failed");
+    }
+
+    return SFTPError();
+}
+
+SFTPError SFTPSideChannel::receive(uint32_t& id, uint8_t& type, std::string& body) {
+    std::string reply;
+    if (!readPacket(reply)) {
+        return channelError("SFTP request failed");
+    }
+
+    SFTPPacketReader reader(reply.data(), reply.size());
+    if (!reader.getUint8(type) || !reader.getUint32(id)) {
+        return SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Truncated SFTP packet");
+    }
+
+    body = reply.substr(5);
+    return SFTPError();
+}
+
+SFTPError SFTPSideChannel::requestStatus(const std::string& packet) {
+    uint8_t type = 0;
+    std::string body;
+    const auto err = request(packet, type, body);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    SFTPPacketReader reader(body.data(), body.size());
+    return statusError(type, reader);
+}
+
+SFTPError SFTPSideChannel::openFile(const std::string& path, const uint32_t flags,
+                                    const uint32_t permissions, std::string& handle) {
+    const auto packet = SFTPPacketWriter(SSH_FXP_OPEN, nextId())
+                            .putString(path)
+                            .putUint32(flags)
+                            .putPermissions(permissions)
+                            .finish();
+
+    uint8_t type = 0;
+    std::string body;
+    const auto err = request(packet, type, body);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    SFTPPacketReader reader(body.data(), body.size());
+    if (type != SSH_FXP_HANDLE || !reader.getString(handle)) {
+        return statusError(type, reader);
+    }
+
+    return SFTPError();
+}
+
+SFTPError SFTPSideChannel::closeFile(const std::string& handle) {
+    return requestStatus(SFTPPacketWriter(SSH_FXP_CLOSE, nextId()).putString(handle).finish());
+}
+
+SFTPError SFTPSideChannel::statusError(const uint8_t type, SFTPPacketReader& reader) {
+    if (type != SSH_FXP_STATUS) {
+        return SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Unexpected SFTP response");
+    }
+
+    uint32_t code = 0;
+    std::string message;
+    if (!reader.getUint32(code)) {
+        return SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed SFTP status");
+    }
+    reader.getString(message);  // Missing in some version 3 servers
+
+    if (code == SSH_FX_OK) {
+        return SFTPError();
+    }
+
+    return SFTPError(SSH_OK, static_cast<int>(code), message);
+}
+
+SFTPError SFTPSideChannel::channelError(const std::string& what) const {
+    return SFTPError(ssh_get_error_code(m_session), SSH_FX_FAILURE,
+                     what + " " + ssh_get_error(m_session));
+}
+
+bool SFTPSideChannel::readFully(char* data, uint32_t size) {
+    while (size > 0) {
+        const int bytesRead = ssh_channel_read(m_channel.get(), data, size, 0);
+        if (bytesRead <= 0) {
+            return false;
+        }
+        data += bytesRead;
+        size -= static_cast<uint32_t>(bytesRead);
+    }
+    return true;
+}
+
+bool SFTPSideChannel::readPacket(std::string& body) {
+    uint8_t length[4];
+    if (!readFully(reinterpret_cast<char*>(length), sizeof(length))) {
+        return false;
+    }
+
+    const uint32_t size = uint32_t(length[0]) << 24 | uint32_t(length[1]) << 16 |
+                          uint32_t(length[2]) << 8 | uint32_t(length[3]);
+    if (size == 0 || size > kMaxPacketSize) {
+        return false;
+    }
+
+    body.resize(size);
+    return readFully(&body[0], size);
+}
+
+bool SFTPSideChannel::writePacket(const std::string& packet) {
+    return ssh_channel_write(m_channel.get(), packet.data(),
+                             static_cast<uint32_t>(packet.size())) ==
+           static_cast<int>(packet.size());
+}
+
+void SSHChannelDeleter::operator()(ssh_channel channel) const {
+    if (channel) {
+        ssh_channel_close(channel);
+        ssh_channel_free(channel);
+    }
+}
+
+std::string shellQuote(const std::string& value) {
+    std::string quoted = "'";
+    for (const char c : value) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+SSHChannelPtr openExecChannel(ssh_session session, const std::string& command) {
+    SSHChannelPtr channel(ssh_channel_new(session));
+    if (!channel || ssh_channel_open_session(channel.get()) != SSH_OK ||
+        ssh_channel_request_exec(channel.get(), command.c_str()) != SSH_OK) {
+        return SSHChannelPtr();
+    }
+    return channel;
+}
+
+bool pollExecChannel(ssh_channel channel, const ExecOutputSink& onOutput, std::string& errors) {
+    char buffer[32 * 1024];
+    for (int isStderr = 0; isStderr <= 1; ++isStderr) {
+        while (true) {
+            const int bytesRead =
+                ssh_channel_read_nonblocking(channel, buffer, sizeof(buffer), isStderr);
+            if (bytesRead == SSH_ERROR) {
+                return false;
+            }
+            if (bytesRead <= 0) {
+                break;  // Nothing buffered, or end of file
+            }
+
+            const auto count = static_cast<size_t>(bytesRead);
+            if (isStderr) {
+                if (errors.size() < 1024 * 1024) {
+                    errors.append(buffer, count);
+                }
+            } else if (!onOutput(buffer, count)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool writeExecChannel(ssh_channel channel, const char* data, size_t size,
+                      const ExecOutputSink& onOutput, std::string& errors) {
+    while (size > 0) {
+        const auto count = static_cast<uint32_t>(std::min<size_t>(size, 32 * 1024));
+        const int written = ssh_channel_write(channel, data, count);
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+
+        if (!pollExecChannel(channel, onOutput, errors)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool readExecChannel(ssh_channel channel, const ExecOutputSink& onOutput, std::string& errors) {
+    while (true) {
+        if (!pollExecChannel(channel, onOutput, errors)) {
+            return false;
+        }
+        if (ssh_channel_is_eof(channel)) {
+            return true;
+        }
+        if (ssh_channel_poll_timeout(channel, 100, 0) == SSH_ERROR) {
+            return false;
+        }
+    }
+}
+
+int execChannelExitStatus(ssh_channel channel) {
+    uint32_t code = 0;
+    char* signal = nullptr;
+    if (ssh_channel_get_exit_state(channel, &code, &signal, nullptr) != SSH_OK) {
+        return -1;
+    }
+    if (signal) {
+        ssh_string_free_char(signal);
+        return -1;
+    }
+    return static_cast<int>(code);
+}
+
+bool remoteCommandSucceeds(ssh_session session, const std::string& command) {
+    auto channel = openExecChannel(session, command);
+    if (!channel) {
+        return false;
+    }
+
+    std::string errors;
+    return readExecChannel(channel.get(), [](const char*, size_t) { return true; }, errors) &&
+           execChannelExitStatus(channel.get()) == 0;
+}
+
+namespace {
+
+// The largest size the 11 octal digits of a ustar header hold.
+constexpr uint64_t kMaxUstarSize = 077777777777ull;
+
+void putOctal(char* field, const size_t width, uint64_t value) {
+    field[width - 1] = '\0';
+    for (size_t i = width - 1; i-- > 0;) {
+        field[i] = static_cast<char>('0' + (value & 7));
+        value >>= 3;
+    }
+}
+
+// Octal, or the base-256 form GNU tar uses for values that do not fit.
+uint64_t getNumber(const char* field, const size_t width) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(field);
+    if (bytes[0] & 0x80) {
+        uint64_t value = bytes[0] & 0x7F;
+        for (size_t i = 1; i < width; ++i) {
+            value = value << 8 | bytes[i];
+        }
+        return value;
+    }
+
+    size_t i = 0;
+    while (i < width && field[i] == ' ') {
+        ++i;
+    }
+
+    uint64_t value = 0;
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; ++i) {
+        value = value * 8 + static_cast<uint64_t>(field[i] - '0');
+    }
+    return value;
+}
+
+std::string getString(const char* field, const size_t width) {
+    return std::string(field, std::find(field, field + width, '\0'));
+}
+
+std::string paxRecord(const std::string& key, const std::string& value) {
+    // The length prefix counts its own digits.
+    const size_t base = key.size() + value.size() + 3;  // ' ', '=' and '\n'
+    size_t length = base + std::to_string(base).size();
+    while (length != base + std::to_string(length).size()) {
+        length = base + std::to_string(length).size();
+    }
+    return std::to_string(length) + " " + key + "=" + value + "\n";
+}
+
+// Splits name into the ustar prefix and name fields, if it fits them.
+bool splitName(const std::string& name, std::string& prefix, std::string& rest) {
+    if (name.size() <= 100) {
+        prefix.clear();
+        rest = name;
+        return true;
+    }
+
+    for (size_t slash = std::min<size_t>(name.size() - 1, 155); slash > 0; --slash) {
+        if (name[slash] == '/' && name.size() - slash - 1 <= 100 && slash + 1 < name.size()) {
+            prefix = name.substr(0, slash);
+            rest = name.substr(slash + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string normalizeName(std::string name) {
+    while (name.compare(0, 2, "./") == 0) {
+        name.erase(0, 2);
+    }
+    while (!name.empty() && name[name.size() - 1] == '/') {
+        name.erase(name.size() - 1);
+    }
+    return name;
+}
+
+// Relative and without "..", so it cannot name anything outside the directory.
+bool isContainedPath(const std::string& path) {
+    if (path.empty() || path[0] == '/') {
+        return false;
+    }
+
+    size_t start = 0;
+    while (true) {
+        const auto end = path.find('/', start);
+        if (path.compare(start, end == std::string::npos ? std::string::npos : end - start,
+                         "..") == 0) {
+            return false;
+        }
+        if (end == std::string::npos) {
+            return true;
+        }
+        start = end + 1;
+    }
+}
+
+std::string joinPath(const std::string& dir, const std::string& path) {
+    if (dir.empty()) {
+        return path;
+    }
+    return dir[dir.size() - 1] == '/' ? dir + path : dir + "/" + path;
+}
+
+SFTPError tarError(ssh_session session, const std::string& what) {
+    return SFTPError(ssh_get_error_code(session), SSH_FX_FAILURE,
+                     what + " " + ssh_get_error(session));
+}
+
+// Attaches tar's "tar: <name>: <message>" lines to the files they name.
+void assignErrors(const std::string& errors, const std::map<std::string, size_t>& index,
+                  std::vector<FileTransferResult>& results) {
+    size_t start = 0;
+    while (start < errors.size()) {
+        auto end = errors.find('\n', start);
+        if (end == std::string::npos) {
+            end = errors.size();
+        }
+        const std::string line = errors.substr(start, end - start);
+        start = end + 1;
+
+        const size_t from = line.compare(0, 5, "tar: ") == 0 ? 5 : 0;
+        for (auto colon = line.find(':', from); colon != std::string::npos;
+             colon = line.find(':', colon + 1)) {
+            const auto it = index.find(normalizeName(line.substr(from, colon - from)));
+            if (it != index.end()) {
+                if (results[it->second].error.isOk()) {
+                    results[it->second].error = SFTPError(SSH_OK, SSH_FX_FAILURE, line);
+                }
+                break;
+            }
+        }
+    }
+}
+
+// Results in the order of paths, with the ones that cannot be transferred already failed, and
+// an index from normalized name to result for the rest.
+std::vector<FileTransferResult> prepareResults(const std::vector<std::string>& paths,
+                                               std::map<std::string, size_t>& index) {
+    std::vector<FileTransferResult> results;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        results.push_back({paths[i], SFTPError()});
+
+        const auto name = normalizeName(paths[i]);
+        if (!isContainedPath(name)) {
+            results[i].error = SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                         "Not a path inside the directory: " + paths[i]);
+        } else {
+            index[name] = i;
+        }
+    }
+    return results;
+}
+
+}  // namespace
+
+TarWriter::TarWriter(Sink sink) : m_sink(std::move(sink)) {}
+
+bool TarWriter::beginFile(const std::string& name, const uint64_t size, const uint32_t mode,
+                          const int64_t mtime) {
+    std::string prefix, rest;
+    const bool fits = splitName(name, prefix, rest);
+
+    if (!fits || size > kMaxUstarSize) {
+        std::string records;
+        if (!fits) {
+            records += paxRecord("path", name);
+            prefix.clear();
+            rest = name.substr(0, 100);
+        }
+        if (size > kMaxUstarSize) {
+            records += paxRecord("size", std::to_string(size));
+        }
+
+        if (!writeHeader("././@PaxHeader", "", records.size(), 0644, mtime, 'x') ||
+            !append(records.data(), records.size()) || !pad(records.size())) {
+            return false;
+        }
+    }
+
+    m_entrySize = size;
+    m_remaining = size;
+    return writeHeader(rest, prefix, size > kMaxUstarSize ? 0 : size, mode, mtime, '0');
+}
+
+bool TarWriter::writeData(const char* data, const size_t size) {
+    const auto count = static_cast<size_t>(std::min<uint64_t>(size, m_remaining));
+    m_remaining -= count;
+    return append(data, count) && (m_remaining > 0 || pad(m_entrySize));
+}
+
+bool TarWriter::finish() {
+    const char zeros[2 * kBlockSize] = {};
+    return append(zeros, sizeof(zeros)) && flush();
+}
+
+bool TarWriter::writeHeader(const std::string& name, const std::string& prefix, const uint64_t size,
+                            const uint32_t mode, const int64_t mtime, const char type) {
+    char header[kBlockSize] = {};
+    std::memcpy(header, name.data(), std::min<size_t>(name.size(), 100));
+    putOctal(header + 100, 8, mode & 07777);
+    putOctal(header + 108, 8, 0);  // uid
+    putOctal(header + 116, 8, 0);  // gid
+    putOctal(header + 124, 12, size);
+    putOctal(header + 136, 12, mtime > 0 ? static_cast<uint64_t>(mtime) : 0);
+    header[156] = type;
+    std::memcpy(header + 257, "ustar", 6);
+    std::memcpy(header + 263, "00", 2);
+    std::memcpy(header + 345, prefix.data(), std::min<size_t>(prefix.size(), 155));
+
+    // The checksum is computed with its own field as spaces.
+    std::memset(header + 148, ' ', 8);
+    uint64_t checksum = 0;
+    for (const char c : header) {
+        checksum += static_cast<unsigned char>(c);
+    }
+    putOctal(header + 148, 7, checksum);
+
+    return append(header, sizeof(header));
+}
+
+bool TarWriter::append(const char* data, const size_t size) {
+    if (m_failed) {
+        return false;
+    }
+
+    // Large pieces go straight to the sink instead of through the buffer.
+    if (size >= kFlushSize) {
+        if (!flush() || !m_sink(data, size)) {
+            m_failed = true;
+            return false;
+        }
+        return true;
+    }
+
+    m_buffer.append(data, size);
+    return m_buffer.size() < kFlushSize || flush();
+}
+
+bool TarWriter::pad(const uint64_t size) {
+    const char zeros[kBlockSize] = {};
+    return append(zeros, static_cast<size_t>((kBlockSize - size % kBlockSize) % kBlockSize));
+}
+
+bool TarWriter::flush() {
+    if (m_failed) {
+        return false;
+    }
+    if (!m_buffer.empty() && !m_sink(m_buffer.data(), m_buffer.size())) {
+        m_failed = true;
+    }
+    m_buffer.clear();
+    return !m_failed;
+}
+
+TarReader::TarReader(std::function<bool(const Entry&)> onEntry,
+                     std::function<bool(const char* data, size_t size)> onData,
+                     std::function<bool()> onEnd)
+    : m_onEntry(std::move(onEntry)), m_onData(std::move(onData)), m_onEnd(std::move(onEnd)) {}
+
+bool TarReader::feed(const char* data, size_t size) {
+    while (size > 0 && m_state != State::Finished && m_state != State::Failed) {
+        if (m_state == State::Header) {
+            const size_t count = std::min(size, sizeof(m_header) - m_headerSize);
+            std::memcpy(m_header + m_headerSize, data, count);
+            m_headerSize += count;
+            data += count;
+            size -= count;
+
+            if (m_headerSize == sizeof(m_header)) {
+                m_headerSize = 0;
+                if (!parseHeader()) {
+                    m_state = State::Failed;
+                }
+            }
+            continue;
+        }
+
+        const uint64_t left = m_remaining > 0 ? m_remaining : m_padding;
+        const auto count = static_cast<size_t>(std::min<uint64_t>(size, left));
+        if (m_remaining > 0) {
+            if (m_state == State::FileData && !m_onData(data, count)) {
+                m_state = State::Failed;
+                break;
+            }
+            if (m_state == State::MetaData) {
+                m_meta.append(data, count);
+            }
+            m_remaining -= count;
+        } else {
+            m_padding -= count;
+        }
+        data += count;
+        size -= count;
+
+        if (m_remaining == 0 && m_padding == 0 && !endData()) {
+            m_state = State::Failed;
+        }
+    }
+
+    return m_state != State::Failed;
+}
+
+bool TarReader::parseHeader() {
+    if (std::all_of(m_header, m_header + sizeof(m_header), [](char c) { return c == '\0'; })) {
+        if (++m_zeroBlocks == 2) {
+            m_state = State::Finished;
+        }
+        return true;
+    }
+    m_zeroBlocks = 0;
+
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < sizeof(m_header); ++i) {
+        checksum += i >= 148 && i < 156 ? ' ' : static_cast<unsigned char>(m_header[i]);
+    }
+    if (checksum != getNumber(m_header + 148, 8)) {
+        return false;
+    }
+
+    const char type = m_header[156] == '\0' ? '0' : m_header[156];
+    const uint64_t headerSize = getNumber(m_header + 124, 12);
+
+    if (type == 'x' || type == 'L') {
+        if (headerSize > 1024 * 1024) {
+            return false;  // Far beyond any real name or attribute set
+        }
+        m_state = State::MetaData;
+        m_metaType = type;
+        m_meta.clear();
+        m_remaining = headerSize;
+    } else if (type == 'g') {
+        m_state = State::Skip;  // Global pax attributes carry nothing needed here
+        m_remaining = headerSize;
+    } else {
+        Entry entry;
+        entry.type = type == '7' ? '0' : type;  // Contiguous files are plain files
+        entry.size = m_hasNextSize ? m_nextSize : headerSize;
+        entry.mode = static_cast<uint32_t>(getNumber(m_header + 100, 8));
+
+        if (!m_nextName.empty()) {
+            entry.name = m_nextName;
+        } else {
+            const auto name = getString(m_header, 100);
+            const bool posix = std::memcmp(m_header + 257, "ustar", 6) == 0;
+            const auto prefix = posix ? getString(m_header + 345, 155) : std::string();
+            entry.name = prefix.empty() ? name : prefix + "/" + name;
+        }
+        m_nextName.clear();
+        m_hasNextSize = false;
+
+        if (!m_onEntry(entry)) {
+            return false;
+        }
+
+        m_state = entry.type == '0' ? State::FileData : State::Skip;
+        m_remaining = entry.size;
+    }
+
+    m_padding = (kBlockSize - m_remaining % kBlockSize) % kBlockSize;
+    return m_remaining > 0 || endData();
+}
+
+void TarReader::parsePaxRecords() {
+    size_t position = 0;
+    while (position < m_meta.size()) {
+        const auto space = m_meta.find(' ', position);
+        if (space == std::string::npos) {
+            return;
+        }
+
+        const auto length = std::strtoull(m_meta.c_str() + position, nullptr, 10);
+        if (length <= space - position || position + length > m_meta.size()) {
+            return;
+        }
+
+        const auto record = m_meta.substr(space + 1, position + length - space - 2);
+        const auto equals = record.find('=');
+        if (equals != std::string::npos) {
+            const auto key = record.substr(0, equals);
+            const auto value = record.substr(equals + 1);
+            if (key == "path") {
+                m_nextName = value;
+            } else if (key == "size") {
+                m_nextSize = std::strtoull(value.c_str(), nullptr, 10);
+                m_hasNextSize = true;
+            }
+        }
+        position += length;
+    }
+}
+
+bool TarReader::endData() {
+    const auto state = m_state;
+    m_state = State::Header;
+
+    if (state == State::FileData) {
+        return m_onEnd();
+    }
+
+    if (state == State::MetaData) {
+        if (m_metaType == 'x') {
+            parsePaxRecords();
+        } else {
+            m_nextName = m_meta.substr(0, m_meta.find('\0'));
+        }
+        m_meta.clear();
+    }
+    return true;
+}
+
+bool createParentDirectories(const std::string& path) {
+    for (auto slash = path.find('/', 1); slash != std::string::npos;
+         slash = path.find('/', slash + 1)) {
+        const auto dir = path.substr(0, slash);
+#ifdef _WIN32
+        const int rc = _mkdir(dir.c_str());
+#else
+        const int rc = ::mkdir(dir.c_str(), 0755);
+#endif
+        if (rc != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool remoteTarAvailable(ssh_session session) {
+    return remoteCommandSucceeds(session, "tar --version");
+}
+
+std::pair<SFTPError, std::vector<FileTransferResult>> tarPut(
+    ssh_session session, const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) {
+    std::map<std::string, size_t> index;
+    auto results = prepareResults(paths, index);
+
+    const auto dir = shellQuote(remoteDir.empty() ? "." : remoteDir);
+    auto channel = openExecChannel(session, "mkdir -p -- " + dir + " && exec tar -xf - -C " + dir);
+    if (!channel) {
+        return {tarError(session, "Failed to start tar on the server"), results};
+    }
+
+    std::string errors;
+    const ExecOutputSink ignoreOutput = [](const char*, size_t) { return true; };
+    TarWriter writer([&](const char* data, size_t size) {
+        return writeExecChannel(channel.get(), data, size, ignoreOutput, errors);
+    });
+
+    std::vector<char> buffer(256 * 1024);
+    bool streamed = true;
+
+    for (const auto& entry : index) {
+        auto& result = results[entry.second];
+        const auto localFileName = joinPath(localDir, entry.first);
+
+        struct stat info;
+        std::ifstream file(localFileName, std::ios::binary);
+        if (!file || ::stat(localFileName.c_str(), &info) != 0 ||
+            (info.st_mode & S_IFMT) != S_IFREG) {
+            result.error = SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                                     "Failed to open local file: " + localFileName);
+            continue;
+        }
+
+        auto remaining = static_cast<uint64_t>(info.st_size);
+        streamed = writer.beginFile(entry.first, remaining, static_cast<uint32_t>(info.st_mode),
+                                    static_cast<int64_t>(info.st_mtime));
+
+        while (streamed && remaining > 0) {
+            const auto count = static_cast<size_t>(std::min<uint64_t>(buffer.size(), remaining));
+            file.read(buffer.data(), static_cast<std::streamsize>(count));
+            if (static_cast<size_t>(file.gcount()) < count) {
+                // The header already promised the old size, so the entry is completed with
+                // zeros and the file reported instead.
+                std::fill(buffer.begin() + file.gcount(), buffer.begin() + count, '\0');
+                result.error = SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                         "Local file changed while being sent: " +
+                                                  localFileName);
+            }
+            streamed = writer.writeData(buffer.data(), count);
+            remaining -= count;
+        }
+
+        if (!streamed) {
+            break;
+        }
+    }
+
+    streamed = streamed && writer.finish();
+    ssh_channel_send_eof(channel.get());
+    const bool complete = readExecChannel(channel.get(), ignoreOutput, errors);
+    const int status = complete ? execChannelExitStatus(channel.get()) : -1;
+
+    assignErrors(errors, index, results);
+
+    if (!streamed) {
+        return {tarError(session, "Failed to stream files to tar on the server"), results};
+    }
+
+    // A tar that gave up, say after "Unexpected EOF", never got to the files it did not name,
+    // so only a clean exit confirms them.
+    if (status != 0) {
+        const auto failure = "tar exited with status " + std::to_string(status) +
+                             " on the server before confirming this file";
+        for (const auto& entry : index) {
+            auto& result = results[entry.second];
+            if (result.error.isOk()) {
+                result.error = SFTPError(SSH_OK, SSH_FX_FAILURE, failure);
+            }
+        }
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE, "tar failed on the server: " + errors),
+                results};
+    }
+
+    return {SFTPError(), results};
+}
+
+std::pair<SFTPError, std::vector<FileTransferResult>> tarGet(
+    ssh_session session, const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) {
+    std::map<std::string, size_t> index;
+    auto results = prepareResults(paths, index);
+
+    // Names are read from stdin, NUL separated, so neither the command line length nor odd
+    // characters limit them. The "./" keeps names starting with '-' from looking like options.
+    const auto dir = shellQuote(remoteDir.empty() ? "." : remoteDir);
+    auto channel = openExecChannel(session, "cd -- " + dir + " && exec tar --null -cf - -T -");
+    if (!channel) {
+        return {tarError(session, "Failed to start tar on the server"), results};
+    }
+
+    std::vector<bool> received(results.size(), false);
+    std::ofstream file;
+    size_t current = results.size();  // None
+
+    TarReader reader(
+        [&](const TarReader::Entry& entry) {
+            current = results.size();
+            const auto it = index.find(normalizeName(entry.name));
+            if (entry.type != '0' || it == index.end()) {
+                return true;  // Directories are created as needed, anything else is skipped
+            }
+
+            const auto localFileName = joinPath(localDir, it->first);
+            file.clear();
+            if (createParentDirectories(localFileName)) {
+                file.open(localFileName, std::ios::binary | std::ios::trunc);
+            }
+            if (!file.is_open()) {
+                results[it->second].error = SFTPError(
+                    SSH_OK, SSH_FX_FAILURE, "Failed to open local file: " + localFileName);
+                return true;
+            }
+
+            current = it->second;
+            return true;
+        },
+        [&](const char* data, size_t size) {
+            if (current < results.size() &&
+                !file.write(data, static_cast<std::streamsize>(size))) {
+                results[current].error =
+                    SFTPError(SSH_OK, SSH_FX_FAILURE, "Failed to write local file");
+                file.close();
+                current = results.size();
+            }
+            return true;
+        },
+        [&]() {
+            if (current < results.size()) {
+                file.close();
+                received[current] = !file.fail();
+                current = results.size();
+            }
+            return true;
+        });
+
+    std::string errors;
+    const ExecOutputSink feed = [&](const char* data, size_t size) {
+        return reader.feed(data, size);
+    };
+
+    std::string names;
+    for (const auto& entry : index) {
+        names += "./" + entry.first;
+        names += '\0';
+    }
+
+    const bool requested =
+        writeExecChannel(channel.get(), names.data(), names.size(), feed, errors) &&
+        ssh_channel_send_eof(channel.get()) == SSH_OK;
+    const bool complete = requested && readExecChannel(channel.get(), feed, errors);
+    const int status = complete ? execChannelExitStatus(channel.get()) : -1;
+
+    assignErrors(errors, index, results);
+
+    for (const auto& entry : index) {
+        auto& result = results[entry.second];
+        if (result.error.isOk() && !received[entry.second]) {
+            result.error = SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                                     "Not received from the server: " + entry.first);
+        }
+    }
+
+    if (!complete || !reader.finished()) {
+        return {complete ? SFTPError(SSH_OK, SSH_FX_BAD_MESSAGE,
+                                     "Incomplete archive from tar on the server: " + errors)
+                         : tarError(session, "Failed to read from tar on the server"),
+                results};
+    }
+
+    // A file missing on the server already explains a failed exit. Without one, tar hit an
+    // error that the archive does not show, so the transfer as a whole fails.
+    const bool explained = std::any_of(results.begin(), results.end(),
+                                       [](const FileTransferResult& result) {
+                                           return !result.error.isOk();
+                                       });
+    if (status != 0 && !explained) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE, "tar failed on the server: " + errors),
+                results};
+    }
+
+    return {SFTPError(), results};
+}
+
+#ifdef SFTPCLIENTPP_HAVE_ZSTD
+
+namespace {
+
+// Levels above this need --ultra on zstd's command line.
+constexpr int kMaxZstdLevel = 19;
+
+// Read from the local file per call into the compressor, which hands its workers jobs of a few
+// MiB each.
+constexpr size_t kZstdInputSize = 1024 * 1024;
+
+struct ZstdCCtxDeleter {
+    void operator()(ZSTD_CCtx* context) const { ZSTD_freeCCtx(context); }
+};
+
+struct ZstdDCtxDeleter {
+    void operator()(ZSTD_DCtx* context) const { ZSTD_freeDCtx(context); }
+};
+
+// A download in progress, removed unless it replaced its target.
+class ZstdPartialFile {
+   public:
+    explicit ZstdPartialFile(const std::string& name) : m_name(name) {}
+    ~ZstdPartialFile() {
+        if (!m_replaced) {
+            std::remove(m_name.c_str());
+        }
+    }
+
+    const std::string& name() const { return m_name; }
+
+    bool replace(const std::string& target) {
+#ifdef _WIN32
+        m_replaced = MoveFileExA(m_name.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        m_replaced = std::rename(m_name.c_str(), target.c_str()) == 0;
+#endif
+        return m_replaced;
+    }
+
+   private:
+    ZstdPartialFile(const ZstdPartialFile&) = delete;
+    ZstdPartialFile& operator=(const ZstdPartialFile&) = delete;
+
+    const std::string m_name;
+    bool m_replaced = false;
+};
+
+int zstdCompressionLevel(const TransferOptions& options) {
+    return std::max(1, std::min(options.zstdLevel, kMaxZstdLevel));
+}
+
+SFTPError zstdChannelError(ssh_session session, const std::string& what) {
+    return SFTPError(ssh_get_error_code(session), SSH_FX_FAILURE,
+                     what + " " + ssh_get_error(session));
+}
+
+}  // namespace
+
+bool zstdSupported() { return true; }
+
+std::pair<SFTPError, TransferStats> zstdPut(ssh_session session, const std::string& localFileName,
+                                            const std::string& remoteFileName,
+                                            const TransferOptions& options, Checksum& checksum) {
+    TransferStats stats;
+    stats.zstd = true;
+
+    std::ifstream file(localFileName, std::ios::binary);
+    if (!file) {
+        return {SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                          "Failed to open local file: " + localFileName),
+                stats};
+    }
+
+    // The content checksum lets the remote zstd catch corruption on its own. libzstd built
+    // without threads rejects nbWorkers and compresses on this thread instead.
+    std::unique_ptr<ZSTD_CCtx, ZstdCCtxDeleter> context(ZSTD_createCCtx());
+    if (!context ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(context.get(), ZSTD_c_compressionLevel,
+                                            zstdCompressionLevel(options))) ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(context.get(), ZSTD_c_checksumFlag, 1))) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE, "Failed to set up the zstd compressor"), stats};
+    }
+    const unsigned int threads = options.zstdThreads > 0
+                                     ? options.zstdThreads
+                                     : std::max(std::thread::hardware_concurrency(), 1u);
+    ZSTD_CCtx_setParameter(context.get(), ZSTD_c_nbWorkers, static_cast<int>(threads));
+
+    // zstd writes through -o like SFTP creates files, owner only, and keeps runs of zeros
+    // sparse.
+    auto channel = openExecChannel(
+        session, "umask 077 && exec zstd -d -q -f -o " + shellQuote(remoteFileName));
+    if (!channel) {
+        return {zstdChannelError(session, "Failed to start zstd on the server"), stats};
+    }
+
+    const ExecOutputSink ignoreOutput = [](const char*, size_t) { return true; };
+    std::vector<char> input(kZstdInputSize);
+    std::vector<char> output(ZSTD_CStreamOutSize());
+    std::string errors;
+
+    bool last = false;
+    while (!last) {
+        file.read(input.data(), static_cast<std::streamsize>(input.size()));
+        if (file.bad()) {
+            return {SFTPError(SSH_OK, SSH_FX_FAILURE,
+                              "Failed to read local file: " + localFileName),
+                    stats};
+        }
+        const auto count = static_cast<size_t>(file.gcount());
+        last = count < input.size();
+        checksum.update(input.data(), count);
+
+        // Without ZSTD_e_end the compressor may hold on to input until its jobs fill up.
+        ZSTD_inBuffer in = {input.data(), count, 0};
+        const auto mode = last ? ZSTD_e_end : ZSTD_e_continue;
+        bool consumed = false;
+        while (!consumed) {
+            ZSTD_outBuffer out = {output.data(), output.size(), 0};
+            const size_t remaining = ZSTD_compressStream2(context.get(), &out, &in, mode);
+            if (ZSTD_isError(remaining)) {
+                return {SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                  std::string("zstd compression failed: ") +
+                                      ZSTD_getErrorName(remaining)),
+                        stats};
+            }
+
+            // zstd that exited early, say for a missing directory, explains why on stderr.
+            if (out.pos > 0 &&
+                !writeExecChannel(channel.get(), output.data(), out.pos, ignoreOutput, errors)) {
+                return {errors.empty()
+                            ? zstdChannelError(session, "Failed to stream to zstd on the server")
+                            : SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                        "zstd failed on the server: " + errors),
+                        stats};
+            }
+            stats.wireBytes += out.pos;
+            consumed = last ? remaining == 0 : in.pos == in.size;
+        }
+
+        // Nothing counts as acknowledged before zstd on the server exits cleanly, as a broken
+        // frame leaves no remote file to resume, so progress stays at 0 until then.
+        stats.bytes += count;
+        if (options.progress && !options.progress(0)) {
+            return {SFTPError(SSH_OK, SFTPError::kCancelled, "Transfer cancelled"), stats};
+        }
+    }
+
+    ssh_channel_send_eof(channel.get());
+    if (!readExecChannel(channel.get(), ignoreOutput, errors)) {
+        return {zstdChannelError(session, "Failed to stream to zstd on the server"), stats};
+    }
+    if (execChannelExitStatus(channel.get()) != 0) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE, "zstd failed on the server: " + errors),
+                stats};
+    }
+
+    if (options.progress) {
+        options.progress(stats.bytes);
+    }
+    return {SFTPError(), stats};
+}
+
+std::pair<SFTPError, TransferStats> zstdGet(ssh_session session, const std::string& localFileName,
+                                            const std::string& remoteFileName,
+                                            const TransferOptions& options, Checksum& checksum) {
+    TransferStats stats;
+    stats.zstd = true;
+
+    std::unique_ptr<ZSTD_DCtx, ZstdDCtxDeleter> context(ZSTD_createDCtx());
+    if (!context) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE, "Failed to set up the zstd decompressor"),
+                stats};
+    }
+
+    // The stream goes to a file next to localFileName, which only replaces it once everything
+    // arrived, so a missing remote file or a failed transfer leaves the local one as it was.
+    // Declared before the stream so that the stream is closed before the file is removed.
+    ZstdPartialFile partial(localFileName + ".zstdpart");
+    std::ofstream file(partial.name(), std::ios::binary);
+    if (!file) {
+        return {SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                          "Failed to open local file: " + partial.name()),
+                stats};
+    }
+
+    // -T0 has zstd use every core of the server.
+    auto channel = openExecChannel(
+        session, "exec zstd -q -c -T" + std::to_string(options.zstdThreads) + " -" +
+                     std::to_string(zstdCompressionLevel(options)) + " -- " +
+                     shellQuote(remoteFileName));
+    if (!channel) {
+        return {zstdChannelError(session, "Failed to start zstd on the server"), stats};
+    }
+
+    std::vector<char> output(ZSTD_DStreamOutSize());
+    size_t pending = 0;  // 0 once a frame is complete
+    SFTPError failure;
+    const ExecOutputSink feed = [&](const char* data, size_t size) {
+        stats.wireBytes += size;
+
+        // A full output buffer can leave decompressed data behind in the context.
+        ZSTD_inBuffer in = {data, size, 0};
+        bool full = false;
+        while (in.pos < in.size || full) {
+            ZSTD_outBuffer out = {output.data(), output.size(), 0};
+            const size_t consumed = in.pos;
+            const size_t result = ZSTD_decompressStream(context.get(), &out, &in);
+            if (ZSTD_isError(result)) {
+                failure = SFTPError(SSH_OK, SSH_FX_BAD_MESSAGE,
+                                    std::string("Corrupt zstd stream from the server: ") +
+                                        ZSTD_getErrorName(result));
+                return false;
+            }
+
+            // After the end of a frame, a call that finds nothing to do already asks for the
+            // header of the next one.
+            if (in.pos > consumed || out.pos > 0) {
+                pending = result;
+            }
+
+            if (!file.write(output.data(), static_cast<std::streamsize>(out.pos))) {
+                failure = SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                    "Failed to write local file: " + localFileName);
+                return false;
+            }
+            checksum.update(output.data(), out.pos);
+            stats.bytes += out.pos;
+            full = out.pos == out.size;
+        }
+
+        // The partial file is removed on failure, so nothing is reported before it replaced
+        // localFileName.
+        if (options.progress && !options.progress(0)) {
+            failure = SFTPError(SSH_OK, SFTPError::kCancelled, "Transfer cancelled");
+            return false;
+        }
+        return true;
+    };
+
+    // Once reading stopped early the exit status would wait for a process that is stuck on a
+    // full channel window, so it is only asked for after a complete read.
+    std::string errors;
+    const bool complete = readExecChannel(channel.get(), feed, errors);
+    if (!failure.isOk()) {
+        return {failure, stats};
+    }
+    if (!complete) {
+        return {zstdChannelError(session, "Failed to read from zstd on the server"), stats};
+    }
+    if (execChannelExitStatus(channel.get()) != 0) {
+        const int code =
+            errors.find("No such file") != std::string::npos ? SSH_FX_NO_SUCH_FILE : SSH_FX_FAILURE;
+        return {SFTPError(SSH_OK, code, "zstd failed on the server: " + errors), stats};
+    }
+    if (pending != 0) {
+        return {SFTPError(SSH_OK, SSH_FX_BAD_MESSAGE, "Incomplete zstd stream from the server"),
+                stats};
+    }
+
+    file.close();
+    if (!file) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE, "Failed to write local file: " + localFileName),
+                stats};
+    }
+    if (!partial.replace(localFileName)) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE,
+                          "Failed to replace local file: " + localFileName),
+                stats};
+    }
+
+    if (options.progress) {
+        options.progress(stats.bytes);
+    }
+    return {SFTPError(), stats};
+}
+
+#else
+
+bool zstdSupported() { return false; }
+
+std::pair<SFTPError, TransferStats> zstdPut(ssh_session, const std::string&, const std::string&,
+                                            const TransferOptions&, Checksum&) {
+    return {SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED, "Built without libzstd"), TransferStats()};
+}
+
+std::pair<SFTPError, TransferStats> zstdGet(ssh_session, const std::string&, const std::string&,
+                                            const TransferOptions&, Checksum&) {
+    return {SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED, "Built without libzstd"), TransferStats()};
+}
+
+#endif
+
+bool remoteZstdAvailable(ssh_session session) {
+    return remoteCommandSucceeds(session, "zstd --version");
+}
+
+struct SFTPBatchTransfer::File {
+    size_t index = 0;
+    std::string localFileName;
+    std::string remoteFileName;
+    std::ifstream in;
+    std::ofstream out;
+    std::string handle;
+    std::vector<char> buffer;
+    uint64_t offset = 0;
+    unsigned int outstanding = 0;
+
+    // Reads a download keeps outstanding. Most files in a batch fit into one chunk, so more
+    // are only asked for once a full chunk showed that the file is larger.
+    unsigned int window = 1;
+
+    bool endOfFile = false;
+    bool closing = false;
+    SFTPError error;
+};
+
+SFTPBatchTransfer::SFTPBatchTransfer(ssh_session session, const ConnectOptions& options,
+                                     const uint32_t maxReadLength, const uint32_t maxWriteLength)
+    : m_channel(session),
+      m_configuredChunkSize(std::max(options.chunkSize, 1u)),
+      m_maxReadLength(std::min(maxReadLength, uint32_t(SFTPSideChannel::kMaxDataLength))),
+      m_maxWriteLength(maxWriteLength),
+      m_maxInFlight(std::max(options.maxInFlightRequests, 1u)),
+      m_maxFiles(std::max(options.maxFilesInFlight, 1u)) {}
+
+SFTPError SFTPBatchTransfer::open() { return m_channel.open(); }
+
+std::pair<SFTPError, std::vector<FileTransferResult>> SFTPBatchTransfer::put(
+    const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) {
+    return run(localDir, paths, remoteDir, true);
+}
+
+std::pair<SFTPError, std::vector<FileTransferResult>> SFTPBatchTransfer::get(
+    const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) {
+    return run(localDir, paths, remoteDir, false);
+}
+
+std::pair<SFTPError, std::vector<FileTransferResult>> SFTPBatchTransfer::run(
+    const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir, const bool upload) {
+    m_upload = upload;
+    m_error = SFTPError();
+    m_chunkSize = std::max(
+        std::min(m_configuredChunkSize, upload ? m_maxWriteLength : m_maxReadLength), 1u);
+
+    m_results.clear();
+    std::vector<std::shared_ptr<File>> files;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        auto file = std::make_shared<File>();
+        file->index = i;
+        file->localFileName = localDir.empty() ? paths[i] : localDir + "/" + paths[i];
+        file->remoteFileName = remoteDir.empty() ? paths[i] : remoteDir + "/" + paths[i];
+        files.push_back(file);
+        m_results.push_back({paths[i], SFTPError()});
+    }
+
+    if (upload) {
+        std::vector<std::string> remoteFileNames;
+        for (const auto& file : files) {
+            remoteFileNames.push_back(file->remoteFileName);
+        }
+        createRemoteDirectories(remoteFileNames);
+    }
+
+    size_t next = 0;
+    size_t turn = 0;
+    while (m_error.isOk()) {
+        while (m_open.size() < m_maxFiles && next < files.size()) {
+            startFile(files[next++]);
+        }
+
+        // Take turns at the head of the line so one large file cannot hold the whole budget.
+        const auto open = m_open;
+        for (size_t i = 0; i < open.size(); ++i) {
+            const auto& file = open[(turn + i) % open.size()];
+            if (upload) {
+                pumpPut(file);
+            } else {
+                pumpGet(file);
+            }
+        }
+        ++turn;
+
+        if (m_handlers.empty()) {
+            if (next == files.size() && m_open.empty()) {
+                break;
+            }
+            continue;  // Files that failed locally made room for more
+        }
+
+        receive();
+    }
+
+    if (!m_error.isOk()) {
+        for (const auto& file : m_open) {
+            m_results[file->index].error = m_error;
+        }
+        for (; next < files.size(); ++next) {
+            m_results[next].error = m_error;
+        }
+    }
+
+    m_open.clear();
+    m_handlers.clear();
+    m_bytesInFlight = 0;
+    return {m_error, m_results};
+}
+
+void SFTPBatchTransfer::createRemoteDirectories(
+    const std::vector<std::string>& remoteFileNames) {
+    std::map<size_t, std::set<std::string>> byDepth;
+    for (const auto& remoteFileName : remoteFileNames) {
+        size_t depth = 0;
+        for (auto slash = remoteFileName.find('/', 1); slash != std::string::npos;
+             slash = remoteFileName.find('/', slash + 1)) {
+            byDepth[++depth].insert(remoteFileName.substr(0, slash));
+        }
+    }
+
+    // Servers may reorder requests, so a level is only asked for once its parents exist.
+    for (const auto& level : byDepth) {
+        for (const auto& dir : level.second) {
+            auto packet = request(SSH_FXP_MKDIR);
+            packet.putString(dir).putPermissions(0755);
+            // Fails harmlessly for directories that already exist.
+            send(packet, [](uint8_t, SFTPPacketReader&) {});
+        }
+
+        while (!m_handlers.empty() && m_error.isOk()) {
+            receive();
+        }
+    }
+}
+
+void SFTPBatchTransfer::startFile(const std::shared_ptr<File>& file) {
+    if (m_upload) {
+        file->in.open(file->localFileName, std::ios::binary);
+        if (!file->in) {
+            m_results[file->index].error = SFTPError(
+                SSH_OK, SSH_FX_NO_SUCH_FILE, "Failed to open local file: " + file->localFileName);
+            return;
+        }
+        file->buffer.resize(m_chunkSize);
+    }
+
+    m_open.push_back(file);
+
+    auto packet = request(SSH_FXP_OPEN);
+    packet.putString(file->remoteFileName);
+    if (m_upload) {
+        packet.putUint32(SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC)
+            .putPermissions(0600);
+    } else {
+        packet.putUint32(SSH_FXF_READ).putEmptyAttributes();
+    }
+
+    send(packet, [this, file](uint8_t type, SFTPPacketReader& reader) {
+        std::string handle;
+        if (type != SSH_FXP_HANDLE || !reader.getString(handle)) {
+            const auto err = SFTPSideChannel::statusError(type, reader);
+            finishFile(file, SFTPError(err.getSSHErrorCode(), err.getSFTPErrorCode(),
+                                       "Failed to open remote file [" +
+                                                file->remoteFileName + "] " +
+                                                err.getSSHErrorMsg()));
+            return;
+        }
+        // Files without a handle are never written or closed, so one would hold up the batch.
+        if (handle.empty()) {
+            finishFile(file, SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE,
+                                       "Empty handle for remote file [" +
+                                                file->remoteFileName + "]"));
+            return;
+        }
+        file->handle = handle;
+
+        if (!m_upload) {
+            createParentDirectories(file->localFileName);
+            file->out.open(file->localFileName, std::ios::binary);
+            if (!file->out) {
+                file->error = SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                                        "Failed to open local file: " + file->localFileName);
+            }
+        }
+    });
+}
+
+void SFTPBatchTransfer::pumpPut(const std::shared_ptr<File>& file) {
+    if (file->handle.empty() || file->closing) {
+        return;
+    }
+
+    while (!file->endOfFile && file->error.isOk() && file->outstanding < m_maxInFlight &&
+           m_bytesInFlight < kMaxBytesInFlight) {
+        file->in.read(file->buffer.data(), static_cast<std::streamsize>(file->buffer.size()));
+        const auto bytesRead = static_cast<uint32_t>(file->in.gcount());
+        file->endOfFile = !file->in;
+
+        if (file->in.bad()) {
+            file->error = SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                    "Failed to read from local file: " + file->localFileName);
+            break;
+        }
+
+        if (bytesRead == 0) {
+            break;
+        }
+
+        auto packet = request(SSH_FXP_WRITE);
+        packet.putString(file->handle)
+            .putUint64(file->offset)
+            .putString(file->buffer.data(), bytesRead);
+        file->offset += bytesRead;
+        ++file->outstanding;
+        m_bytesInFlight += bytesRead;
+
+        send(packet, [this, file, bytesRead](uint8_t type, SFTPPacketReader& reader) {
+            --file->outstanding;
+            m_bytesInFlight -= bytesRead;
+
+            const auto err = SFTPSideChannel::statusError(type, reader);
+            if (!err.isOk() && file->error.isOk()) {
+                file->error = SFTPError(err.getSSHErrorCode(), err.getSFTPErrorCode(),
+                                        "Failed to write to remote file [" +
+                                                 file->remoteFileName + "] " +
+                                                 err.getSSHErrorMsg());
+            }
+        });
+    }
+
+    if ((file->endOfFile || !file->error.isOk()) && file->outstanding == 0) {
+        closeFile(file);
+    }
+}
+
+void SFTPBatchTransfer::pumpGet(const std::shared_ptr<File>& file) {
+    if (file->handle.empty() || file->closing) {
+        return;
+    }
+
+    while (!file->endOfFile && file->error.isOk() && file->outstanding < file->window &&
+           m_bytesInFlight < kMaxBytesInFlight) {
+        readChunk(file, file->offset, m_chunkSize);
+        file->offset += m_chunkSize;
+    }
+
+    if ((file->endOfFile || !file->error.isOk()) && file->outstanding == 0) {
+        closeFile(file);
+    }
+}
+
+void SFTPBatchTransfer::readChunk(const std::shared_ptr<File>& file, const uint64_t offset,
+                                  const uint32_t length) {
+    auto packet = request(SSH_FXP_READ);
+    packet.putString(file->handle).putUint64(offset).putUint32(length);
+    ++file->outstanding;
+    m_bytesInFlight += length;
+
+    send(packet, [this, file, offset, length](uint8_t type, SFTPPacketReader& reader) {
+        --file->outstanding;
+        m_bytesInFlight -= length;
+
+        const char* data = nullptr;
+        uint32_t size = 0;
+
+        if (type == SSH_FXP_DATA && reader.getStringView(data, size) && size <= length) {
+            if (file->error.isOk()) {
+                file->out.seekp(static_cast<std::streamoff>(offset));
+                file->out.write(data, size);
+                if (!file->out) {
+                    file->error = SFTPError(
+                        SSH_OK, SSH_FX_FAILURE,
+                        "Failed to write to local file [" + file->localFileName + "]");
+                }
+            }
+
+            if (size == length) {
+                file->window = m_maxInFlight;
+            } else if (size > 0 && file->error.isOk()) {
+                // The rest of a short read is asked for again, at the end of the file that
+                // comes back as EOF.
+                readChunk(file, offset + size, length - size);
+            } else if (size == 0 && file->error.isOk()) {
+                // Asking again could go on forever, and skipping it would leave a gap.
+                file->error = SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE,
+                                        "Empty read response for remote file [" +
+                                                 file->remoteFileName + "]");
+            }
+        } else {
+            const auto err = SFTPSideChannel::statusError(type, reader);
+            if (err.getSFTPErrorCode() == SSH_FX_EOF) {
+                file->endOfFile = true;
+            } else if (file->error.isOk()) {
+                file->error = err.isOk() ? SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE,
+                                                     "Malformed read response")
+                                         : err;
+            }
+        }
+    });
+}
+
+void SFTPBatchTransfer::closeFile(const std::shared_ptr<File>& file) {
+    file->closing = true;
+
+    auto packet = request(SSH_FXP_CLOSE);
+    packet.putString(file->handle);
+
+    send(packet, [this, file](uint8_t type, SFTPPacketReader& reader) {
+        const auto err = SFTPSideChannel::statusError(type, reader);
+        if (file->out.is_open()) {
+            file->out.close();
+        }
+        finishFile(file, file->error.isOk() ? err : file->error);
+    });
+}
+
+void SFTPBatchTransfer::finishFile(const std::shared_ptr<File>& file, const SFTPError& err) {
+    m_results[file->index].error = err;
+    m_open.erase(std::remove(m_open.begin(), m_open.end(), file), m_open.end());
+}
+
+void SFTPBatchTransfer::send(SFTPPacketWriter& packet, ResponseHandler handler) {
+    if (!m_error.isOk()) {
+        return;
+    }
+
+    m_error = m_channel.send(packet.finish());
+    if (m_error.isOk()) {
+        m_handlers.emplace(m_nextId, std::move(handler));
+    }
+    ++m_nextId;
+}
+
+void SFTPBatchTransfer::receive() {
+    uint32_t id = 0;
+    uint8_t type = 0;
+    std::string body;
+    m_error = m_channel.receive(id, type, body);
+    if (!m_error.isOk()) {
+        return;
+    }
+
+    auto it = m_handlers.find(id);
+    if (it == m_handlers.end()) {
+        return;
+    }
+
+    auto handler = std::move(it->second);
+    m_handlers.erase(it);
+    SFTPPacketReader reader(body.data(), body.size());
+    handler(type, reader);
+}
+
+struct SFTPNonBlockingClient::PutTransfer {
+    std::ifstream file;
+    std::string remoteFileName;
+    std::string handle;
+    std::vector<char> buffer;
+    uint64_t offset = 0;
+    unsigned int outstanding = 0;
+    bool endOfFile = false;
+    bool closing = false;
+    SFTPError error;
+    Callback done;
+};
+
+struct SFTPNonBlockingClient::GetTransfer {
+    std::ofstream file;
+    std::string localFileName;
+    std::string handle;
+    uint32_t chunkSize = 0;
+    uint64_t nextOffset = 0;
+    unsigned int outstanding = 0;
+    bool endOfFile = false;
+    bool closing = false;
+    SFTPError error;
+    Callback done;
+};
+
+struct SFTPNonBlockingClient::Listing {
+    std::string remoteDir;
+    std::string handle;
+    std::vector<SFTPAttributes> entries;
+    LsCallback done;
+};
+
+SFTPNonBlockingClient::~SFTPNonBlockingClient() { disconnect(); }
+
+SFTPError SFTPNonBlockingClient::connect(const std::string& host, const std::string& user,
+                                         const std::string& pw, const ConnectOptions& options,
+                                         const uint16_t port, const bool onlyKnownServers) {
+    disconnect();
+    m_options = options;
+    m_onlyKnownServers = onlyKnownServers;
+    m_password = pw;
+
+    m_sshSession = SSHSessionPtr(ssh_new());
+    if (!m_sshSession) {
+        return SFTPError(SSH_ERROR, SSH_FX_OK, "Failed to create ssh session.");
+    }
+
+    // libssh reads the port as an unsigned int
+    const unsigned int sshPort = port;
+
+    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_HOST, host.c_str());
+    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_PORT, &sshPort);
+    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_USER, user.c_str());
+
+    const bool compress = options.compression == ConnectOptions::Compression::On;
+    const auto err = applySessionOptions(m_sshSession.get(), options, compress);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    ssh_set_blocking(m_sshSession.get(), 0);
+    m_state = State::Connecting;
+
+    // The first step resolves the host and starts the TCP connect, so fd() is valid afterwards.
+    advanceHandshake();
+
+    return m_error;
+}
+
+void SFTPNonBlockingClient::disconnect() {
+    m_handlers.clear();
+    m_queued.clear();
+    m_inbox.clear();
+    m_outbox.clear();
+    m_outboxOffset = 0;
+    m_nextId = 1;
+    m_maxReadLength = kFallbackMaxChunkSize;
+    m_maxWriteLength = kFallbackMaxChunkSize;
+    m_password.clear();
+    m_channel.reset();
+    m_sshSession.reset();
+    m_state = State::Disconnected;
+    m_error = SFTPError();
+}
+
+int SFTPNonBlockingClient::fd() const {
+    return m_sshSession ? static_cast<int>(ssh_get_fd(m_sshSession.get())) : -1;
+}
+
+bool SFTPNonBlockingClient::wantsRead() const {
+    return m_sshSession && m_state != State::Disconnected && m_state != State::Failed;
+}
+
+bool SFTPNonBlockingClient::wantsWrite() const {
+    if (!wantsRead()) {
+        return false;
+    }
+
+    // Work that only needs process() to run is reported as writability too, which an idle
+    // socket signals immediately.
+    if (m_state == State::Ready && !m_queued.empty()) {
+        return true;
+    }
+
+    if (m_outboxOffset < m_outbox.size() && m_channel &&
+        ssh_channel_window_size(m_channel.get()) > 0) {
+        return true;
+    }
+
+    return (ssh_get_poll_flags(m_sshSession.get()) & SSH_WRITE_PENDING) != 0;
+}
+
+SFTPError SFTPNonBlockingClient::process() {
+    if (m_state == State::Disconnected || m_state == State::Failed) {
+        return m_error;
+    }
+
+    if (m_state < State::Initializing && !advanceHandshake()) {
+        return m_error;
+    }
+
+    if (m_state >= State::Initializing) {
+        readIncoming();
+    }
+
+    if (m_state == State::Ready) {
+        while (!m_queued.empty()) {
+            auto operation = std::move(m_queued.front());
+            m_queued.pop_front();
+            operation();
+        }
+    }
+
+    if (m_state >= State::Initializing) {
+        flushOutbox();
+    }
+
+    return m_error;
+}
+
+void SFTPNonBlockingClient::put(const std::string& localFileName, const std::string& remoteFileName,
+                                Callback done) {
+    start([this, localFileName, remoteFileName, done]() {
+        auto transfer = std::make_shared<PutTransfer>();
+        transfer->remoteFileName = remoteFileName;
+        transfer->done = done;
+        transfer->file.open(localFileName, std::ios::binary);
+        if (!transfer->file) {
+            done(SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                           "Failed to open local file: " + localFileName));
+            return;
+        }
+
+        auto packet = request(SSH_FXP_OPEN);
+        packet.putString(remoteFileName)
+            .putUint32(SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC)
+            .putPermissions(S_IRUSR | S_IWUSR);
+
+        send(packet, [this, transfer](uint8_t type, SFTPPacketReader& reader) {
+            if (type != SSH_FXP_HANDLE || !reader.getString(transfer->handle)) {
+                transfer->done(statusError(type, reader));
+                return;
+            }
+
+            const auto chunkSize = std::min(m_options.chunkSize, m_maxWriteLength);
+            transfer->buffer.resize(std::max(chunkSize, 1u));
+            pumpPut(transfer);
+        });
+    });
+}
+
+void SFTPNonBlockingClient::get(const std::string& localFileName, const std::string& remoteFileName,
+                                Callback done) {
+    start([this, localFileName, remoteFileName, done]() {
+        auto transfer = std::make_shared<GetTransfer>();
+        transfer->localFileName = localFileName;
+        transfer->done = done;
+
+        auto packet = request(SSH_FXP_OPEN);
+        packet.putString(remoteFileName).putUint32(SSH_FXF_READ).putEmptyAttributes();
+
+        send(packet, [this, transfer](uint8_t type, SFTPPacketReader& reader) {
+            if (type != SSH_FXP_HANDLE || !reader.getString(transfer->handle)) {
+                transfer->done(statusError(type, reader));
+                return;
+            }
+
+            transfer->file.open(transfer->localFileName, std::ios::binary);
+            if (!transfer->file) {
+                transfer->error = SFTPError(
+                    SSH_OK, SSH_FX_NO_SUCH_FILE, "Failed to open local file: " + transfer->localFileName);
+                transfer->closing = true;
+                closeHandle(transfer->handle, [transfer](const SFTPError&) {
+                    transfer->done(transfer->error);
+                });
+                return;
+            }
+
+            transfer->chunkSize = std::max(std::min(m_options.chunkSize, m_maxReadLength), 1u);
+            pumpGet(transfer);
+        });
+    });
+}
+
+void SFTPNonBlockingClient::mkdir(const std::string& remoteDir, const mode_t permissions,
+                                  Callback done) {
+    start([this, remoteDir, permissions, done]() {
+        auto packet = request(SSH_FXP_MKDIR);
+        packet.putString(remoteDir).putPermissions(static_cast<uint32_t>(permissions));
+        send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+            done(statusError(type, reader));
+        });
+    });
+}
+
+void SFTPNonBlockingClient::ls(const std::string& remoteDir, LsCallback done) {
+    start([this, remoteDir, done]() {
+        auto listing = std::make_shared<Listing>();
+        listing->remoteDir = remoteDir;
+        listing->done = done;
+
+        auto packet = request(SSH_FXP_OPENDIR);
+        packet.putString(remoteDir);
+
+        send(packet, [this, listing](uint8_t type, SFTPPacketReader& reader) {
+            if (type != SSH_FXP_HANDLE || !reader.getString(listing->handle)) {
+                listing->done(statusError(type, reader), {});
+                return;
+            }
+
+            readDirectory(listing);
+        });
+    });
+}
+
+void SFTPNonBlockingClient::rename(const std::string& oldRemoteName,
+                                   const std::string& newRemoteName, Callback done) {
+    start([this, oldRemoteName, newRemoteName, done]() {
+        auto packet = request(SSH_FXP_RENAME);
+        packet.putString(oldRemoteName).putString(newRemoteName);
+        send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+            done(statusError(type, reader));
+        });
+    });
+}
+
+void SFTPNonBlockingClient::rm(const std::string& remoteFileName, Callback done) {
+    start([this, remoteFileName, done]() {
+        auto packet = request(SSH_FXP_REMOVE);
+        packet.putString(remoteFileName);
+        send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+            done(statusError(type, reader));
+        });
+    });
+}
+
+void SFTPNonBlockingClient::rmdir(const std::string& remoteDirName, Callback done) {
+    start([this, remoteDirName, done]() {
+        auto packet = request(SSH_FXP_RMDIR);
+        packet.putString(remoteDirName);
+        send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+            done(statusError(type, reader));
+        });
+    });
+}
+
+void SFTPNonBlockingClient::stat(const std::string& remotePath, StatCallback done) {
+    start([this, remotePath, done]() {
+        auto packet = request(SSH_FXP_LSTAT);
+        packet.putString(remotePath);
+        send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+            if (type != SSH_FXP_ATTRS) {
+                done(statusError(type, reader), {});
+                return;
+            }
+
+            auto* attributes =
+                static_cast<sftp_attributes>(std::calloc(1, sizeof(sftp_attributes_struct)));
+            SFTPAttributes result(attributes);
+            if (!attributes || !reader.getAttributes(*attributes)) {
+                done(SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed attributes"), {});
+                return;
+            }
+
+            done(SFTPError(), result);
+        });
+    });
+}
+
+bool SFTPNonBlockingClient::advanceHandshake() {
+    while (m_state < State::Initializing) {
+        switch (m_state) {
+            case State::Connecting: {
+                const int rc = ssh_connect(m_sshSession.get());
+                if (rc == SSH_AGAIN) {
+                    return true;
+                }
+                if (rc != SSH_OK) {
+                    fail(SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                applySocketOptions(m_sshSession.get(), m_options);
+
+                if (m_onlyKnownServers &&
+                    ssh_session_is_known_server(m_sshSession.get()) != SSH_KNOWN_HOSTS_OK) {
+                    fail(SFTPError(ssh_get_error_code(m_sshSession.get()), SSH_FX_OK,
+                                   ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                m_state = State::Authenticating;
+                break;
+            }
+
+            case State::Authenticating: {
+                const int rc =
+                    ssh_userauth_password(m_sshSession.get(), nullptr, m_password.c_str());
+                if (rc == SSH_AUTH_AGAIN) {
+                    return true;
+                }
+                if (rc != SSH_AUTH_SUCCESS) {
+                    fail(SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                m_password.clear();
+                m_channel = SSHChannelPtr(ssh_channel_new(m_sshSession.get()));
+                if (!m_channel) {
+                    fail(SFTPError(SSH_ERROR, SSH_FX_OK, ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                m_state = State::OpeningChannel;
+                break;
+            }
+
+            case State::OpeningChannel: {
+                const int rc = ssh_channel_open_session(m_channel.get());
+                if (rc == SSH_AGAIN) {
+                    return true;
+                }
+                if (rc != SSH_OK) {
+                    fail(SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                m_state = State::StartingSubsystem;
+                break;
+            }
+
+            case State::StartingSubsystem: {
+                const int rc = ssh_channel_request_subsystem(m_channel.get(), "sftp");
+                if (rc == SSH_AGAIN) {
+                    return true;
+                }
+                if (rc != SSH_OK) {
+                    fail(SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                SFTPPacketWriter init(SSH_FXP_INIT);
+                init.putUint32(3);
+                m_outbox += init.finish();
+                m_state = State::Initializing;
+                break;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void SFTPNonBlockingClient::handleVersion(SFTPPacketReader& reader) {
+    uint32_t version = 0;
+    if (!reader.getUint32(version) || version < 3) {
+        fail(SFTPError(SSH_ERROR, SSH_FX_OP_UNSUPPORTED, "Unsupported SFTP version"));
+        return;
+    }
+
+    bool hasLimits = false;
+    std::string name;
+    std::string data;
+    while (!reader.atEnd() && reader.getString(name) && reader.getString(data)) {
+        hasLimits = hasLimits || (name == "limits@openssh.com" && data == "1");
+    }
+
+    if (!hasLimits) {
+        becomeReady();
+        return;
+    }
+
+    auto packet = request(SSH_FXP_EXTENDED);
+    packet.putString("limits@openssh.com");
+
+    send(packet, [this](uint8_t type, SFTPPacketReader& limits) {
+        uint64_t maxPacketLength = 0;
+        uint64_t maxReadLength = 0;
+        uint64_t maxWriteLength = 0;
+
+        if (type == SSH_FXP_EXTENDED_REPLY && limits.getUint64(maxPacketLength) &&
+            limits.getUint64(maxReadLength) && limits.getUint64(maxWriteLength)) {
+            const uint64_t maxChunk = kMaxPacketLength / 2;
+            if (maxReadLength > 0) {
+                m_maxReadLength = static_cast<uint32_t>(std::min(maxReadLength, maxChunk));
+            }
+            if (maxWriteLength > 0) {
+                m_maxWriteLength = static_cast<uint32_t>(std::min(maxWriteLength, maxChunk));
+            }
+        }
+
+        if (m_state == State::Initializing) {
+            becomeReady();
+        }
+    });
+}
+
+void SFTPNonBlockingClient::becomeReady() {
+    m_state = State::Ready;
+
+    while (!m_queued.empty()) {
+        auto operation = std::move(m_queued.front());
+        m_queued.pop_front();
+        operation();
+    }
+}
+
+void SFTPNonBlockingClient::fail(const SFTPError& err) {
+    if (m_state == State::Failed) {
+        return;
+    }
+
+    m_state = State::Failed;
+    m_error = err;
+
+    // Every outstanding request is answered with a connection-lost status, so each operation
+    // finishes through its usual error path. Requests sent from here on are answered the same
+    // way straight away.
+    auto handlers = std::move(m_handlers);
+    m_handlers.clear();
+
+    SFTPPacketWriter lost(SSH_FXP_STATUS);
+    lost.putUint32(SSH_FX_CONNECTION_LOST).putString(err.getSSHErrorMsg()).putString("");
+    const std::string packet = lost.finish();
+
+    for (auto& handler : handlers) {
+        SFTPPacketReader reader(packet.data() + 5, packet.size() - 5);
+        handler.second(SSH_FXP_STATUS, reader);
+    }
+
+    while (!m_queued.empty()) {
+        auto operation = std::move(m_queued.front());
+        m_queued.pop_front();
+        operation();
+    }
+}
+
+void SFTPNonBlockingClient::flushOutbox() {
+    while (m_state != State::Failed && m_outboxOffset < m_outbox.size()) {
+        const auto remaining = std::min<size_t>(m_outbox.size() - m_outboxOffset, 1024 * 1024);
+        const int written = ssh_channel_write(m_channel.get(), m_outbox.data() + m_outboxOffset,
+                                              static_cast<uint32_t>(remaining));
+        if (written == SSH_AGAIN || written == 0) {
+            break;  // Channel window or socket buffer full
+        }
+        if (written < 0) {
+            fail(SFTPError(SSH_ERROR, SSH_FX_CONNECTION_LOST, ssh_get_error(m_sshSession.get())));
+            return;
+        }
+
+        m_outboxOffset += static_cast<size_t>(written);
+    }
+
+    if (m_outboxOffset == m_outbox.size()) {
+        m_outbox.clear();
+        m_outboxOffset = 0;
+    } else if (m_outboxOffset > m_outbox.size() / 2) {
+        m_outbox.erase(0, m_outboxOffset);
+        m_outboxOffset = 0;
+    }
+}
+
+void SFTPNonBlockingClient::readIncoming() {
+    constexpr uint32_t kReadSize = 256 * 1024;
+
+    while (m_state != State::Failed) {
+        const auto used = m_inbox.size();
+        m_inbox.resize(used + kReadSize);
+        const int rc = ssh_channel_read_nonblocking(m_channel.get(), &m_inbox[used], kReadSize, 0);
+        m_inbox.resize(used + static_cast<size_t>(std::max(rc, 0)));
+
+        if (rc == SSH_EOF || (rc < 0 && rc != SSH_AGAIN)) {
+            fail(SFTPError(SSH_ERROR, SSH_FX_CONNECTION_LOST,
+                           rc == SSH_EOF ? std::string("Server closed the SFTP channel")
+                                              : std::string(ssh_get_error(m_sshSession.get()))));
+            return;
+        }
+        if (rc <= 0) {
+            break;
+        }
+    }
+
+    size_t offset = 0;
+    while (m_state != State::Failed && m_inbox.size() - offset >= 4) {
+        SFTPPacketReader header(m_inbox.data() + offset, 4);
+        uint32_t length = 0;
+        header.getUint32(length);
+
+        if (length == 0 || length > kMaxPacketLength) {
+            fail(SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Invalid SFTP packet length"));
+            return;
+        }
+        if (m_inbox.size() - offset - 4 < length) {
+            break;
+        }
+
+        dispatch(m_inbox.data() + offset + 4, length);
+        offset += 4 + length;
+    }
+
+    if (m_state != State::Failed) {
+        m_inbox.erase(0, offset);
+    }
+}
+
+void SFTPNonBlockingClient::dispatch(const char* data, const size_t size) {
+    SFTPPacketReader reader(data, size);
+    uint8_t type = 0;
+    reader.getUint8(type);
+
+    if (type == SSH_FXP_VERSION) {
+        if (m_state == State::Initializing) {
+            handleVersion(reader);
+        }
+        return;
+    }
+
+    uint32_t id = 0;
+    if (!reader.getUint32(id)) {
+        fail(SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Truncated SFTP packet"));
+        return;
+    }
+
+    auto it = m_handlers.find(id);
+    if (it == m_handlers.end()) {
+        return;  // Not ours, e.g. an answer that arrived after a failure
+    }
+
+    auto handler = std::move(it->second);
+    m_handlers.erase(it);
+    handler(type, reader);
+}
+
+uint32_t SFTPNonBlockingClient::send(SFTPPacketWriter& packet, ResponseHandler handler) {
+    const auto id = m_nextId++;
+
+    if (m_state == State::Failed) {
+        SFTPPacketWriter lost(SSH_FXP_STATUS);
+        lost.putUint32(SSH_FX_CONNECTION_LOST).putString(m_error.getSSHErrorMsg()).putString("");
+        const std::string status = lost.finish();
+        SFTPPacketReader reader(status.data() + 5, status.size() - 5);
+        handler(SSH_FXP_STATUS, reader);
+        return id;
+    }
+
+    m_outbox += packet.finish();
+    m_handlers.emplace(id, std::move(handler));
+    return id;
+}
+
+void SFTPNonBlockingClient::start(std::function<void()> operation) {
+    m_queued.push_back(std::move(operation));
+}
+
+void SFTPNonBlockingClient::pumpPut(const std::shared_ptr<PutTransfer>& transfer) {
+    const auto maxInFlight = std::max(m_options.maxInFlightRequests, 1u);
+
+    while (!transfer->endOfFile && transfer->error.isOk() && transfer->outstanding < maxInFlight) {
+        auto& file = transfer->file;
+        file.read(transfer->buffer.data(), static_cast<std::streamsize>(transfer->buffer.size()));
+        const auto bytesRead = static_cast<size_t>(file.gcount());
+        transfer->endOfFile = !file;
+
+        if (file.bad()) {
+            transfer->error = SFTPError(SSH_OK, SSH_FX_FAILURE, "Failed to read from local file");
+            break;
+        }
+
+        if (bytesRead == 0) {
+            break;
+        }
+
+        auto packet = request(SSH_FXP_WRITE);
+        packet.putString(transfer->handle)
+            .putUint64(transfer->offset)
+            .putString(transfer->buffer.data(), bytesRead);
+        transfer->offset += bytesRead;
+        ++transfer->outstanding;
+
+        send(packet, [this, transfer](uint8_t type, SFTPPacketReader& reader) {
+            --transfer->outstanding;
+            const auto err = statusError(type, reader);
+            if (!err.isOk() && transfer->error.isOk()) {
+                transfer->error = SFTPError(err.getSSHErrorCode(), err.getSFTPErrorCode(),
+                                            "Failed to write to remote file [" +
+                                                     transfer->remoteFileName + "] " +
+                                                     err.getSSHErrorMsg());
+            }
+            pumpPut(transfer);
+        });
+    }
+
+    if ((transfer->endOfFile || !transfer->error.isOk()) && transfer->outstanding == 0 &&
+        !transfer->closing) {
+        transfer->closing = true;
+        closeHandle(transfer->handle, [transfer](const SFTPError& err) {
+            transfer->done(transfer->error.isOk() ? err : transfer->error);
+        });
+    }
+}
+
+void SFTPNonBlockingClient::pumpGet(const std::shared_ptr<GetTransfer>& transfer) {
+    const auto maxInFlight = std::max(m_options.maxInFlightRequests, 1u);
+
+    while (!transfer->endOfFile && transfer->error.isOk() && transfer->outstanding < maxInFlight) {
+        readChunk(transfer, transfer->nextOffset, transfer->chunkSize);
+        transfer->nextOffset += transfer->chunkSize;
+    }
+
+    if ((transfer->endOfFile || !transfer->error.isOk()) && transfer->outstanding == 0 &&
+        !transfer->closing) {
+        transfer->closing = true;
+        closeHandle(transfer->handle, [transfer](const SFTPError& err) {
+            transfer->file.close();
+            transfer->done(transfer->error.isOk() ? err : transfer->error);
+        });
+    }
+}
+
+void SFTPNonBlockingClient::readChunk(const std::shared_ptr<GetTransfer>& transfer,
+                                      const uint64_t offset, const uint32_t length) {
+    auto packet = request(SSH_FXP_READ);
+    packet.putString(transfer->handle).putUint64(offset).putUint32(length);
+    ++transfer->outstanding;
+
+    send(packet, [this, transfer, offset, length](uint8_t type, SFTPPacketReader& reader) {
+        --transfer->outstanding;
+
+        const char* data = nullptr;
+        uint32_t size = 0;
+
+        if (type == SSH_FXP_DATA && reader.getStringView(data, size) && size <= length) {
+            transfer->file.seekp(static_cast<std::streamoff>(offset));
+            transfer->file.write(data, size);
+            if (!transfer->file && transfer->error.isOk()) {
+                transfer->error = SFTPError(
+                    SSH_OK, SSH_FX_FAILURE,
+                    "Failed to write to local file [" + transfer->localFileName + "]");
+            }
+
+            // A short read before the end of the file only covers part of the range, the rest
+            // is asked for again. At the end of the file that request comes back as EOF.
+            if (size > 0 && size < length && transfer->error.isOk()) {
+                readChunk(transfer, offset + size, length - size);
+            }
+        } else {
+            const auto err = statusError(type, reader);
+            if (err.getSFTPErrorCode() == SSH_FX_EOF) {
+                transfer->endOfFile = true;
+            } else if (transfer->error.isOk()) {
+                transfer->error = err.isOk() ? SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE,
+                                                         "Malformed read response")
+                                             : err;
+            }
+        }
+
+        pumpGet(transfer);
+    });
+}
+
+void SFTPNonBlockingClient::readDirectory(const std::shared_ptr<Listing>& listing) {
+    auto packet = request(SSH_FXP_READDIR);
+    packet.putString(listing->handle);
+
+    send(packet, [this, listing](uint8_t type, SFTPPacketReader& reader) {
+        if (type != SSH_FXP_NAME) {
+            auto err = statusError(type, reader);
+            if (err.getSFTPErrorCode() == SSH_FX_EOF) {
+                err = SFTPError();
+            }
+
+            closeHandle(listing->handle, [listing, err](const SFTPError&) {
+                listing->done(err, err.isOk() ? listing->entries : std::vector<SFTPAttributes>());
+            });
+            return;
+        }
+
+        uint32_t count = 0;
+        reader.getUint32(count);
+
+        for (uint32_t i = 0; i < count; ++i) {
+            auto* attributes =
+                static_cast<sftp_attributes>(std::calloc(1, sizeof(sftp_attributes_struct)));
+            if (!attributes) {
+                break;
+            }
+            listing->entries.emplace_back(attributes);
+
+            std::string name;
+            std::string longName;
+            if (!reader.getString(name) || !reader.getString(longName) ||
+                !reader.getAttributes(*attributes)) {
+                listing->entries.pop_back();
+                break;
+            }
+
+            attributes->name = strdup(name.c_str());
+            attributes->longname = strdup(longName.c_str());
+        }
+
+        readDirectory(listing);
+    });
+}
+
+void SFTPNonBlockingClient::closeHandle(const std::string& handle, Callback done) {
+    auto packet = request(SSH_FXP_CLOSE);
+    packet.putString(handle);
+    send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+        done(statusError(type, reader));
+    });
+}
+
+SFTPError SFTPNonBlockingClient::statusError(const uint8_t type, SFTPPacketReader& reader) {
+    if (type != SSH_FXP_STATUS) {
+        return SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Unexpected SFTP response");
+    }
+
+    uint32_t code = 0;
+    std::string message;
+    if (!reader.getUint32(code)) {
+        return SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed SFTP status");
+    }
+    reader.getString(message);  // Missing in some version 3 servers
+
+    if (code == SSH_FX_OK) {
+        return SFTPError();
+    }
+
+    const int sshCode = code == SSH_FX_CONNECTION_LOST ? SSH_ERROR : SSH_OK;
+    return SFTPError(sshCode, static_cast<int>(code), message);
+}
+
+void SFTPNonBlockingClient::SSHSessionDeleter::operator()(ssh_session session) const {
+    if (session) {
+        ssh_disconnect(session);
+        ssh_free(session);
+    }
+}
+
+void SFTPNonBlockingClient::SSHChannelDeleter::operator()(ssh_channel channel) const {
+    if (channel) {
+        ssh_channel_free(channel);
+    }
+}
+
+SFTPAsyncClient::~SFTPAsyncClient() { disconnect(); }
+
+SFTPError SFTPAsyncClient::connect(const std::string& host, const std::string& user,
+                                   const std::string& pw, const ConnectOptions& options,
+                                   const unsigned int workers, const size_t maxQueueDepth,
+                                   const uint16_t port, const bool onlyKnownServers) {
+    disconnect();
+
+    for (unsigned int i = 0; i < std::max(workers, 1u); ++i) {
+        std::unique_ptr<SFTPClient> client(new SFTPClient());
+        const auto err = client->connect(host, user, pw, options, port, onlyKnownServers);
+        if (!err.isOk()) {
+            m_clients.clear();
+            return err;
+        }
+        m_clients.push_back(std::move(client));
+    }
+
+    m_maxQueueDepth = std::max(maxQueueDepth, size_t(1));
+    m_stopping = false;
+
+    for (const auto& client : m_clients) {
+        const SFTPClient& session = *client;
+        m_workers.emplace_back([this, &session]() { workerLoop(session); });
+    }
+
+    return SFTPError();
+}
+
+void SFTPAsyncClient::disconnect() {
+    std::deque<Job> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        dropped.swap(m_queue);
+    }
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+
+    for (auto& job : dropped) {
+        job(nullptr);
+    }
+
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+
+    m_workers.clear();
+    m_clients.clear();
+}
+
+std::future<SFTPError> SFTPAsyncClient::putAsync(const std::string& localFileName,
+                                                 const std::string& remoteFileName,
+                                                 const CancellationToken& token,
+                                                 const TransferOptions& options) {
+    const auto transferOptions = cancellable(options, token);
+    return submit<SFTPError>(token, [=](const SFTPClient& client) {
+        return client.put(localFileName, remoteFileName, transferOptions);
+    });
+}
+
+std::future<SFTPError> SFTPAsyncClient::getAsync(const std::string& localFileName,
+                                                 const std::string& remoteFileName,
+                                                 const CancellationToken& token,
+                                                 const TransferOptions& options) {
+    const auto transferOptions = cancellable(options, token);
+    return submit<SFTPError>(token, [=](const SFTPClient& client) {
+        return client.get(localFileName, remoteFileName, transferOptions);
+    });
+}
+
+std::future<SFTPError> SFTPAsyncClient::mkdirAsync(const std::string& remoteDir,
+                                                   const mode_t permissions,
+                                                   const CancellationToken& token) {
+    return submit<SFTPError>(
+        token, [=](const SFTPClient& client) { return client.mkdir(remoteDir, permissions); });
+}
+
+std::future<std::pair<SFTPError, std::vector<SFTPAttributes>>>
+SFTPAsyncClient::lsAsync(const std::string& remoteDir, const CancellationToken& token) {
+    return submit<std::pair<SFTPError, std::vector<SFTPAttributes>>>(
+        token, [=](const SFTPClient& client) { return client.ls(remoteDir); });
+}
+
+std::future<SFTPError> SFTPAsyncClient::renameAsync(const std::string& oldRemoteName,
+                                                    const std::string& newRemoteName,
+                                                    const CancellationToken& token) {
+    return submit<SFTPError>(token, [=](const SFTPClient& client) {
+        return client.rename(oldRemoteName, newRemoteName);
+    });
+}
+
+std::future<SFTPError> SFTPAsyncClient::copyAsync(const std::string& remoteSrc,
+                                                  const std::string& remoteDst,
+                                                  const bool recursive,
+                                                  const CancellationToken& token) {
+    return submit<SFTPError>(token, [=](const SFTPClient& client) {
+        return client.copy(remoteSrc, remoteDst, recursive);
+    });
+}
+
+std::future<SFTPError> SFTPAsyncClient::rmAsync(const std::string& remoteFileName,
+                                                const CancellationToken& token) {
+    return submit<SFTPError>(token,
+                             [=](const SFTPClient& client) { return client.rm(remoteFileName); });
+}
+
+std::future<SFTPError> SFTPAsyncClient::rmdirAsync(const std::string& remoteDirName,
+                                                   const CancellationToken& token) {
+    return submit<SFTPError>(
+        token, [=](const SFTPClient& client) { return client.rmdir(remoteDirName); });
+}
+
+std::future<std::pair<SFTPError, SFTPAttributes>> SFTPAsyncClient::statAsync(
+    const std::string& remotePath, const CancellationToken& token) {
+    return submit<std::pair<SFTPError, SFTPAttributes>>(
+        token, [=](const SFTPClient& client) { return client.stat(remotePath); });
+}
+
+template <typename Result>
+std::future<Result> SFTPAsyncClient::submit(
+    const CancellationToken& token, std::function<Result(const SFTPClient&)> operation) {
+    // std::function needs a copyable target, so the promise is shared.
+    auto promise = std::make_shared<std::promise<Result>>();
+    auto future = promise->get_future();
+
+    const auto fail = [promise](const SFTPError& err) {
+        Result result{};
+        errorOf(result) = err;
+        promise->set_value(std::move(result));
+    };
+
+    Job job = [promise, token, operation, fail](const SFTPClient* client) {
+        if (!client) {
+            fail(SFTPError(SSH_OK, SFTPError::kCancelled, "Client disconnected"));
+        } else if (token.isCancelled()) {
+            fail(SFTPError(SSH_OK, SFTPError::kCancelled, "Operation cancelled"));
+        } else {
+            promise->set_value(operation(*client));
+        }
+    };
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notFull.wait(lock, [this]() { return m_stopping || m_queue.size() < m_maxQueueDepth; });
+
+    if (m_stopping || m_workers.empty()) {
+        lock.unlock();
+        fail(SFTPError(SSH_ERROR, SSH_FX_NO_CONNECTION, "Not connected"));
+        return future;
+    }
+
+    m_queue.push_back(std::move(job));
+    lock.unlock();
+    m_notEmpty.notify_one();
+
+    return future;
+}
+
+TransferOptions SFTPAsyncClient::cancellable(const TransferOptions& options,
+                                             const CancellationToken& token) {
+    auto transferOptions = options;
+    const auto progress = options.progress;
+
+    transferOptions.progress = [progress, token](uint64_t transferred) {
+        if (token.isCancelled()) {
+            return false;
+        }
+        return !progress || progress(transferred);
+    };
+
+    return transferOptions;
+}
+
+void SFTPAsyncClient::workerLoop(const SFTPClient& client) {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                return;
+            }
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        m_notFull.notify_one();
+
+        job(&client);
+    }
+}
+
+namespace {
+
+// A read-only mapping of a whole file. Empty files map to an empty, non-null buffer.
+class FanOutMapping {
+   public:
+    explicit FanOutMapping(const std::string& fileName) {
+#ifdef _WIN32
+        const HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            size.QuadPart = -1;
+        }
+        if (size.QuadPart == 0) {
+            m_data = kEmpty;
+            m_valid = true;
+        } else if (size.QuadPart > 0) {
+            const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                m_view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+            if (m_view) {
+                m_data = static_cast<const char*>(m_view);
+                m_size = static_cast<uint64_t>(size.QuadPart);
+                m_valid = true;
+            }
+        }
+        CloseHandle(file);
+#else
+        const int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            st.st_size = -1;
+        }
+        if (st.st_size == 0) {
+            m_data = kEmpty;
+            m_valid = true;
+        } else if (st.st_size > 0) {
+            void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (view != MAP_FAILED) {
+                m_view = view;
+                m_data = static_cast<const char*>(view);
+                m_size = static_cast<uint64_t>(st.st_size);
+                m_valid = true;
+            }
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~FanOutMapping() {
+        if (!m_view) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(m_view);
+#else
+        munmap(m_view, size_t(m_size));
+#endif
+    }
+
+    bool valid() const { return m_valid; }
+    const char* data() const { return m_data; }
+    uint64_t size() const { return m_size; }
+
+   private:
+    FanOutMapping(const FanOutMapping&) = delete;
+    FanOutMapping& operator=(const FanOutMapping&) = delete;
+
+    static constexpr const char* kEmpty = "";
+
+    void* m_view = nullptr;
+    const char* m_data = nullptr;
+    uint64_t m_size = 0;
+    bool m_valid = false;
+};
+
+std::chrono::milliseconds fanOutElapsed(const std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+}
+
+}  // namespace
+
+SFTPFanOut::SFTPFanOut(const ConnectOptions& options, const unsigned int maxConcurrentHosts,
+                       const bool onlyKnownServers)
+    : m_options(options),
+      m_maxConcurrentHosts(std::max(maxConcurrentHosts, 1u)),
+      m_onlyKnownServers(onlyKnownServers) {}
+
+std::pair<SFTPError, std::vector<SFTPFanOut::Result>> SFTPFanOut::put(
+    const std::string& localFileName, const std::vector<Target>& targets,
+    const TransferOptions& options) const {
+    const FanOutMapping mapping(localFileName);
+    if (!mapping.valid()) {
+        return {SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                          "Failed to map local file: " + localFileName),
+                {}};
+    }
+
+    std::vector<Result> results(targets.size());
+    std::atomic<size_t> next{0};
+    std::mutex callbackMutex;
+
+    const auto worker = [&]() {
+        for (size_t i = next++; i < targets.size(); i = next++) {
+            const Target& target = targets[i];
+            Result& result = results[i];
+            result.host = target.host;
+
+            auto start = std::chrono::steady_clock::now();
+            SFTPClient client;
+            result.error = client.connect(target.host, target.user, target.password, m_options,
+                                          target.port, m_onlyKnownServers);
+            result.connectTime = fanOutElapsed(start);
+            if (!result.error.isOk()) {
+                continue;
+            }
+
+            // Every host gets its own copy of the options, whose callbacks count what the host
+            // acknowledged and take turns calling the caller's.
+            uint64_t acknowledged = options.resumeOffset;
+            TransferOptions hostOptions = options;
+            hostOptions.progress = [&](const uint64_t transferred) {
+                acknowledged = transferred;
+                if (!options.progress) {
+                    return true;
+                }
+                std::lock_guard<std::mutex> lock(callbackMutex);
+                return options.progress(transferred);
+            };
+            if (options.onChecksum) {
+                hostOptions.onChecksum = [&](const std::string& digest) {
+                    std::lock_guard<std::mutex> lock(callbackMutex);
+                    options.onChecksum(digest);
+                };
+            }
+            if (options.onStats) {
+                hostOptions.onStats = [&](const TransferStats& stats) {
+                    std::lock_guard<std::mutex> lock(callbackMutex);
+                    options.onStats(stats);
+                };
+            }
+
+            start = std::chrono::steady_clock::now();
+            result.error = client.putBuffer(mapping.data(), mapping.size(), target.remoteFileName,
+                                            hostOptions);
+            result.transferTime = fanOutElapsed(start);
+            if (result.error.isOk()) {
+                acknowledged = std::max(acknowledged, mapping.size());
+            }
+            result.bytes = acknowledged - std::min(acknowledged, options.resumeOffset);
+        }
+    };
+
+    const size_t threadCount = std::min<size_t>(m_maxConcurrentHosts, targets.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    if (threadCount > 0) {
+        worker();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return {SFTPError(), results};
+}
+
+namespace {
+
+// Requests of the broker protocol, framed like SFTP packets. Each gets one kBrokerReply: the
+// SSH and SFTP error codes and the message, followed by the result when the request succeeded.
+enum BrokerMessage : uint8_t {
+    kBrokerOpen = 1,
+    kBrokerPut,
+    kBrokerGet,
+    kBrokerMkdir,
+    kBrokerLs,
+    kBrokerRename,
+    kBrokerCopy,
+    kBrokerRm,
+    kBrokerRmdir,
+    kBrokerStat,
+    kBrokerReply = 100,
+};
+
+constexpr uint32_t kBrokerVersion = 3;
+
+// Room for the listing of a very large directory.
+constexpr uint32_t kBrokerMaxMessage = 64 * 1024 * 1024;
+
+SFTPError brokerSystemError(const std::string& what) {
+    return SFTPError(SSH_ERROR, SSH_FX_FAILURE, what + " " + std::strerror(errno));
+}
+
+bool brokerSend(const int fd, const std::string& message) {
+#ifdef _WIN32
+    (void)fd;
+    (void)message;
+    return false;
+#else
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;  // A vanished peer is an error, not a SIGPIPE
+#else
+    const int flags = 0;
+#endif
+    size_t sent = 0;
+    while (sent < message.size()) {
+        const auto n = ::send(fd, message.data() + sent, message.size() - sent, flags);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+#endif
+}
+
+bool brokerReceiveAll(const int fd, char* data, size_t size) {
+#ifdef _WIN32
+    (void)fd;
+    (void)data;
+    return size == 0;
+#else
+    while (size > 0) {
+        const auto n = ::recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+#endif
+}
+
+// One message as SFTPPacketWriter::finish() frames it, split into its type and the rest.
+bool brokerReceive(const int fd, uint8_t& type, std::string& body) {
+    char prefix[4];
+    uint32_t length = 0;
+    if (!brokerReceiveAll(fd, prefix, sizeof(prefix)) ||
+        !SFTPPacketReader(prefix, sizeof(prefix)).getUint32(length) || length == 0 ||
+        length > kBrokerMaxMessage) {
+        return false;
+    }
+
+    body.resize(length);
+    if (!brokerReceiveAll(fd, &body[0], length)) {
+        return false;
+    }
+
+    type = static_cast<uint8_t>(body[0]);
+    body.erase(0, 1);
+    return true;
+}
+
+#ifndef _WIN32
+bool brokerSocketAddress(const std::string& socketPath, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    return true;
+}
+
+// The socket's mode keeps other users out where the system honours it, this also where not.
+bool brokerPeerIsOwner(const int fd) {
+#if defined(SO_PEERCRED)
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 &&
+           credentials.uid == geteuid();
+#else
+    uid_t uid = 0;
+    gid_t gid = 0;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+#endif
+
+// Compares in constant time, so replies do not reveal how much of a password matched.
+bool brokerSecretsEqual(const std::string& a, const std::string& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    unsigned char difference = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        difference |= static_cast<unsigned char>(a[i] ^ b[i]);
+    }
+    return difference == 0;
+}
+
+std::string brokerAbsolutePath(const std::string& path) {
+#ifndef _WIN32
+    if (!path.empty() && path[0] != '/') {
+        std::vector<char> cwd(4096);
+        if (getcwd(cwd.data(), cwd.size())) {
+            return std::string(cwd.data()) + "/" + path;
+        }
+    }
+#endif
+    return path;
+}
+
+void putBrokerOptions(SFTPPacketWriter& writer, const TransferOptions& options) {
+    writer.putUint32(options.chunkSize)
+        .putUint64(options.resumeOffset)
+        .putUint8(static_cast<uint8_t>(options.checksum))
+        .putUint8(options.verifyChecksum)
+        .putUint8(options.sparse)
+        .putUint8(options.zstd)
+        .putUint32(static_cast<uint32_t>(options.zstdLevel))
+        .putUint32(options.zstdThreads);
+}
+
+bool getBrokerOptions(SFTPPacketReader& reader, TransferOptions& options) {
+    uint8_t checksum = 0;
+    uint8_t verifyChecksum = 0;
+    uint8_t sparse = 0;
+    uint8_t zstd = 0;
+    uint32_t zstdLevel = 0;
+    if (!reader.getUint32(options.chunkSize) || !reader.getUint64(options.resumeOffset) ||
+        !reader.getUint8(checksum) || !reader.getUint8(verifyChecksum) ||
+        !reader.getUint8(sparse) || !reader.getUint8(zstd) || !reader.getUint32(zstdLevel) ||
+        !reader.getUint32(options.zstdThreads) ||
+        checksum > static_cast<uint8_t>(ChecksumAlgorithm::Sha256)) {
+        return false;
+    }
+
+    options.checksum = static_cast<ChecksumAlgorithm>(checksum);
+    options.verifyChecksum = verifyChecksum != 0;
+    options.sparse = sparse != 0;
+    options.zstd = zstd != 0;
+    options.zstdLevel = static_cast<int>(zstdLevel);
+    return true;
+}
+
+void putBrokerStats(SFTPPacketWriter& writer, const TransferStats& stats) {
+    writer.putUint64(stats.bytes)
+        .putUint64(stats.wireBytes)
+        .putUint8(stats.zstd)
+        .putUint64(static_cast<uint64_t>(stats.elapsed.count()));
+}
+
+bool getBrokerStats(SFTPPacketReader& reader, TransferStats& stats) {
+    uint8_t zstd = 0;
+    uint64_t elapsed = 0;
+    if (!reader.getUint64(stats.bytes) || !reader.getUint64(stats.wireBytes) ||
+        !reader.getUint8(zstd) || !reader.getUint64(elapsed)) {
+        return false;
+    }
+
+    stats.zstd = zstd != 0;
+    stats.elapsed = std::chrono::milliseconds(elapsed);
+    return true;
+}
+
+void putBrokerAttributes(SFTPPacketWriter& writer, const sftp_attributes_struct& attributes) {
+    writer.putString(attributes.name ? attributes.name : "")
+        .putString(attributes.longname ? attributes.longname : "")
+        .putAttributes(attributes);
+}
+
+bool getBrokerAttributes(SFTPPacketReader& reader, SFTPAttributes& result) {
+    auto* attributes =
+        static_cast<sftp_attributes>(std::calloc(1, sizeof(sftp_attributes_struct)));
+    result = SFTPAttributes(attributes);
+
+    std::string name;
+    std::string longName;
+    if (!attributes || !reader.getString(name) || !reader.getString(longName) ||
+        !reader.getAttributes(*attributes)) {
+        return false;
+    }
+
+    attributes->name = name.empty() ? nullptr : strdup(name.c_str());
+    attributes->longname = longName.empty() ? nullptr : strdup(longName.c_str());
+    return true;
+}
+
+SFTPPacketWriter brokerReply(const SFTPError& err) {
+    SFTPPacketWriter reply(kBrokerReply);
+    reply.putUint32(static_cast<uint32_t>(err.getSSHErrorCode()))
+        .putUint32(static_cast<uint32_t>(err.getSFTPErrorCode()))
+        .putString(err.getSSHErrorMsg());
+    return reply;
+}
+
+// Whether the session behind err is beyond use and should not go back to the pool.
+bool brokerSessionLost(const SFTPError& err) {
+    return err.getSFTPErrorCode() == SSH_FX_NO_CONNECTION ||
+           err.getSFTPErrorCode() == SSH_FX_CONNECTION_LOST ||
+           err.getSSHErrorCode() == SSH_FATAL;
+}
+
+}  // namespace
+
+SFTPBroker::SFTPBroker(const std::string& socketPath, const ConnectOptions& options,
+                       const std::chrono::seconds idleTimeout)
+    : m_socketPath(socketPath), m_options(options), m_idleTimeout(idleTimeout) {}
+
+SFTPBroker::~SFTPBroker() {
+    stop();
+#ifndef _WIN32
+    if (m_listenFd >= 0) {
+        ::close(m_listenFd);
+        ::unlink(m_socketPath.c_str());
+    }
+#endif
+}
+
+SFTPError SFTPBroker::listen() {
+#ifdef _WIN32
+    return SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED, "The session broker needs Unix sockets");
+#else
+    sockaddr_un address;
+    if (!brokerSocketAddress(m_socketPath, address)) {
+        return SFTPError(SSH_OK, SSH_FX_FAILURE, "Invalid socket path [" + m_socketPath + "]");
+    }
+
+    // A socket that refuses connections was left behind by a broker that is gone. Anything
+    // else at the path is not the broker's to remove.
+    struct stat existing;
+    if (::lstat(m_socketPath.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            return SFTPError(SSH_OK, SSH_FX_FILE_ALREADY_EXISTS,
+                             "[" + m_socketPath + "] exists and is not a socket");
+        }
+
+        const int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe < 0) {
+            return brokerSystemError("Failed to create socket [" + m_socketPath + "]");
+        }
+        const bool running =
+            ::connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+        ::close(probe);
+        if (running) {
+            return SFTPError(SSH_OK, SSH_FX_FAILURE,
+                             "A broker already listens on [" + m_socketPath + "]");
+        }
+        ::unlink(m_socketPath.c_str());
+    } else if (errno != ENOENT) {
+        return brokerSystemError("Failed to inspect [" + m_socketPath + "]");
+    }
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return brokerSystemError("Failed to create socket [" + m_socketPath + "]");
+    }
+
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 ||
+        ::chmod(m_socketPath.c_str(), S_IRUSR | S_IWUSR) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        const auto err = brokerSystemError("Failed to listen on [" + m_socketPath + "]");
+        ::close(fd);
+        return err;
+    }
+
+    m_listenFd = fd;
+    return SFTPError();
+#endif
+}
+
+SFTPError SFTPBroker::run() {
+#ifdef _WIN32
+    return listen();
+#else
+    if (m_listenFd < 0) {
+        const auto err = listen();
+        if (!err.isOk()) {
+            return err;
+        }
+    }
+
+    while (!m_stopping) {
+        // Wakes up every second to close idle sessions, reap finished processes and notice
+        // stop().
+        pollfd ready = {m_listenFd, POLLIN, 0};
+        const int rc = ::poll(&ready, 1, 1000);
+        closeIdleSessions();
+        joinFinished();
+
+        if (rc <= 0) {
+            continue;
+        }
+
+        const int fd = ::accept(m_listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+
+        if (!brokerPeerIsOwner(fd)) {
+            ::close(fd);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping) {
+            ::close(fd);
+            break;
+        }
+        m_clients[fd] = std::thread(&SFTPBroker::serve, this, fd);
+    }
+
+    stop();
+    ::close(m_listenFd);
+    ::unlink(m_socketPath.c_str());
+    m_listenFd = -1;
+
+    std::map<int, std::thread> clients;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        clients.swap(m_clients);
+        m_finished.clear();
+    }
+    for (auto& client : clients) {
+        client.second.join();
+        ::close(client.first);
+    }
+
+    std::map<std::string, std::vector<Session>> idle;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        idle.swap(m_idle);
+    }
+
+    return SFTPError();
+#endif
+}
+
+void SFTPBroker::stop() {
+    m_stopping = true;
+
+#ifndef _WIN32
+    // Unblocks the threads waiting for their process's next request.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& client : m_clients) {
+        ::shutdown(client.first, SHUT_RDWR);
+    }
+#endif
+}
+
+size_t SFTPBroker::sessionCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t count = m_leased;
+    for (const auto& host : m_idle) {
+        count += host.second.size();
+    }
+    return count;
+}
+
+void SFTPBroker::serve(const int fd) {
+    std::string key;
+    Session session;
+    bool reusable = true;
+
+    uint8_t type = 0;
+    std::string body;
+    while (!m_stopping && brokerReceive(fd, type, body)) {
+        SFTPPacketReader reader(body.data(), body.size());
+        std::string reply;
+
+        if (type == kBrokerOpen) {
+            uint32_t version = 0;
+            uint32_t port = 0;
+            uint8_t onlyKnownServers = 1;
+            std::string host, user, password;
+            if (session.client) {
+                reply = brokerReply(SFTPError(SSH_OK, SSH_FX_FAILURE, "Already open"))
+                            .finish();
+            } else if (!reader.getUint32(version) || version != kBrokerVersion ||
+                       !reader.getString(host) || !reader.getString(user) ||
+                       !reader.getString(password) || !reader.getUint32(port) ||
+                       !reader.getUint8(onlyKnownServers) || port > 0xffff) {
+                reply = brokerReply(SFTPError(SSH_OK, SSH_FX_BAD_MESSAGE,
+                                              "Unsupported broker request"))
+                            .finish();
+            } else {
+                key = user + "@" + host + ":" + std::to_string(port);
+                auto leased = lease(key, host, user, password, static_cast<uint16_t>(port),
+                                    onlyKnownServers != 0);
+                session = std::move(leased.second);
+                reply = brokerReply(leased.first).finish();
+            }
+        } else if (!session.client) {
+            reply = brokerReply(SFTPError(SSH_ERROR, SSH_FX_FAILURE, "No session open"))
+                        .finish();
+        } else {
+            reply = handle(type, reader, *session.client, reusable);
+        }
+
+        if (!brokerSend(fd, reply)) {
+            break;
+        }
+    }
+
+    if (session.client) {
+        release(key, std::move(session), reusable);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_finished.push_back(fd);
+}
+
+std::string SFTPBroker::handle(const uint8_t type, SFTPPacketReader& reader,
+                               const SFTPClient& client, bool& reusable) {
+    const auto malformed = [&]() {
+        return brokerReply(SFTPError(SSH_OK, SSH_FX_BAD_MESSAGE, "Malformed broker request"))
+            .finish();
+    };
+
+    std::string first, second;
+    SFTPError err;
+
+    switch (type) {
+        case kBrokerPut:
+        case kBrokerGet: {
+            TransferOptions options;
+            if (!reader.getString(first) || !reader.getString(second) ||
+                !getBrokerOptions(reader, options)) {
+                return malformed();
+            }
+
+            std::string digest;
+            TransferStats stats;
+            options.onChecksum = [&digest](const std::string& value) { digest = value; };
+            options.onStats = [&stats](const TransferStats& value) { stats = value; };
+            err = type == kBrokerPut ? client.put(first, second, options)
+                                     : client.get(first, second, options);
+            reusable = reusable && !brokerSessionLost(err);
+
+            // Failed transfers report what they moved too, as put() and get() do.
+            auto reply = brokerReply(err);
+            reply.putString(err.isOk() ? digest : std::string());
+            putBrokerStats(reply, stats);
+            return reply.finish();
+        }
+
+        case kBrokerLs: {
+            if (!reader.getString(first)) {
+                return malformed();
+            }
+
+            const auto result = client.ls(first);
+            reusable = reusable && !brokerSessionLost(result.first);
+
+            auto reply = brokerReply(result.first);
+            if (result.first.isOk()) {
+                reply.putUint32(static_cast<uint32_t>(result.second.size()));
+                for (const auto& entry : result.second) {
+                    putBrokerAttributes(reply, *entry.get());
+                }
+            }
+            return reply.finish();
+        }
+
+        case kBrokerStat: {
+            if (!reader.getString(first)) {
+                return malformed();
+            }
+
+            const auto result = client.stat(first);
+            reusable = reusable && !brokerSessionLost(result.first);
+
+            auto reply = brokerReply(result.first);
+            if (result.first.isOk()) {
+                putBrokerAttributes(reply, *result.second.get());
+            }
+            return reply.finish();
+        }
+
+        case kBrokerMkdir: {
+            uint32_t permissions = 0;
+            if (!reader.getString(first) || !reader.getUint32(permissions)) {
+                return malformed();
+            }
+            err = client.mkdir(first, static_cast<mode_t>(permissions));
+            break;
+        }
+
+        case kBrokerRename:
+            if (!reader.getString(first) || !reader.getString(second)) {
+                return malformed();
+            }
+            err = client.rename(first, second);
+            break;
+
+        case kBrokerCopy: {
+            uint8_t recursive = 0;
+            if (!reader.getString(first) || !reader.getString(second) ||
+                !reader.getUint8(recursive)) {
+                return malformed();
+            }
+            err = client.copy(first, second, recursive != 0);
+            break;
+        }
+
+        case kBrokerRm:
+        case kBrokerRmdir:
+            if (!reader.getString(first)) {
+                return malformed();
+            }
+            err = type == kBrokerRm ? client.rm(first) : client.rmdir(first);
+            break;
+
+        default:
+            return brokerReply(SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED,
+                                         "Unsupported broker request"))
+                .finish();
+    }
+
+    reusable = reusable && !brokerSessionLost(err);
+    return brokerReply(err).finish();
+}
+
+std::pair<SFTPError, SFTPBroker::Session> SFTPBroker::lease(
+    const std::string& key, const std::string& host, const std::string& user,
+    const std::string& password, const uint16_t port, const bool onlyKnownServers) {
+    const auto takeIdle = [&](Session& session) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it = m_idle.find(key);
+        if (it == m_idle.end()) {
+            return false;
+        }
+        auto& sessions = it->second;
+        for (size_t i = sessions.size(); i-- > 0;) {
+            if (sessions[i].onlyKnownServers == onlyKnownServers &&
+                brokerSecretsEqual(sessions[i].password, password)) {
+                session = std::move(sessions[i]);
+                sessions.erase(sessions.begin() + static_cast<std::ptrdiff_t>(i));
+                if (sessions.empty()) {
+                    m_idle.erase(it);
+                }
+                ++m_leased;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // The server or a firewall may have dropped an idle session without the broker noticing,
+    // so one round trip has to succeed before it is lent. Dead sessions are closed here,
+    // outside the lock.
+    for (Session idle; takeIdle(idle); idle = Session()) {
+        if (!brokerSessionLost(idle.client->stat(".").first)) {
+            return {SFTPError(), std::move(idle)};
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_leased;
+    }
+
+    Session session;
+    session.client.reset(new SFTPClient());
+    const auto err =
+        session.client->connect(host, user, password, m_options, port, onlyKnownServers);
+    if (!err.isOk()) {
+        return {err, Session()};
+    }
+    session.password = password;
+    session.onlyKnownServers = onlyKnownServers;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_leased;
+    return {SFTPError(), std::move(session)};
+}
+
+void SFTPBroker::release(const std::string& key, Session session, const bool reusable) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    --m_leased;
+    if (reusable && !m_stopping) {
+        session.idleSince = Clock::now();
+        m_idle[key].push_back(std::move(session));
+    }
+}
+
+void SFTPBroker::closeIdleSessions() {
+    std::vector<Session> expired;  // Disconnected after the lock is released
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto now = Clock::now();
+    for (auto it = m_idle.begin(); it != m_idle.end();) {
+        auto& sessions = it->second;
+        for (size_t i = sessions.size(); i-- > 0;) {
+            if (now - sessions[i].idleSince >= m_idleTimeout) {
+                expired.push_back(std::move(sessions[i]));
+                sessions.erase(sessions.begin() + static_cast<std::ptrdiff_t>(i));
+            }
+        }
+        it = sessions.empty() ? m_idle.erase(it) : std::next(it);
+    }
+}
+
+void SFTPBroker::joinFinished() {
+    std::vector<std::pair<int, std::thread>> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const int fd : m_finished) {
+            const auto it = m_clients.find(fd);
+            if (it != m_clients.end()) {
+                finished.emplace_back(fd, std::move(it->second));
+                m_clients.erase(it);
+            }
+        }
+        m_finished.clear();
+    }
+
+    // Closed only now, so the descriptor cannot be reused while its thread still runs.
+    for (auto& client : finished) {
+        client.second.join();
+#ifndef _WIN32
+        ::close(client.first);
+#endif
+    }
+}
+
+SFTPBrokerConnection::SFTPBrokerConnection(const std::string& socketPath)
+    : m_socketPath(socketPath) {}
+
+SFTPBrokerConnection::~SFTPBrokerConnection() {
+#ifndef _WIN32
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+#endif
+}
+
+SFTPError SFTPBrokerConnection::open(const std::string& host, const std::string& user,
+                                     const std::string& pw, const uint16_t port,
+                                     const bool onlyKnownServers) {
+#ifdef _WIN32
+    (void)host;
+    (void)user;
+    (void)pw;
+    (void)port;
+    (void)onlyKnownServers;
+    return SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED, "The session broker needs Unix sockets");
+#else
+    sockaddr_un address;
+    if (!brokerSocketAddress(m_socketPath, address)) {
+        return SFTPError(SSH_OK, SSH_FX_FAILURE, "Invalid socket path [" + m_socketPath + "]");
+    }
+
+    m_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fd < 0) {
+        return brokerSystemError("Failed to create socket");
+    }
+
+#ifdef SO_NOSIGPIPE
+    const int on = 1;
+    setsockopt(m_fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    if (::connect(m_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+        return brokerSystemError("Failed to reach the session broker at [" + m_socketPath + "]");
+    }
+
+    return call(SFTPPacketWriter(kBrokerOpen)
+                    .putUint32(kBrokerVersion)
+                    .putString(host)
+                    .putString(user)
+                    .putString(pw)
+                    .putUint32(port)
+                    .putUint8(onlyKnownServers)
+                    .finish(),
+                nullptr);
+#endif
+}
+
+SFTPError SFTPBrokerConnection::put(const std::string& localFileName,
+                                    const std::string& remoteFileName,
+                                    const TransferOptions& options) {
+    return transfer(kBrokerPut, localFileName, remoteFileName, options);
+}
+
+SFTPError SFTPBrokerConnection::get(const std::string& localFileName,
+                                    const std::string& remoteFileName,
+                                    const TransferOptions& options) {
+    return transfer(kBrokerGet, localFileName, remoteFileName, options);
+}
+
+SFTPError SFTPBrokerConnection::mkdir(const std::string& remoteDir, const uint32_t permissions) {
+    return call(SFTPPacketWriter(kBrokerMkdir).putString(remoteDir).putUint32(permissions).finish(),
+                nullptr);
+}
+
+std::pair<SFTPError, std::vector<SFTPAttributes>> SFTPBrokerConnection::ls(
+    const std::string& remoteDir) {
+    std::vector<SFTPAttributes> entries;
+    const auto err =
+        call(SFTPPacketWriter(kBrokerLs).putString(remoteDir).finish(),
+             [&](SFTPPacketReader& reader) {
+                 uint32_t count = 0;
+                 if (!reader.getUint32(count)) {
+                     return false;
+                 }
+                 for (uint32_t i = 0; i < count; ++i) {
+                     entries.emplace_back();
+                     if (!getBrokerAttributes(reader, entries.back())) {
+                         return false;
+                     }
+                 }
+                 return true;
+             });
+
+    if (!err.isOk()) {
+        return {err, {}};
+    }
+    return {err, std::move(entries)};
+}
+
+SFTPError SFTPBrokerConnection::rename(const std::string& oldRemoteName,
+                                       const std::string& newRemoteName) {
+    return call(
+        SFTPPacketWriter(kBrokerRename).putString(oldRemoteName).putString(newRemoteName).finish(),
+        nullptr);
+}
+
+SFTPError SFTPBrokerConnection::copy(const std::string& remoteSrc, const std::string& remoteDst,
+                                     const bool recursive) {
+    return call(SFTPPacketWriter(kBrokerCopy)
+                    .putString(remoteSrc)
+                    .putString(remoteDst)
+                    .putUint8(recursive)
+                    .finish(),
+                nullptr);
+}
+
+SFTPError SFTPBrokerConnection::rm(const std::string& remoteFileName) {
+    return call(SFTPPacketWriter(kBrokerRm).putString(remoteFileName).finish(), nullptr);
+}
+
+SFTPError SFTPBrokerConnection::rmdir(const std::string& remoteDir) {
+    return call(SFTPPacketWriter(kBrokerRmdir).putString(remoteDir).finish(), nullptr);
+}
+
+std::pair<SFTPError, SFTPAttributes> SFTPBrokerConnection::stat(
+    const std::string& remotePath) {
+    SFTPAttributes attributes;
+    const auto err = call(SFTPPacketWriter(kBrokerStat).putString(remotePath).finish(),
+                          [&](SFTPPacketReader& reader) {
+                              return getBrokerAttributes(reader, attributes);
+                          });
+
+    if (!err.isOk()) {
+        return {err, {}};
+    }
+    return {err, attributes};
+}
+
+SFTPError SFTPBrokerConnection::transfer(const uint8_t type, const std::string& localFileName,
+                                         const std::string& remoteFileName,
+                                         const TransferOptions& options) {
+    SFTPPacketWriter request(type);
+    request.putString(brokerAbsolutePath(localFileName)).putString(remoteFileName);
+    putBrokerOptions(request, options);
+
+    std::string digest;
+    TransferStats stats;
+    const auto err = call(
+        request.finish(),
+        [&](SFTPPacketReader& reader) {
+            return reader.getString(digest) && getBrokerStats(reader, stats);
+        },
+        true);
+
+    if (err.isOk() && !digest.empty() && options.onChecksum) {
+        options.onChecksum(digest);
+    }
+    if (options.onStats) {
+        options.onStats(stats);
+    }
+    return err;
+}
+
+SFTPError SFTPBrokerConnection::call(
+    const std::string& request, const std::function<bool(SFTPPacketReader&)>& readResult,
+    const bool resultOnFailure) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint8_t type = 0;
+    std::string body;
+    if (m_fd < 0 || !brokerSend(m_fd, request) || !brokerReceive(m_fd, type, body) ||
+        type != kBrokerReply) {
+        return SFTPError(SSH_ERROR, SSH_FX_CONNECTION_LOST,
+                         "Lost the session broker at [" + m_socketPath + "]");
+    }
+
+    SFTPPacketReader reader(body.data(), body.size());
+    uint32_t sshCode = 0;
+    uint32_t sftpCode = 0;
+    std::string message;
+    if (!reader.getUint32(sshCode) || !reader.getUint32(sftpCode) || !reader.getString(message)) {
+        return SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed broker reply");
+    }
+
+    const SFTPError err(static_cast<int>(sshCode), static_cast<int>(sftpCode), message);
+    // A failure keeps its own error even when the result that came with it is unreadable.
+    if ((err.isOk() || resultOnFailure) && readResult && !readResult(reader) && err.isOk()) {
+        return SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed broker reply");
+    }
+    return err;
+}
+
+TokenBucket::TokenBucket(const double bytesPerSecond, const double burstBytes) {
+    setRate(bytesPerSecond, burstBytes);
+}
+
+void TokenBucket::setRate(const double bytesPerSecond, const double burstBytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    refill(Clock::now());
+    m_rate = bytesPerSecond > 0 ? bytesPerSecond : 0;
+    m_burst = burstBytes > 0 ? burstBytes : m_rate / 4;
+    m_tokens = std::min(m_tokens, m_burst);
+}
+
+double TokenBucket::rate() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_rate;
+}
+
+void TokenBucket::consume(const uint64_t bytes) {
+    std::chrono::duration<double> wait(0);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_rate <= 0) {
+            return;
+        }
+
+        refill(Clock::now());
+        m_tokens -= static_cast<double>(bytes);
+        if (m_tokens >= 0) {
+            return;
+        }
+
+        wait = std::chrono::duration<double>(-m_tokens / m_rate);
+    }
+
+    std::this_thread::sleep_for(wait);
+}
+
+void TokenBucket::refill(const Clock::time_point now) {
+    const std::chrono::duration<double> elapsed = now - m_lastRefill;
+    m_lastRefill = now;
+    m_tokens = std::min(m_burst, m_tokens + elapsed.count() * m_rate);
+}
+
+SFTPTransferScheduler::SFTPTransferScheduler(const double globalBytesPerSecond)
+    : m_globalBucket(globalBytesPerSecond) {}
+
+SFTPTransferScheduler::~SFTPTransferScheduler() { stop(); }
+
+SFTPError SFTPTransferScheduler::addHost(const std::string& host, const std::string& user,
+                                         const std::string& pw, const ConnectOptions& options,
+                                         const unsigned int sessions, const double bytesPerSecond,
+                                         const uint16_t port, const bool onlyKnownServers) {
+    std::unique_ptr<Host> entry(new Host());
+    entry->bucket.setRate(bytesPerSecond);
+
+    for (unsigned int i = 0; i < std::max(sessions, 1u); ++i) {
+        std::unique_ptr<SFTPClient> client(new SFTPClient());
+        const auto err = client->connect(host, user, pw, options, port, onlyKnownServers);
+        if (!err.isOk()) {
+            return err;
+        }
+        entry->clients.push_back(std::move(client));
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopping || m_hosts.count(host) > 0) {
+        return SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Host already added: " + host);
+    }
+
+    Host& added = *entry;
+    for (const auto& client : added.clients) {
+        const SFTPClient& session = *client;
+        added.workers.emplace_back([this, &added, &session]() { workerLoop(added, session); });
+    }
+    m_hosts[host] = std::move(entry);
+
+    return SFTPError();
+}
+
+void SFTPTransferScheduler::setGlobalBandwidth(const double bytesPerSecond) {
+    m_globalBucket.setRate(bytesPerSecond);
+}
+
+void SFTPTransferScheduler::setHostBandwidth(const std::string& host, const double bytesPerSecond) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_hosts.find(host);
+    if (it != m_hosts.end()) {
+        it->second->bucket.setRate(bytesPerSecond);
+    }
+}
+
+std::future<SFTPTransferScheduler::Result> SFTPTransferScheduler::submit(
+    const Job& job) {
+    auto entry = std::make_shared<Entry>();
+    entry->job = job;
+    auto future = entry->promise.get_future();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const auto it = m_hosts.find(job.host);
+    if (m_stopping || it == m_hosts.end()) {
+        lock.unlock();
+        entry->result.error = m_stopping ? SFTPError(SSH_OK, SFTPError::kCancelled,
+                                                     "Scheduler stopped")
+                                         : SFTPError(SSH_ERROR, SSH_FX_NO_CONNECTION,
+                                                     "Unknown host: " + job.host);
+        entry->promise.set_value(entry->result);
+        return future;
+    }
+
+    Host& host = *it->second;
+    entry->sequence = m_nextSequence++;
+    entry->enqueuedAt = Clock::now();
+    host.queue.push(entry);
+    ++m_metrics.queued;
+
+    preemptFor(host, job.priority);
+    lock.unlock();
+    m_workAvailable.notify_all();
+
+    return future;
+}
+
+SFTPTransferScheduler::Metrics SFTPTransferScheduler::metrics() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_metrics;
+}
+
+void SFTPTransferScheduler::stop() {
+    std::vector<std::shared_ptr<Entry>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        for (auto& host : m_hosts) {
+            auto& queue = host.second->queue;
+            while (!queue.empty()) {
+                dropped.push_back(queue.top());
+                queue.pop();
+            }
+        }
+        m_metrics.queued = 0;
+    }
+    m_workAvailable.notify_all();
+
+    for (auto& entry : dropped) {
+        entry->result.error =
+            SFTPError(SSH_OK, SFTPError::kCancelled, "Scheduler stopped");
+        entry->promise.set_value(entry->result);
+    }
+
+    for (auto& host : m_hosts) {
+        for (auto& worker : host.second->workers) {
+            worker.join();
+        }
+        host.second->workers.clear();
+    }
+}
+
+void SFTPTransferScheduler::preemptFor(Host& host, const int priority) {
+    if (host.running.size() < host.workers.size()) {
+        return;  // A session is free
+    }
+
+    std::shared_ptr<Entry> victim;
+    for (const auto& running : host.running) {
+        if (!running->preempt && running->job.priority < priority &&
+            (!victim || running->job.priority < victim->job.priority)) {
+            victim = running;
+        }
+    }
+
+    if (victim) {
+        victim->preempt = true;
+    }
+}
+
+void SFTPTransferScheduler::workerLoop(Host& host, const SFTPClient& client) {
+    while (true) {
+        std::shared_ptr<Entry> entry;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_workAvailable.wait(lock, [&]() { return m_stopping || !host.queue.empty(); });
+            if (m_stopping) {
+                return;
+            }
+
+            entry = host.queue.top();
+            host.queue.pop();
+            host.running.push_back(entry);
+            entry->preempt = false;
+            entry->result.queueTime += std::chrono::duration_cast<std::chrono::milliseconds>(
+                Clock::now() - entry->enqueuedAt);
+
+            --m_metrics.queued;
+            ++m_metrics.running;
+        }
+
+        // The buckets are charged for what the server acknowledged since the last chunk.
+        uint64_t charged = entry->result.bytes;
+        TransferOptions options;
+        options.resumeOffset = entry->result.bytes;
+        options.progress = [&](uint64_t transferred) {
+            const auto delta = transferred > charged ? transferred - charged : 0;
+            charged = transferred;
+            entry->result.bytes = transferred;
+
+            host.bucket.consume(delta);
+            m_globalBucket.consume(delta);
+
+            return !entry->preempt && !m_stopping;
+        };
+
+        const auto started = Clock::now();
+        const auto& job = entry->job;
+        const auto err = job.direction == Direction::Put
+                             ? client.put(job.localFileName, job.remoteFileName, options)
+                             : client.get(job.localFileName, job.remoteFileName, options);
+        entry->result.transferTime +=
+            std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started);
+        entry->result.error = err;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            host.running.erase(std::find(host.running.begin(), host.running.end(), entry));
+            --m_metrics.running;
+
+            if (err.isCancelled() && entry->preempt && !m_stopping) {
+                ++entry->result.preemptions;
+                ++m_metrics.preemptions;
+                ++m_metrics.queued;
+                entry->enqueuedAt = Clock::now();
+                host.queue.push(entry);
+                m_workAvailable.notify_all();
+                continue;
+            }
+
+            ++m_metrics.completed;
+            m_metrics.totalQueueTime += entry->result.queueTime;
+            m_metrics.maxQueueTime = std::max(m_metrics.maxQueueTime, entry->result.queueTime);
+        }
+
+        entry->promise.set_value(entry->result);
     }
 }
 
@@ -0,0 +1,217 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpasyncclient.h"
+
+#include <algorithm>  // max
+
+cts::SFTPAsyncClient::~SFTPAsyncClient() { disconnect(); }
+
+cts::SFTPError cts::SFTPAsyncClient::connect(const std::string& host, const std::string& user,
+                                             const std::string& pw, const ConnectOptions& options,
+                                             const unsigned int workers,
+                                             const size_t maxQueueDepth, const uint16_t port,
+                                             const bool onlyKnownServers) {
+    disconnect();
+
+    for (unsigned int i = 0; i < std::max(workers, 1u); ++i) {
+        std::unique_ptr<SFTPClient> client(new SFTPClient());
+        const auto err = client->connect(host, user, pw, options, port, onlyKnownServers);
+        if (!err.isOk()) {
+            m_clients.clear();
+            return err;
+        }
+        m_clients.push_back(std::move(client));
+    }
+
+    m_maxQueueDepth = std::max(maxQueueDepth, size_t(1));
+    m_stopping = false;
+
+    for (const auto& client : m_clients) {
+        const SFTPClient& session = *client;
+        m_workers.emplace_back([this, &session]() { workerLoop(session); });
+    }
+
+    return cts::SFTPError();
+}
+
+void cts::SFTPAsyncClient::disconnect() {
+    std::deque<Job> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        dropped.swap(m_queue);
+    }
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+
+    for (auto& job : dropped) {
+        job(nullptr);
+    }
+
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+
+    m_workers.clear();
+    m_clients.clear();
+}
+
+std::future<cts::SFTPError> cts::SFTPAsyncClient::putAsync(const std::string& localFileName,
+                                                           const std::string& remoteFileName,
+                                                           const CancellationToken& token,
+                                                           const TransferOptions& options) {
+    const auto transferOptions = cancellable(options, token);
+    return submit<SFTPError>(token, [=](const SFTPClient& client) {
+        return client.put(localFileName, remoteFileName, transferOptions);
+    });
+}
+
+std::future<cts::SFTPError> cts::SFTPAsyncClient::getAsync(const std::string& localFileName,
+                                                           const std::string& remoteFileName,
+                                                           const CancellationToken& token,
+                                                           const TransferOptions& options) {
+    const auto transferOptions = cancellable(options, token);
+    return submit<SFTPError>(token, [=](const SFTPClient& client) {
+        return client.get(localFileName, remoteFileName, transferOptions);
+    });
+}
+
+std::future<cts::SFTPError> cts::SFTPAsyncClient::mkdirAsync(const std::string& remoteDir,
+                                                             const mode_t permissions,
+                                                             const CancellationToken& token) {
+    return submit<SFTPError>(
+        token, [=](const SFTPClient& client) { return client.mkdir(remoteDir, permissions); });
+}
+
+std::future<std::pair<cts::SFTPError, std::vector<cts::SFTPAttributes>>>
+cts::SFTPAsyncClient::lsAsync(const std::string& remoteDir, const CancellationToken& token) {
+    return submit<std::pair<SFTPError, std::vector<SFTPAttributes>>>(
+        token, [=](const SFTPClient& client) { return client.ls(remoteDir); });
+}
+
+std::future<cts::SFTPError> cts::SFTPAsyncClient::renameAsync(const std::string& oldRemoteName,
+                                                              const std::string& newRemoteName,
+                                                              const CancellationToken& token) {
+    return submit<SFTPError>(token, [=](const SFTPClient& client) {
+        return client.rename(oldRemoteName, newRemoteName);
+    });
+}
+
+std::future<cts::SFTPError> cts::SFTPAsyncClient::copyAsync(const std::string& remoteSrc,
+                                                            const std::string& remoteDst,
+                                                            const bool recursive,
+                                                            const CancellationToken& token) {
+    return submit<SFTPError>(token, [=](const SFTPClient& client) {
+        return client.copy(remoteSrc, remoteDst, recursive);
+    });
+}
+
+std::future<cts::SFTPError> cts::SFTPAsyncClient::rmAsync(const std::string& remoteFileName,
+                                                          const CancellationToken& token) {
+    return submit<SFTPError>(token,
+                             [=](const SFTPClient& client) { return client.rm(remoteFileName); });
+}
+
+std::future<cts::SFTPError> cts::SFTPAsyncClient::rmdirAsync(const std::string& remoteDirName,
+                                                             const CancellationToken& token) {
+    return submit<SFTPError>(
+        token, [=](const SFTPClient& client) { return client.rmdir(remoteDirName); });
+}
+
+std::future<std::pair<cts::SFTPError, cts::SFTPAttributes>> cts::SFTPAsyncClient::statAsync(
+    const std::string& remotePath, const CancellationToken& token) {
+    return submit<std::pair<SFTPError, SFTPAttributes>>(
+        token, [=](const SFTPClient& client) { return client.stat(remotePath); });
+}
+
+template <typename Result>
+std::future<Result> cts::SFTPAsyncClient::submit(
+    const CancellationToken& token, std::function<Result(const SFTPClient&)> operation) {
+    // std::function needs a copyable target, so the promise is shared.
+    auto promise = std::make_shared<std::promise<Result>>();
+    auto future = promise->get_future();
+
+    const auto fail = [promise](const cts::SFTPError& err) {
+        Result result{};
+        errorOf(result) = err;
+        promise->set_value(std::move(result));
+    };
+
+    Job job = [promise, token, operation, fail](const SFTPClient* client) {
+        if (!client) {
+            fail(cts::SFTPError(SSH_OK, cts::SFTPError::kCancelled, "Client disconnected"));
+        } else if (token.isCancelled()) {
+            fail(cts::SFTPError(SSH_OK, cts::SFTPError::kCancelled, "Operation cancelled"));
+        } else {
+            promise->set_value(operation(*client));
+        }
+    };
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notFull.wait(lock, [this]() { return m_stopping || m_queue.size() < m_maxQueueDepth; });
+
+    if (m_stopping || m_workers.empty()) {
+        lock.unlock();
+        fail(cts::SFTPError(SSH_ERROR, SSH_FX_NO_CONNECTION, "Not connected"));
+        return future;
+    }
+
+    m_queue.push_back(std::move(job));
+    lock.unlock();
+    m_notEmpty.notify_one();
+
+    return future;
+}
+
+cts::TransferOptions cts::SFTPAsyncClient::cancellable(const TransferOptions& options,
+                                                       const CancellationToken& token) {
+    auto transferOptions = options;
+    const auto progress = options.progress;
+
+    transferOptions.progress = [progress, token](uint64_t transferred) {
+        if (token.isCancelled()) {
+            return false;
+        }
+        return !progress || progress(transferred);
+    };
+
+    return transferOptions;
+}
+
+void cts::SFTPAsyncClient::workerLoop(const SFTPClient& client) {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                return;
+            }
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        m_notFull.notify_one();
+
+        job(&client);
+    }
+}
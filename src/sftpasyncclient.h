@@ -0,0 +1,147 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_ASYNC_CLIENT_H
+#define SFTP_ASYNC_CLIENT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "sftpclient.h"
+
+namespace cts {
+
+// Shared cancellation flag. Copies refer to the same flag, so the caller keeps one copy and
+// passes another along with the operation.
+class CancellationToken {
+   public:
+    CancellationToken() : m_cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void cancel() const { m_cancelled->store(true); }
+
+    bool isCancelled() const { return m_cancelled->load(); }
+
+   private:
+    std::shared_ptr<std::atomic<bool>> m_cancelled;
+};
+
+// Runs SFTPClient operations on a pool of worker threads, each with its own session, and
+// returns their results as futures. Operations wait in a bounded queue: once it is full the
+// *Async() calls block until a worker takes one, so producers cannot run ahead of the
+// network without limit.
+//
+// A cancelled operation that has not started yet completes with an error for which
+// isCancelled() is true; a transfer already running stops after its current chunk.
+class SFTPAsyncClient {
+   public:
+    SFTPAsyncClient() = default;
+    ~SFTPAsyncClient();
+
+    // Opens one session per worker and starts the workers. Fails, with no worker running, if
+    // any session cannot be opened.
+    SFTPError connect(const std::string& host, const std::string& user, const std::string& pw,
+                      const ConnectOptions& options = ConnectOptions(),
+                      const unsigned int workers = 4, const size_t maxQueueDepth = 64,
+                      const uint16_t port = 22, const bool onlyKnownServers = true);
+
+    // Waits for running operations; queued ones complete as cancelled.
+    void disconnect();
+
+    std::future<SFTPError> putAsync(const std::string& localFileName,
+                                    const std::string& remoteFileName,
+                                    const CancellationToken& token = CancellationToken(),
+                                    const TransferOptions& options = TransferOptions());
+
+    std::future<SFTPError> getAsync(const std::string& localFileName,
+                                    const std::string& remoteFileName,
+                                    const CancellationToken& token = CancellationToken(),
+                                    const TransferOptions& options = TransferOptions());
+
+    std::future<SFTPError> mkdirAsync(const std::string& remoteDir, const mode_t permissions,
+                                      const CancellationToken& token = CancellationToken());
+
+    std::future<std::pair<SFTPError, std::vector<SFTPAttributes>>> lsAsync(
+        const std::string& remoteDir, const CancellationToken& token = CancellationToken());
+
+    std::future<SFTPError> renameAsync(const std::string& oldRemoteName,
+                                       const std::string& newRemoteName,
+                                       const CancellationToken& token = CancellationToken());
+
+    std::future<SFTPError> copyAsync(const std::string& remoteSrc, const std::string& remoteDst,
+                                     const bool recursive = false,
+                                     const CancellationToken& token = CancellationToken());
+
+    std::future<SFTPError> rmAsync(const std::string& remoteFileName,
+                                   const CancellationToken& token = CancellationToken());
+
+    std::future<SFTPError> rmdirAsync(const std::string& remoteDirName,
+                                      const CancellationToken& token = CancellationToken());
+
+    std::future<std::pair<SFTPError, SFTPAttributes>> statAsync(
+        const std::string& remotePath, const CancellationToken& token = CancellationToken());
+
+   private:
+    SFTPAsyncClient(const SFTPAsyncClient&) = delete;
+    SFTPAsyncClient& operator=(const SFTPAsyncClient&) = delete;
+
+    // Called with the worker's client, or with nullptr when the operation is dropped.
+    using Job = std::function<void(const SFTPClient*)>;
+
+    template <typename Result>
+    std::future<Result> submit(const CancellationToken& token,
+                               std::function<Result(const SFTPClient&)> operation);
+
+    static SFTPError& errorOf(SFTPError& err) { return err; }
+
+    template <typename T>
+    static SFTPError& errorOf(std::pair<SFTPError, T>& result) {
+        return result.first;
+    }
+
+    static TransferOptions cancellable(const TransferOptions& options,
+                                       const CancellationToken& token);
+
+    void workerLoop(const SFTPClient& client);
+
+    std::vector<std::unique_ptr<SFTPClient>> m_clients;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<Job> m_queue;
+    size_t m_maxQueueDepth = 64;
+    bool m_stopping = false;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_ASYNC_CLIENT_H */
@@ -0,0 +1,138 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpautotuner.h"
+
+#include <algorithm>  // max, min, max_element
+#include <map>
+#include <mutex>
+
+namespace {
+
+std::mutex& tunerCacheMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::map<std::string, cts::SFTPAutoTuner::Tuning>& tunerCache() {
+    static std::map<std::string, cts::SFTPAutoTuner::Tuning> tunings;
+    return tunings;
+}
+
+}  // namespace
+
+cts::SFTPAutoTuner::SFTPAutoTuner(const std::string& host, const unsigned int initialChunkSize,
+                                  const unsigned int initialInFlight,
+                                  const unsigned int maxChunkSize)
+    : m_host(host), m_maxChunkSize(std::max(maxChunkSize, 1u)) {
+    const auto known = cached(host);
+    if (known.chunkSize > 0) {
+        // The link was measured before, start from there and only follow changes.
+        m_probing = false;
+        m_minRtt = known.rtt;
+        setWindow(uint64_t(known.chunkSize) * known.maxInFlight);
+    } else {
+        setWindow(uint64_t(std::max(initialChunkSize, 1u)) * std::max(initialInFlight, 1u));
+    }
+
+    m_roundStart = Clock::now();
+    m_roundTarget = m_window;
+}
+
+cts::SFTPAutoTuner::~SFTPAutoTuner() {
+    if (m_roundRates.empty()) {
+        return;  // Too short to learn anything
+    }
+
+    Tuning tuning;
+    tuning.chunkSize = m_chunkSize;
+    tuning.maxInFlight = m_maxInFlight;
+    tuning.rtt = m_minRtt;
+    tuning.bytesPerSecond = *std::max_element(m_roundRates.begin(), m_roundRates.end());
+
+    std::lock_guard<std::mutex> lock(tunerCacheMutex());
+    tunerCache()[m_host] = tuning;
+}
+
+void cts::SFTPAutoTuner::onCompleted(const size_t length, const std::chrono::microseconds rtt) {
+    if (rtt.count() > 0 && (m_minRtt.count() == 0 || rtt < m_minRtt)) {
+        m_minRtt = rtt;
+    }
+
+    m_roundBytes += length;
+    if (m_roundBytes >= m_roundTarget) {
+        endRound(Clock::now());
+    }
+}
+
+cts::SFTPAutoTuner::Tuning cts::SFTPAutoTuner::cached(const std::string& host) {
+    std::lock_guard<std::mutex> lock(tunerCacheMutex());
+    const auto it = tunerCache().find(host);
+    return it != tunerCache().end() ? it->second : Tuning();
+}
+
+void cts::SFTPAutoTuner::endRound(const Clock::time_point now) {
+    const auto elapsed = std::chrono::duration<double>(now - m_roundStart).count();
+    if (elapsed <= 0) {
+        return;
+    }
+
+    const double rate = static_cast<double>(m_roundBytes) / elapsed;
+    m_roundRates.push_back(rate);
+    if (m_roundRates.size() > kRateRounds) {
+        m_roundRates.pop_front();
+    }
+
+    if (m_probing) {
+        if (rate >= m_bestProbeRate * 1.25) {
+            m_plateauRounds = 0;
+            m_bestProbeRate = rate;
+            setWindow(m_window * 2);
+        } else if (++m_plateauRounds >= kStartupPlateauRounds) {
+            m_probing = false;
+        }
+    }
+
+    if (!m_probing) {
+        const double bestRate = *std::max_element(m_roundRates.begin(), m_roundRates.end());
+        const double rtt = std::chrono::duration<double>(m_minRtt).count();
+        setWindow(static_cast<uint64_t>(2 * bestRate * rtt));
+    }
+
+    m_roundStart = now;
+    m_roundBytes = 0;
+    m_roundTarget = m_window;
+}
+
+void cts::SFTPAutoTuner::setWindow(const uint64_t window) {
+    m_window = std::min(std::max(window, uint64_t(kMinChunkSize) * kMinInFlight),
+                        uint64_t(kMaxWindow));
+
+    // Large requests cost the server fewer round trips per byte, but the window has to be
+    // split into enough of them to keep the pipe full while each one is answered.
+    const auto chunk = std::max<uint64_t>(m_window / kMinInFlight, kMinChunkSize);
+    m_chunkSize = static_cast<unsigned int>(std::min<uint64_t>(chunk, m_maxChunkSize));
+
+    const auto inFlight = (m_window + m_chunkSize - 1) / m_chunkSize;
+    m_maxInFlight = static_cast<unsigned int>(
+        std::min<uint64_t>(std::max<uint64_t>(inFlight, kMinInFlight), kMaxInFlight));
+}
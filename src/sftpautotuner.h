@@ -0,0 +1,106 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_AUTO_TUNER_H
+#define SFTP_AUTO_TUNER_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+namespace cts {
+
+// Sizes the requests of one transfer to the bandwidth-delay product of the link.
+//
+// Completions are grouped into rounds of roughly one window of data. Starting from the
+// configured window, it doubles every round while throughput keeps growing by a quarter or
+// more; once three rounds pass without such growth the window follows twice the product of
+// the best recent throughput and the lowest round trip time seen. The window is spent on
+// chunks as large as the server allows, with at least a few of them in flight.
+//
+// The last window per host is remembered for the lifetime of the process, so later transfers
+// to the same host start from it instead of probing again.
+class SFTPAutoTuner {
+   public:
+    struct Tuning {
+        unsigned int chunkSize = 0;
+        unsigned int maxInFlight = 0;
+        std::chrono::microseconds rtt{0};
+        double bytesPerSecond = 0;
+    };
+
+    // host identifies the peer in the cache, maxChunkSize is the server's read/write limit.
+    SFTPAutoTuner(const std::string& host, const unsigned int initialChunkSize,
+                  const unsigned int initialInFlight, const unsigned int maxChunkSize);
+
+    // Stores the current window for the host.
+    ~SFTPAutoTuner();
+
+    // A request of length bytes completed rtt after it was sent.
+    void onCompleted(const size_t length, const std::chrono::microseconds rtt);
+
+    unsigned int chunkSize() const { return m_chunkSize; }
+
+    unsigned int maxInFlight() const { return m_maxInFlight; }
+
+    // The last tuning stored for host, zeroed if there is none.
+    static Tuning cached(const std::string& host);
+
+   private:
+    SFTPAutoTuner(const SFTPAutoTuner&) = delete;
+    SFTPAutoTuner& operator=(const SFTPAutoTuner&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    void endRound(const Clock::time_point now);
+
+    void setWindow(const uint64_t window);
+
+    static constexpr unsigned int kMinChunkSize = 16 * 1024;
+    static constexpr unsigned int kMinInFlight = 4;
+    static constexpr unsigned int kMaxInFlight = 256;
+    static constexpr uint64_t kMaxWindow = 256ull * 1024 * 1024;
+    static constexpr size_t kRateRounds = 8;
+    static constexpr unsigned int kStartupPlateauRounds = 3;
+
+    const std::string m_host;
+    const unsigned int m_maxChunkSize;
+
+    unsigned int m_chunkSize;
+    unsigned int m_maxInFlight;
+    uint64_t m_window;
+
+    bool m_probing = true;
+    unsigned int m_plateauRounds = 0;
+    double m_bestProbeRate = 0;
+    std::deque<double> m_roundRates;  // The last kRateRounds rounds
+    std::chrono::microseconds m_minRtt{0};
+
+    Clock::time_point m_roundStart;
+    uint64_t m_roundBytes = 0;
+    uint64_t m_roundTarget;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_AUTO_TUNER_H */
@@ -0,0 +1,390 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpbatchtransfer.h"
+
+#include <algorithm>  // min, max
+#include <fstream>
+#include <map>
+#include <set>
+
+#include "sftptarstream.h"
+
+struct cts::SFTPBatchTransfer::File {
+    size_t index = 0;
+    std::string localFileName;
+    std::string remoteFileName;
+    std::ifstream in;
+    std::ofstream out;
+    std::string handle;
+    std::vector<char> buffer;
+    uint64_t offset = 0;
+    unsigned int outstanding = 0;
+
+    // Reads a download keeps outstanding. Most files in a batch fit into one chunk, so more
+    // are only asked for once a full chunk showed that the file is larger.
+    unsigned int window = 1;
+
+    bool endOfFile = false;
+    bool closing = false;
+    SFTPError error;
+};
+
+cts::SFTPBatchTransfer::SFTPBatchTransfer(ssh_session session, const ConnectOptions& options,
+                                          const uint32_t maxReadLength,
+                                          const uint32_t maxWriteLength)
+    : m_channel(session),
+      m_configuredChunkSize(std::max(options.chunkSize, 1u)),
+      m_maxReadLength(std::min(maxReadLength, uint32_t(SFTPSideChannel::kMaxDataLength))),
+      m_maxWriteLength(maxWriteLength),
+      m_maxInFlight(std::max(options.maxInFlightRequests, 1u)),
+      m_maxFiles(std::max(options.maxFilesInFlight, 1u)) {}
+
+cts::SFTPError cts::SFTPBatchTransfer::open() { return m_channel.open(); }
+
+std::pair<cts::SFTPError, std::vector<cts::FileTransferResult>> cts::SFTPBatchTransfer::put(
+    const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) {
+    return run(localDir, paths, remoteDir, true);
+}
+
+std::pair<cts::SFTPError, std::vector<cts::FileTransferResult>> cts::SFTPBatchTransfer::get(
+    const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) {
+    return run(localDir, paths, remoteDir, false);
+}
+
+std::pair<cts::SFTPError, std::vector<cts::FileTransferResult>> cts::SFTPBatchTransfer::run(
+    const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir, const bool upload) {
+    m_upload = upload;
+    m_error = cts::SFTPError();
+    m_chunkSize = std::max(
+        std::min(m_configuredChunkSize, upload ? m_maxWriteLength : m_maxReadLength), 1u);
+
+    m_results.clear();
+    std::vector<std::shared_ptr<File>> files;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        auto file = std::make_shared<File>();
+        file->index = i;
+        file->localFileName = localDir.empty() ? paths[i] : localDir + "/" + paths[i];
+        file->remoteFileName = remoteDir.empty() ? paths[i] : remoteDir + "/" + paths[i];
+        files.push_back(file);
+        m_results.push_back({paths[i], cts::SFTPError()});
+    }
+
+    if (upload) {
+        std::vector<std::string> remoteFileNames;
+        for (const auto& file : files) {
+            remoteFileNames.push_back(file->remoteFileName);
+        }
+        createRemoteDirectories(remoteFileNames);
+    }
+
+    size_t next = 0;
+    size_t turn = 0;
+    while (m_error.isOk()) {
+        while (m_open.size() < m_maxFiles && next < files.size()) {
+            startFile(files[next++]);
+        }
+
+        // Take turns at the head of the line so one large file cannot hold the whole budget.
+        const auto open = m_open;
+        for (size_t i = 0; i < open.size(); ++i) {
+            const auto& file = open[(turn + i) % open.size()];
+            if (upload) {
+                pumpPut(file);
+            } else {
+                pumpGet(file);
+            }
+        }
+        ++turn;
+
+        if (m_handlers.empty()) {
+            if (next == files.size() && m_open.empty()) {
+                break;
+            }
+            continue;  // Files that failed locally made room for more
+        }
+
+        receive();
+    }
+
+    if (!m_error.isOk()) {
+        for (const auto& file : m_open) {
+            m_results[file->index].error = m_error;
+        }
+        for (; next < files.size(); ++next) {
+            m_results[next].error = m_error;
+        }
+    }
+
+    m_open.clear();
+    m_handlers.clear();
+    m_bytesInFlight = 0;
+    return {m_error, m_results};
+}
+
+void cts::SFTPBatchTransfer::createRemoteDirectories(
+    const std::vector<std::string>& remoteFileNames) {
+    std::map<size_t, std::set<std::string>> byDepth;
+    for (const auto& remoteFileName : remoteFileNames) {
+        size_t depth = 0;
+        for (auto slash = remoteFileName.find('/', 1); slash != std::string::npos;
+             slash = remoteFileName.find('/', slash + 1)) {
+            byDepth[++depth].insert(remoteFileName.substr(0, slash));
+        }
+    }
+
+    // Servers may reorder requests, so a level is only asked for once its parents exist.
+    for (const auto& level : byDepth) {
+        for (const auto& dir : level.second) {
+            auto packet = request(SSH_FXP_MKDIR);
+            packet.putString(dir).putPermissions(0755);
+            // Fails harmlessly for directories that already exist.
+            send(packet, [](uint8_t, SFTPPacketReader&) {});
+        }
+
+        while (!m_handlers.empty() && m_error.isOk()) {
+            receive();
+        }
+    }
+}
+
+void cts::SFTPBatchTransfer::startFile(const std::shared_ptr<File>& file) {
+    if (m_upload) {
+        file->in.open(file->localFileName, std::ios::binary);
+        if (!file->in) {
+            m_results[file->index].error = cts::SFTPError(
+                SSH_OK, SSH_FX_NO_SUCH_FILE, "Failed to open local file: " + file->localFileName);
+            return;
+        }
+        file->buffer.resize(m_chunkSize);
+    }
+
+    m_open.push_back(file);
+
+    auto packet = request(SSH_FXP_OPEN);
+    packet.putString(file->remoteFileName);
+    if (m_upload) {
+        packet.putUint32(SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC)
+            .putPermissions(0600);
+    } else {
+        packet.putUint32(SSH_FXF_READ).putEmptyAttributes();
+    }
+
+    send(packet, [this, file](uint8_t type, SFTPPacketReader& reader) {
+        std::string handle;
+        if (type != SSH_FXP_HANDLE || !reader.getString(handle)) {
+            const auto err = SFTPSideChannel::statusError(type, reader);
+            finishFile(file, cts::SFTPError(err.getSSHErrorCode(), err.getSFTPErrorCode(),
+                                            "Failed to open remote file [" +
+                                                file->remoteFileName + "] " +
+                                                err.getSSHErrorMsg()));
+            return;
+        }
+        // Files without a handle are never written or closed, so one would hold up the batch.
+        if (handle.empty()) {
+            finishFile(file, cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE,
+                                            "Empty handle for remote file [" +
+                                                file->remoteFileName + "]"));
+            return;
+        }
+        file->handle = handle;
+
+        if (!m_upload) {
+            cts::createParentDirectories(file->localFileName);
+            file->out.open(file->localFileName, std::ios::binary);
+            if (!file->out) {
+                file->error = cts::SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                                             "Failed to open local file: " + file->localFileName);
+            }
+        }
+    });
+}
+
+void cts::SFTPBatchTransfer::pumpPut(const std::shared_ptr<File>& file) {
+    if (file->handle.empty() || file->closing) {
+        return;
+    }
+
+    while (!file->endOfFile && file->error.isOk() && file->outstanding < m_maxInFlight &&
+           m_bytesInFlight < kMaxBytesInFlight) {
+        file->in.read(file->buffer.data(), static_cast<std::streamsize>(file->buffer.size()));
+        const auto bytesRead = static_cast<uint32_t>(file->in.gcount());
+        file->endOfFile = !file->in;
+
+        if (file->in.bad()) {
+            file->error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                         "Failed to read from local file: " + file->localFileName);
+            break;
+        }
+
+        if (bytesRead == 0) {
+            break;
+        }
+
+        auto packet = request(SSH_FXP_WRITE);
+        packet.putString(file->handle)
+            .putUint64(file->offset)
+            .putString(file->buffer.data(), bytesRead);
+        file->offset += bytesRead;
+        ++file->outstanding;
+        m_bytesInFlight += bytesRead;
+
+        send(packet, [this, file, bytesRead](uint8_t type, SFTPPacketReader& reader) {
+            --file->outstanding;
+            m_bytesInFlight -= bytesRead;
+
+            const auto err = SFTPSideChannel::statusError(type, reader);
+            if (!err.isOk() && file->error.isOk()) {
+                file->error = cts::SFTPError(err.getSSHErrorCode(), err.getSFTPErrorCode(),
+                                             "Failed to write to remote file [" +
+                                                 file->remoteFileName + "] " +
+                                                 err.getSSHErrorMsg());
+            }
+        });
+    }
+
+    if ((file->endOfFile || !file->error.isOk()) && file->outstanding == 0) {
+        closeFile(file);
+    }
+}
+
+void cts::SFTPBatchTransfer::pumpGet(const std::shared_ptr<File>& file) {
+    if (file->handle.empty() || file->closing) {
+        return;
+    }
+
+    while (!file->endOfFile && file->error.isOk() && file->outstanding < file->window &&
+           m_bytesInFlight < kMaxBytesInFlight) {
+        readChunk(file, file->offset, m_chunkSize);
+        file->offset += m_chunkSize;
+    }
+
+    if ((file->endOfFile || !file->error.isOk()) && file->outstanding == 0) {
+        closeFile(file);
+    }
+}
+
+void cts::SFTPBatchTransfer::readChunk(const std::shared_ptr<File>& file, const uint64_t offset,
+                                       const uint32_t length) {
+    auto packet = request(SSH_FXP_READ);
+    packet.putString(file->handle).putUint64(offset).putUint32(length);
+    ++file->outstanding;
+    m_bytesInFlight += length;
+
+    send(packet, [this, file, offset, length](uint8_t type, SFTPPacketReader& reader) {
+        --file->outstanding;
+        m_bytesInFlight -= length;
+
+        const char* data = nullptr;
+        uint32_t size = 0;
+
+        if (type == SSH_FXP_DATA && reader.getStringView(data, size) && size <= length) {
+            if (file->error.isOk()) {
+                file->out.seekp(static_cast<std::streamoff>(offset));
+                file->out.write(data, size);
+                if (!file->out) {
+                    file->error = cts::SFTPError(
+                        SSH_OK, SSH_FX_FAILURE,
+                        "Failed to write to local file [" + file->localFileName + "]");
+                }
+            }
+
+            if (size == length) {
+                file->window = m_maxInFlight;
+            } else if (size > 0 && file->error.isOk()) {
+                // The rest of a short read is asked for again, at the end of the file that
+                // comes back as EOF.
+                readChunk(file, offset + size, length - size);
+            } else if (size == 0 && file->error.isOk()) {
+                // Asking again could go on forever, and skipping it would leave a gap.
+                file->error = cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE,
+                                             "Empty read response for remote file [" +
+                                                 file->remoteFileName + "]");
+            }
+        } else {
+            const auto err = SFTPSideChannel::statusError(type, reader);
+            if (err.getSFTPErrorCode() == SSH_FX_EOF) {
+                file->endOfFile = true;
+            } else if (file->error.isOk()) {
+                file->error = err.isOk() ? cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE,
+                                                          "Malformed read response")
+                                         : err;
+            }
+        }
+    });
+}
+
+void cts::SFTPBatchTransfer::closeFile(const std::shared_ptr<File>& file) {
+    file->closing = true;
+
+    auto packet = request(SSH_FXP_CLOSE);
+    packet.putString(file->handle);
+
+    send(packet, [this, file](uint8_t type, SFTPPacketReader& reader) {
+        const auto err = SFTPSideChannel::statusError(type, reader);
+        if (file->out.is_open()) {
+            file->out.close();
+        }
+        finishFile(file, file->error.isOk() ? err : file->error);
+    });
+}
+
+void cts::SFTPBatchTransfer::finishFile(const std::shared_ptr<File>& file,
+                                        const SFTPError& err) {
+    m_results[file->index].error = err;
+    m_open.erase(std::remove(m_open.begin(), m_open.end(), file), m_open.end());
+}
+
+void cts::SFTPBatchTransfer::send(SFTPPacketWriter& packet, ResponseHandler handler) {
+    if (!m_error.isOk()) {
+        return;
+    }
+
+    m_error = m_channel.send(packet.finish());
+    if (m_error.isOk()) {
+        m_handlers.emplace(m_nextId, std::move(handler));
+    }
+    ++m_nextId;
+}
+
+void cts::SFTPBatchTransfer::receive() {
+    uint32_t id = 0;
+    uint8_t type = 0;
+    std::string body;
+    m_error = m_channel.receive(id, type, body);
+    if (!m_error.isOk()) {
+        return;
+    }
+
+    auto it = m_handlers.find(id);
+    if (it == m_handlers.end()) {
+        return;
+    }
+
+    auto handler = std::move(it->second);
+    m_handlers.erase(it);
+    SFTPPacketReader reader(body.data(), body.size());
+    handler(type, reader);
+}
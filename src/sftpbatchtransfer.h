@@ -0,0 +1,127 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_BATCH_TRANSFER_H
+#define SFTP_BATCH_TRANSFER_H
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "sftpconnectoptions.h"
+#include "sftperror.h"
+#include "sftppacket.h"
+#include "sftpsidechannel.h"
+#include "sftptransferoptions.h"
+
+namespace cts {
+
+// Transfers many files over one SFTP side channel with their opens, reads or writes and closes
+// overlapping: up to ConnectOptions::maxFilesInFlight files are open at once, each with up to
+// maxInFlightRequests chunks outstanding, so the link stays busy while single files wait for
+// their round trips. The replies still outstanding are kept below kMaxBytesInFlight, which
+// fits into the channel window, so the blocking channel never waits on itself.
+class SFTPBatchTransfer {
+   public:
+    // maxReadLength and maxWriteLength are the server's limits, see limits@openssh.com.
+    SFTPBatchTransfer(ssh_session session, const ConnectOptions& options,
+                      const uint32_t maxReadLength, const uint32_t maxWriteLength);
+
+    // Opens the side channel, which servers that allow a single channel per session refuse.
+    SFTPError open();
+
+    // localDir/path to remoteDir/path for each path, creating missing remote directories.
+    std::pair<SFTPError, std::vector<FileTransferResult>> put(
+        const std::string& localDir, const std::vector<std::string>& paths,
+        const std::string& remoteDir);
+
+    // remoteDir/path to localDir/path for each path, creating missing local directories.
+    std::pair<SFTPError, std::vector<FileTransferResult>> get(
+        const std::string& localDir, const std::vector<std::string>& paths,
+        const std::string& remoteDir);
+
+   private:
+    SFTPBatchTransfer(const SFTPBatchTransfer&) = delete;
+    SFTPBatchTransfer& operator=(const SFTPBatchTransfer&) = delete;
+
+    // Called with the response type and a reader positioned after the request id.
+    using ResponseHandler = std::function<void(uint8_t type, SFTPPacketReader& reader)>;
+
+    struct File;
+
+    std::pair<SFTPError, std::vector<FileTransferResult>> run(
+        const std::string& localDir, const std::vector<std::string>& paths,
+        const std::string& remoteDir, const bool upload);
+
+    // Creates the remote directories above the files, one level of depth per round trip.
+    void createRemoteDirectories(const std::vector<std::string>& remoteFileNames);
+
+    void startFile(const std::shared_ptr<File>& file);
+
+    void pumpPut(const std::shared_ptr<File>& file);
+
+    void pumpGet(const std::shared_ptr<File>& file);
+
+    void readChunk(const std::shared_ptr<File>& file, const uint64_t offset,
+                   const uint32_t length);
+
+    void closeFile(const std::shared_ptr<File>& file);
+
+    void finishFile(const std::shared_ptr<File>& file, const SFTPError& err);
+
+    SFTPPacketWriter request(const uint8_t type) { return SFTPPacketWriter(type, m_nextId); }
+
+    void send(SFTPPacketWriter& packet, ResponseHandler handler);
+
+    // Reads one reply and runs its handler.
+    void receive();
+
+    static constexpr uint32_t kMaxBytesInFlight = 1024 * 1024;
+
+    SFTPSideChannel m_channel;
+    SFTPError m_error;
+    bool m_upload = true;
+
+    uint32_t m_configuredChunkSize;
+    uint32_t m_maxReadLength;
+    uint32_t m_maxWriteLength;
+    uint32_t m_chunkSize = 0;
+    unsigned int m_maxInFlight;
+    unsigned int m_maxFiles;
+
+    uint32_t m_nextId = 1;
+    std::unordered_map<uint32_t, ResponseHandler> m_handlers;
+    std::vector<std::shared_ptr<File>> m_open;
+    std::vector<FileTransferResult> m_results;
+    uint64_t m_bytesInFlight = 0;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_BATCH_TRANSFER_H */
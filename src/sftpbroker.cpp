@@ -0,0 +1,883 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpbroker.h"
+
+#include <cerrno>
+#include <cstdlib>  // calloc
+#include <cstring>  // memcpy, strdup, strerror
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>  // chmod, lstat
+#include <sys/un.h>    // sockaddr_un
+#include <unistd.h>    // close, getcwd, unlink
+#endif
+
+#include "sftppacket.h"
+
+namespace {
+
+// Requests of the broker protocol, framed like SFTP packets. Each gets one kBrokerReply: the
+// SSH and SFTP error codes and the message, followed by the result when the request succeeded.
+enum BrokerMessage : uint8_t {
+    kBrokerOpen = 1,
+    kBrokerPut,
+    kBrokerGet,
+    kBrokerMkdir,
+    kBrokerLs,
+    kBrokerRename,
+    kBrokerCopy,
+    kBrokerRm,
+    kBrokerRmdir,
+    kBrokerStat,
+    kBrokerReply = 100,
+};
+
+constexpr uint32_t kBrokerVersion = 3;
+
+// Room for the listing of a very large directory.
+constexpr uint32_t kBrokerMaxMessage = 64 * 1024 * 1024;
+
+cts::SFTPError brokerSystemError(const std::string& what) {
+    return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, what + " " + std::strerror(errno));
+}
+
+bool brokerSend(const int fd, const std::string& message) {
+#ifdef _WIN32
+    (void)fd;
+    (void)message;
+    return false;
+#else
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;  // A vanished peer is an error, not a SIGPIPE
+#else
+    const int flags = 0;
+#endif
+    size_t sent = 0;
+    while (sent < message.size()) {
+        const auto n = ::send(fd, message.data() + sent, message.size() - sent, flags);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+#endif
+}
+
+bool brokerReceiveAll(const int fd, char* data, size_t size) {
+#ifdef _WIN32
+    (void)fd;
+    (void)data;
+    return size == 0;
+#else
+    while (size > 0) {
+        const auto n = ::recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+#endif
+}
+
+// One message as SFTPPacketWriter::finish() frames it, split into its type and the rest.
+bool brokerReceive(const int fd, uint8_t& type, std::string& body) {
+    char prefix[4];
+    uint32_t length = 0;
+    if (!brokerReceiveAll(fd, prefix, sizeof(prefix)) ||
+        !cts::SFTPPacketReader(prefix, sizeof(prefix)).getUint32(length) || length == 0 ||
+        length > kBrokerMaxMessage) {
+        return false;
+    }
+
+    body.resize(length);
+    if (!brokerReceiveAll(fd, &body[0], length)) {
+        return false;
+    }
+
+    type = static_cast<uint8_t>(body[0]);
+    body.erase(0, 1);
+    return true;
+}
+
+#ifndef _WIN32
+bool brokerSocketAddress(const std::string& socketPath, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    return true;
+}
+
+// The socket's mode keeps other users out where the system honours it, this also where not.
+bool brokerPeerIsOwner(const int fd) {
+#if defined(SO_PEERCRED)
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 &&
+           credentials.uid == geteuid();
+#else
+    uid_t uid = 0;
+    gid_t gid = 0;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+#endif
+
+// Compares in constant time, so replies do not reveal how much of a password matched.
+bool brokerSecretsEqual(const std::string& a, const std::string& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    unsigned char difference = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        difference |= static_cast<unsigned char>(a[i] ^ b[i]);
+    }
+    return difference == 0;
+}
+
+std::string brokerAbsolutePath(const std::string& path) {
+#ifndef _WIN32
+    if (!path.empty() && path[0] != '/') {
+        std::vector<char> cwd(4096);
+        if (getcwd(cwd.data(), cwd.size())) {
+            return std::string(cwd.data()) + "/" + path;
+        }
+    }
+#endif
+    return path;
+}
+
+void putBrokerOptions(cts::SFTPPacketWriter& writer, const cts::TransferOptions& options) {
+    writer.putUint32(options.chunkSize)
+        .putUint64(options.resumeOffset)
+        .putUint8(static_cast<uint8_t>(options.checksum))
+        .putUint8(options.verifyChecksum)
+        .putUint8(options.sparse)
+        .putUint8(options.zstd)
+        .putUint32(static_cast<uint32_t>(options.zstdLevel))
+        .putUint32(options.zstdThreads);
+}
+
+bool getBrokerOptions(cts::SFTPPacketReader& reader, cts::TransferOptions& options) {
+    uint8_t checksum = 0;
+    uint8_t verifyChecksum = 0;
+    uint8_t sparse = 0;
+    uint8_t zstd = 0;
+    uint32_t zstdLevel = 0;
+    if (!reader.getUint32(options.chunkSize) || !reader.getUint64(options.resumeOffset) ||
+        !reader.getUint8(checksum) || !reader.getUint8(verifyChecksum) ||
+        !reader.getUint8(sparse) || !reader.getUint8(zstd) || !reader.getUint32(zstdLevel) ||
+        !reader.getUint32(options.zstdThreads) ||
+        checksum > static_cast<uint8_t>(cts::ChecksumAlgorithm::Sha256)) {
+        return false;
+    }
+
+    options.checksum = static_cast<cts::ChecksumAlgorithm>(checksum);
+    options.verifyChecksum = verifyChecksum != 0;
+    options.sparse = sparse != 0;
+    options.zstd = zstd != 0;
+    options.zstdLevel = static_cast<int>(zstdLevel);
+    return true;
+}
+
+void putBrokerStats(cts::SFTPPacketWriter& writer, const cts::TransferStats& stats) {
+    writer.putUint64(stats.bytes)
+        .putUint64(stats.wireBytes)
+        .putUint8(stats.zstd)
+        .putUint64(static_cast<uint64_t>(stats.elapsed.count()));
+}
+
+bool getBrokerStats(cts::SFTPPacketReader& reader, cts::TransferStats& stats) {
+    uint8_t zstd = 0;
+    uint64_t elapsed = 0;
+    if (!reader.getUint64(stats.bytes) || !reader.getUint64(stats.wireBytes) ||
+        !reader.getUint8(zstd) || !reader.getUint64(elapsed)) {
+        return false;
+    }
+
+    stats.zstd = zstd != 0;
+    stats.elapsed = std::chrono::milliseconds(elapsed);
+    return true;
+}
+
+void putBrokerAttributes(cts::SFTPPacketWriter& writer, const sftp_attributes_struct& attributes) {
+    writer.putString(attributes.name ? attributes.name : "")
+        .putString(attributes.longname ? attributes.longname : "")
+        .putAttributes(attributes);
+}
+
+bool getBrokerAttributes(cts::SFTPPacketReader& reader, cts::SFTPAttributes& result) {
+    auto* attributes =
+        static_cast<sftp_attributes>(std::calloc(1, sizeof(sftp_attributes_struct)));
+    result = cts::SFTPAttributes(attributes);
+
+    std::string name;
+    std::string longName;
+    if (!attributes || !reader.getString(name) || !reader.getString(longName) ||
+        !reader.getAttributes(*attributes)) {
+        return false;
+    }
+
+    attributes->name = name.empty() ? nullptr : strdup(name.c_str());
+    attributes->longname = longName.empty() ? nullptr : strdup(longName.c_str());
+    return true;
+}
+
+cts::SFTPPacketWriter brokerReply(const cts::SFTPError& err) {
+    cts::SFTPPacketWriter reply(kBrokerReply);
+    reply.putUint32(static_cast<uint32_t>(err.getSSHErrorCode()))
+        .putUint32(static_cast<uint32_t>(err.getSFTPErrorCode()))
+        .putString(err.getSSHErrorMsg());
+    return reply;
+}
+
+// Whether the session behind err is beyond use and should not go back to the pool.
+bool brokerSessionLost(const cts::SFTPError& err) {
+    return err.getSFTPErrorCode() == SSH_FX_NO_CONNECTION ||
+           err.getSFTPErrorCode() == SSH_FX_CONNECTION_LOST ||
+           err.getSSHErrorCode() == SSH_FATAL;
+}
+
+}  // namespace
+
+cts::SFTPBroker::SFTPBroker(const std::string& socketPath, const ConnectOptions& options,
+                            const std::chrono::seconds idleTimeout)
+    : m_socketPath(socketPath), m_options(options), m_idleTimeout(idleTimeout) {}
+
+cts::SFTPBroker::~SFTPBroker() {
+    stop();
+#ifndef _WIN32
+    if (m_listenFd >= 0) {
+        ::close(m_listenFd);
+        ::unlink(m_socketPath.c_str());
+    }
+#endif
+}
+
+cts::SFTPError cts::SFTPBroker::listen() {
+#ifdef _WIN32
+    return cts::SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED, "The session broker needs Unix sockets");
+#else
+    sockaddr_un address;
+    if (!brokerSocketAddress(m_socketPath, address)) {
+        return cts::SFTPError(SSH_OK, SSH_FX_FAILURE, "Invalid socket path [" + m_socketPath + "]");
+    }
+
+    // A socket that refuses connections was left behind by a broker that is gone. Anything
+    // else at the path is not the broker's to remove.
+    struct stat existing;
+    if (::lstat(m_socketPath.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            return cts::SFTPError(SSH_OK, SSH_FX_FILE_ALREADY_EXISTS,
+                                  "[" + m_socketPath + "] exists and is not a socket");
+        }
+
+        const int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe < 0) {
+            return brokerSystemError("Failed to create socket [" + m_socketPath + "]");
+        }
+        const bool running =
+            ::connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+        ::close(probe);
+        if (running) {
+            return cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                  "A broker already listens on [" + m_socketPath + "]");
+        }
+        ::unlink(m_socketPath.c_str());
+    } else if (errno != ENOENT) {
+        return brokerSystemError("Failed to inspect [" + m_socketPath + "]");
+    }
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return brokerSystemError("Failed to create socket [" + m_socketPath + "]");
+    }
+
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 ||
+        ::chmod(m_socketPath.c_str(), S_IRUSR | S_IWUSR) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        const auto err = brokerSystemError("Failed to listen on [" + m_socketPath + "]");
+        ::close(fd);
+        return err;
+    }
+
+    m_listenFd = fd;
+    return cts::SFTPError();
+#endif
+}
+
+cts::SFTPError cts::SFTPBroker::run() {
+#ifdef _WIN32
+    return listen();
+#else
+    if (m_listenFd < 0) {
+        const auto err = listen();
+        if (!err.isOk()) {
+            return err;
+        }
+    }
+
+    while (!m_stopping) {
+        // Wakes up every second to close idle sessions, reap finished processes and notice
+        // stop().
+        pollfd ready = {m_listenFd, POLLIN, 0};
+        const int rc = ::poll(&ready, 1, 1000);
+        closeIdleSessions();
+        joinFinished();
+
+        if (rc <= 0) {
+            continue;
+        }
+
+        const int fd = ::accept(m_listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+
+        if (!brokerPeerIsOwner(fd)) {
+            ::close(fd);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping) {
+            ::close(fd);
+            break;
+        }
+        m_clients[fd] = std::thread(&SFTPBroker::serve, this, fd);
+    }
+
+    stop();
+    ::close(m_listenFd);
+    ::unlink(m_socketPath.c_str());
+    m_listenFd = -1;
+
+    std::map<int, std::thread> clients;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        clients.swap(m_clients);
+        m_finished.clear();
+    }
+    for (auto& client : clients) {
+        client.second.join();
+        ::close(client.first);
+    }
+
+    std::map<std::string, std::vector<Session>> idle;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        idle.swap(m_idle);
+    }
+
+    return cts::SFTPError();
+#endif
+}
+
+void cts::SFTPBroker::stop() {
+    m_stopping = true;
+
+#ifndef _WIN32
+    // Unblocks the threads waiting for their process's next request.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& client : m_clients) {
+        ::shutdown(client.first, SHUT_RDWR);
+    }
+#endif
+}
+
+size_t cts::SFTPBroker::sessionCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t count = m_leased;
+    for (const auto& host : m_idle) {
+        count += host.second.size();
+    }
+    return count;
+}
+
+void cts::SFTPBroker::serve(const int fd) {
+    std::string key;
+    Session session;
+    bool reusable = true;
+
+    uint8_t type = 0;
+    std::string body;
+    while (!m_stopping && brokerReceive(fd, type, body)) {
+        SFTPPacketReader reader(body.data(), body.size());
+        std::string reply;
+
+        if (type == kBrokerOpen) {
+            uint32_t version = 0;
+            uint32_t port = 0;
+            uint8_t onlyKnownServers = 1;
+            std::string host, user, password;
+            if (session.client) {
+                reply = brokerReply(cts::SFTPError(SSH_OK, SSH_FX_FAILURE, "Already open"))
+                            .finish();
+            } else if (!reader.getUint32(version) || version != kBrokerVersion ||
+                       !reader.getString(host) || !reader.getString(user) ||
+                       !reader.getString(password) || !reader.getUint32(port) ||
+                       !reader.getUint8(onlyKnownServers) || port > 0xffff) {
+                reply = brokerReply(cts::SFTPError(SSH_OK, SSH_FX_BAD_MESSAGE,
+                                                   "Unsupported broker request"))
+                            .finish();
+            } else {
+                key = user + "@" + host + ":" + std::to_string(port);
+                auto leased = lease(key, host, user, password, static_cast<uint16_t>(port),
+                                    onlyKnownServers != 0);
+                session = std::move(leased.second);
+                reply = brokerReply(leased.first).finish();
+            }
+        } else if (!session.client) {
+            reply = brokerReply(cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "No session open"))
+                        .finish();
+        } else {
+            reply = handle(type, reader, *session.client, reusable);
+        }
+
+        if (!brokerSend(fd, reply)) {
+            break;
+        }
+    }
+
+    if (session.client) {
+        release(key, std::move(session), reusable);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_finished.push_back(fd);
+}
+
+std::string cts::SFTPBroker::handle(const uint8_t type, SFTPPacketReader& reader,
+                                    const SFTPClient& client, bool& reusable) {
+    const auto malformed = [&]() {
+        return brokerReply(cts::SFTPError(SSH_OK, SSH_FX_BAD_MESSAGE, "Malformed broker request"))
+            .finish();
+    };
+
+    std::string first, second;
+    cts::SFTPError err;
+
+    switch (type) {
+        case kBrokerPut:
+        case kBrokerGet: {
+            TransferOptions options;
+            if (!reader.getString(first) || !reader.getString(second) ||
+                !getBrokerOptions(reader, options)) {
+                return malformed();
+            }
+
+            std::string digest;
+            TransferStats stats;
+            options.onChecksum = [&digest](const std::string& value) { digest = value; };
+            options.onStats = [&stats](const TransferStats& value) { stats = value; };
+            err = type == kBrokerPut ? client.put(first, second, options)
+                                     : client.get(first, second, options);
+            reusable = reusable && !brokerSessionLost(err);
+
+            // Failed transfers report what they moved too, as put() and get() do.
+            auto reply = brokerReply(err);
+            reply.putString(err.isOk() ? digest : std::string());
+            putBrokerStats(reply, stats);
+            return reply.finish();
+        }
+
+        case kBrokerLs: {
+            if (!reader.getString(first)) {
+                return malformed();
+            }
+
+            const auto result = client.ls(first);
+            reusable = reusable && !brokerSessionLost(result.first);
+
+            auto reply = brokerReply(result.first);
+            if (result.first.isOk()) {
+                reply.putUint32(static_cast<uint32_t>(result.second.size()));
+                for (const auto& entry : result.second) {
+                    putBrokerAttributes(reply, *entry.get());
+                }
+            }
+            return reply.finish();
+        }
+
+        case kBrokerStat: {
+            if (!reader.getString(first)) {
+                return malformed();
+            }
+
+            const auto result = client.stat(first);
+            reusable = reusable && !brokerSessionLost(result.first);
+
+            auto reply = brokerReply(result.first);
+            if (result.first.isOk()) {
+                putBrokerAttributes(reply, *result.second.get());
+            }
+            return reply.finish();
+        }
+
+        case kBrokerMkdir: {
+            uint32_t permissions = 0;
+            if (!reader.getString(first) || !reader.getUint32(permissions)) {
+                return malformed();
+            }
+            err = client.mkdir(first, static_cast<mode_t>(permissions));
+            break;
+        }
+
+        case kBrokerRename:
+            if (!reader.getString(first) || !reader.getString(second)) {
+                return malformed();
+            }
+            err = client.rename(first, second);
+            break;
+
+        case kBrokerCopy: {
+            uint8_t recursive = 0;
+            if (!reader.getString(first) || !reader.getString(second) ||
+                !reader.getUint8(recursive)) {
+                return malformed();
+            }
+            err = client.copy(first, second, recursive != 0);
+            break;
+        }
+
+        case kBrokerRm:
+        case kBrokerRmdir:
+            if (!reader.getString(first)) {
+                return malformed();
+            }
+            err = type == kBrokerRm ? client.rm(first) : client.rmdir(first);
+            break;
+
+        default:
+            return brokerReply(cts::SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED,
+                                              "Unsupported broker request"))
+                .finish();
+    }
+
+    reusable = reusable && !brokerSessionLost(err);
+    return brokerReply(err).finish();
+}
+
+std::pair<cts::SFTPError, cts::SFTPBroker::Session> cts::SFTPBroker::lease(
+    const std::string& key, const std::string& host, const std::string& user,
+    const std::string& password, const uint16_t port, const bool onlyKnownServers) {
+    const auto takeIdle = [&](Session& session) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it = m_idle.find(key);
+        if (it == m_idle.end()) {
+            return false;
+        }
+        auto& sessions = it->second;
+        for (size_t i = sessions.size(); i-- > 0;) {
+            if (sessions[i].onlyKnownServers == onlyKnownServers &&
+                brokerSecretsEqual(sessions[i].password, password)) {
+                session = std::move(sessions[i]);
+                sessions.erase(sessions.begin() + static_cast<std::ptrdiff_t>(i));
+                if (sessions.empty()) {
+                    m_idle.erase(it);
+                }
+                ++m_leased;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // The server or a firewall may have dropped an idle session without the broker noticing,
+    // so one round trip has to succeed before it is lent. Dead sessions are closed here,
+    // outside the lock.
+    for (Session idle; takeIdle(idle); idle = Session()) {
+        if (!brokerSessionLost(idle.client->stat(".").first)) {
+            return {cts::SFTPError(), std::move(idle)};
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_leased;
+    }
+
+    Session session;
+    session.client.reset(new SFTPClient());
+    const auto err =
+        session.client->connect(host, user, password, m_options, port, onlyKnownServers);
+    if (!err.isOk()) {
+        return {err, Session()};
+    }
+    session.password = password;
+    session.onlyKnownServers = onlyKnownServers;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_leased;
+    return {cts::SFTPError(), std::move(session)};
+}
+
+void cts::SFTPBroker::release(const std::string& key, Session session, const bool reusable) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    --m_leased;
+    if (reusable && !m_stopping) {
+        session.idleSince = Clock::now();
+        m_idle[key].push_back(std::move(session));
+    }
+}
+
+void cts::SFTPBroker::closeIdleSessions() {
+    std::vector<Session> expired;  // Disconnected after the lock is released
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto now = Clock::now();
+    for (auto it = m_idle.begin(); it != m_idle.end();) {
+        auto& sessions = it->second;
+        for (size_t i = sessions.size(); i-- > 0;) {
+            if (now - sessions[i].idleSince >= m_idleTimeout) {
+                expired.push_back(std::move(sessions[i]));
+                sessions.erase(sessions.begin() + static_cast<std::ptrdiff_t>(i));
+            }
+        }
+        it = sessions.empty() ? m_idle.erase(it) : std::next(it);
+    }
+}
+
+void cts::SFTPBroker::joinFinished() {
+    std::vector<std::pair<int, std::thread>> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const int fd : m_finished) {
+            const auto it = m_clients.find(fd);
+            if (it != m_clients.end()) {
+                finished.emplace_back(fd, std::move(it->second));
+                m_clients.erase(it);
+            }
+        }
+        m_finished.clear();
+    }
+
+    // Closed only now, so the descriptor cannot be reused while its thread still runs.
+    for (auto& client : finished) {
+        client.second.join();
+#ifndef _WIN32
+        ::close(client.first);
+#endif
+    }
+}
+
+cts::SFTPBrokerConnection::SFTPBrokerConnection(const std::string& socketPath)
+    : m_socketPath(socketPath) {}
+
+cts::SFTPBrokerConnection::~SFTPBrokerConnection() {
+#ifndef _WIN32
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+#endif
+}
+
+cts::SFTPError cts::SFTPBrokerConnection::open(const std::string& host, const std::string& user,
+                                               const std::string& pw, const uint16_t port,
+                                               const bool onlyKnownServers) {
+#ifdef _WIN32
+    (void)host;
+    (void)user;
+    (void)pw;
+    (void)port;
+    (void)onlyKnownServers;
+    return cts::SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED, "The session broker needs Unix sockets");
+#else
+    sockaddr_un address;
+    if (!brokerSocketAddress(m_socketPath, address)) {
+        return cts::SFTPError(SSH_OK, SSH_FX_FAILURE, "Invalid socket path [" + m_socketPath + "]");
+    }
+
+    m_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fd < 0) {
+        return brokerSystemError("Failed to create socket");
+    }
+
+#ifdef SO_NOSIGPIPE
+    const int on = 1;
+    setsockopt(m_fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    if (::connect(m_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+        return brokerSystemError("Failed to reach the session broker at [" + m_socketPath + "]");
+    }
+
+    return call(SFTPPacketWriter(kBrokerOpen)
+                    .putUint32(kBrokerVersion)
+                    .putString(host)
+                    .putString(user)
+                    .putString(pw)
+                    .putUint32(port)
+                    .putUint8(onlyKnownServers)
+                    .finish(),
+                nullptr);
+#endif
+}
+
+cts::SFTPError cts::SFTPBrokerConnection::put(const std::string& localFileName,
+                                              const std::string& remoteFileName,
+                                              const TransferOptions& options) {
+    return transfer(kBrokerPut, localFileName, remoteFileName, options);
+}
+
+cts::SFTPError cts::SFTPBrokerConnection::get(const std::string& localFileName,
+                                              const std::string& remoteFileName,
+                                              const TransferOptions& options) {
+    return transfer(kBrokerGet, localFileName, remoteFileName, options);
+}
+
+cts::SFTPError cts::SFTPBrokerConnection::mkdir(const std::string& remoteDir,
+                                                const uint32_t permissions) {
+    return call(SFTPPacketWriter(kBrokerMkdir).putString(remoteDir).putUint32(permissions).finish(),
+                nullptr);
+}
+
+std::pair<cts::SFTPError, std::vector<cts::SFTPAttributes>> cts::SFTPBrokerConnection::ls(
+    const std::string& remoteDir) {
+    std::vector<SFTPAttributes> entries;
+    const auto err =
+        call(SFTPPacketWriter(kBrokerLs).putString(remoteDir).finish(),
+             [&](SFTPPacketReader& reader) {
+                 uint32_t count = 0;
+                 if (!reader.getUint32(count)) {
+                     return false;
+                 }
+                 for (uint32_t i = 0; i < count; ++i) {
+                     entries.emplace_back();
+                     if (!getBrokerAttributes(reader, entries.back())) {
+                         return false;
+                     }
+                 }
+                 return true;
+             });
+
+    if (!err.isOk()) {
+        return {err, {}};
+    }
+    return {err, std::move(entries)};
+}
+
+cts::SFTPError cts::SFTPBrokerConnection::rename(const std::string& oldRemoteName,
+                                                 const std::string& newRemoteName) {
+    return call(
+        SFTPPacketWriter(kBrokerRename).putString(oldRemoteName).putString(newRemoteName).finish(),
+        nullptr);
+}
+
+cts::SFTPError cts::SFTPBrokerConnection::copy(const std::string& remoteSrc,
+                                               const std::string& remoteDst,
+                                               const bool recursive) {
+    return call(SFTPPacketWriter(kBrokerCopy)
+                    .putString(remoteSrc)
+                    .putString(remoteDst)
+                    .putUint8(recursive)
+                    .finish(),
+                nullptr);
+}
+
+cts::SFTPError cts::SFTPBrokerConnection::rm(const std::string& remoteFileName) {
+    return call(SFTPPacketWriter(kBrokerRm).putString(remoteFileName).finish(), nullptr);
+}
+
+cts::SFTPError cts::SFTPBrokerConnection::rmdir(const std::string& remoteDir) {
+    return call(SFTPPacketWriter(kBrokerRmdir).putString(remoteDir).finish(), nullptr);
+}
+
+std::pair<cts::SFTPError, cts::SFTPAttributes> cts::SFTPBrokerConnection::stat(
+    const std::string& remotePath) {
+    SFTPAttributes attributes;
+    const auto err = call(SFTPPacketWriter(kBrokerStat).putString(remotePath).finish(),
+                          [&](SFTPPacketReader& reader) {
+                              return getBrokerAttributes(reader, attributes);
+                          });
+
+    if (!err.isOk()) {
+        return {err, {}};
+    }
+    return {err, attributes};
+}
+
+cts::SFTPError cts::SFTPBrokerConnection::transfer(const uint8_t type,
+                                                   const std::string& localFileName,
+                                                   const std::string& remoteFileName,
+                                                   const TransferOptions& options) {
+    SFTPPacketWriter request(type);
+    request.putString(brokerAbsolutePath(localFileName)).putString(remoteFileName);
+    putBrokerOptions(request, options);
+
+    std::string digest;
+    TransferStats stats;
+    const auto err = call(
+        request.finish(),
+        [&](SFTPPacketReader& reader) {
+            return reader.getString(digest) && getBrokerStats(reader, stats);
+        },
+        true);
+
+    if (err.isOk() && !digest.empty() && options.onChecksum) {
+        options.onChecksum(digest);
+    }
+    if (options.onStats) {
+        options.onStats(stats);
+    }
+    return err;
+}
+
+cts::SFTPError cts::SFTPBrokerConnection::call(
+    const std::string& request, const std::function<bool(SFTPPacketReader&)>& readResult,
+    const bool resultOnFailure) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint8_t type = 0;
+    std::string body;
+    if (m_fd < 0 || !brokerSend(m_fd, request) || !brokerReceive(m_fd, type, body) ||
+        type != kBrokerReply) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_CONNECTION_LOST,
+                              "Lost the session broker at [" + m_socketPath + "]");
+    }
+
+    SFTPPacketReader reader(body.data(), body.size());
+    uint32_t sshCode = 0;
+    uint32_t sftpCode = 0;
+    std::string message;
+    if (!reader.getUint32(sshCode) || !reader.getUint32(sftpCode) || !reader.getString(message)) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed broker reply");
+    }
+
+    const cts::SFTPError err(static_cast<int>(sshCode), static_cast<int>(sftpCode), message);
+    // A failure keeps its own error even when the result that came with it is unreadable.
+    if ((err.isOk() || resultOnFailure) && readResult && !readResult(reader) && err.isOk()) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed broker reply");
+    }
+    return err;
+}
@@ -0,0 +1,175 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_BROKER_H
+#define SFTP_BROKER_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "sftpattributes.h"
+#include "sftpclient.h"
+#include "sftpconnectoptions.h"
+#include "sftperror.h"
+#include "sftptransferoptions.h"
+
+namespace cts {
+
+class SFTPPacketReader;
+
+// Keeps authenticated sessions open for short lived processes, in the spirit of OpenSSH's
+// ControlMaster. Processes reach it over a Unix domain socket through
+// SFTPClient::connectThroughBroker(), which costs a local connect instead of a key exchange
+// and authentication. Each process leases one session of its host for as long as it stays
+// connected; sessions go back to the pool afterwards and close after idleTimeout unused.
+//
+// The socket is created readable and writable by its owner only. A pooled session is only
+// handed to a process that presents the password it was opened with. Not available on Windows.
+class SFTPBroker {
+   public:
+    explicit SFTPBroker(const std::string& socketPath,
+                        const ConnectOptions& options = ConnectOptions(),
+                        const std::chrono::seconds idleTimeout = std::chrono::seconds(300));
+    ~SFTPBroker();
+
+    // Creates the socket, replacing a stale one left by an earlier broker. Fails when a broker
+    // still listens there or the path holds something other than a socket.
+    SFTPError listen();
+
+    // Serves processes on the calling thread, each on a thread of its own, until stop().
+    SFTPError run();
+
+    // Callable from any thread. Connected processes are disconnected once their current
+    // operation is done.
+    void stop();
+
+    // Open sessions, leased or idle.
+    size_t sessionCount() const;
+
+   private:
+    SFTPBroker(const SFTPBroker&) = delete;
+    SFTPBroker& operator=(const SFTPBroker&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Session {
+        std::unique_ptr<SFTPClient> client;
+        std::string password;
+        bool onlyKnownServers = true;
+        Clock::time_point idleSince;
+    };
+
+    void serve(const int fd);
+
+    // Runs one request on client and returns the reply. reusable is cleared once the session
+    // is lost, so it does not go back to the pool.
+    std::string handle(const uint8_t type, SFTPPacketReader& reader, const SFTPClient& client,
+                       bool& reusable);
+
+    // An idle session of user@host:port opened with password that still answers, or a newly
+    // connected one.
+    std::pair<SFTPError, Session> lease(const std::string& key, const std::string& host,
+                                        const std::string& user, const std::string& password,
+                                        const uint16_t port, const bool onlyKnownServers);
+
+    void release(const std::string& key, Session session, const bool reusable);
+
+    void closeIdleSessions();
+
+    void joinFinished();
+
+    const std::string m_socketPath;
+    const ConnectOptions m_options;
+    const std::chrono::seconds m_idleTimeout;
+
+    int m_listenFd = -1;
+    std::atomic<bool> m_stopping{false};
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::vector<Session>> m_idle;
+    size_t m_leased = 0;
+    std::map<int, std::thread> m_clients;  // By socket, closed once the thread is joined
+    std::vector<int> m_finished;
+};
+
+// One process's connection to a SFTPBroker, used by SFTPClient in broker mode. Local file
+// names are sent as absolute paths, since the broker runs in another working directory.
+class SFTPBrokerConnection {
+   public:
+    explicit SFTPBrokerConnection(const std::string& socketPath);
+    ~SFTPBrokerConnection();
+
+    // Leases a session to user@host:port, which the broker opens if it has none idle.
+    SFTPError open(const std::string& host, const std::string& user, const std::string& pw,
+                   const uint16_t port, const bool onlyKnownServers);
+
+    // TransferOptions::progress is not called through a broker, onChecksum is.
+    SFTPError put(const std::string& localFileName, const std::string& remoteFileName,
+                  const TransferOptions& options);
+
+    SFTPError get(const std::string& localFileName, const std::string& remoteFileName,
+                  const TransferOptions& options);
+
+    SFTPError mkdir(const std::string& remoteDir, const uint32_t permissions);
+
+    std::pair<SFTPError, std::vector<SFTPAttributes>> ls(const std::string& remoteDir);
+
+    SFTPError rename(const std::string& oldRemoteName, const std::string& newRemoteName);
+
+    SFTPError copy(const std::string& remoteSrc, const std::string& remoteDst,
+                   const bool recursive);
+
+    SFTPError rm(const std::string& remoteFileName);
+
+    SFTPError rmdir(const std::string& remoteDir);
+
+    std::pair<SFTPError, SFTPAttributes> stat(const std::string& remotePath);
+
+   private:
+    SFTPBrokerConnection(const SFTPBrokerConnection&) = delete;
+    SFTPBrokerConnection& operator=(const SFTPBrokerConnection&) = delete;
+
+    SFTPError transfer(const uint8_t type, const std::string& localFileName,
+                       const std::string& remoteFileName, const TransferOptions& options);
+
+    // Sends request and returns the status of the reply. readResult, when given, reads the
+    // rest of a successful reply, and of a failed one too with resultOnFailure.
+    SFTPError call(const std::string& request,
+                   const std::function<bool(SFTPPacketReader&)>& readResult,
+                   const bool resultOnFailure = false);
+
+    const std::string m_socketPath;
+    int m_fd = -1;
+    std::mutex m_mutex;  // One request at a time on the socket
+};
+
+}  // namespace cts
+
+#endif /* SFTP_BROKER_H */
@@ -0,0 +1,107 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpbufferpool.h"
+
+#include <cstdlib>  // free, posix_memalign
+
+#ifdef _WIN32
+#include <malloc.h>  // _aligned_malloc
+#endif
+
+namespace {
+
+char* allocateAligned(const size_t size) {
+#ifdef _WIN32
+    return static_cast<char*>(_aligned_malloc(size, cts::SFTPBufferPool::kAlignment));
+#else
+    void* memory = nullptr;
+    if (posix_memalign(&memory, cts::SFTPBufferPool::kAlignment, size) != 0) {
+        return nullptr;
+    }
+    return static_cast<char*>(memory);
+#endif
+}
+
+void freeAligned(char* buffer) {
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    std::free(buffer);
+#endif
+}
+
+}  // namespace
+
+cts::SFTPBufferPool& cts::SFTPBufferPool::shared() {
+    static SFTPBufferPool pool;
+    return pool;
+}
+
+cts::SFTPBufferPool::~SFTPBufferPool() {
+    for (auto& sizeClass : m_free) {
+        for (char* buffer : sizeClass.second) {
+            freeAligned(buffer);
+        }
+    }
+}
+
+char* cts::SFTPBufferPool::acquire(const size_t size) {
+    const auto rounded = sizeClass(size);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& buffers = m_free[rounded];
+        if (!buffers.empty()) {
+            char* buffer = buffers.back();
+            buffers.pop_back();
+            return buffer;
+        }
+    }
+
+    return allocateAligned(rounded);
+}
+
+void cts::SFTPBufferPool::release(char* buffer, const size_t size) {
+    if (!buffer) {
+        return;
+    }
+
+    const auto rounded = sizeClass(size);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& buffers = m_free[rounded];
+        if ((buffers.size() + 1) * rounded <= kMaxKeptBytes) {
+            buffers.push_back(buffer);
+            return;
+        }
+    }
+
+    freeAligned(buffer);
+}
+
+size_t cts::SFTPBufferPool::sizeClass(const size_t size) {
+    size_t rounded = kAlignment;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+    return rounded;
+}
@@ -0,0 +1,112 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_BUFFER_POOL_H
+#define SFTP_BUFFER_POOL_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace cts {
+
+// Chunk buffers shared by every transfer in the process. Sizes are rounded up to a power of
+// two and buffers are page aligned, as unbuffered and direct I/O want them. Released buffers
+// are kept for the next transfer instead of being freed, up to kMaxKeptBytes per size, so a
+// process that keeps transferring stops allocating without holding on to what a burst of
+// parallel transfers needed.
+class SFTPBufferPool {
+   public:
+    static constexpr size_t kAlignment = 4096;
+
+    // Enough for a couple of transfers at the largest tuned chunk sizes.
+    static constexpr size_t kMaxKeptBytes = 16 * 1024 * 1024;
+
+    static SFTPBufferPool& shared();
+
+    SFTPBufferPool() = default;
+    ~SFTPBufferPool();
+
+    // At least size bytes, or nullptr when memory runs out.
+    char* acquire(const size_t size);
+
+    // Returns a buffer from acquire() with the size it was asked for.
+    void release(char* buffer, const size_t size);
+
+   private:
+    SFTPBufferPool(const SFTPBufferPool&) = delete;
+    SFTPBufferPool& operator=(const SFTPBufferPool&) = delete;
+
+    static size_t sizeClass(const size_t size);
+
+    std::mutex m_mutex;
+    std::map<size_t, std::vector<char*>> m_free;
+};
+
+// A buffer from a SFTPBufferPool, given back when it goes out of scope.
+class PooledBuffer {
+   public:
+    PooledBuffer() = default;
+    PooledBuffer(SFTPBufferPool& pool, const size_t size)
+        : m_pool(&pool), m_data(pool.acquire(size)), m_size(m_data ? size : 0) {}
+    ~PooledBuffer() { reset(); }
+
+    PooledBuffer(PooledBuffer&& other) noexcept { *this = std::move(other); }
+
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept {
+        if (this != &other) {
+            reset();
+            m_pool = other.m_pool;
+            m_data = other.m_data;
+            m_size = other.m_size;
+            other.m_data = nullptr;
+            other.m_size = 0;
+        }
+        return *this;
+    }
+
+    char* data() const { return m_data; }
+
+    size_t size() const { return m_size; }
+
+    void reset() {
+        if (m_data) {
+            m_pool->release(m_data, m_size);
+            m_data = nullptr;
+            m_size = 0;
+        }
+    }
+
+   private:
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    SFTPBufferPool* m_pool = nullptr;
+    char* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_BUFFER_POOL_H */
@@ -0,0 +1,494 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpchecksum.h"
+
+#include <algorithm>  // min
+#include <cstring>    // memcpy
+
+#include "sftpcipherpreference.h"
+#include "sftppacket.h"
+#include "sftpsidechannel.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define SFTP_CHECKSUM_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define SFTP_CHECKSUM_ARM_CRC 1
+#endif
+
+#if defined(_MSC_VER)
+#define SFTP_CHECKSUM_TARGET(features)
+#else
+#define SFTP_CHECKSUM_TARGET(features) __attribute__((target(features)))
+#endif
+
+namespace {
+
+// CRC32C, the Castagnoli polynomial in its reflected form.
+constexpr uint32_t kCrc32cPolynomial = 0x82F63B78;
+
+struct Crc32cTables {
+    uint32_t table[8][256];
+
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ ((crc & 1) ? kCrc32cPolynomial : 0);
+            }
+            table[0][i] = crc;
+        }
+
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+uint32_t loadLittleEndian32(const uint8_t* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+// Slicing by 8: one table lookup per input byte, but eight independent ones per step.
+uint32_t crc32cPortable(uint32_t crc, const uint8_t* data, size_t size) {
+    static const Crc32cTables tables;
+    const auto& t = tables.table;
+
+    while (size >= 8) {
+        const uint32_t low = crc ^ loadLittleEndian32(data);
+        const uint32_t high = loadLittleEndian32(data + 4);
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^
+              t[4][low >> 24] ^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^
+              t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        data += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0) {
+        crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(SFTP_CHECKSUM_X86)
+SFTP_CHECKSUM_TARGET("sse4.2")
+uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t size) {
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+
+    crc = static_cast<uint32_t>(crc64);
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+
+    return crc;
+}
+#elif defined(SFTP_CHECKSUM_ARM_CRC)
+uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t size) {
+    while (size >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+        data += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0) {
+        crc = __crc32cb(crc, *data++);
+    }
+
+    return crc;
+}
+#endif
+
+const uint32_t kSha256Constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+    0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+    0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+    0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+    0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+    0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+    0xc67178f2};
+
+uint32_t rotateRight(const uint32_t value, const int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+void sha256Portable(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    for (; blocks > 0; --blocks, data += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = uint32_t(data[4 * i]) << 24 | uint32_t(data[4 * i + 1]) << 16 |
+                   uint32_t(data[4 * i + 2]) << 8 | uint32_t(data[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            const uint32_t s0 =
+                rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 =
+                rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int i = 0; i < 64; ++i) {
+            const uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+            const uint32_t choose = (e & f) ^ (~e & g);
+            const uint32_t t1 = h + s1 + choose + kSha256Constants[i] + w[i];
+            const uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+            const uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+            const uint32_t t2 = s0 + majority;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#if defined(SFTP_CHECKSUM_X86)
+// The SHA extensions keep the state as ABEF and CDGH and do two rounds per sha256rnds2. The
+// loop below is unrolled by the compiler; in group i the message schedule for group i + 1 is
+// finished with sha256msg2 and the one for group i + 3 started with sha256msg1.
+SFTP_CHECKSUM_TARGET("sha,sse4.1")
+void sha256Hardware(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);            // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);      // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);   // CDGH
+
+    for (; blocks > 0; --blocks, data += 64) {
+        const __m128i savedState0 = state0;
+        const __m128i savedState1 = state1;
+        __m128i message[4];
+
+        for (int i = 0; i < 16; ++i) {
+            if (i < 4) {
+                message[i] = _mm_shuffle_epi8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)), byteSwap);
+            }
+
+            __m128i rounds = _mm_add_epi32(
+                message[i & 3],
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(&kSha256Constants[4 * i])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, rounds);
+
+            if (i >= 3 && i <= 14) {
+                tmp = _mm_alignr_epi8(message[i & 3], message[(i - 1) & 3], 4);
+                message[(i + 1) & 3] = _mm_add_epi32(message[(i + 1) & 3], tmp);
+                message[(i + 1) & 3] = _mm_sha256msg2_epu32(message[(i + 1) & 3], message[i & 3]);
+            }
+
+            rounds = _mm_shuffle_epi32(rounds, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, rounds);
+
+            if (i >= 1 && i <= 12) {
+                message[(i - 1) & 3] = _mm_sha256msg1_epu32(message[(i - 1) & 3], message[i & 3]);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, savedState0);
+        state1 = _mm_add_epi32(state1, savedState1);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);        // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);     // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);  // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);     // HGFE
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+#endif
+
+cts::SFTPError channelError(ssh_session session, const std::string& what) {
+    return cts::SFTPError(ssh_get_error_code(session), SSH_FX_FAILURE,
+                          what + " " + ssh_get_error(session));
+}
+
+cts::SFTPError unsupported(const std::string& what) {
+    return cts::SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED, what);
+}
+
+bool offersCheckFile(sftp_session sftp, const std::string& algorithm) {
+    const unsigned int count = sftp_extensions_get_count(sftp);
+    for (unsigned int i = 0; i < count; ++i) {
+        const char* name = sftp_extensions_get_name(sftp, i);
+        const char* data = sftp_extensions_get_data(sftp, i);
+        if (name && data && std::string(name) == "check-file" &&
+            ("," + std::string(data) + ",").find("," + algorithm + ",") != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::pair<cts::SFTPError, std::string> checkFile(ssh_session session,
+                                                 const std::string& remoteFileName) {
+    cts::SFTPSideChannel channel(session);
+    auto err = channel.open();
+    if (!err.isOk()) {
+        return {err, ""};
+    }
+
+    const auto request = cts::SFTPPacketWriter(SSH_FXP_EXTENDED, channel.nextId())
+                             .putString("check-file-name")
+                             .putString(remoteFileName)
+                             .putString("sha256")
+                             .putUint64(0)  // From the start
+                             .putUint64(0)  // To the end
+                             .putUint32(0)  // One hash for the whole range
+                             .finish();
+
+    uint8_t type = 0;
+    std::string body;
+    err = channel.request(request, type, body);
+    if (!err.isOk()) {
+        return {err, ""};
+    }
+
+    cts::SFTPPacketReader reader(body.data(), body.size());
+    if (type == SSH_FXP_STATUS) {
+        return {cts::SFTPSideChannel::statusError(type, reader), ""};
+    }
+
+    std::string extension, algorithm;
+    if (type != SSH_FXP_EXTENDED_REPLY || !reader.getString(extension) ||
+        !reader.getString(algorithm) || algorithm != "sha256") {
+        return {unsupported("Unexpected check-file reply"), ""};
+    }
+
+    static const char kHexDigits[] = "0123456789abcdef";
+    std::string digest;
+    uint8_t byte = 0;
+    while (reader.getUint8(byte)) {
+        digest += kHexDigits[byte >> 4];
+        digest += kHexDigits[byte & 0xF];
+    }
+
+    if (digest.size() != 64) {
+        return {unsupported("Unexpected check-file hash length"), ""};
+    }
+
+    return {cts::SFTPError(), digest};
+}
+
+std::pair<cts::SFTPError, std::string> hashCommand(ssh_session session,
+                                                   const std::string& remoteFileName) {
+    cts::SSHChannelPtr channel(ssh_channel_new(session));
+    if (!channel || ssh_channel_open_session(channel.get()) != SSH_OK) {
+        return {channelError(session, "Failed to open a channel for sha256sum"), ""};
+    }
+
+    const auto path = cts::shellQuote(remoteFileName);
+    const auto command =
+        "sha256sum -- " + path + " 2>/dev/null || shasum -a 256 -- " + path + " 2>/dev/null";
+    if (ssh_channel_request_exec(channel.get(), command.c_str()) != SSH_OK) {
+        return {unsupported("The server does not run commands"), ""};
+    }
+
+    std::string output;
+    char buffer[512];
+    int bytesRead = 0;
+    while (output.size() < 4096 &&
+           (bytesRead = ssh_channel_read(channel.get(), buffer, sizeof(buffer), 0)) > 0) {
+        output.append(buffer, static_cast<size_t>(bytesRead));
+    }
+
+    if (bytesRead < 0) {
+        return {channelError(session, "Failed to read the sha256sum output"), ""};
+    }
+
+    // sha256sum escapes names with a backslash or newline and marks the line with a leading '\'.
+    const size_t start = !output.empty() && output[0] == '\\' ? 1 : 0;
+    if (output.size() < start + 64 ||
+        output.find_first_not_of("0123456789abcdef", start) != start + 64) {
+        return {unsupported("Neither sha256sum nor shasum is available on the server"), ""};
+    }
+
+    return {cts::SFTPError(), output.substr(start, 64)};
+}
+
+}  // namespace
+
+cts::Checksum::Checksum(const ChecksumAlgorithm algorithm)
+    : m_algorithm(algorithm),
+      m_state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab,
+              0x5be0cd19},
+      m_block() {}
+
+void cts::Checksum::update(const char* data, const size_t size) {
+    if (m_finished || size == 0) {
+        return;
+    }
+
+    const auto* bytes = reinterpret_cast<const uint8_t*>(data);
+
+    if (m_algorithm == ChecksumAlgorithm::Crc32c) {
+#if defined(SFTP_CHECKSUM_X86) || defined(SFTP_CHECKSUM_ARM_CRC)
+        static const bool hardware = cts::detectCpuFeatures().crc32c;
+        m_crc = hardware ? crc32cHardware(m_crc, bytes, size) : crc32cPortable(m_crc, bytes, size);
+#else
+        m_crc = crc32cPortable(m_crc, bytes, size);
+#endif
+        return;
+    }
+
+    if (m_algorithm != ChecksumAlgorithm::Sha256) {
+        return;
+    }
+
+    size_t remaining = size;
+    m_length += size;
+
+    if (m_blockSize > 0) {
+        const size_t count = std::min(remaining, sizeof(m_block) - m_blockSize);
+        std::memcpy(m_block + m_blockSize, bytes, count);
+        m_blockSize += count;
+        bytes += count;
+        remaining -= count;
+
+        if (m_blockSize < sizeof(m_block)) {
+            return;
+        }
+        compressBlocks(m_block, 1);
+        m_blockSize = 0;
+    }
+
+    // Whole blocks are hashed straight from the caller's buffer.
+    const size_t blocks = remaining / 64;
+    compressBlocks(bytes, blocks);
+    bytes += blocks * 64;
+    remaining -= blocks * 64;
+
+    std::memcpy(m_block, bytes, remaining);
+    m_blockSize = remaining;
+}
+
+std::string cts::Checksum::hexDigest() {
+    static const char kHexDigits[] = "0123456789abcdef";
+    std::string digest;
+
+    if (m_algorithm == ChecksumAlgorithm::Crc32c) {
+        m_finished = true;
+        const uint32_t crc = ~m_crc;
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            digest += kHexDigits[(crc >> shift) & 0xF];
+        }
+        return digest;
+    }
+
+    if (m_algorithm != ChecksumAlgorithm::Sha256) {
+        return digest;
+    }
+
+    if (!m_finished) {
+        const uint64_t bits = m_length * 8;
+        const uint8_t padding = 0x80;
+        update(reinterpret_cast<const char*>(&padding), 1);
+
+        const uint8_t zero = 0;
+        while (m_blockSize != 56) {
+            update(reinterpret_cast<const char*>(&zero), 1);
+        }
+
+        uint8_t length[8];
+        for (int i = 0; i < 8; ++i) {
+            length[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        }
+        update(reinterpret_cast<const char*>(length), sizeof(length));
+        m_finished = true;
+    }
+
+    for (const uint32_t word : m_state) {
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            digest += kHexDigits[(word >> shift) & 0xF];
+        }
+    }
+    return digest;
+}
+
+void cts::Checksum::compressBlocks(const uint8_t* data, const size_t blocks) {
+    if (blocks == 0) {
+        return;
+    }
+
+#if defined(SFTP_CHECKSUM_X86)
+    static const bool hardware = cts::detectCpuFeatures().sha256 && cts::detectCpuFeatures().sse41;
+    if (hardware) {
+        sha256Hardware(m_state, data, blocks);
+        return;
+    }
+#endif
+    sha256Portable(m_state, data, blocks);
+}
+
+std::pair<cts::SFTPError, std::string> cts::remoteChecksum(ssh_session session,
+                                                           sftp_session sftp,
+                                                           const std::string& remoteFileName,
+                                                           const ChecksumAlgorithm algorithm) {
+    if (algorithm != ChecksumAlgorithm::Sha256) {
+        return {unsupported("The server can only compute SHA-256"), ""};
+    }
+
+    if (offersCheckFile(sftp, "sha256")) {
+        const auto result = checkFile(session, remoteFileName);
+        if (result.first.getSFTPErrorCode() != SSH_FX_OP_UNSUPPORTED) {
+            return result;
+        }
+    }
+
+    return hashCommand(session, remoteFileName);
+}
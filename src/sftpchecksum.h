@@ -0,0 +1,77 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_CHECKSUM_H
+#define SFTP_CHECKSUM_H
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "sftperror.h"
+
+namespace cts {
+
+enum class ChecksumAlgorithm { None, Crc32c, Sha256 };
+
+// Incremental CRC32C or SHA-256. CRC32C uses the SSE4.2 crc32 instruction and SHA-256 the SHA
+// extensions when the CPU has them, with portable code otherwise.
+class Checksum {
+   public:
+    explicit Checksum(const ChecksumAlgorithm algorithm = ChecksumAlgorithm::None);
+
+    void update(const char* data, const size_t size);
+
+    // Lowercase hex, the same as sha256sum prints; CRC32C as its 8 digit big endian value.
+    // Ends the computation, further updates are ignored.
+    std::string hexDigest();
+
+    ChecksumAlgorithm algorithm() const { return m_algorithm; }
+
+   private:
+    void compressBlocks(const uint8_t* data, const size_t blocks);
+
+    ChecksumAlgorithm m_algorithm;
+    bool m_finished = false;
+
+    uint32_t m_crc = 0xFFFFFFFF;
+
+    uint32_t m_state[8];
+    uint8_t m_block[64];
+    size_t m_blockSize = 0;
+    uint64_t m_length = 0;
+};
+
+// Has the server hash a file: through the check-file extension when it offers it, otherwise
+// by running sha256sum (or shasum) on a separate channel of the session. Only SHA-256 can be
+// computed remotely; when neither way works the error code is SSH_FX_OP_UNSUPPORTED.
+std::pair<SFTPError, std::string> remoteChecksum(ssh_session session, sftp_session sftp,
+                                                 const std::string& remoteFileName,
+                                                 const ChecksumAlgorithm algorithm);
+
+}  // namespace cts
+
+#endif /* SFTP_CHECKSUM_H */
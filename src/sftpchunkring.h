@@ -0,0 +1,121 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_CHUNK_RING_H
+#define SFTP_CHUNK_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "sftpbufferpool.h"
+#include "sftpspscring.h"
+
+namespace cts {
+
+// The slots a reader thread fills for its caller, each a Chunk whose data points at a buffer
+// from SFTPBufferPool::shared(). Filled slots go to the caller through one SPSCRing and come
+// back through another once the caller asks for the next, so the buffers are reused in turn.
+template <typename Chunk>
+class SFTPChunkRing {
+   public:
+    static constexpr size_t kDepth = 8;
+
+    SFTPChunkRing() = default;
+
+    // Gives every slot a buffer of bufferSize, false when memory runs out.
+    bool allocate(const size_t bufferSize) {
+        m_chunks.resize(kDepth);
+        for (size_t slot = 0; slot < kDepth; ++slot) {
+            m_buffers.emplace_back(SFTPBufferPool::shared(), bufferSize);
+            if (!m_buffers.back().data()) {
+                return false;
+            }
+            m_chunks[slot].data = m_buffers.back().data();
+            m_free.tryPush(slot);
+        }
+        return true;
+    }
+
+    char* buffer(const size_t slot) { return m_buffers[slot].data(); }
+    Chunk& chunk(const size_t slot) { return m_chunks[slot]; }
+
+    // Reader thread only. Waits for a slot the caller is done with, false once stopped.
+    bool takeFreeSlot(size_t& slot) {
+        const auto stopped = [this]() { return m_stop.load(std::memory_order_relaxed); };
+        return m_free.pop(slot, stopped) && !stopped();
+    }
+
+    // Reader thread only. Hands a filled slot to the caller.
+    void publish(const size_t slot) { m_filled.push(slot); }
+
+    // Reader thread only. No more slots follow, and what the reader wrote before is visible
+    // to the caller once next() returned nullptr.
+    void finish() {
+        m_done.store(true, std::memory_order_release);
+        m_filled.wake();
+    }
+
+    // Caller only. Gives back the last chunk and waits for the next, nullptr once the reader
+    // finished and every chunk was taken.
+    const Chunk* next() {
+        if (m_current != kNoSlot) {
+            m_free.push(m_current);  // Never full, there are only kDepth slots
+            m_current = kNoSlot;
+        }
+
+        size_t slot = kNoSlot;
+        if (!m_filled.pop(slot, [this]() { return m_done.load(std::memory_order_acquire); })) {
+            return nullptr;
+        }
+
+        m_current = slot;
+        return &m_chunks[slot];
+    }
+
+    // Caller only. Makes takeFreeSlot() return false, for a reader that should stop early.
+    void stop() {
+        m_stop = true;
+        m_free.wake();
+    }
+
+    bool stopped() const { return m_stop.load(std::memory_order_relaxed); }
+
+   private:
+    SFTPChunkRing(const SFTPChunkRing&) = delete;
+    SFTPChunkRing& operator=(const SFTPChunkRing&) = delete;
+
+    static constexpr size_t kNoSlot = ~size_t(0);
+
+    std::vector<PooledBuffer> m_buffers;
+    std::vector<Chunk> m_chunks;
+    SPSCRing<size_t> m_filled{kDepth};
+    SPSCRing<size_t> m_free{kDepth};
+    size_t m_current = kNoSlot;
+
+    std::atomic<bool> m_done{false};
+    std::atomic<bool> m_stop{false};
+};
+
+}  // namespace cts
+
+#endif /* SFTP_CHUNK_RING_H */
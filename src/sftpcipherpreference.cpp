@@ -0,0 +1,118 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpcipherpreference.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+namespace {
+
+cts::CpuFeatures queryCpuFeatures() {
+    cts::CpuFeatures features;
+
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+#if defined(_MSC_VER)
+    int regs[4] = {};
+    __cpuid(regs, 1);
+    ecx = static_cast<unsigned int>(regs[2]);
+#else
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+#endif
+    features.aes = (ecx & (1u << 25)) != 0;
+    features.clmul = (ecx & (1u << 1)) != 0;
+    features.sse41 = (ecx & (1u << 19)) != 0;
+    features.crc32c = (ecx & (1u << 20)) != 0;
+
+    ebx = 0;
+#if defined(_MSC_VER)
+    __cpuidex(regs, 7, 0);
+    ebx = static_cast<unsigned int>(regs[1]);
+#else
+    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+#endif
+    features.sha256 = (ebx & (1u << 29)) != 0;
+#elif defined(__aarch64__) && defined(__linux__)
+    const auto hwcap = getauxval(AT_HWCAP);
+    features.aes = (hwcap & (1ul << 3)) != 0;    // HWCAP_AES
+    features.clmul = (hwcap & (1ul << 4)) != 0;  // HWCAP_PMULL
+    features.sha256 = (hwcap & (1ul << 6)) != 0;  // HWCAP_SHA2
+    features.crc32c = (hwcap & (1ul << 7)) != 0;  // HWCAP_CRC32
+#elif defined(__aarch64__) && defined(__APPLE__)
+    // Every Apple silicon core implements the ARMv8 crypto extensions.
+    features.aes = features.clmul = features.sha256 = features.crc32c = true;
+#endif
+
+    return features;
+}
+
+cts::CipherPreference orderCiphers(const cts::CpuFeatures& cpu) {
+    cts::CipherPreference preference;
+
+    // With AES and carry-less multiply in hardware AES-GCM is the fastest AEAD by a wide margin.
+    // Without both, chacha20-poly1305 wins: software AES is slow and leaks timing, and GHASH
+    // without carry-less multiply is slower still. AES-128 beats AES-256 by the four rounds it
+    // saves.
+    if (cpu.aes && cpu.clmul) {
+        preference.ciphers =
+            "aes128-gcm@openssh.com,aes256-gcm@openssh.com,chacha20-poly1305@openssh.com,"
+            "aes128-ctr,aes256-ctr,aes192-ctr";
+    } else {
+        preference.ciphers =
+            "chacha20-poly1305@openssh.com,aes128-ctr,aes256-ctr,aes192-ctr,"
+            "aes128-gcm@openssh.com,aes256-gcm@openssh.com";
+    }
+
+    // MACs only matter when the server picks a non-AEAD cipher. SHA-256 instructions make
+    // SHA-256 the fastest; in software SHA-512 processes more bytes per round on 64-bit CPUs.
+    if (cpu.sha256 || sizeof(void*) < 8) {
+        preference.macs =
+            "hmac-sha2-256-etm@openssh.com,hmac-sha2-512-etm@openssh.com,"
+            "hmac-sha2-256,hmac-sha2-512,hmac-sha1-etm@openssh.com,hmac-sha1";
+    } else {
+        preference.macs =
+            "hmac-sha2-512-etm@openssh.com,hmac-sha2-256-etm@openssh.com,"
+            "hmac-sha2-512,hmac-sha2-256,hmac-sha1-etm@openssh.com,hmac-sha1";
+    }
+
+    return preference;
+}
+
+}  // namespace
+
+const cts::CpuFeatures& cts::detectCpuFeatures() {
+    static const CpuFeatures features = queryCpuFeatures();
+    return features;
+}
+
+const cts::CipherPreference& cts::preferredCiphers() {
+    static const CipherPreference preference = orderCiphers(detectCpuFeatures());
+    return preference;
+}
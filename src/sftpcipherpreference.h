@@ -0,0 +1,61 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_CIPHER_PREFERENCE_H
+#define SFTP_CIPHER_PREFERENCE_H
+
+#include <string>
+
+namespace cts {
+
+struct CpuFeatures {
+    bool aes = false;     // AES-NI or the ARMv8 AES instructions
+    bool clmul = false;   // Carry-less multiply (PCLMULQDQ / PMULL), makes GHASH fast
+    bool sha256 = false;  // SHA-NI or the ARMv8 SHA2 instructions
+    bool crc32c = false;  // SSE4.2 or the ARMv8 CRC32 instructions
+    bool sse41 = false;   // Used next to SHA-NI on x86
+};
+
+// Comma separated algorithm lists in the format accepted by SSH_OPTIONS_CIPHERS_* and
+// SSH_OPTIONS_HMAC_*.
+struct CipherPreference {
+    std::string ciphers;
+    std::string macs;
+};
+
+// What a connected session actually agreed on with the server.
+struct NegotiatedAlgorithms {
+    std::string kex;
+    std::string cipherIn;
+    std::string cipherOut;
+    std::string macIn;
+    std::string macOut;
+};
+
+// Both are computed on first use and cached for the lifetime of the process.
+const CpuFeatures& detectCpuFeatures();
+
+const CipherPreference& preferredCiphers();
+
+}  // namespace cts
+
+#endif /* SFTP_CIPHER_PREFERENCE_H */
@@ -22,128 +22,446 @@
 
 #include "sftpclient.h"
 
-#include <algorithm>  // min
+#include <algorithm>  // min, max
+#include <chrono>
+#include <limits>
+#include <thread>
+
+#include "sftpautotuner.h"
+#include "sftpbroker.h"
+#include "sftpcompression.h"
+#include "sftpdiskpipeline.h"
+#include "sftpzstdstream.h"
 
 cts::SFTPClient::~SFTPClient() { disconnect(); }
 
 cts::SFTPError cts::SFTPClient::connect(const std::string& host, const std::string& user,
                                         const std::string& pw, const uint16_t port,
                                         const bool onlyKnownServers) {
-    m_sshSession = SSHSessionPtr(ssh_new());
-    if (!m_sshSession) {
-        return cts::SFTPError(SSH_ERROR, SSH_FX_OK, "Failed to create ssh session.");
-    }
+    return connect(host, user, pw, cts::ConnectOptions(), port, onlyKnownServers);
+}
 
-    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_HOST, host.c_str());
-    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_PORT, &port);
-    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_USER, user.c_str());
+cts::SFTPError cts::SFTPClient::connect(const std::string& host, const std::string& user,
+                                        const std::string& pw, const ConnectOptions& options,
+                                        const uint16_t port, const bool onlyKnownServers) {
+    disconnect();
+    m_options = options;
+    m_host = host;
+    m_user = user;
+    m_port = port;
+    m_onlyKnownServers = onlyKnownServers;
 
-    int rc = ssh_connect(m_sshSession.get());
-    if (rc != SSH_OK) {
-        return cts::SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get()));
+    if (options.retry.maxAttempts > 1) {
+        m_password = pw;
     }
 
-    if (onlyKnownServers) {
-        const auto res = ssh_session_is_known_server(m_sshSession.get());
-        if (res != SSH_KNOWN_HOSTS_OK) {
-            return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
-                                  sftp_get_error(m_sftpSession.get()),
-                                  ssh_get_error(m_sshSession.get()));
-        }
+    const auto err = openSessions(pw);
+    if (!err.isOk()) {
+        return err;
     }
 
-    rc = ssh_userauth_password(m_sshSession.get(), nullptr, pw.c_str());
-    if (rc != SSH_AUTH_SUCCESS) {
-        return cts::SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get()));
-    }
+    readServerLimits();
 
-    m_sftpSession = cts::SFTPClient::SFTPSessionPtr(sftp_new(m_sshSession.get()));
-    if (!m_sftpSession) {
-        return cts::SFTPError(ssh_get_error_code(m_sshSession.get()), SSH_FX_FAILURE,
-                              "Failed to create a new sftp session.");
-    }
+    return cts::SFTPError();
+}
 
-    rc = sftp_init(m_sftpSession.get());
-    if (rc < 0) {
-        return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
-                              sftp_get_error(m_sftpSession.get()),
-                              ssh_get_error(m_sshSession.get()));
+cts::SFTPError cts::SFTPClient::connectThroughBroker(const std::string& socketPath,
+                                                     const std::string& host,
+                                                     const std::string& user,
+                                                     const std::string& pw, const uint16_t port,
+                                                     const bool onlyKnownServers) {
+    disconnect();
+
+    std::shared_ptr<SFTPBrokerConnection> broker(new SFTPBrokerConnection(socketPath));
+    const auto err = broker->open(host, user, pw, port, onlyKnownServers);
+    if (!err.isOk()) {
+        return err;
     }
 
+    m_host = host;
+    m_user = user;
+    m_port = port;
+    m_onlyKnownServers = onlyKnownServers;
+    m_broker = std::move(broker);
+
     return cts::SFTPError();
 }
 
 void cts::SFTPClient::disconnect() {
+    m_broker.reset();
+    m_compressedSftpSession.reset();
+    m_compressedSshSession.reset();
     m_sftpSession.reset();
     m_sshSession.reset();
+    m_password.clear();
+}
+
+template <typename Operation>
+auto cts::SFTPClient::withRetry(const bool idempotent, Operation operation) const
+    -> decltype(operation()) {
+    auto result = operation();
+    RetryState retry(m_options.retry);
+    // Operations that are not idempotent reconnect but do not run again.
+    while (reconnectAfter(errorOf(result), retry) && idempotent) {
+        result = operation();
+    }
+    return result;
+}
+
+bool cts::SFTPClient::reconnectAfter(const SFTPError& err, RetryState& retry) const {
+    if (err.isOk() || !connectionLost(err)) {
+        return false;
+    }
+
+    while (retry.attempt < m_options.retry.maxAttempts) {
+        ++retry.attempt;
+        std::this_thread::sleep_for(retry.backoff);
+        retry.backoff = std::min(m_options.retry.maxBackoff,
+                                 std::chrono::duration_cast<std::chrono::milliseconds>(
+                                     retry.backoff * m_options.retry.backoffMultiplier));
+        if (reconnect().isOk()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+cts::NegotiatedAlgorithms cts::SFTPClient::negotiatedAlgorithms() const {
+    cts::NegotiatedAlgorithms algorithms;
+    if (!m_sshSession) {
+        return algorithms;
+    }
+
+    const auto toString = [](const char* name) {
+        return name ? std::string(name) : std::string();
+    };
+
+    algorithms.kex = toString(ssh_get_kex_algo(m_sshSession.get()));
+    algorithms.cipherIn = toString(ssh_get_cipher_in(m_sshSession.get()));
+    algorithms.cipherOut = toString(ssh_get_cipher_out(m_sshSession.get()));
+    algorithms.macIn = toString(ssh_get_hmac_in(m_sshSession.get()));
+    algorithms.macOut = toString(ssh_get_hmac_out(m_sshSession.get()));
+
+    return algorithms;
 }
 
 cts::SFTPError cts::SFTPClient::put(const std::string& localFileName,
                                     const std::string& remoteFileName,
                                     unsigned int chunkSize) const {
+    cts::TransferOptions options;
+    options.chunkSize = chunkSize;
+    return put(localFileName, remoteFileName, options);
+}
+
+cts::SFTPError cts::SFTPClient::get(const std::string& localFileName,
+                                    const std::string& remoteFileName,
+                                    unsigned int chunkSize) const {
+    cts::TransferOptions options;
+    options.chunkSize = chunkSize;
+    return get(localFileName, remoteFileName, options);
+}
+
+cts::SFTPError cts::SFTPClient::put(const std::string& localFileName,
+                                    const std::string& remoteFileName,
+                                    const TransferOptions& options) const {
+    if (m_broker) {
+        return m_broker->put(localFileName, remoteFileName, options);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    TransferStats stats;
+    cts::SFTPError err;
+    if (useZstd(options, false)) {
+        err = withRetry(true, [&]() {
+            Checksum checksum(options.checksum);
+            const auto result =
+                cts::zstdPut(m_sshSession.get(), localFileName, remoteFileName, options, checksum);
+            stats = result.second;
+            if (!result.first.isOk()) {
+                stats.bytes = 0;  // Nothing to resume from
+            }
+            return result.first.isOk() ? finishChecksum(remoteFileName, checksum, options)
+                                       : result.first;
+        });
+    } else {
+        PutSource source;
+        source.fileName = localFileName;
+        uint64_t offset = options.resumeOffset;
+        err = withRetry(true, [&]() { return putFrom(source, remoteFileName, options, offset); });
+        stats.bytes = offset > options.resumeOffset ? offset - options.resumeOffset : 0;
+        stats.wireBytes = stats.bytes;
+    }
+
+    reportStats(options, stats, start);
+    return err;
+}
+
+cts::SFTPError cts::SFTPClient::get(const std::string& localFileName,
+                                    const std::string& remoteFileName,
+                                    const TransferOptions& options) const {
+    if (m_broker) {
+        return m_broker->get(localFileName, remoteFileName, options);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    TransferStats stats;
+    cts::SFTPError err;
+    if (useZstd(options, true)) {
+        err = withRetry(true, [&]() {
+            Checksum checksum(options.checksum);
+            const auto result =
+                cts::zstdGet(m_sshSession.get(), localFileName, remoteFileName, options, checksum);
+            stats = result.second;
+            if (!result.first.isOk()) {
+                stats.bytes = 0;  // Nothing to resume from
+            }
+            return result.first.isOk() ? finishChecksum(remoteFileName, checksum, options)
+                                       : result.first;
+        });
+    } else {
+        uint64_t offset = options.resumeOffset;
+        err = withRetry(true, [&]() {
+            return getFrom(localFileName, remoteFileName, options, offset);
+        });
+        stats.bytes = offset > options.resumeOffset ? offset - options.resumeOffset : 0;
+        stats.wireBytes = stats.bytes;
+    }
+
+    reportStats(options, stats, start);
+    return err;
+}
+
+cts::SFTPError cts::SFTPClient::putBuffer(const char* data, const uint64_t size,
+                                          const std::string& remoteFileName,
+                                          const TransferOptions& options) const {
+    const auto start = std::chrono::steady_clock::now();
+    PutSource source;
+    source.data = data;
+    source.size = size;
+    uint64_t offset = options.resumeOffset;
+    const auto err =
+        withRetry(true, [&]() { return putFrom(source, remoteFileName, options, offset); });
+
+    TransferStats stats;
+    stats.bytes = offset > options.resumeOffset ? offset - options.resumeOffset : 0;
+    stats.wireBytes = stats.bytes;
+    reportStats(options, stats, start);
+    return err;
+}
+
+cts::SFTPError cts::SFTPClient::putFrom(const PutSource& source,
+                                        const std::string& remoteFileName,
+                                        const TransferOptions& options, uint64_t& offset) const {
     if (!m_sftpSession || !m_sshSession) {
         return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
     }
 
-    if (chunkSize < 1) {
-        chunkSize = kDefaultChunkSize;
+    unsigned int chunkSize = options.chunkSize > 0 ? options.chunkSize : m_options.chunkSize;
+    chunkSize = std::min(chunkSize, m_maxWriteLength);
+    size_t maxInFlight = std::max(m_options.maxInFlightRequests, 1u);
+
+    std::unique_ptr<SFTPAutoTuner> tuner;
+    if (m_options.autoTune && options.chunkSize == 0) {
+        tuner.reset(new SFTPAutoTuner(tunerKey(), chunkSize, unsigned(maxInFlight),
+                                      m_maxWriteLength));
+        chunkSize = tuner->chunkSize();
+        maxInFlight = tuner->maxInFlight();
     }
 
-    chunkSize = std::min(chunkSize, kMaxChunkSize);
+    const std::string& localFileName = source.fileName;
+    std::ifstream file;
+    if (!source.data) {
+        file.open(localFileName, std::ios::binary);
+        if (!file) {
+            return cts::SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                                  "Failed to open local file: " + localFileName);
+        }
+    }
 
-    std::ifstream file(localFileName, std::ios::binary);
-    if (!file) {
-        return cts::SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
-                              "Failed to open local file: " + localFileName);
+    ssh_session sshSession = m_sshSession.get();
+    sftp_session sftpSession = m_sftpSession.get();
+
+    if (m_compressedSftpSession) {
+        uint64_t fileSize = source.size;
+        if (!source.data) {
+            file.seekg(0, std::ios::end);
+            fileSize = static_cast<uint64_t>(std::max<std::streamoff>(file.tellg(), 0));
+            file.seekg(0);
+        }
+
+        if (fileSize > 0 && fileSize >= m_options.compressionMinFileSize) {
+            const char* sample = source.data;
+            size_t sampleSize = size_t(std::min<uint64_t>(fileSize, kCompressionSampleSize));
+            std::vector<char> buffer;
+            if (!source.data) {
+                buffer.resize(kCompressionSampleSize);
+                file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                sample = buffer.data();
+                sampleSize = static_cast<size_t>(file.gcount());
+                file.clear();
+                file.seekg(0);
+            }
+
+            if (cts::estimateCompressionRatio(sample, sampleSize) <
+                m_options.compressionThreshold) {
+                sshSession = m_compressedSshSession.get();
+                sftpSession = m_compressedSftpSession.get();
+            }
+        }
     }
 
+    const int accessType = offset > 0 ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC;
     auto remoteFilePtr = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
-        sftp_open(m_sftpSession.get(), remoteFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
-                  S_IRUSR | S_IWUSR));
+        sftp_open(sftpSession, remoteFileName.c_str(), accessType, S_IRUSR | S_IWUSR));
 
     if (!remoteFilePtr.get()) {
-        return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
-                              sftp_get_error(m_sftpSession.get()),
-                              ssh_get_error(m_sshSession.get()));
+        return cts::SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                              ssh_get_error(sshSession));
     }
 
-    std::vector<char> buffer(chunkSize);
-    size_t totalBytes = 0;
+    if (offset > 0) {
+        if (!source.data) {
+            file.seekg(static_cast<std::streamoff>(offset));
+        }
+        if (!file || sftp_seek64(remoteFilePtr.get(), offset) < 0) {
+            return cts::SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                                  "Failed to resume transfer to remote file [" + remoteFileName +
+                                      "] " + ssh_get_error(sshSession));
+        }
+    }
 
-    while (file) {
-        file.read(buffer.data(), chunkSize);
-        auto bytesRead = file.gcount();
+    Checksum checksum(options.checksum);
+    if (options.checksum != ChecksumAlgorithm::None && offset > 0) {
+        if (source.data) {
+            checksum.update(source.data, size_t(std::min(offset, source.size)));
+        } else {
+            const auto err = hashLocalFile(localFileName, 0, offset, checksum);
+            if (!err.isOk()) {
+                return err;
+            }
+        }
+    }
 
-        if (bytesRead == 0) {
-            break;  // End of file
+    struct PendingWrite {
+        SFTPAioPtr aio;
+        size_t length;
+        uint64_t end;
+        std::chrono::steady_clock::time_point sentAt;
+    };
+
+    const auto writeError = [&]() {
+        return cts::SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                              "Failed to write to remote file [" + remoteFileName + "] " +
+                                  ssh_get_error(sshSession));
+    };
+
+    // The disk side reads ahead on its own thread and hashes as it goes. Sparse reads come
+    // without the holes, and chunks of zeros are skipped here by seeking past them.
+    const size_t bufferSize =
+        tuner ? std::min(m_maxWriteLength, unsigned(kMaxPooledChunkSize)) : chunkSize;
+    std::unique_ptr<SFTPFileReader> reader(
+        source.data ? new SFTPFileReader(source.data, source.size, offset, chunkSize, bufferSize,
+                                         options.sparse, checksum)
+                    : new SFTPFileReader(std::move(file), localFileName, offset, chunkSize,
+                                         bufferSize, options.sparse, checksum));
+    uint64_t remoteOffset = offset;
+
+    std::deque<PendingWrite> pending;
+    bool endOfFile = false;
+
+    while (true) {
+        while (!endOfFile && pending.size() < maxInFlight) {
+            const auto* chunk = reader->next();
+            if (!chunk) {
+                if (!reader->error().isOk()) {
+                    return reader->error();
+                }
+                endOfFile = true;
+                break;
+            }
+
+            if (chunk->offset != remoteOffset &&
+                sftp_seek64(remoteFilePtr.get(), chunk->offset) < 0) {
+                return writeError();
+            }
+            remoteOffset = chunk->offset + chunk->length;
+
+            if (chunk->zeros) {
+                continue;
+            }
+
+            // libssh copies the data into the request, so the chunk can go back to the reader.
+            sftp_aio aio = nullptr;
+            if (sftp_aio_begin_write(remoteFilePtr.get(), chunk->data, chunk->length, &aio) <
+                0) {
+                return writeError();
+            }
+            pending.push_back(
+                {SFTPAioPtr(aio), chunk->length, remoteOffset, std::chrono::steady_clock::now()});
         }
 
-        auto bytesWritten = sftp_write(remoteFilePtr.get(), buffer.data(), bytesRead);
-        if (bytesWritten < 0) {
-            return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
-                                  sftp_get_error(m_sftpSession.get()),
-                                  "Failed to write to remote file [" + remoteFileName + "] " +
-                                      ssh_get_error(m_sshSession.get()));
+        if (pending.empty()) {
+            break;
+        }
+
+        PendingWrite request = std::move(pending.front());
+        pending.pop_front();
+
+        // sftp_aio_wait_write() frees the request whether it succeeds or not
+        sftp_aio aio = request.aio.release();
+
+        if (sftp_aio_wait_write(&aio) < 0) {
+            return writeError();
+        }
+
+        // Writes are answered in order, so everything before this one has landed too, including
+        // what a sparse transfer skipped.
+        offset = request.end;
+
+        if (tuner) {
+            tuner->onCompleted(request.length,
+                               std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::steady_clock::now() - request.sentAt));
+            reader->setChunkSize(tuner->chunkSize());
+            maxInFlight = tuner->maxInFlight();
         }
 
-        totalBytes += bytesWritten;
+        if (options.progress && !options.progress(offset)) {
+            return cts::SFTPError(SSH_OK, cts::SFTPError::kCancelled, "Transfer cancelled");
+        }
     }
 
-    return cts::SFTPError();
+    // A file that ends in skipped zeros gets its size from a single zero byte at the end.
+    if (reader->end() > offset) {
+        const char zero = 0;
+        if (sftp_seek64(remoteFilePtr.get(), reader->end() - 1) < 0 ||
+            sftp_write(remoteFilePtr.get(), &zero, 1) != 1) {
+            return writeError();
+        }
+        offset = reader->end();
+    }
+
+    return finishChecksum(remoteFileName, checksum, options);
 }
 
-cts::SFTPError cts::SFTPClient::get(const std::string& localFileName,
-                                    const std::string& remoteFileName,
-                                    unsigned int chunkSize) const {
+cts::SFTPError cts::SFTPClient::getFrom(const std::string& localFileName,
+                                        const std::string& remoteFileName,
+                                        const TransferOptions& options, uint64_t& offset) const {
     if (!m_sftpSession.get() || !m_sshSession.get()) {
         return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
     }
 
-    if (chunkSize < 1) {
-        chunkSize = kDefaultChunkSize;
-    }
+    unsigned int chunkSize = options.chunkSize > 0 ? options.chunkSize : m_options.chunkSize;
+    chunkSize = std::min(chunkSize, m_maxReadLength);
+    size_t maxInFlight = std::max(m_options.maxInFlightRequests, 1u);
 
-    chunkSize = std::min(chunkSize, kMaxChunkSize);
+    std::unique_ptr<SFTPAutoTuner> tuner;
+    if (m_options.autoTune && options.chunkSize == 0) {
+        tuner.reset(new SFTPAutoTuner(tunerKey(), chunkSize, unsigned(maxInFlight),
+                                      m_maxReadLength));
+        chunkSize = tuner->chunkSize();
+        maxInFlight = tuner->maxInFlight();
+    }
 
     auto remoteFilePtr = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
         sftp_open(m_sftpSession.get(), remoteFileName.c_str(), O_RDONLY, S_IRUSR));
@@ -155,153 +473,1066 @@ cts::SFTPError cts::SFTPClient::get(const std::string& localFileName,
                                   ssh_get_error(m_sshSession.get()));
     }
 
-    std::ofstream file(localFileName, std::ios::binary);
+    // A resumed transfer keeps what an earlier attempt already wrote.
+    const auto mode =
+        offset > 0 ? std::ios::binary | std::ios::in | std::ios::out : std::ios::binary;
+    std::ofstream file(localFileName, mode);
     if (!file) {
         return cts::SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
                               "Failed to open local file: " + localFileName);
     }
 
-    std::vector<char> buffer(chunkSize);
-    size_t totalBytes = 0;
+    // Sparse transfers leave chunks of zeros unwritten. Only where an earlier attempt left data
+    // does a hole have to be punched.
+    uint64_t localSize = 0;
+    if (options.sparse && offset > 0) {
+        file.seekp(0, std::ios::end);
+        localSize = static_cast<uint64_t>(std::max<std::streamoff>(file.tellp(), 0));
+    }
+
+    struct PendingRead {
+        SFTPAioPtr aio;
+        uint64_t offset;
+        size_t length;
+        std::chrono::steady_clock::time_point sentAt;
+    };
+
+    ssh_session sshSession = m_sshSession.get();
+    sftp_session sftpSession = m_sftpSession.get();
+
+    const auto readError = [&]() {
+        return cts::SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                              "Failed to read from remote file [" + remoteFileName + "] " +
+                                  ssh_get_error(sshSession));
+    };
+
+    if (offset > 0) {
+        file.seekp(static_cast<std::streamoff>(offset));
+        if (!file || sftp_seek64(remoteFilePtr.get(), offset) < 0) {
+            return readError();
+        }
+    }
+
+    // Chunks are hashed as they arrive in order. One that lands after a gap left by a short
+    // read is not, and everything past the gap is read back from disk at the end instead.
+    Checksum checksum(options.checksum);
+    uint64_t hashedOffset = 0;
+    if (options.checksum != ChecksumAlgorithm::None && offset > 0) {
+        const auto err = hashLocalFile(localFileName, 0, offset, checksum);
+        if (!err.isOk()) {
+            return err;
+        }
+        hashedOffset = offset;
+    }
+
+    // Adaptive compression decides on the first blocks of the file, read over the plain
+    // session. They are kept, and the transfer continues after them on whichever session wins.
+    uint64_t startOffset = offset;
+
+    if (offset == 0 && m_compressedSftpSession) {
+        sftp_attributes attributes = sftp_fstat(remoteFilePtr.get());
+        const uint64_t fileSize = attributes ? attributes->size : 0;
+        sftp_attributes_free(attributes);
+
+        if (fileSize >= m_options.compressionMinFileSize) {
+            std::vector<char> sample(kCompressionSampleSize);
+            size_t sampleSize = 0;
+
+            while (sampleSize < sample.size()) {
+                const auto count = std::min(sample.size() - sampleSize, size_t(m_maxReadLength));
+                const auto bytesRead =
+                    sftp_read(remoteFilePtr.get(), sample.data() + sampleSize, count);
+                if (bytesRead < 0) {
+                    return readError();
+                }
+                if (bytesRead == 0) {
+                    break;
+                }
+                sampleSize += static_cast<size_t>(bytesRead);
+            }
+
+            file.write(sample.data(), static_cast<std::streamsize>(sampleSize));
+            if (!file) {
+                return cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                      "Failed to write to local file [" + localFileName + "]");
+            }
+            startOffset = sampleSize;
+            offset = sampleSize;
+            checksum.update(sample.data(), sampleSize);
+            hashedOffset = sampleSize;
+
+            if (cts::estimateCompressionRatio(sample.data(), sampleSize) <
+                m_options.compressionThreshold) {
+                auto compressedFilePtr = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+                    sftp_open(m_compressedSftpSession.get(), remoteFileName.c_str(), O_RDONLY,
+                              S_IRUSR));
+
+                if (compressedFilePtr) {
+                    remoteFilePtr = std::move(compressedFilePtr);
+                    sshSession = m_compressedSshSession.get();
+                    sftpSession = m_compressedSftpSession.get();
+                }
+            }
+
+            if (sftp_seek64(remoteFilePtr.get(), startOffset) < 0) {
+                return readError();
+            }
+        }
+    }
+
+    // Received chunks go to disk on a thread of their own, which also hashes and leaves holes
+    // for sparse transfers, while this one goes straight back to the server.
+    const size_t bufferSize =
+        tuner ? std::min(m_maxReadLength, unsigned(kMaxPooledChunkSize)) : chunkSize;
+    chunkSize = std::min(chunkSize, unsigned(bufferSize));
+    SFTPFileWriter writer(std::move(file), localFileName, startOffset, bufferSize,
+                          options.sparse, localSize, checksum, hashedOffset);
+
+    std::deque<PendingRead> pending;
+    uint64_t nextOffset = startOffset;
+    uint64_t highestWritten = startOffset;
+    bool endOfFile = false;
 
     while (true) {
-        auto bytesRead = sftp_read(remoteFilePtr.get(), buffer.data(), chunkSize);
+        while (!endOfFile && pending.size() < maxInFlight) {
+            sftp_aio aio = nullptr;
+            if (sftp_aio_begin_read(remoteFilePtr.get(), chunkSize, &aio) < 0) {
+                return readError();
+            }
+            pending.push_back(
+                {SFTPAioPtr(aio), nextOffset, chunkSize, std::chrono::steady_clock::now()});
+            nextOffset += chunkSize;
+        }
+
+        if (pending.empty()) {
+            break;
+        }
+
+        PendingRead request = std::move(pending.front());
+        pending.pop_front();
+
+        char* buffer = writer.buffer();
+        if (!buffer) {
+            return writer.finish();
+        }
+
+        // sftp_aio_wait_read() frees the request whether it succeeds or not
+        sftp_aio aio = request.aio.release();
+        const auto bytesRead = sftp_aio_wait_read(&aio, buffer, bufferSize);
 
         if (bytesRead < 0) {
-            return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
-                                  sftp_get_error(m_sftpSession.get()),
-                                  "Failed to read from remote file [" + remoteFileName + "] " +
-                                      ssh_get_error(m_sshSession.get()));
+            return readError();
         }
 
         if (bytesRead == 0) {
-            break;  // End of file
+            endOfFile = true;  // Requests past the end keep returning 0 until drained
+            continue;
         }
 
-        file.write(buffer.data(), bytesRead);
-        if (!file) {
-            return cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
-                                  "Failed to write to local file [" + localFileName + "]");
+        const auto received = static_cast<size_t>(bytesRead);
+        writer.submit(request.offset, received);
+        highestWritten = std::max(highestWritten, request.offset + received);
+
+        if (tuner) {
+            tuner->onCompleted(received, std::chrono::duration_cast<std::chrono::microseconds>(
+                                             std::chrono::steady_clock::now() - request.sentAt));
+            chunkSize = std::min(tuner->chunkSize(), unsigned(bufferSize));
+            maxInFlight = tuner->maxInFlight();
+        }
+
+        // A server may return less than requested before the end of the file.
+        if (received < request.length) {
+            const auto remaining = request.length - received;
+            const auto receivedEnd = request.offset + received;
+            if (!cts::beginTailRead(remoteFilePtr.get(), receivedEnd, remaining, nextOffset,
+                                    &aio)) {
+                return readError();
+            }
+            pending.push_back(
+                {SFTPAioPtr(aio), receivedEnd, remaining, std::chrono::steady_clock::now()});
+        }
+
+        // Every byte below the lowest outstanding request is on disk or queued for it, and the
+        // writer drains its queue before getFrom() returns, also after an error.
+        offset = highestWritten;
+        for (const auto& outstanding : pending) {
+            offset = std::min(offset, outstanding.offset);
         }
 
-        totalBytes += bytesRead;
+        if (options.progress && !options.progress(offset)) {
+            return cts::SFTPError(SSH_OK, cts::SFTPError::kCancelled, "Transfer cancelled");
+        }
     }
 
-    return cts::SFTPError();
+    const auto writeError = writer.finish();
+    if (!writeError.isOk()) {
+        return writeError;
+    }
+    hashedOffset = writer.hashedOffset();
+
+    if (options.checksum != ChecksumAlgorithm::None && hashedOffset < highestWritten) {
+        const auto err = hashLocalFile(localFileName, hashedOffset, highestWritten, checksum);
+        if (!err.isOk()) {
+            return err;
+        }
+    }
+
+    return finishChecksum(remoteFileName, checksum, options);
 }
 
-cts::SFTPError cts::SFTPClient::mkdir(const std::string& remoteDir,
-                                      const mode_t permissions) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+std::pair<cts::SFTPError, std::vector<cts::FileTransferResult>> cts::SFTPClient::putFiles(
+    const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) const {
+    if (!m_sftpSession || !m_sshSession) {
+        return {cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
     }
 
-    int rc = sftp_mkdir(m_sftpSession.get(), remoteDir.c_str(), permissions);
-    if (rc < 0) {
-        return cts::SFTPError(rc, sftp_get_error(m_sftpSession.get()),
-                              ssh_get_error(m_sshSession.get()));
+    if (remoteToolAvailable(m_remoteTar, cts::remoteTarAvailable)) {
+        return cts::tarPut(m_sshSession.get(), localDir, paths, remoteDir);
     }
 
-    return cts::SFTPError();
+    SFTPBatchTransfer batch(m_sshSession.get(), m_options, m_maxReadLength, m_maxWriteLength);
+    if (batch.open().isOk()) {
+        return batch.put(localDir, paths, remoteDir);
+    }
+
+    // Servers that allow a single channel per session
+    std::vector<FileTransferResult> results;
+    std::set<std::string> known;
+    for (const auto& path : paths) {
+        const auto remoteFileName = remoteDir.empty() ? path : remoteDir + "/" + path;
+        createRemoteParents(remoteFileName, known);
+        results.push_back(
+            {path, put(localDir.empty() ? path : localDir + "/" + path, remoteFileName)});
+    }
+
+    return {cts::SFTPError(), results};
 }
 
-std::pair<cts::SFTPError, std::vector<cts::SFTPAttributes>> cts::SFTPClient::ls(
+std::pair<cts::SFTPError, std::vector<cts::FileTransferResult>> cts::SFTPClient::getFiles(
+    const std::string& localDir, const std::vector<std::string>& paths,
     const std::string& remoteDir) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
+    if (!m_sftpSession || !m_sshSession) {
         return {cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
     }
 
-    auto dir = std::unique_ptr<sftp_dir_struct, decltype(&sftp_closedir)>(
-        sftp_opendir(m_sftpSession.get(), remoteDir.c_str()), sftp_closedir);
+    if (remoteToolAvailable(m_remoteTar, cts::remoteTarAvailable)) {
+        return cts::tarGet(m_sshSession.get(), localDir, paths, remoteDir);
+    }
 
-    if (!dir) {
-        return {cts::SFTPError(ssh_get_error_code(m_sftpSession.get()),
-                               sftp_get_error(m_sftpSession.get()),
-                               "Failed to open directory: " + remoteDir),
-                {}};
+    SFTPBatchTransfer batch(m_sshSession.get(), m_options, m_maxReadLength, m_maxWriteLength);
+    if (batch.open().isOk()) {
+        return batch.get(localDir, paths, remoteDir);
     }
 
-    std::vector<SFTPAttributes> attributesList;
+    std::vector<FileTransferResult> results;
+    for (const auto& path : paths) {
+        const auto localFileName = localDir.empty() ? path : localDir + "/" + path;
+        cts::createParentDirectories(localFileName);
+        results.push_back(
+            {path, get(localFileName, remoteDir.empty() ? path : remoteDir + "/" + path)});
+    }
 
-    while (sftp_attributes attributes = sftp_readdir(m_sftpSession.get(), dir.get())) {
-        attributesList.emplace_back(attributes);
+    return {cts::SFTPError(), results};
+}
+
+cts::SFTPError cts::SFTPClient::mkdir(const std::string& remoteDir,
+                                      const mode_t permissions) const {
+    if (m_broker) {
+        return m_broker->mkdir(remoteDir, static_cast<uint32_t>(permissions));
     }
 
-    if (!sftp_dir_eof(dir.get())) {
-        return {cts::SFTPError(ssh_get_error_code(m_sftpSession.get()),
-                               sftp_get_error(m_sftpSession.get()),
-                               "Failed to read directory: " + remoteDir),
-                {}};
+    return withRetry(false, [&]() -> cts::SFTPError {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        int rc = sftp_mkdir(m_sftpSession.get(), remoteDir.c_str(), permissions);
+        if (rc < 0) {
+            return cts::SFTPError(rc, sftp_get_error(m_sftpSession.get()),
+                                  ssh_get_error(m_sshSession.get()));
+        }
+
+        return cts::SFTPError();
+    });
+}
+
+std::pair<cts::SFTPError, std::vector<cts::SFTPAttributes>> cts::SFTPClient::ls(
+    const std::string& remoteDir) const {
+    if (m_broker) {
+        return m_broker->ls(remoteDir);
     }
 
-    return {cts::SFTPError(SSH_OK, SSH_FX_OK), std::move(attributesList)};
+    return withRetry(true, [&]() -> std::pair<cts::SFTPError, std::vector<cts::SFTPAttributes>> {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return {cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
+        }
+
+        auto dir = std::unique_ptr<sftp_dir_struct, decltype(&sftp_closedir)>(
+            sftp_opendir(m_sftpSession.get(), remoteDir.c_str()), sftp_closedir);
+
+        if (!dir) {
+            return {cts::SFTPError(ssh_get_error_code(m_sftpSession.get()),
+                                   sftp_get_error(m_sftpSession.get()),
+                                   "Failed to open directory: " + remoteDir),
+                    {}};
+        }
+
+        std::vector<SFTPAttributes> attributesList;
+
+        while (sftp_attributes attributes = sftp_readdir(m_sftpSession.get(), dir.get())) {
+            attributesList.emplace_back(attributes);
+        }
+
+        if (!sftp_dir_eof(dir.get())) {
+            return {cts::SFTPError(ssh_get_error_code(m_sftpSession.get()),
+                                   sftp_get_error(m_sftpSession.get()),
+                                   "Failed to read directory: " + remoteDir),
+                    {}};
+        }
+
+        return {cts::SFTPError(SSH_OK, SSH_FX_OK), std::move(attributesList)};
+    });
 }
 
 cts::SFTPError cts::SFTPClient::rename(const std::string& oldRemoteName,
                                        const std::string& newRemoteName) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+    if (m_broker) {
+        return m_broker->rename(oldRemoteName, newRemoteName);
     }
 
-    int rc = sftp_rename(m_sftpSession.get(), oldRemoteName.c_str(), newRemoteName.c_str());
-    if (rc < 0) {
-        return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
-                              sftp_get_error(m_sftpSession.get()),
-                              ssh_get_error(m_sshSession.get()));
+    return withRetry(false, [&]() -> cts::SFTPError {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        int rc = sftp_rename(m_sftpSession.get(), oldRemoteName.c_str(), newRemoteName.c_str());
+        if (rc < 0) {
+            return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
+                                  sftp_get_error(m_sftpSession.get()),
+                                  ssh_get_error(m_sshSession.get()));
+        }
+
+        return cts::SFTPError();
+    });
+}
+
+cts::SFTPError cts::SFTPClient::copy(const std::string& remoteSrc, const std::string& remoteDst,
+                                     const bool recursive) const {
+    if (m_broker) {
+        return m_broker->copy(remoteSrc, remoteDst, recursive);
     }
 
-    return cts::SFTPError();
+    if (remoteSrc == remoteDst || (recursive && remoteDst.compare(0, remoteSrc.size() + 1,
+                                                                  remoteSrc + "/") == 0)) {
+        return cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
+                              "Cannot copy [" + remoteSrc + "] onto or into itself");
+    }
+
+    // Copying again overwrites the same destination, so a lost connection simply starts over.
+    return withRetry(true, [&]() -> cts::SFTPError {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        const SFTPAttributes attributes(sftp_stat(m_sftpSession.get(), remoteSrc.c_str()));
+        if (!attributes.get()) {
+            return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
+                                  sftp_get_error(m_sftpSession.get()),
+                                  "Failed to stat remote file [" + remoteSrc + "] " +
+                                      ssh_get_error(m_sshSession.get()));
+        }
+
+        // One side channel serves every file of a recursive copy.
+        std::unique_ptr<SFTPSideChannel> channel;
+        if (sftp_extension_supported(m_sftpSession.get(), "copy-data", "1")) {
+            channel.reset(new SFTPSideChannel(m_sshSession.get()));
+            if (!channel->open().isOk() || !channel->hasExtension("copy-data")) {
+                channel.reset();
+            }
+        }
+
+        return copyPath(*this, remoteSrc, remoteDst, *attributes.get(), recursive,
+                        channel.get(), nullptr);
+    });
+}
+
+cts::SFTPError cts::SFTPClient::relay(const SFTPClient& destination, const std::string& remoteSrc,
+                                      const std::string& remoteDst, const bool recursive) const {
+    if (&destination == this) {
+        return copy(remoteSrc, remoteDst, recursive);
+    }
+
+    bool destinationFailed = false;
+    const auto relayOnce = [&]() -> cts::SFTPError {
+        destinationFailed = !destination.m_sftpSession.get() || !destination.m_sshSession.get();
+        if (!m_sftpSession.get() || !m_sshSession.get() || destinationFailed) {
+            return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        const SFTPAttributes attributes(sftp_stat(m_sftpSession.get(), remoteSrc.c_str()));
+        if (!attributes.get()) {
+            return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
+                                  sftp_get_error(m_sftpSession.get()),
+                                  "Failed to stat remote file [" + remoteSrc + "] " +
+                                      ssh_get_error(m_sshSession.get()));
+        }
+
+        return copyPath(destination, remoteSrc, remoteDst, *attributes.get(), recursive,
+                        nullptr, &destinationFailed);
+    };
+
+    // Relaying again overwrites the same destination, so it can start over after either side
+    // reconnected. Only the side the error came from reconnects, within its own retry policy.
+    auto result = relayOnce();
+    RetryState sourceRetry(m_options.retry);
+    RetryState destinationRetry(destination.m_options.retry);
+    while (destinationFailed ? destination.reconnectAfter(result, destinationRetry)
+                             : reconnectAfter(result, sourceRetry)) {
+        result = relayOnce();
+    }
+    return result;
 }
 
 cts::SFTPError cts::SFTPClient::rm(const std::string& remoteFileName) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+    if (m_broker) {
+        return m_broker->rm(remoteFileName);
+    }
+
+    return withRetry(false, [&]() -> cts::SFTPError {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        int rc = sftp_unlink(m_sftpSession.get(), remoteFileName.c_str());
+        if (rc < 0) {
+            return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
+                                  sftp_get_error(m_sftpSession.get()),
+                                  "Failed to remove remote file [" + remoteFileName + "] " +
+                                      ssh_get_error(m_sshSession.get()));
+        }
+
+        return cts::SFTPError();
+    });
+}
+
+cts::SFTPError cts::SFTPClient::rmdir(const std::string& remoteDir) const {
+    if (m_broker) {
+        return m_broker->rmdir(remoteDir);
+    }
+
+    return withRetry(false, [&]() -> cts::SFTPError {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+        }
+
+        int rc = sftp_rmdir(m_sftpSession.get(), remoteDir.c_str());
+        if (rc < 0) {
+            return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
+                                  sftp_get_error(m_sftpSession.get()),
+                                  "Failed to remove remote dir [" + remoteDir + "] " +
+                                      ssh_get_error(m_sshSession.get()));
+        }
+
+        return cts::SFTPError();
+    });
+}
+
+std::pair<cts::SFTPError, cts::SFTPAttributes> cts::SFTPClient::stat(
+    const std::string& remotePath) const {
+    if (m_broker) {
+        return m_broker->stat(remotePath);
     }
 
-    int rc = sftp_unlink(m_sftpSession.get(), remoteFileName.c_str());
+    return withRetry(true, [&]() -> std::pair<cts::SFTPError, cts::SFTPAttributes> {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return {cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
+        }
+
+        sftp_attributes attr = sftp_lstat(m_sftpSession.get(), remotePath.c_str());
+        if (!attr) {
+            return {cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
+                                   sftp_get_error(m_sftpSession.get()),
+                                   "Failed to stat remote dir [" + remotePath + "] " +
+                                       ssh_get_error(m_sshSession.get())),
+                    {}};
+        }
+
+        return {cts::SFTPError(), {attr}};
+    });
+}
+
+std::pair<cts::SFTPError, std::string> cts::SFTPClient::checksum(
+    const std::string& remoteFileName, const ChecksumAlgorithm algorithm) const {
+    return withRetry(true, [&]() -> std::pair<cts::SFTPError, std::string> {
+        if (!m_sftpSession.get() || !m_sshSession.get()) {
+            return {cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), ""};
+        }
+
+        return cts::remoteChecksum(m_sshSession.get(), m_sftpSession.get(), remoteFileName,
+                                   algorithm);
+    });
+}
+
+cts::SFTPError cts::SFTPClient::openSessions(const std::string& pw) const {
+    // A new session may land on another server behind the same name.
+    m_remoteTar = RemoteTool::Unknown;
+    m_remoteZstd = RemoteTool::Unknown;
+
+    const bool compress = m_options.compression == cts::ConnectOptions::Compression::On;
+    const auto err = openSession(pw, compress, m_sshSession, m_sftpSession);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    // Without the compressed session every transfer simply stays on the plain one.
+    if (m_options.compression == cts::ConnectOptions::Compression::Adaptive &&
+        !openSession(pw, true, m_compressedSshSession, m_compressedSftpSession).isOk()) {
+        m_compressedSftpSession.reset();
+        m_compressedSshSession.reset();
+    }
+
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPClient::openSession(const std::string& pw, const bool compress,
+                                            SSHSessionPtr& sshSession,
+                                            SFTPSessionPtr& sftpSession) const {
+    sshSession = SSHSessionPtr(ssh_new());
+    if (!sshSession) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_OK, "Failed to create ssh session.");
+    }
+
+    // libssh reads the port as an unsigned int
+    const unsigned int sshPort = m_port;
+
+    ssh_options_set(sshSession.get(), SSH_OPTIONS_HOST, m_host.c_str());
+    ssh_options_set(sshSession.get(), SSH_OPTIONS_PORT, &sshPort);
+    ssh_options_set(sshSession.get(), SSH_OPTIONS_USER, m_user.c_str());
+
+    const auto err = cts::applySessionOptions(sshSession.get(), m_options, compress);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    int rc = ssh_connect(sshSession.get());
+    if (rc != SSH_OK) {
+        return cts::SFTPError(rc, SSH_FX_OK, ssh_get_error(sshSession.get()));
+    }
+
+    cts::applySocketOptions(sshSession.get(), m_options);
+
+    if (m_onlyKnownServers) {
+        const auto res = ssh_session_is_known_server(sshSession.get());
+        if (res != SSH_KNOWN_HOSTS_OK) {
+            return cts::SFTPError(ssh_get_error_code(sshSession.get()),
+                                  sftp_get_error(sftpSession.get()),
+                                  ssh_get_error(sshSession.get()));
+        }
+    }
+
+    rc = ssh_userauth_password(sshSession.get(), nullptr, pw.c_str());
+    if (rc != SSH_AUTH_SUCCESS) {
+        return cts::SFTPError(rc, SSH_FX_OK, ssh_get_error(sshSession.get()));
+    }
+
+    sftpSession = SFTPSessionPtr(sftp_new(sshSession.get()));
+    if (!sftpSession) {
+        return cts::SFTPError(ssh_get_error_code(sshSession.get()), SSH_FX_FAILURE,
+                              "Failed to create a new sftp session.");
+    }
+
+    rc = sftp_init(sftpSession.get());
     if (rc < 0) {
+        return cts::SFTPError(ssh_get_error_code(sshSession.get()),
+                              sftp_get_error(sftpSession.get()),
+                              ssh_get_error(sshSession.get()));
+    }
+
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPClient::reconnect() const {
+    m_compressedSftpSession.reset();
+    m_compressedSshSession.reset();
+    m_sftpSession.reset();
+    m_sshSession.reset();
+
+    return openSessions(m_password);
+}
+
+bool cts::SFTPClient::connectionLost(const SFTPError& err) const {
+    if (err.getSFTPErrorCode() == SSH_FX_NO_CONNECTION ||
+        err.getSFTPErrorCode() == SSH_FX_CONNECTION_LOST) {
+        return true;
+    }
+
+    const auto sessionDown = [](ssh_session session) {
+        return !ssh_is_connected(session) ||
+               (ssh_get_status(session) & (SSH_CLOSED | SSH_CLOSED_ERROR)) != 0 ||
+               ssh_get_error_code(session) == SSH_FATAL;
+    };
+
+    return !m_sshSession || sessionDown(m_sshSession.get()) ||
+           (m_compressedSshSession && sessionDown(m_compressedSshSession.get()));
+}
+
+bool cts::SFTPClient::useZstd(const TransferOptions& options, const bool download) const {
+    if (!options.zstd || options.resumeOffset > 0 || (download && options.sparse) ||
+        !m_sshSession || !cts::zstdSupported()) {
+        return false;
+    }
+    return remoteToolAvailable(m_remoteZstd, cts::remoteZstdAvailable);
+}
+
+bool cts::SFTPClient::remoteToolAvailable(RemoteTool& known,
+                                          bool (*probe)(ssh_session session)) const {
+    if (known == RemoteTool::Unknown) {
+        known = probe(m_sshSession.get()) ? RemoteTool::Available : RemoteTool::Missing;
+    }
+    return known == RemoteTool::Available;
+}
+
+void cts::SFTPClient::reportStats(const TransferOptions& options, TransferStats stats,
+                                  const std::chrono::steady_clock::time_point start) {
+    if (options.onStats) {
+        stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        options.onStats(stats);
+    }
+}
+
+cts::SFTPError cts::SFTPClient::finishChecksum(const std::string& remoteFileName,
+                                               Checksum& checksum,
+                                               const TransferOptions& options) const {
+    if (checksum.algorithm() == ChecksumAlgorithm::None) {
+        return cts::SFTPError();
+    }
+
+    const auto digest = checksum.hexDigest();
+    if (options.onChecksum) {
+        options.onChecksum(digest);
+    }
+
+    if (!options.verifyChecksum) {
+        return cts::SFTPError();
+    }
+
+    const auto remote = cts::remoteChecksum(m_sshSession.get(), m_sftpSession.get(),
+                                            remoteFileName, checksum.algorithm());
+    if (remote.first.getSFTPErrorCode() == SSH_FX_OP_UNSUPPORTED) {
+        return cts::SFTPError();  // Nothing to compare with
+    }
+
+    if (!remote.first.isOk()) {
+        return remote.first;
+    }
+
+    if (remote.second != digest) {
+        return cts::SFTPError(SSH_OK, cts::SFTPError::kChecksumMismatch,
+                              "Checksum mismatch for remote file [" + remoteFileName +
+                                  "]: local " + digest + ", remote " + remote.second);
+    }
+
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPClient::hashLocalFile(const std::string& localFileName,
+                                              const uint64_t from, const uint64_t to,
+                                              Checksum& checksum) {
+    std::ifstream file(localFileName, std::ios::binary);
+    file.seekg(static_cast<std::streamoff>(from));
+
+    std::vector<char> buffer(256 * 1024);
+    uint64_t position = from;
+
+    while (file && position < to) {
+        const auto count = static_cast<size_t>(std::min<uint64_t>(buffer.size(), to - position));
+        file.read(buffer.data(), static_cast<std::streamsize>(count));
+        const auto bytesRead = static_cast<size_t>(file.gcount());
+        checksum.update(buffer.data(), bytesRead);
+        position += bytesRead;
+    }
+
+    if (position < to) {
+        return cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
+                              "Failed to read local file [" + localFileName + "] for checksum");
+    }
+
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPClient::copyPath(const SFTPClient& destination,
+                                         const std::string& remoteSrc,
+                                         const std::string& remoteDst,
+                                         const sftp_attributes_struct& attributes,
+                                         const bool recursive, SFTPSideChannel* channel,
+                                         bool* destinationFailed) const {
+    sftp_session sftpSession = m_sftpSession.get();
+    ssh_session sshSession = m_sshSession.get();
+    sftp_session dstSftpSession = destination.m_sftpSession.get();
+    ssh_session dstSshSession = destination.m_sshSession.get();
+    const uint32_t permissions = attributes.permissions & 07777;
+
+    const auto error = [&](const std::string& what) {
+        return cts::SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                              what + " " + ssh_get_error(sshSession));
+    };
+
+    const auto dstError = [&](const std::string& what) {
+        if (destinationFailed) {
+            *destinationFailed = true;
+        }
+        return cts::SFTPError(ssh_get_error_code(dstSshSession), sftp_get_error(dstSftpSession),
+                              what + " " + ssh_get_error(dstSshSession));
+    };
+
+    if (attributes.type == SSH_FILEXFER_TYPE_REGULAR) {
+        if (&destination != this) {
+            return relayFile(destination, remoteSrc, remoteDst, permissions, destinationFailed);
+        }
+        if (channel) {
+            const auto err = copyData(*channel, remoteSrc, remoteDst, permissions);
+            if (err.getSFTPErrorCode() != SSH_FX_OP_UNSUPPORTED) {
+                return err;
+            }
+        }
+        return copyPipelined(remoteSrc, remoteDst, permissions);
+    }
+
+    if (attributes.type == SSH_FILEXFER_TYPE_SYMLINK) {
+        char* target = sftp_readlink(sftpSession, remoteSrc.c_str());
+        if (!target) {
+            return error("Failed to read remote link [" + remoteSrc + "]");
+        }
+        const std::string linkTarget(target);
+        ssh_string_free_char(target);
+
+        if (sftp_symlink(dstSftpSession, linkTarget.c_str(), remoteDst.c_str()) < 0) {
+            return dstError("Failed to create remote link [" + remoteDst + "]");
+        }
+        return cts::SFTPError();
+    }
+
+    if (attributes.type != SSH_FILEXFER_TYPE_DIRECTORY) {
+        return cts::SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED,
+                              "Cannot copy special file [" + remoteSrc + "]");
+    }
+
+    if (!recursive) {
+        return cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
+                              "[" + remoteSrc + "] is a directory, copy it recursively");
+    }
+
+    // The owner needs write access to fill the directory; the original mode is restored after.
+    const uint32_t writablePermissions = permissions | 0700;
+    if (sftp_mkdir(dstSftpSession, remoteDst.c_str(), static_cast<mode_t>(writablePermissions)) <
+        0) {
+        const SFTPAttributes existing(sftp_stat(dstSftpSession, remoteDst.c_str()));
+        if (!existing.get() || existing.get()->type != SSH_FILEXFER_TYPE_DIRECTORY) {
+            return dstError("Failed to create remote directory [" + remoteDst + "]");
+        }
+    }
+
+    // The listing is read completely first so no directory handle stays open while recursing.
+    std::vector<SFTPAttributes> entries;
+    {
+        auto dir = std::unique_ptr<sftp_dir_struct, decltype(&sftp_closedir)>(
+            sftp_opendir(sftpSession, remoteSrc.c_str()), sftp_closedir);
+        if (!dir) {
+            return error("Failed to open remote directory [" + remoteSrc + "]");
+        }
+
+        while (sftp_attributes entry = sftp_readdir(sftpSession, dir.get())) {
+            entries.emplace_back(entry);
+        }
+
+        if (!sftp_dir_eof(dir.get())) {
+            return error("Failed to read remote directory [" + remoteSrc + "]");
+        }
+    }
+
+    for (const auto& entry : entries) {
+        const std::string name = entry.get()->name ? entry.get()->name : "";
+        if (name.empty() || name == "." || name == "..") {
+            continue;
+        }
+
+        const auto err = copyPath(destination, remoteSrc + "/" + name, remoteDst + "/" + name,
+                                  *entry.get(), true, channel, destinationFailed);
+        if (!err.isOk()) {
+            return err;
+        }
+    }
+
+    if (writablePermissions != permissions &&
+        sftp_chmod(dstSftpSession, remoteDst.c_str(), static_cast<mode_t>(permissions)) < 0) {
+        return dstError("Failed to set permissions of remote directory [" + remoteDst + "]");
+    }
+
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPClient::copyData(SFTPSideChannel& channel, const std::string& remoteSrc,
+                                         const std::string& remoteDst,
+                                         const uint32_t permissions) const {
+    std::string srcHandle, dstHandle;
+    auto err = channel.openFile(remoteSrc, SSH_FXF_READ, 0, srcHandle);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    err = channel.openFile(remoteDst, SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC, permissions,
+                           dstHandle);
+    if (!err.isOk()) {
+        channel.closeFile(srcHandle);
+        return err;
+    }
+
+    err = channel.requestStatus(SFTPPacketWriter(SSH_FXP_EXTENDED, channel.nextId())
+                                    .putString("copy-data")
+                                    .putString(srcHandle)
+                                    .putUint64(0)  // Read from the start
+                                    .putUint64(0)  // Up to the end of the file
+                                    .putString(dstHandle)
+                                    .putUint64(0)  // Write from the start
+                                    .finish());
+
+    channel.closeFile(srcHandle);
+    const auto closeErr = channel.closeFile(dstHandle);
+
+    return err.isOk() ? closeErr : err;
+}
+
+cts::SFTPError cts::SFTPClient::copyPipelined(const std::string& remoteSrc,
+                                              const std::string& remoteDst,
+                                              const uint32_t permissions) const {
+    sftp_session sftpSession = m_sftpSession.get();
+    ssh_session sshSession = m_sshSession.get();
+
+    const auto error = [&](const std::string& what) {
+        return cts::SFTPError(ssh_get_error_code(sshSession), sftp_get_error(sftpSession),
+                              what + " " + ssh_get_error(sshSession));
+    };
+
+    auto srcFile = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+        sftp_open(sftpSession, remoteSrc.c_str(), O_RDONLY, 0));
+    if (!srcFile) {
+        return error("Failed to open remote file [" + remoteSrc + "]");
+    }
+
+    auto dstFile = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+        sftp_open(sftpSession, remoteDst.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                  static_cast<mode_t>(permissions)));
+    if (!dstFile) {
+        return error("Failed to open remote file [" + remoteDst + "]");
+    }
+
+    const size_t chunkSize =
+        std::max(std::min({m_options.chunkSize, m_maxReadLength, m_maxWriteLength}), 1u);
+    const size_t maxInFlight = std::max(m_options.maxInFlightRequests, 1u);
+
+    struct PendingRead {
+        SFTPAioPtr aio;
+        uint64_t offset;
+        size_t length;
+    };
+
+    // Reads and writes share the in-flight budget; each completed read is written straight
+    // back, and libssh copies the data when the write is queued.
+    std::vector<char> buffer(chunkSize);
+    std::deque<PendingRead> reads;
+    std::deque<SFTPAioPtr> writes;
+    uint64_t nextOffset = 0;
+    uint64_t writeOffset = 0;
+    bool endOfFile = false;
+
+    const auto waitWrite = [&]() {
+        sftp_aio aio = writes.front().release();
+        writes.pop_front();
+        return sftp_aio_wait_write(&aio) >= 0;  // Frees the request either way
+    };
+
+    while (true) {
+        while (!endOfFile && reads.size() + writes.size() < maxInFlight) {
+            sftp_aio aio = nullptr;
+            if (sftp_aio_begin_read(srcFile.get(), chunkSize, &aio) < 0) {
+                return error("Failed to read from remote file [" + remoteSrc + "]");
+            }
+            reads.push_back({SFTPAioPtr(aio), nextOffset, chunkSize});
+            nextOffset += chunkSize;
+        }
+
+        if (reads.empty()) {
+            break;
+        }
+
+        PendingRead request = std::move(reads.front());
+        reads.pop_front();
+
+        sftp_aio aio = request.aio.release();
+        const auto bytesRead = sftp_aio_wait_read(&aio, buffer.data(), buffer.size());
+        if (bytesRead < 0) {
+            return error("Failed to read from remote file [" + remoteSrc + "]");
+        }
+
+        if (bytesRead == 0) {
+            endOfFile = true;
+            continue;
+        }
+
+        const auto received = static_cast<size_t>(bytesRead);
+        if (request.offset != writeOffset && sftp_seek64(dstFile.get(), request.offset) < 0) {
+            return error("Failed to seek in remote file [" + remoteDst + "]");
+        }
+
+        if (sftp_aio_begin_write(dstFile.get(), buffer.data(), received, &aio) < 0) {
+            return error("Failed to write to remote file [" + remoteDst + "]");
+        }
+        writes.emplace_back(aio);
+        writeOffset = request.offset + received;
+
+        if (received < request.length) {
+            const auto remaining = request.length - received;
+            if (!cts::beginTailRead(srcFile.get(), writeOffset, remaining, nextOffset, &aio)) {
+                return error("Failed to read from remote file [" + remoteSrc + "]");
+            }
+            reads.push_back({SFTPAioPtr(aio), writeOffset, remaining});
+        }
+
+        while (!writes.empty() && reads.size() + writes.size() >= maxInFlight) {
+            if (!waitWrite()) {
+                return error("Failed to write to remote file [" + remoteDst + "]");
+            }
+        }
+    }
+
+    while (!writes.empty()) {
+        if (!waitWrite()) {
+            return error("Failed to write to remote file [" + remoteDst + "]");
+        }
+    }
+
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPClient::relayFile(const SFTPClient& destination,
+                                          const std::string& remoteSrc,
+                                          const std::string& remoteDst,
+                                          const uint32_t permissions,
+                                          bool* destinationFailed) const {
+    sftp_session dstSftpSession = destination.m_sftpSession.get();
+    ssh_session dstSshSession = destination.m_sshSession.get();
+
+    const auto dstError = [&](const std::string& what) {
+        if (destinationFailed) {
+            *destinationFailed = true;
+        }
+        return cts::SFTPError(ssh_get_error_code(dstSshSession), sftp_get_error(dstSftpSession),
+                              what + " " + ssh_get_error(dstSshSession));
+    };
+
+    auto srcFile = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+        sftp_open(m_sftpSession.get(), remoteSrc.c_str(), O_RDONLY, 0));
+    if (!srcFile) {
         return cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
                               sftp_get_error(m_sftpSession.get()),
-                              "Failed to remove remote file [" + remoteFileName + "] " +
+                              "Failed to open remote file [" + remoteSrc + "] " +
                                   ssh_get_error(m_sshSession.get()));
     }
 
-    return cts::SFTPError();
-}
+    auto dstFile = std::unique_ptr<sftp_file_struct, SFTPFileDeleter>(
+        sftp_open(dstSftpSession, remoteDst.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                  static_cast<mode_t>(permissions)));
+    if (!dstFile) {
+        return dstError("Failed to open remote file [" + remoteDst + "]");
+    }
 
-cts::SFTPError cts::SFTPClient::rmdir(const std::string& remoteDir) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session");
+    const size_t chunkSize = std::max(
+        std::min({m_options.chunkSize, m_maxReadLength, destination.m_maxWriteLength}), 1u);
+    const size_t maxWrites = std::max(destination.m_options.maxInFlightRequests, 1u);
+
+    // Declared after the files so the reader's thread stops before the source is closed.
+    // libssh copies the data when a write is queued, so each chunk goes straight back.
+    SFTPRemoteReader reader(m_sshSession.get(), m_sftpSession.get(), srcFile.get(), remoteSrc,
+                            chunkSize, m_options.maxInFlightRequests);
+    std::deque<SFTPAioPtr> writes;
+    uint64_t writeOffset = 0;
+
+    const auto waitWrite = [&]() {
+        sftp_aio aio = writes.front().release();
+        writes.pop_front();
+        return sftp_aio_wait_write(&aio) >= 0;  // Frees the request either way
+    };
+
+    while (const auto* chunk = reader.next()) {
+        if (chunk->offset != writeOffset && sftp_seek64(dstFile.get(), chunk->offset) < 0) {
+            return dstError("Failed to seek in remote file [" + remoteDst + "]");
+        }
+
+        sftp_aio aio = nullptr;
+        if (sftp_aio_begin_write(dstFile.get(), chunk->data, chunk->length, &aio) < 0) {
+            return dstError("Failed to write to remote file [" + remoteDst + "]");
+        }
+        writes.emplace_back(aio);
+        writeOffset = chunk->offset + chunk->length;
+
+        while (writes.size() >= maxWrites) {
+            if (!waitWrite()) {
+                return dstError("Failed to write to remote file [" + remoteDst + "]");
+            }
+        }
     }
 
-    int rc = sftp_rmdir(m_sftpSession.get(), remoteDir.c_str());
-    if (rc < 0) {
-        return cts::SFTPError(
-            ssh_get_error_code(m_sshSession.get()), sftp_get_error(m_sftpSession.get()),
-            "Failed to remove remote dir [" + remoteDir + "] " + ssh_get_error(m_sshSession.get()));
+    if (!reader.error().isOk()) {
+        return reader.error();
+    }
+
+    while (!writes.empty()) {
+        if (!waitWrite()) {
+            return dstError("Failed to write to remote file [" + remoteDst + "]");
+        }
     }
 
     return cts::SFTPError();
 }
 
-std::pair<cts::SFTPError, cts::SFTPAttributes> cts::SFTPClient::stat(
-    const std::string& remotePath) const {
-    if (!m_sftpSession.get() || !m_sshSession.get()) {
-        return {cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Invalid SFTP or SSH session"), {}};
+void cts::SFTPClient::createRemoteParents(const std::string& remoteFileName,
+                                          std::set<std::string>& known) const {
+    for (auto slash = remoteFileName.find('/', 1); slash != std::string::npos;
+         slash = remoteFileName.find('/', slash + 1)) {
+        const auto dir = remoteFileName.substr(0, slash);
+        if (known.insert(dir).second) {
+            // Fails harmlessly for directories that already exist.
+            sftp_mkdir(m_sftpSession.get(), dir.c_str(), 0755);
+        }
+    }
+}
+
+void cts::SFTPClient::readServerLimits() {
+    m_maxReadLength = kFallbackMaxChunkSize;
+    m_maxWriteLength = kFallbackMaxChunkSize;
+
+    sftp_limits_t limits = sftp_limits(m_sftpSession.get());
+    if (!limits) {
+        return;
+    }
+
+    const uint64_t maxChunk = std::numeric_limits<unsigned int>::max();
+    if (limits->max_read_length > 0) {
+        m_maxReadLength = static_cast<unsigned int>(std::min(limits->max_read_length, maxChunk));
     }
 
-    sftp_attributes attr = sftp_lstat(m_sftpSession.get(), remotePath.c_str());
-    if (!attr) {
-        return {cts::SFTPError(ssh_get_error_code(m_sshSession.get()),
-                               sftp_get_error(m_sftpSession.get()),
-                               "Failed to stat remote dir [" + remotePath + "] " +
-                                   ssh_get_error(m_sshSession.get())),
-                {}};
+    if (limits->max_write_length > 0) {
+        m_maxWriteLength =
+            static_cast<unsigned int>(std::min(limits->max_write_length, maxChunk));
     }
 
-    std::cout << "In stat() " << attr->name;
+    sftp_limits_free(limits);
+}
 
-    return {cts::SFTPError(), {attr}};
+std::string cts::SFTPClient::tunerKey() const {
+    return m_host + ":" + std::to_string(m_port);
 }
 
 void cts::SFTPClient::SSHSessionDeleter::operator()(ssh_session session) const {
@@ -322,3 +1553,9 @@ void cts::SFTPClient::SFTPFileDeleter::operator()(sftp_file file) const {
         sftp_close(file);
     }
 }
+
+void cts::SFTPClient::SFTPAioDeleter::operator()(sftp_aio aio) const {
+    if (aio) {
+        sftp_aio_free(aio);
+    }
+}
@@ -46,17 +46,30 @@
 #include <sys/stat.h>  // mode_t, S_IRUSR, S_IWUSR
 #endif
 
+#include <chrono>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "sftpattributes.h"
+#include "sftpbatchtransfer.h"
+#include "sftpchecksum.h"
+#include "sftpcipherpreference.h"
+#include "sftpconnectoptions.h"
 #include "sftperror.h"
+#include "sftpremotereader.h"
+#include "sftpsidechannel.h"
+#include "sftptarstream.h"
+#include "sftptransferoptions.h"
 
 namespace cts {
 
+class SFTPBrokerConnection;
+
 class SFTPClient {
    public:
     SFTPClient() = default;
@@ -69,13 +82,53 @@ class SFTPClient {
     SFTPError connect(const std::string& host, const std::string& user, const std::string& pw,
                       const uint16_t port = 22, const bool onlyKnownServers = true);
 
+    SFTPError connect(const std::string& host, const std::string& user, const std::string& pw,
+                      const ConnectOptions& options, const uint16_t port = 22,
+                      const bool onlyKnownServers = true);
+
+    // Broker mode: put(), get(), mkdir(), ls(), rename(), copy(), rm(), rmdir() and stat() are
+    // forwarded to the SFTPBroker listening on socketPath, which lends this process a session
+    // to user@host:port that is already authenticated when it has one idle. Other operations
+    // report an invalid session in broker mode.
+    SFTPError connectThroughBroker(const std::string& socketPath, const std::string& host,
+                                   const std::string& user, const std::string& pw,
+                                   const uint16_t port = 22, const bool onlyKnownServers = true);
+
     void disconnect();
 
+    NegotiatedAlgorithms negotiatedAlgorithms() const;
+
+    // A chunkSize of 0 uses ConnectOptions::chunkSize.
+    SFTPError put(const std::string& localFileName, const std::string& remoteFileName,
+                  unsigned int chunkSize = 0) const;
+
+    SFTPError get(const std::string& localFileName, const std::string& remoteFileName,
+                  unsigned int chunkSize = 0) const;
+
     SFTPError put(const std::string& localFileName, const std::string& remoteFileName,
-                  unsigned int chunkSize = kDefaultChunkSize) const;
+                  const TransferOptions& options) const;
 
     SFTPError get(const std::string& localFileName, const std::string& remoteFileName,
-                  unsigned int chunkSize = kDefaultChunkSize) const;
+                  const TransferOptions& options) const;
+
+    // Uploads size bytes from memory, which has to stay valid and unchanged until the call
+    // returns. SFTPFanOut sends one mapping of a file to many hosts with it.
+    SFTPError putBuffer(const char* data, const uint64_t size, const std::string& remoteFileName,
+                        const TransferOptions& options = TransferOptions()) const;
+
+    // Transfer many files in one call: localDir/path to or from remoteDir/path for each of the
+    // relative paths. When the server runs commands, all of them travel as one tar stream over
+    // an exec channel, so small files no longer cost an open, write and close round trip each.
+    // Otherwise SFTPBatchTransfer keeps ConnectOptions::maxFilesInFlight files open at once on a
+    // second SFTP channel. The results follow the order of paths, the returned error only
+    // reports a failure of the transfer as a whole.
+    std::pair<SFTPError, std::vector<FileTransferResult>> putFiles(
+        const std::string& localDir, const std::vector<std::string>& paths,
+        const std::string& remoteDir) const;
+
+    std::pair<SFTPError, std::vector<FileTransferResult>> getFiles(
+        const std::string& localDir, const std::vector<std::string>& paths,
+        const std::string& remoteDir) const;
 
     SFTPError mkdir(const std::string& remoteDir, const mode_t permissions) const;
 
@@ -83,12 +136,30 @@ class SFTPClient {
 
     SFTPError rename(const std::string& oldRemoteName, const std::string& newRemoteName) const;
 
+    // Copies a remote file to another remote path on the server itself, through the copy-data
+    // extension when the server has it (OpenSSH since 9.0) and otherwise by pipelined reads
+    // and writes through this client, never touching local disk. recursive copies directories
+    // with their contents and recreates the symbolic links inside them instead of following.
+    SFTPError copy(const std::string& remoteSrc, const std::string& remoteDst,
+                   const bool recursive = false) const;
+
+    // Streams remoteSrc on this client's server to remoteDst on destination's server through
+    // a few chunk buffers, never touching local disk. Reads from this server run on their own
+    // thread while writes go to the other one. recursive relays a directory as copy() does.
+    SFTPError relay(const SFTPClient& destination, const std::string& remoteSrc,
+                    const std::string& remoteDst, const bool recursive = false) const;
+
     SFTPError rm(const std::string& remoteFileName) const;
 
     SFTPError rmdir(const std::string& remoteDirName) const;
 
     std::pair<SFTPError, SFTPAttributes> stat(const std::string& remotePath) const;
 
+    // The server's hex digest of a remote file, see remoteChecksum().
+    std::pair<SFTPError, std::string> checksum(
+        const std::string& remoteFileName,
+        const ChecksumAlgorithm algorithm = ChecksumAlgorithm::Sha256) const;
+
    private:
     SFTPClient& operator=(const SFTPClient&) = delete;
     SFTPClient(const SFTPClient&) = delete;
@@ -105,14 +176,142 @@ class SFTPClient {
         void operator()(sftp_file file) const;
     };
 
+    struct SFTPAioDeleter {
+        void operator()(sftp_aio aio) const;
+    };
+
     using SSHSessionPtr = std::unique_ptr<ssh_session_struct, SSHSessionDeleter>;
     using SFTPSessionPtr = std::unique_ptr<sftp_session_struct, SFTPSessionDeleter>;
+    using SFTPAioPtr = std::unique_ptr<sftp_aio_struct, SFTPAioDeleter>;
+
+    SFTPError openSessions(const std::string& pw) const;
+
+    SFTPError openSession(const std::string& pw, const bool compress, SSHSessionPtr& sshSession,
+                          SFTPSessionPtr& sftpSession) const;
+
+    SFTPError reconnect() const;
+
+    bool connectionLost(const SFTPError& err) const;
+
+    // How far one operation got through a RetryPolicy.
+    struct RetryState {
+        explicit RetryState(const RetryPolicy& policy) : backoff(policy.initialBackoff) {}
+
+        unsigned int attempt = 1;
+        std::chrono::milliseconds backoff;
+    };
+
+    // After err lost the connection, backs off and reconnects until that works or the attempts
+    // run out. True when the operation can run again.
+    bool reconnectAfter(const SFTPError& err, RetryState& retry) const;
+
+    template <typename Operation>
+    auto withRetry(const bool idempotent, Operation operation) const -> decltype(operation());
+
+    static const SFTPError& errorOf(const SFTPError& err) { return err; }
+
+    template <typename T>
+    static const SFTPError& errorOf(const std::pair<SFTPError, T>& result) {
+        return result.first;
+    }
+
+    // What putFrom() uploads: a local file, or memory when data is set.
+    struct PutSource {
+        std::string fileName;
+        const char* data = nullptr;
+        uint64_t size = 0;
+    };
+
+    // offset is where the transfer starts and, on return, how far the server acknowledged it.
+    SFTPError putFrom(const PutSource& source, const std::string& remoteFileName,
+                      const TransferOptions& options, uint64_t& offset) const;
+
+    SFTPError getFrom(const std::string& localFileName, const std::string& remoteFileName,
+                      const TransferOptions& options, uint64_t& offset) const;
+
+    // Whether put(), or get() when download is set, goes through zstd instead of SFTP.
+    bool useZstd(const TransferOptions& options, const bool download) const;
+
+    // What the server can run over an exec channel, asked once per session.
+    enum class RemoteTool { Unknown, Available, Missing };
+
+    // Runs probe on the first call after the sessions were opened and then remembers its
+    // answer in known.
+    bool remoteToolAvailable(RemoteTool& known, bool (*probe)(ssh_session session)) const;
+
+    static void reportStats(const TransferOptions& options, TransferStats stats,
+                            const std::chrono::steady_clock::time_point start);
+
+    // Reports the digest through options.onChecksum and compares it with the server's.
+    SFTPError finishChecksum(const std::string& remoteFileName, Checksum& checksum,
+                             const TransferOptions& options) const;
+
+    // Feeds bytes [from, to) of a local file to checksum, for data that did not stream past it.
+    static SFTPError hashLocalFile(const std::string& localFileName, const uint64_t from,
+                                   const uint64_t to, Checksum& checksum);
+
+    // Writes go to destination, which is *this for copy(). channel is null when the server
+    // lacks copy-data or the copy goes to another server. destinationFailed, when given, is set
+    // if the error came from destination rather than this client.
+    SFTPError copyPath(const SFTPClient& destination, const std::string& remoteSrc,
+                       const std::string& remoteDst, const sftp_attributes_struct& attributes,
+                       const bool recursive, SFTPSideChannel* channel,
+                       bool* destinationFailed) const;
+
+    SFTPError copyData(SFTPSideChannel& channel, const std::string& remoteSrc,
+                       const std::string& remoteDst, const uint32_t permissions) const;
+
+    SFTPError copyPipelined(const std::string& remoteSrc, const std::string& remoteDst,
+                            const uint32_t permissions) const;
+
+    SFTPError relayFile(const SFTPClient& destination, const std::string& remoteSrc,
+                        const std::string& remoteDst, const uint32_t permissions,
+                        bool* destinationFailed) const;
+
+    // Creates the missing remote directories above remoteFileName; known lists those that
+    // already exist so a batch does not ask twice.
+    void createRemoteParents(const std::string& remoteFileName,
+                             std::set<std::string>& known) const;
+
+    void readServerLimits();
+
+    // Identifies the server in the SFTPAutoTuner cache.
+    std::string tunerKey() const;
+
+    // Mutable so that const operations can reconnect under a RetryPolicy.
+    mutable SSHSessionPtr m_sshSession;
+    mutable SFTPSessionPtr m_sftpSession;
+
+    // Only open with Compression::Adaptive.
+    mutable SSHSessionPtr m_compressedSshSession;
+    mutable SFTPSessionPtr m_compressedSftpSession;
+
+    ConnectOptions m_options;
+    std::string m_host;
+    std::string m_user;
+    uint16_t m_port = 22;
+    bool m_onlyKnownServers = true;
+
+    // Only kept when the RetryPolicy allows reconnecting.
+    std::string m_password;
+
+    // Only set in broker mode, which has no sessions of its own.
+    std::shared_ptr<SFTPBrokerConnection> m_broker;
+
+    unsigned int m_maxReadLength = kFallbackMaxChunkSize;
+    unsigned int m_maxWriteLength = kFallbackMaxChunkSize;
+
+    // Reset whenever the sessions are opened again.
+    mutable RemoteTool m_remoteTar = RemoteTool::Unknown;
+    mutable RemoteTool m_remoteZstd = RemoteTool::Unknown;
+
+    // libssh's limit for servers that do not announce limits@openssh.com.
+    static constexpr unsigned int kFallbackMaxChunkSize = 32 * 1024;
 
-    SSHSessionPtr m_sshSession;
-    SFTPSessionPtr m_sftpSession;
+    static constexpr size_t kCompressionSampleSize = 256 * 1024;
 
-    static constexpr unsigned int kDefaultChunkSize = 16 * 1024;
-    static constexpr unsigned int kMaxChunkSize = 32 * 1024;
+    // Largest chunk the disk pipeline buffers for tuned transfers, whose chunk size changes.
+    static constexpr unsigned int kMaxPooledChunkSize = 1024 * 1024;
 };
 
 }  // namespace cts
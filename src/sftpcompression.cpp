@@ -0,0 +1,128 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpcompression.h"
+
+#include <algorithm>  // min
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+bool hasCompressedSignature(const unsigned char* data, size_t size) {
+    struct Signature {
+        const char* bytes;
+        size_t length;
+    };
+
+    static const Signature signatures[] = {
+        {"\x1f\x8b", 2},                  // gzip
+        {"PK\x03\x04", 4},                // zip and the formats built on it
+        {"\x28\xb5\x2f\xfd", 4},          // zstd
+        {"\xfd" "7zXZ\x00", 6},           // xz
+        {"BZh", 3},                       // bzip2
+        {"7z\xbc\xaf\x27\x1c", 6},        // 7-Zip
+        {"\x04\x22\x4d\x18", 4},          // lz4 frame
+        {"\x89PNG", 4},                   // png
+        {"\xff\xd8\xff", 3},              // jpeg
+    };
+
+    for (const auto& signature : signatures) {
+        if (size >= signature.length && std::memcmp(data, signature.bytes, signature.length) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}  // namespace
+
+double cts::estimateCompressionRatio(const char* data, size_t size) {
+    if (size == 0) {
+        return 1.0;
+    }
+
+    const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+    if (hasCompressedSignature(bytes, size)) {
+        return 1.0;
+    }
+
+    // A greedy LZ77 pass over a deflate sized window finds the repetition zlib exploits, and
+    // the order-0 entropy of what is left approximates its Huffman stage.
+    constexpr size_t kMinMatch = 4;
+    constexpr size_t kMaxMatch = 258;
+    constexpr size_t kWindow = 32 * 1024;
+    constexpr unsigned int kHashBits = 14;
+    constexpr uint32_t kEmpty = UINT32_MAX;
+
+    std::vector<uint32_t> lastPosition(size_t(1) << kHashBits, kEmpty);
+    std::array<size_t, 256> literalCounts{};
+    size_t literals = 0;
+    size_t matches = 0;
+    size_t pos = 0;
+
+    while (pos + kMinMatch <= size) {
+        uint32_t word;
+        std::memcpy(&word, bytes + pos, sizeof(word));
+        const uint32_t hash = (word * 2654435761u) >> (32 - kHashBits);
+        const uint32_t candidate = lastPosition[hash];
+        lastPosition[hash] = static_cast<uint32_t>(pos);
+
+        if (candidate != kEmpty && pos - candidate <= kWindow &&
+            std::memcmp(bytes + candidate, bytes + pos, kMinMatch) == 0) {
+            size_t length = kMinMatch;
+            while (pos + length < size && length < kMaxMatch &&
+                   bytes[candidate + length] == bytes[pos + length]) {
+                ++length;
+            }
+            ++matches;
+            pos += length;
+            continue;
+        }
+
+        ++literalCounts[bytes[pos]];
+        ++literals;
+        ++pos;
+    }
+
+    for (; pos < size; ++pos) {
+        ++literalCounts[bytes[pos]];
+        ++literals;
+    }
+
+    double literalBits = 0.0;
+    for (const auto count : literalCounts) {
+        if (count > 0) {
+            const double frequency = static_cast<double>(count);
+            literalBits -= frequency * std::log2(frequency / static_cast<double>(literals));
+        }
+    }
+
+    // A length/distance pair costs deflate roughly three bytes.
+    const double estimatedSize = literalBits / 8.0 + static_cast<double>(matches) * 3.0;
+
+    return std::min(1.0, estimatedSize / static_cast<double>(size));
+}
@@ -0,0 +1,131 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpconnectoptions.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>   // IPPROTO_TCP
+#include <netinet/tcp.h>  // TCP_KEEPIDLE, TCP_KEEPINTVL, TCP_KEEPCNT
+#include <sys/socket.h>   // setsockopt, SO_SNDBUF, SO_RCVBUF, SO_KEEPALIVE
+#endif
+
+#include "sftpcipherpreference.h"
+
+cts::SFTPError cts::applySessionOptions(ssh_session session, const ConnectOptions& options,
+                                       const bool compress) {
+    if (options.tcpNoDelay) {
+        const int noDelay = 1;
+        ssh_options_set(session, SSH_OPTIONS_NODELAY, &noDelay);
+    }
+
+    if (options.rekeyDataLimit > 0) {
+        ssh_options_set(session, SSH_OPTIONS_REKEY_DATA, &options.rekeyDataLimit);
+    }
+
+    if (options.rekeyTimeLimit > 0) {
+        ssh_options_set(session, SSH_OPTIONS_REKEY_TIME, &options.rekeyTimeLimit);
+    }
+
+    if (options.operationTimeout > 0) {
+        ssh_options_set(session, SSH_OPTIONS_TIMEOUT, &options.operationTimeout);
+    }
+
+    if (compress) {
+        ssh_options_set(session, SSH_OPTIONS_COMPRESSION, "yes");
+        if (options.compressionLevel > 0) {
+            ssh_options_set(session, SSH_OPTIONS_COMPRESSION_LEVEL, &options.compressionLevel);
+        }
+    }
+
+    std::string ciphers = options.ciphers;
+    std::string macs = options.macs;
+
+    if (options.autoSelectCiphers) {
+        const auto& preference = cts::preferredCiphers();
+        if (ciphers.empty()) {
+            ciphers = preference.ciphers;
+        }
+        if (macs.empty()) {
+            macs = preference.macs;
+        }
+    }
+
+    // libssh drops names it does not support and only fails if none are left.
+    if (!ciphers.empty() &&
+        (ssh_options_set(session, SSH_OPTIONS_CIPHERS_C_S, ciphers.c_str()) < 0 ||
+         ssh_options_set(session, SSH_OPTIONS_CIPHERS_S_C, ciphers.c_str()) < 0)) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_OK, ssh_get_error(session));
+    }
+
+    if (!macs.empty() &&
+        (ssh_options_set(session, SSH_OPTIONS_HMAC_C_S, macs.c_str()) < 0 ||
+         ssh_options_set(session, SSH_OPTIONS_HMAC_S_C, macs.c_str()) < 0)) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_OK, ssh_get_error(session));
+    }
+
+    return cts::SFTPError();
+}
+
+void cts::applySocketOptions(ssh_session session, const ConnectOptions& options) {
+    const auto fd = ssh_get_fd(session);
+
+    // Larger buffers let TCP keep a full bandwidth-delay product in flight, where the kernel
+    // does not size them better itself.
+    if (options.socketSendBufferSize > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+                   reinterpret_cast<const char*>(&options.socketSendBufferSize),
+                   sizeof(options.socketSendBufferSize));
+    }
+
+    if (options.socketReceiveBufferSize > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+                   reinterpret_cast<const char*>(&options.socketReceiveBufferSize),
+                   sizeof(options.socketReceiveBufferSize));
+    }
+
+    if (options.keepAliveIdle > 0) {
+        const int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, reinterpret_cast<const char*>(&enable),
+                   sizeof(enable));
+#if defined(TCP_KEEPIDLE)
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE,
+                   reinterpret_cast<const char*>(&options.keepAliveIdle),
+                   sizeof(options.keepAliveIdle));
+#elif defined(TCP_KEEPALIVE)  // macOS
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPALIVE,
+                   reinterpret_cast<const char*>(&options.keepAliveIdle),
+                   sizeof(options.keepAliveIdle));
+#endif
+#if defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL,
+                   reinterpret_cast<const char*>(&options.keepAliveInterval),
+                   sizeof(options.keepAliveInterval));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT,
+                   reinterpret_cast<const char*>(&options.keepAliveCount),
+                   sizeof(options.keepAliveCount));
+#endif
+    }
+}
+
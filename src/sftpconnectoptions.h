@@ -0,0 +1,171 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_CONNECT_OPTIONS_H
+#define SFTP_CONNECT_OPTIONS_H
+
+#include <libssh/libssh.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "sftperror.h"
+
+namespace cts {
+
+// How SFTPClient recovers from a lost connection. After a failure that took the connection
+// down it reconnects with the parameters of the last connect(), waiting initialBackoff before
+// the first attempt and multiplying the wait after every further one. Idempotent operations
+// are then run again and put()/get() resume from the last offset the server acknowledged;
+// mkdir(), rename(), rm() and rmdir() only reconnect and return the original error, as the
+// server may already have carried them out.
+struct RetryPolicy {
+    // Total attempts per operation, 1 disables reconnecting.
+    unsigned int maxAttempts = 1;
+
+    std::chrono::milliseconds initialBackoff{500};
+    std::chrono::milliseconds maxBackoff{30000};
+    double backoffMultiplier = 2.0;
+};
+
+// Transport and transfer tuning applied by SFTPClient::connect(). A default constructed
+// ConnectOptions keeps the libssh and operating system defaults; the presets below trade
+// them for throughput or latency.
+struct ConnectOptions {
+    enum class Compression { Off, On, Adaptive };
+
+    // Disable Nagle's algorithm so small requests are not held back behind unacknowledged data.
+    bool tcpNoDelay = false;
+
+    // SO_SNDBUF / SO_RCVBUF in bytes, 0 keeps the operating system default. On Linux an
+    // explicit size turns off TCP buffer autotuning, which grows the buffers to several MiB on
+    // its own, and is clamped to net.core.wmem_max / rmem_max (about 208 KiB out of the box).
+    // Only set these where those limits were raised or autotuning is unavailable.
+    int socketSendBufferSize = 0;
+    int socketReceiveBufferSize = 0;
+
+    // Rekey after this many bytes or seconds, 0 keeps the libssh default for the cipher.
+    uint64_t rekeyDataLimit = 0;
+    uint32_t rekeyTimeLimit = 0;
+
+    // Chunk size used by put()/get() when the call does not pass one. It is capped by the
+    // server's read/write limits.
+    unsigned int chunkSize = 16 * 1024;
+
+    // SFTP read/write requests kept outstanding per transfer. Together with chunkSize this is
+    // the amount of data in flight, which has to cover the bandwidth-delay product of the link.
+    unsigned int maxInFlightRequests = 1;
+
+    // Files that putFiles()/getFiles() keep open at once when they go through SFTP, each with
+    // its own maxInFlightRequests. Opening and closing one file overlaps the data of the others,
+    // so small files do not cost a round trip each.
+    unsigned int maxFilesInFlight = 16;
+
+    // Let put()/get() measure round trip time and throughput while they run and size chunks and
+    // outstanding requests to the bandwidth-delay product, see SFTPAutoTuner. chunkSize and
+    // maxInFlightRequests are then only the starting point, and a chunk size passed to the call
+    // turns tuning off for that call.
+    bool autoTune = false;
+
+    // Order ciphers and MACs by what this CPU runs fastest, see preferredCiphers(). The choice
+    // is made once per process.
+    bool autoSelectCiphers = false;
+
+    // Explicit comma separated cipher and MAC lists, e.g. "aes128-gcm@openssh.com". They take
+    // precedence over autoSelectCiphers.
+    std::string ciphers;
+    std::string macs;
+
+    // SSH transport compression. Adaptive opens a second, compressed session next to the plain
+    // one and sends a file over it when a sample of its first blocks is estimated to shrink
+    // below compressionThreshold; smaller files and incompressible data use the plain session.
+    Compression compression = Compression::Off;
+
+    // zlib level from 1 (fastest) to 9 (smallest), 0 keeps the libssh default.
+    int compressionLevel = 0;
+
+    double compressionThreshold = 0.8;
+    uint64_t compressionMinFileSize = 1024 * 1024;
+
+    // TCP keepalive: the first probe after keepAliveIdle idle seconds, then one every
+    // keepAliveInterval seconds, giving up after keepAliveCount unanswered probes. Keeps NAT
+    // mappings open and notices a dead peer long before TCP's own timeouts. 0 leaves keepalive
+    // off.
+    int keepAliveIdle = 0;
+    int keepAliveInterval = 10;
+    int keepAliveCount = 3;
+
+    // Upper bound in seconds for any single blocking libssh call, 0 keeps the libssh default.
+    long operationTimeout = 0;
+
+    RetryPolicy retry;
+
+    // Multi-GB transfers over high bandwidth-delay links.
+    static ConnectOptions bulk() {
+        ConnectOptions options;
+        options.tcpNoDelay = true;
+        options.rekeyDataLimit = 16ull * 1024 * 1024 * 1024;
+        options.chunkSize = 256 * 1024;
+        options.maxInFlightRequests = 64;
+        options.maxFilesInFlight = 64;
+        options.autoTune = true;
+        options.autoSelectCiphers = true;
+        options.keepAliveIdle = 60;
+        options.operationTimeout = 300;
+        options.retry.maxAttempts = 5;
+        return options;
+    }
+
+    // Many small operations where each round trip counts.
+    static ConnectOptions interactive() {
+        ConnectOptions options;
+        options.tcpNoDelay = true;
+        options.chunkSize = 32 * 1024;
+        options.maxInFlightRequests = 4;
+        options.maxFilesInFlight = 32;
+        return options;
+    }
+
+    // Low latency, high bandwidth local networks.
+    static ConnectOptions lan() {
+        ConnectOptions options;
+        options.tcpNoDelay = true;
+        options.chunkSize = 128 * 1024;
+        options.maxInFlightRequests = 16;
+        options.maxFilesInFlight = 32;
+        options.autoSelectCiphers = true;
+        return options;
+    }
+};
+
+// Sets the options that have to be in place before ssh_connect(). compress turns on transport
+// compression regardless of options.compression.
+SFTPError applySessionOptions(ssh_session session, const ConnectOptions& options,
+                              const bool compress);
+
+// Sets the socket options, once ssh_connect() has created the socket.
+void applySocketOptions(ssh_session session, const ConnectOptions& options);
+
+}  // namespace cts
+
+#endif /* SFTP_CONNECT_OPTIONS_H */
@@ -0,0 +1,414 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_COROUTINE_H
+#define SFTP_COROUTINE_H
+
+// Awaitable SFTP operations for C++20 code. The rest of the library stays C++11; only
+// translation units that include this header need coroutine support.
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <poll.h>
+#endif
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <list>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sftpnonblockingclient.h"
+
+namespace cts {
+
+class SFTPExecutor;
+
+namespace detail {
+
+template <typename T>
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            auto continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+// WSAPoll on Windows, without leaking a poll macro into code that includes this header.
+inline int pollSockets(pollfd* fds, size_t count, int timeout) {
+#ifdef _WIN32
+    return ::WSAPoll(fds, static_cast<ULONG>(count), timeout);
+#else
+    return ::poll(fds, static_cast<nfds_t>(count), timeout);
+#endif
+}
+
+}  // namespace detail
+
+// A lazily started coroutine returning T. Awaiting it starts it and resumes the awaiter when
+// it finishes; top level tasks are handed to SFTPExecutor::spawn().
+template <typename T = void>
+class Task {
+   public:
+    struct promise_type : detail::TaskPromiseBase<T> {
+        std::optional<T> value;
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        void return_value(T result) { value = std::move(result); }
+    };
+
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    ~Task() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        m_handle.promise().continuation = awaiter;
+        return m_handle;
+    }
+
+    T await_resume() {
+        if (m_handle.promise().exception) {
+            std::rethrow_exception(m_handle.promise().exception);
+        }
+        return std::move(*m_handle.promise().value);
+    }
+
+   private:
+    friend class SFTPExecutor;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template <>
+class Task<void> {
+   public:
+    struct promise_type : detail::TaskPromiseBase<void> {
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        void return_void() {}
+    };
+
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    ~Task() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        m_handle.promise().continuation = awaiter;
+        return m_handle;
+    }
+
+    void await_resume() {
+        if (m_handle.promise().exception) {
+            std::rethrow_exception(m_handle.promise().exception);
+        }
+    }
+
+   private:
+    friend class SFTPExecutor;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+class SFTPCoroutineClient;
+
+// Single threaded event loop for SFTPCoroutineClients. It polls every attached session,
+// feeds readiness to process() and resumes coroutines whose operations completed. Coroutines
+// are never resumed from inside process(), so they are free to disconnect or destroy their
+// client.
+class SFTPExecutor {
+   public:
+    SFTPExecutor() = default;
+    SFTPExecutor(const SFTPExecutor&) = delete;
+    SFTPExecutor& operator=(const SFTPExecutor&) = delete;
+
+    void spawn(Task<void> task) {
+        m_tasks.push_back(std::move(task));
+        schedule(m_tasks.back().m_handle);
+    }
+
+    void schedule(std::coroutine_handle<> handle) { m_ready.push_back(handle); }
+
+    // Returns once every spawned task has finished, or when the remaining ones wait on
+    // something no attached session can deliver.
+    void run();
+
+   private:
+    friend class SFTPCoroutineClient;
+
+    void attach(SFTPCoroutineClient* client) { m_clients.push_back(client); }
+
+    void detach(SFTPCoroutineClient* client) { m_clients.remove(client); }
+
+    void resumeReady() {
+        while (!m_ready.empty()) {
+            auto handle = m_ready.front();
+            m_ready.pop_front();
+            handle.resume();
+        }
+        m_tasks.remove_if([](const Task<void>& task) { return task.m_handle.done(); });
+    }
+
+    std::deque<std::coroutine_handle<>> m_ready;
+    std::list<Task<void>> m_tasks;
+    std::list<SFTPCoroutineClient*> m_clients;
+};
+
+// Awaiting it starts the operation and suspends until its callback has run.
+template <typename Result>
+class SFTPOperation {
+   public:
+    using Start = std::function<void(std::function<void(Result)>)>;
+
+    SFTPOperation(SFTPExecutor& executor, Start start)
+        : m_executor(executor), m_start(std::move(start)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> awaiter) {
+        m_start([this, awaiter](Result result) {
+            m_result = std::move(result);
+            m_executor.schedule(awaiter);
+        });
+    }
+
+    Result await_resume() { return std::move(m_result); }
+
+   private:
+    SFTPExecutor& m_executor;
+    Start m_start;
+    Result m_result{};
+};
+
+// Awaitable counterparts of the SFTPClient operations, with the same results. Any number of
+// coroutines can have operations outstanding on one client at the same time; they share its
+// single session.
+class SFTPCoroutineClient {
+   public:
+    explicit SFTPCoroutineClient(SFTPExecutor& executor) : m_executor(executor) {
+        m_executor.attach(this);
+    }
+
+    ~SFTPCoroutineClient() { m_executor.detach(this); }
+
+    SFTPCoroutineClient(const SFTPCoroutineClient&) = delete;
+    SFTPCoroutineClient& operator=(const SFTPCoroutineClient&) = delete;
+
+    SFTPOperation<SFTPError> connect(const std::string& host, const std::string& user,
+                                     const std::string& pw,
+                                     const ConnectOptions& options = ConnectOptions(),
+                                     const uint16_t port = 22,
+                                     const bool onlyKnownServers = true) {
+        return {m_executor, [=, this](std::function<void(SFTPError)> done) {
+                    const auto err = m_client.connect(host, user, pw, options, port,
+                                                      onlyKnownServers);
+                    if (!err.isOk()) {
+                        done(err);
+                        return;
+                    }
+                    m_connectWaiters.push_back(std::move(done));
+                }};
+    }
+
+    void disconnect() { m_client.disconnect(); }
+
+    SFTPOperation<SFTPError> put(const std::string& localFileName,
+                                 const std::string& remoteFileName) {
+        return {m_executor, [=, this](std::function<void(SFTPError)> done) {
+                    m_client.put(localFileName, remoteFileName, done);
+                }};
+    }
+
+    SFTPOperation<SFTPError> get(const std::string& localFileName,
+                                 const std::string& remoteFileName) {
+        return {m_executor, [=, this](std::function<void(SFTPError)> done) {
+                    m_client.get(localFileName, remoteFileName, done);
+                }};
+    }
+
+    SFTPOperation<SFTPError> mkdir(const std::string& remoteDir, const mode_t permissions) {
+        return {m_executor, [=, this](std::function<void(SFTPError)> done) {
+                    m_client.mkdir(remoteDir, permissions, done);
+                }};
+    }
+
+    SFTPOperation<std::pair<SFTPError, std::vector<SFTPAttributes>>> ls(
+        const std::string& remoteDir) {
+        using Result = std::pair<SFTPError, std::vector<SFTPAttributes>>;
+        return {m_executor, [=, this](std::function<void(Result)> done) {
+                    m_client.ls(remoteDir, [done](const SFTPError& err,
+                                                  const std::vector<SFTPAttributes>& entries) {
+                        done({err, entries});
+                    });
+                }};
+    }
+
+    SFTPOperation<SFTPError> rename(const std::string& oldRemoteName,
+                                    const std::string& newRemoteName) {
+        return {m_executor, [=, this](std::function<void(SFTPError)> done) {
+                    m_client.rename(oldRemoteName, newRemoteName, done);
+                }};
+    }
+
+    SFTPOperation<SFTPError> rm(const std::string& remoteFileName) {
+        return {m_executor, [=, this](std::function<void(SFTPError)> done) {
+                    m_client.rm(remoteFileName, done);
+                }};
+    }
+
+    SFTPOperation<SFTPError> rmdir(const std::string& remoteDirName) {
+        return {m_executor, [=, this](std::function<void(SFTPError)> done) {
+                    m_client.rmdir(remoteDirName, done);
+                }};
+    }
+
+    SFTPOperation<std::pair<SFTPError, SFTPAttributes>> stat(const std::string& remotePath) {
+        using Result = std::pair<SFTPError, SFTPAttributes>;
+        return {m_executor, [=, this](std::function<void(Result)> done) {
+                    m_client.stat(remotePath,
+                                  [done](const SFTPError& err, const SFTPAttributes& attributes) {
+                                      done({err, attributes});
+                                  });
+                }};
+    }
+
+    SFTPNonBlockingClient& client() { return m_client; }
+
+   private:
+    friend class SFTPExecutor;
+
+    void process() {
+        const auto err = m_client.process();
+
+        const auto state = m_client.state();
+        if (state != SFTPNonBlockingClient::State::Ready &&
+            state != SFTPNonBlockingClient::State::Failed) {
+            return;
+        }
+
+        auto waiters = std::move(m_connectWaiters);
+        m_connectWaiters.clear();
+        for (auto& done : waiters) {
+            done(err);
+        }
+    }
+
+    SFTPExecutor& m_executor;
+    SFTPNonBlockingClient m_client;
+    std::vector<std::function<void(SFTPError)>> m_connectWaiters;
+};
+
+inline void SFTPExecutor::run() {
+    std::vector<pollfd> fds;
+    std::vector<SFTPCoroutineClient*> polled;
+
+    while (true) {
+        resumeReady();
+        if (m_tasks.empty()) {
+            return;
+        }
+
+        fds.clear();
+        polled.clear();
+        for (auto* client : m_clients) {
+            auto& session = client->m_client;
+            const int fd = session.fd();
+            if (fd < 0 || !session.wantsRead()) {
+                continue;
+            }
+
+            short events = POLLIN;
+            if (session.wantsWrite()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({fd, events, 0});
+            polled.push_back(client);
+        }
+
+        if (fds.empty()) {
+            // Sessions that failed before polling still owe their connect waiters an answer.
+            for (auto* client : m_clients) {
+                client->process();
+            }
+            if (m_ready.empty()) {
+                return;
+            }
+            continue;
+        }
+
+        if (detail::pollSockets(fds.data(), fds.size(), -1) < 0) {
+            return;
+        }
+
+        for (size_t i = 0; i < fds.size(); ++i) {
+            if (fds[i].revents != 0) {
+                polled[i]->process();
+            }
+        }
+    }
+}
+
+}  // namespace cts
+
+#endif  // __cpp_impl_coroutine
+
+#endif /* SFTP_COROUTINE_H */
@@ -0,0 +1,288 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpdiskpipeline.h"
+
+#include <libssh/sftp.h>  // SSH_FX_*
+
+#include <algorithm>  // min, max
+#include <limits>
+#include <memory>
+
+#include "sftpsparse.h"
+
+cts::SFTPFileReader::SFTPFileReader(std::ifstream&& file, const std::string& fileName,
+                                    const uint64_t offset, const size_t chunkSize,
+                                    const size_t maxChunkSize, const bool sparse,
+                                    Checksum& checksum)
+    : m_file(std::move(file)),
+      m_fileName(fileName),
+      m_offset(offset),
+      m_maxChunkSize(std::max<size_t>(maxChunkSize, 1)),
+      m_sparse(sparse),
+      m_checksum(checksum),
+      m_chunkSize(std::max<size_t>(std::min(chunkSize, m_maxChunkSize), 1)) {
+    if (!m_ring.allocate(m_maxChunkSize)) {
+        m_error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE, "Out of memory for read buffers");
+        m_ring.finish();
+        return;
+    }
+
+    m_thread = std::thread(&SFTPFileReader::run, this);
+}
+
+cts::SFTPFileReader::SFTPFileReader(const char* data, const uint64_t size, const uint64_t offset,
+                                    const size_t chunkSize, const size_t maxChunkSize,
+                                    const bool sparse, Checksum& checksum)
+    : m_inMemory(true),
+      m_memory(data),
+      m_memorySize(size),
+      m_memoryOffset(std::min(offset, size)),
+      m_offset(offset),
+      m_maxChunkSize(std::max<size_t>(maxChunkSize, 1)),
+      m_sparse(sparse),
+      m_checksum(checksum),
+      m_chunkSize(std::max<size_t>(std::min(chunkSize, m_maxChunkSize), 1)) {}
+
+cts::SFTPFileReader::~SFTPFileReader() {
+    m_ring.stop();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void cts::SFTPFileReader::setChunkSize(const size_t chunkSize) {
+    m_chunkSize = std::max<size_t>(std::min(chunkSize, m_maxChunkSize), 1);
+}
+
+const cts::SFTPFileReader::Chunk* cts::SFTPFileReader::next() {
+    if (m_inMemory) {
+        if (m_memoryOffset >= m_memorySize) {
+            m_end = m_memorySize;
+            return nullptr;
+        }
+
+        auto& chunk = m_memoryChunk;
+        chunk.data = m_memory + m_memoryOffset;
+        chunk.offset = m_memoryOffset;
+        chunk.length =
+            size_t(std::min<uint64_t>(m_chunkSize.load(), m_memorySize - m_memoryOffset));
+        chunk.zeros = m_sparse && cts::isAllZero(chunk.data, chunk.length);
+        m_checksum.update(chunk.data, chunk.length);
+        m_memoryOffset += chunk.length;
+        return &chunk;
+    }
+
+    return m_ring.next();
+}
+
+void cts::SFTPFileReader::run() {
+    std::unique_ptr<SparseFileMap> sparseMap;
+    if (m_sparse) {
+        sparseMap.reset(new SparseFileMap(m_fileName));
+    }
+
+    // Holes are hashed as the zeros they read as.
+    static const char kZeros[64 * 1024] = {};
+
+    uint64_t offset = m_offset;
+    uint64_t segmentEnd = m_sparse ? offset : std::numeric_limits<uint64_t>::max();
+    size_t slot = 0;
+
+    while (true) {
+        if (offset >= segmentEnd) {
+            uint64_t dataStart = 0;
+            const bool last = !sparseMap->nextData(offset, dataStart, segmentEnd);
+            if (last) {
+                dataStart = std::max(offset, sparseMap->size());
+            }
+
+            for (uint64_t at = offset; at < dataStart; at += sizeof(kZeros)) {
+                m_checksum.update(kZeros,
+                                  size_t(std::min<uint64_t>(sizeof(kZeros), dataStart - at)));
+            }
+            offset = dataStart;
+
+            if (last) {
+                break;
+            }
+
+            m_file.seekg(static_cast<std::streamoff>(offset));
+            if (!m_file) {
+                m_error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                         "Failed to read from local file [" + m_fileName + "]");
+                break;
+            }
+        }
+
+        if (!m_ring.takeFreeSlot(slot)) {
+            break;
+        }
+
+        auto& chunk = m_ring.chunk(slot);
+        const auto length = std::min<uint64_t>(m_chunkSize.load(), segmentEnd - offset);
+        m_file.read(m_ring.buffer(slot), static_cast<std::streamsize>(length));
+        const auto bytesRead = static_cast<size_t>(m_file.gcount());
+        const bool endOfFile = !m_file;
+
+        if (m_file.bad()) {
+            m_error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                     "Failed to read from local file [" + m_fileName + "]");
+            break;
+        }
+
+        if (bytesRead == 0) {
+            break;
+        }
+
+        m_checksum.update(chunk.data, bytesRead);
+        chunk.offset = offset;
+        chunk.length = bytesRead;
+        chunk.zeros = m_sparse && cts::isAllZero(chunk.data, bytesRead);
+        offset += bytesRead;
+        m_ring.publish(slot);
+
+        if (endOfFile) {
+            break;
+        }
+    }
+
+    m_end = offset;
+    m_ring.finish();
+}
+
+cts::SFTPFileWriter::SFTPFileWriter(std::ofstream&& file, const std::string& fileName,
+                                    const uint64_t offset, const size_t bufferSize,
+                                    const bool sparse, const uint64_t localSize,
+                                    Checksum& checksum, const uint64_t hashedOffset)
+    : m_file(std::move(file)),
+      m_fileName(fileName),
+      m_sparse(sparse),
+      m_localSize(localSize),
+      m_checksum(checksum),
+      m_writeOffset(offset),
+      m_hashedOffset(hashedOffset),
+      m_highestWritten(offset),
+      m_chunks(kDepth) {
+    for (size_t slot = 0; slot < kDepth; ++slot) {
+        m_buffers.emplace_back(SFTPBufferPool::shared(), std::max<size_t>(bufferSize, 1));
+        if (!m_buffers.back().data()) {
+            m_error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE, "Out of memory for write buffers");
+            m_failed = true;
+            return;
+        }
+        m_free.tryPush(slot);
+    }
+
+    m_thread = std::thread(&SFTPFileWriter::run, this);
+}
+
+cts::SFTPFileWriter::~SFTPFileWriter() { finish(); }
+
+char* cts::SFTPFileWriter::buffer() {
+    if (m_current == kNoSlot &&
+        !m_free.pop(m_current, [this]() { return m_failed.load(std::memory_order_acquire); })) {
+        return nullptr;
+    }
+    return m_buffers[m_current].data();
+}
+
+void cts::SFTPFileWriter::submit(const uint64_t offset, const size_t length) {
+    if (m_current == kNoSlot) {
+        return;
+    }
+
+    m_chunks[m_current].offset = offset;
+    m_chunks[m_current].length = length;
+    m_filled.push(m_current);  // Never full, there are only kDepth slots
+    m_current = kNoSlot;
+}
+
+cts::SFTPError cts::SFTPFileWriter::finish() {
+    m_closing.store(true, std::memory_order_release);
+    m_filled.wake();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    return m_error;
+}
+
+void cts::SFTPFileWriter::run() {
+    // Chunks submitted before finish() was called are still written.
+    size_t slot = 0;
+    while (m_filled.pop(slot, [this]() { return m_closing.load(std::memory_order_acquire); })) {
+        write(m_buffers[slot].data(), m_chunks[slot]);
+        m_free.push(slot);
+    }
+
+    if (!m_error.isOk()) {
+        return;
+    }
+
+    // A file that ends in skipped zeros gets its size from a single zero byte at the end.
+    if (m_zerosEnd > 0 && m_zerosEnd == m_highestWritten) {
+        m_file.seekp(static_cast<std::streamoff>(m_zerosEnd - 1));
+        m_file.put(0);
+    }
+
+    m_file.flush();
+    if (!m_file) {
+        fail("Failed to write to local file [" + m_fileName + "]");
+    }
+}
+
+void cts::SFTPFileWriter::write(const char* data, const Chunk& chunk) {
+    if (!m_error.isOk()) {
+        return;  // Buffers keep cycling so the network side never waits on a failed writer
+    }
+
+    const auto end = chunk.offset + chunk.length;
+
+    if (m_sparse && cts::isAllZero(data, chunk.length) &&
+        (chunk.offset >= m_localSize ||
+         cts::punchHole(m_fileName, chunk.offset, chunk.length))) {
+        m_zerosEnd = std::max(m_zerosEnd, end);
+    } else {
+        if (chunk.offset != m_writeOffset) {
+            m_file.seekp(static_cast<std::streamoff>(chunk.offset));
+        }
+
+        m_file.write(data, static_cast<std::streamsize>(chunk.length));
+        if (!m_file) {
+            fail("Failed to write to local file [" + m_fileName + "]");
+            return;
+        }
+        m_writeOffset = end;
+    }
+    m_highestWritten = std::max(m_highestWritten, end);
+
+    if (chunk.offset == m_hashedOffset) {
+        m_checksum.update(data, chunk.length);
+        m_hashedOffset = end;
+    }
+}
+
+void cts::SFTPFileWriter::fail(const std::string& what) {
+    m_error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE, what);
+    m_failed.store(true, std::memory_order_release);
+    m_free.wake();
+}
@@ -0,0 +1,181 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_DISK_PIPELINE_H
+#define SFTP_DISK_PIPELINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sftpbufferpool.h"
+#include "sftpchecksum.h"
+#include "sftpchunkring.h"
+#include "sftperror.h"
+#include "sftpspscring.h"
+
+namespace cts {
+
+// Reads a local file for put() on a thread of its own, so the disk reads ahead while the
+// network side waits for the server. Chunks reach the caller through a SFTPChunkRing. Data
+// already in memory, such as a file mapping SFTPFanOut shares between hosts, is handed out in
+// place without a thread.
+class SFTPFileReader {
+   public:
+    struct Chunk {
+        const char* data = nullptr;
+        uint64_t offset = 0;
+        size_t length = 0;
+
+        // Only set for sparse reads.
+        bool zeros = false;
+    };
+
+    // file is already positioned at offset. Sparse reads skip the holes SparseFileMap finds.
+    // checksum is fed every byte from offset on, holes included, before the caller sees it.
+    SFTPFileReader(std::ifstream&& file, const std::string& fileName, const uint64_t offset,
+                   const size_t chunkSize, const size_t maxChunkSize, const bool sparse,
+                   Checksum& checksum);
+
+    // Hands out [offset, size) of data, which stays valid until the reader is destroyed.
+    SFTPFileReader(const char* data, const uint64_t size, const uint64_t offset,
+                   const size_t chunkSize, const size_t maxChunkSize, const bool sparse,
+                   Checksum& checksum);
+
+    ~SFTPFileReader();
+
+    // For chunks not read yet, capped at maxChunkSize.
+    void setChunkSize(const size_t chunkSize);
+
+    // The next chunk in file order, valid until the next call. nullptr at the end of the file
+    // or when reading failed, see error().
+    const Chunk* next();
+
+    SFTPError error() const { return m_error; }
+
+    // The offset after the last byte, a trailing hole included, once next() returned nullptr.
+    uint64_t end() const { return m_end; }
+
+   private:
+    SFTPFileReader(const SFTPFileReader&) = delete;
+    SFTPFileReader& operator=(const SFTPFileReader&) = delete;
+
+    void run();
+
+    // Only for readers over memory, which have no thread.
+    bool m_inMemory = false;
+    const char* m_memory = nullptr;
+    uint64_t m_memorySize = 0;
+    uint64_t m_memoryOffset = 0;
+    Chunk m_memoryChunk;
+
+    std::ifstream m_file;
+    const std::string m_fileName;
+    const uint64_t m_offset;
+    const size_t m_maxChunkSize;
+    const bool m_sparse;
+    Checksum& m_checksum;
+    std::atomic<size_t> m_chunkSize;
+
+    // m_error and m_end are published by m_ring.finish().
+    SFTPChunkRing<Chunk> m_ring;
+    SFTPError m_error;
+    uint64_t m_end = 0;
+
+    std::thread m_thread;
+};
+
+// Writes what get() receives to the local file on a thread of its own, so the network side
+// goes straight back to the server. Buffers travel through a pair of SPSCRings as in
+// SFTPChunkRing, but from the caller to the writer.
+class SFTPFileWriter {
+   public:
+    // file is already positioned at offset. Sparse writes leave chunks of zeros unwritten and
+    // punch holes for them below localSize, where the file may hold older data. checksum is
+    // fed the chunks that arrive in order from hashedOffset on.
+    SFTPFileWriter(std::ofstream&& file, const std::string& fileName, const uint64_t offset,
+                   const size_t bufferSize, const bool sparse, const uint64_t localSize,
+                   Checksum& checksum, const uint64_t hashedOffset);
+    ~SFTPFileWriter();
+
+    // A buffer of bufferSize for the next chunk, nullptr once writing failed.
+    char* buffer();
+
+    // Queues what the last buffer() received, which belongs at offset.
+    void submit(const uint64_t offset, const size_t length);
+
+    // Waits until everything queued is written and the file has its full size, then returns
+    // the first error.
+    SFTPError finish();
+
+    // How far the file was hashed in order, once finish() returned.
+    uint64_t hashedOffset() const { return m_hashedOffset; }
+
+   private:
+    SFTPFileWriter(const SFTPFileWriter&) = delete;
+    SFTPFileWriter& operator=(const SFTPFileWriter&) = delete;
+
+    struct Chunk {
+        uint64_t offset = 0;
+        size_t length = 0;
+    };
+
+    void run();
+
+    void write(const char* data, const Chunk& chunk);
+
+    void fail(const std::string& what);
+
+    static constexpr size_t kDepth = 8;
+    static constexpr size_t kNoSlot = ~size_t(0);
+
+    std::ofstream m_file;
+    const std::string m_fileName;
+    const bool m_sparse;
+    const uint64_t m_localSize;
+    Checksum& m_checksum;
+
+    // Only touched by the writer thread until finish().
+    uint64_t m_writeOffset;
+    uint64_t m_hashedOffset;
+    uint64_t m_highestWritten = 0;
+    uint64_t m_zerosEnd = 0;
+    SFTPError m_error;
+
+    std::vector<PooledBuffer> m_buffers;
+    std::vector<Chunk> m_chunks;
+    SPSCRing<size_t> m_filled{kDepth};
+    SPSCRing<size_t> m_free{kDepth};
+    size_t m_current = kNoSlot;
+
+    std::atomic<bool> m_failed{false};
+    std::atomic<bool> m_closing{false};
+
+    std::thread m_thread;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_DISK_PIPELINE_H */
@@ -32,6 +32,9 @@ namespace cts {
 
 class SFTPError {
    public:
+    // SFTP error codes outside the protocol's range, for failures raised by this library.
+    enum : int { kCancelled = 0x10000, kChecksumMismatch = 0x10001 };
+
     SFTPError(const int sshCode = SSH_OK, const int sftpCode = SSH_FX_OK,
               const std::string& sshMsg = "")
         : m_sshCode(sshCode), m_sftpCode(sftpCode), m_sshErrorMsg(sshMsg) {}
@@ -42,6 +45,11 @@ class SFTPError {
 
     int getSFTPErrorCode() const { return m_sftpCode; }
 
+    bool isCancelled() const { return m_sftpCode == kCancelled; }
+
+    // The transferred data hashed differently from the file the server has.
+    bool isChecksumMismatch() const { return m_sftpCode == kChecksumMismatch; }
+
     std::string getSSHErrorMsg() const { return m_sshErrorMsg; }
 
    private:
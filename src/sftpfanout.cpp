@@ -0,0 +1,214 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpfanout.h"
+
+#include <algorithm>  // min, max
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>  // CreateFileMapping, MapViewOfFile
+#else
+#include <fcntl.h>     // open
+#include <sys/mman.h>  // mmap, munmap
+#include <sys/stat.h>  // fstat
+#include <unistd.h>    // close
+#endif
+
+namespace {
+
+// A read-only mapping of a whole file. Empty files map to an empty, non-null buffer.
+class FanOutMapping {
+   public:
+    explicit FanOutMapping(const std::string& fileName) {
+#ifdef _WIN32
+        const HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            size.QuadPart = -1;
+        }
+        if (size.QuadPart == 0) {
+            m_data = kEmpty;
+            m_valid = true;
+        } else if (size.QuadPart > 0) {
+            const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                m_view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+            if (m_view) {
+                m_data = static_cast<const char*>(m_view);
+                m_size = static_cast<uint64_t>(size.QuadPart);
+                m_valid = true;
+            }
+        }
+        CloseHandle(file);
+#else
+        const int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            st.st_size = -1;
+        }
+        if (st.st_size == 0) {
+            m_data = kEmpty;
+            m_valid = true;
+        } else if (st.st_size > 0) {
+            void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (view != MAP_FAILED) {
+                m_view = view;
+                m_data = static_cast<const char*>(view);
+                m_size = static_cast<uint64_t>(st.st_size);
+                m_valid = true;
+            }
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~FanOutMapping() {
+        if (!m_view) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(m_view);
+#else
+        munmap(m_view, size_t(m_size));
+#endif
+    }
+
+    bool valid() const { return m_valid; }
+    const char* data() const { return m_data; }
+    uint64_t size() const { return m_size; }
+
+   private:
+    FanOutMapping(const FanOutMapping&) = delete;
+    FanOutMapping& operator=(const FanOutMapping&) = delete;
+
+    static constexpr const char* kEmpty = "";
+
+    void* m_view = nullptr;
+    const char* m_data = nullptr;
+    uint64_t m_size = 0;
+    bool m_valid = false;
+};
+
+std::chrono::milliseconds fanOutElapsed(const std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+}
+
+}  // namespace
+
+cts::SFTPFanOut::SFTPFanOut(const ConnectOptions& options, const unsigned int maxConcurrentHosts,
+                            const bool onlyKnownServers)
+    : m_options(options),
+      m_maxConcurrentHosts(std::max(maxConcurrentHosts, 1u)),
+      m_onlyKnownServers(onlyKnownServers) {}
+
+std::pair<cts::SFTPError, std::vector<cts::SFTPFanOut::Result>> cts::SFTPFanOut::put(
+    const std::string& localFileName, const std::vector<Target>& targets,
+    const TransferOptions& options) const {
+    const FanOutMapping mapping(localFileName);
+    if (!mapping.valid()) {
+        return {cts::SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                               "Failed to map local file: " + localFileName),
+                {}};
+    }
+
+    std::vector<Result> results(targets.size());
+    std::atomic<size_t> next{0};
+    std::mutex callbackMutex;
+
+    const auto worker = [&]() {
+        for (size_t i = next++; i < targets.size(); i = next++) {
+            const Target& target = targets[i];
+            Result& result = results[i];
+            result.host = target.host;
+
+            auto start = std::chrono::steady_clock::now();
+            SFTPClient client;
+            result.error = client.connect(target.host, target.user, target.password, m_options,
+                                          target.port, m_onlyKnownServers);
+            result.connectTime = fanOutElapsed(start);
+            if (!result.error.isOk()) {
+                continue;
+            }
+
+            // Every host gets its own copy of the options, whose callbacks count what the host
+            // acknowledged and take turns calling the caller's.
+            uint64_t acknowledged = options.resumeOffset;
+            TransferOptions hostOptions = options;
+            hostOptions.progress = [&](const uint64_t transferred) {
+                acknowledged = transferred;
+                if (!options.progress) {
+                    return true;
+                }
+                std::lock_guard<std::mutex> lock(callbackMutex);
+                return options.progress(transferred);
+            };
+            if (options.onChecksum) {
+                hostOptions.onChecksum = [&](const std::string& digest) {
+                    std::lock_guard<std::mutex> lock(callbackMutex);
+                    options.onChecksum(digest);
+                };
+            }
+            if (options.onStats) {
+                hostOptions.onStats = [&](const TransferStats& stats) {
+                    std::lock_guard<std::mutex> lock(callbackMutex);
+                    options.onStats(stats);
+                };
+            }
+
+            start = std::chrono::steady_clock::now();
+            result.error = client.putBuffer(mapping.data(), mapping.size(),
+                                            target.remoteFileName, hostOptions);
+            result.transferTime = fanOutElapsed(start);
+            if (result.error.isOk()) {
+                acknowledged = std::max(acknowledged, mapping.size());
+            }
+            result.bytes = acknowledged - std::min(acknowledged, options.resumeOffset);
+        }
+    };
+
+    const size_t threadCount = std::min<size_t>(m_maxConcurrentHosts, targets.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    if (threadCount > 0) {
+        worker();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return {cts::SFTPError(), results};
+}
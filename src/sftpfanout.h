@@ -0,0 +1,78 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_FAN_OUT_H
+#define SFTP_FAN_OUT_H
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sftpclient.h"
+
+namespace cts {
+
+// Uploads one local file to many hosts at once. The file is mapped into memory a single time
+// and every host reads its chunks from that mapping, so the disk is read once however many
+// hosts there are. Each host has its own session and worker thread and takes chunks at the
+// pace its window allows, so a slow host holds back only itself.
+class SFTPFanOut {
+   public:
+    struct Target {
+        std::string host;
+        std::string user;
+        std::string password;
+        std::string remoteFileName;
+        uint16_t port = 22;
+    };
+
+    struct Result {
+        std::string host;
+        SFTPError error;
+        uint64_t bytes = 0;  // Acknowledged by the host, also when it failed part way
+        std::chrono::milliseconds connectTime{0};
+        std::chrono::milliseconds transferTime{0};
+    };
+
+    explicit SFTPFanOut(const ConnectOptions& options = ConnectOptions(),
+                        const unsigned int maxConcurrentHosts = 32,
+                        const bool onlyKnownServers = true);
+
+    // Results are in the order of targets. The returned error is only set when the local
+    // file could not be read, a failed host is reported in its own Result. The callbacks in
+    // options are called from the host threads, but never two at once, so they need not be
+    // thread-safe. progress reports each host's own offset, so values from different hosts
+    // interleave, and onStats is called once per host that connected.
+    std::pair<SFTPError, std::vector<Result>> put(
+        const std::string& localFileName, const std::vector<Target>& targets,
+        const TransferOptions& options = TransferOptions()) const;
+
+   private:
+    ConnectOptions m_options;
+    unsigned int m_maxConcurrentHosts;
+    bool m_onlyKnownServers;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_FAN_OUT_H */
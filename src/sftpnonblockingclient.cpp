@@ -0,0 +1,804 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpnonblockingclient.h"
+
+#include <algorithm>  // min
+#include <cstdlib>    // calloc
+#include <cstring>    // strdup
+#include <fstream>
+
+struct cts::SFTPNonBlockingClient::PutTransfer {
+    std::ifstream file;
+    std::string remoteFileName;
+    std::string handle;
+    std::vector<char> buffer;
+    uint64_t offset = 0;
+    unsigned int outstanding = 0;
+    bool endOfFile = false;
+    bool closing = false;
+    SFTPError error;
+    Callback done;
+};
+
+struct cts::SFTPNonBlockingClient::GetTransfer {
+    std::ofstream file;
+    std::string localFileName;
+    std::string handle;
+    uint32_t chunkSize = 0;
+    uint64_t nextOffset = 0;
+    unsigned int outstanding = 0;
+    bool endOfFile = false;
+    bool closing = false;
+    SFTPError error;
+    Callback done;
+};
+
+struct cts::SFTPNonBlockingClient::Listing {
+    std::string remoteDir;
+    std::string handle;
+    std::vector<SFTPAttributes> entries;
+    LsCallback done;
+};
+
+cts::SFTPNonBlockingClient::~SFTPNonBlockingClient() { disconnect(); }
+
+cts::SFTPError cts::SFTPNonBlockingClient::connect(const std::string& host,
+                                                   const std::string& user,
+                                                   const std::string& pw,
+                                                   const ConnectOptions& options,
+                                                   const uint16_t port,
+                                                   const bool onlyKnownServers) {
+    disconnect();
+    m_options = options;
+    m_onlyKnownServers = onlyKnownServers;
+    m_password = pw;
+
+    m_sshSession = SSHSessionPtr(ssh_new());
+    if (!m_sshSession) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_OK, "Failed to create ssh session.");
+    }
+
+    // libssh reads the port as an unsigned int
+    const unsigned int sshPort = port;
+
+    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_HOST, host.c_str());
+    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_PORT, &sshPort);
+    ssh_options_set(m_sshSession.get(), SSH_OPTIONS_USER, user.c_str());
+
+    const bool compress = options.compression == cts::ConnectOptions::Compression::On;
+    const auto err = cts::applySessionOptions(m_sshSession.get(), options, compress);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    ssh_set_blocking(m_sshSession.get(), 0);
+    m_state = State::Connecting;
+
+    // The first step resolves the host and starts the TCP connect, so fd() is valid afterwards.
+    advanceHandshake();
+
+    return m_error;
+}
+
+void cts::SFTPNonBlockingClient::disconnect() {
+    m_handlers.clear();
+    m_queued.clear();
+    m_inbox.clear();
+    m_outbox.clear();
+    m_outboxOffset = 0;
+    m_nextId = 1;
+    m_maxReadLength = kFallbackMaxChunkSize;
+    m_maxWriteLength = kFallbackMaxChunkSize;
+    m_password.clear();
+    m_channel.reset();
+    m_sshSession.reset();
+    m_state = State::Disconnected;
+    m_error = cts::SFTPError();
+}
+
+int cts::SFTPNonBlockingClient::fd() const {
+    return m_sshSession ? static_cast<int>(ssh_get_fd(m_sshSession.get())) : -1;
+}
+
+bool cts::SFTPNonBlockingClient::wantsRead() const {
+    return m_sshSession && m_state != State::Disconnected && m_state != State::Failed;
+}
+
+bool cts::SFTPNonBlockingClient::wantsWrite() const {
+    if (!wantsRead()) {
+        return false;
+    }
+
+    // Work that only needs process() to run is reported as writability too, which an idle
+    // socket signals immediately.
+    if (m_state == State::Ready && !m_queued.empty()) {
+        return true;
+    }
+
+    if (m_outboxOffset < m_outbox.size() && m_channel &&
+        ssh_channel_window_size(m_channel.get()) > 0) {
+        return true;
+    }
+
+    return (ssh_get_poll_flags(m_sshSession.get()) & SSH_WRITE_PENDING) != 0;
+}
+
+cts::SFTPError cts::SFTPNonBlockingClient::process() {
+    if (m_state == State::Disconnected || m_state == State::Failed) {
+        return m_error;
+    }
+
+    if (m_state < State::Initializing && !advanceHandshake()) {
+        return m_error;
+    }
+
+    if (m_state >= State::Initializing) {
+        readIncoming();
+    }
+
+    if (m_state == State::Ready) {
+        while (!m_queued.empty()) {
+            auto operation = std::move(m_queued.front());
+            m_queued.pop_front();
+            operation();
+        }
+    }
+
+    if (m_state >= State::Initializing) {
+        flushOutbox();
+    }
+
+    return m_error;
+}
+
+void cts::SFTPNonBlockingClient::put(const std::string& localFileName,
+                                     const std::string& remoteFileName, Callback done) {
+    start([this, localFileName, remoteFileName, done]() {
+        auto transfer = std::make_shared<PutTransfer>();
+        transfer->remoteFileName = remoteFileName;
+        transfer->done = done;
+        transfer->file.open(localFileName, std::ios::binary);
+        if (!transfer->file) {
+            done(cts::SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                                "Failed to open local file: " + localFileName));
+            return;
+        }
+
+        auto packet = request(SSH_FXP_OPEN);
+        packet.putString(remoteFileName)
+            .putUint32(SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC)
+            .putPermissions(S_IRUSR | S_IWUSR);
+
+        send(packet, [this, transfer](uint8_t type, SFTPPacketReader& reader) {
+            if (type != SSH_FXP_HANDLE || !reader.getString(transfer->handle)) {
+                transfer->done(statusError(type, reader));
+                return;
+            }
+
+            const auto chunkSize = std::min(m_options.chunkSize, m_maxWriteLength);
+            transfer->buffer.resize(std::max(chunkSize, 1u));
+            pumpPut(transfer);
+        });
+    });
+}
+
+void cts::SFTPNonBlockingClient::get(const std::string& localFileName,
+                                     const std::string& remoteFileName, Callback done) {
+    start([this, localFileName, remoteFileName, done]() {
+        auto transfer = std::make_shared<GetTransfer>();
+        transfer->localFileName = localFileName;
+        transfer->done = done;
+
+        auto packet = request(SSH_FXP_OPEN);
+        packet.putString(remoteFileName).putUint32(SSH_FXF_READ).putEmptyAttributes();
+
+        send(packet, [this, transfer](uint8_t type, SFTPPacketReader& reader) {
+            if (type != SSH_FXP_HANDLE || !reader.getString(transfer->handle)) {
+                transfer->done(statusError(type, reader));
+                return;
+            }
+
+            transfer->file.open(transfer->localFileName, std::ios::binary);
+            if (!transfer->file) {
+                transfer->error =
+                    cts::SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                                   "Failed to open local file: " + transfer->localFileName);
+                transfer->closing = true;
+                closeHandle(transfer->handle, [transfer](const SFTPError&) {
+                    transfer->done(transfer->error);
+                });
+                return;
+            }
+
+            transfer->chunkSize = std::max(std::min(m_options.chunkSize, m_maxReadLength), 1u);
+            pumpGet(transfer);
+        });
+    });
+}
+
+void cts::SFTPNonBlockingClient::mkdir(const std::string& remoteDir, const mode_t permissions,
+                                       Callback done) {
+    start([this, remoteDir, permissions, done]() {
+        auto packet = request(SSH_FXP_MKDIR);
+        packet.putString(remoteDir).putPermissions(static_cast<uint32_t>(permissions));
+        send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+            done(statusError(type, reader));
+        });
+    });
+}
+
+void cts::SFTPNonBlockingClient::ls(const std::string& remoteDir, LsCallback done) {
+    start([this, remoteDir, done]() {
+        auto listing = std::make_shared<Listing>();
+        listing->remoteDir = remoteDir;
+        listing->done = done;
+
+        auto packet = request(SSH_FXP_OPENDIR);
+        packet.putString(remoteDir);
+
+        send(packet, [this, listing](uint8_t type, SFTPPacketReader& reader) {
+            if (type != SSH_FXP_HANDLE || !reader.getString(listing->handle)) {
+                listing->done(statusError(type, reader), {});
+                return;
+            }
+
+            readDirectory(listing);
+        });
+    });
+}
+
+void cts::SFTPNonBlockingClient::rename(const std::string& oldRemoteName,
+                                        const std::string& newRemoteName, Callback done) {
+    start([this, oldRemoteName, newRemoteName, done]() {
+        auto packet = request(SSH_FXP_RENAME);
+        packet.putString(oldRemoteName).putString(newRemoteName);
+        send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+            done(statusError(type, reader));
+        });
+    });
+}
+
+void cts::SFTPNonBlockingClient::rm(const std::string& remoteFileName, Callback done) {
+    start([this, remoteFileName, done]() {
+        auto packet = request(SSH_FXP_REMOVE);
+        packet.putString(remoteFileName);
+        send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+            done(statusError(type, reader));
+        });
+    });
+}
+
+void cts::SFTPNonBlockingClient::rmdir(const std::string& remoteDirName, Callback done) {
+    start([this, remoteDirName, done]() {
+        auto packet = request(SSH_FXP_RMDIR);
+        packet.putString(remoteDirName);
+        send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+            done(statusError(type, reader));
+        });
+    });
+}
+
+void cts::SFTPNonBlockingClient::stat(const std::string& remotePath, StatCallback done) {
+    start([this, remotePath, done]() {
+        auto packet = request(SSH_FXP_LSTAT);
+        packet.putString(remotePath);
+        send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+            if (type != SSH_FXP_ATTRS) {
+                done(statusError(type, reader), {});
+                return;
+            }
+
+            auto* attributes =
+                static_cast<sftp_attributes>(std::calloc(1, sizeof(sftp_attributes_struct)));
+            cts::SFTPAttributes result(attributes);
+            if (!attributes || !reader.getAttributes(*attributes)) {
+                done(cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed attributes"), {});
+                return;
+            }
+
+            done(cts::SFTPError(), result);
+        });
+    });
+}
+
+bool cts::SFTPNonBlockingClient::advanceHandshake() {
+    while (m_state < State::Initializing) {
+        switch (m_state) {
+            case State::Connecting: {
+                const int rc = ssh_connect(m_sshSession.get());
+                if (rc == SSH_AGAIN) {
+                    return true;
+                }
+                if (rc != SSH_OK) {
+                    fail(cts::SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                cts::applySocketOptions(m_sshSession.get(), m_options);
+
+                if (m_onlyKnownServers &&
+                    ssh_session_is_known_server(m_sshSession.get()) != SSH_KNOWN_HOSTS_OK) {
+                    fail(cts::SFTPError(ssh_get_error_code(m_sshSession.get()), SSH_FX_OK,
+                                        ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                m_state = State::Authenticating;
+                break;
+            }
+
+            case State::Authenticating: {
+                const int rc =
+                    ssh_userauth_password(m_sshSession.get(), nullptr, m_password.c_str());
+                if (rc == SSH_AUTH_AGAIN) {
+                    return true;
+                }
+                if (rc != SSH_AUTH_SUCCESS) {
+                    fail(cts::SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                m_password.clear();
+                m_channel = SSHChannelPtr(ssh_channel_new(m_sshSession.get()));
+                if (!m_channel) {
+                    fail(cts::SFTPError(SSH_ERROR, SSH_FX_OK, ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                m_state = State::OpeningChannel;
+                break;
+            }
+
+            case State::OpeningChannel: {
+                const int rc = ssh_channel_open_session(m_channel.get());
+                if (rc == SSH_AGAIN) {
+                    return true;
+                }
+                if (rc != SSH_OK) {
+                    fail(cts::SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                m_state = State::StartingSubsystem;
+                break;
+            }
+
+            case State::StartingSubsystem: {
+                const int rc = ssh_channel_request_subsystem(m_channel.get(), "sftp");
+                if (rc == SSH_AGAIN) {
+                    return true;
+                }
+                if (rc != SSH_OK) {
+                    fail(cts::SFTPError(rc, SSH_FX_OK, ssh_get_error(m_sshSession.get())));
+                    return false;
+                }
+
+                SFTPPacketWriter init(SSH_FXP_INIT);
+                init.putUint32(3);
+                m_outbox += init.finish();
+                m_state = State::Initializing;
+                break;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void cts::SFTPNonBlockingClient::handleVersion(SFTPPacketReader& reader) {
+    uint32_t version = 0;
+    if (!reader.getUint32(version) || version < 3) {
+        fail(cts::SFTPError(SSH_ERROR, SSH_FX_OP_UNSUPPORTED, "Unsupported SFTP version"));
+        return;
+    }
+
+    bool hasLimits = false;
+    std::string name;
+    std::string data;
+    while (!reader.atEnd() && reader.getString(name) && reader.getString(data)) {
+        hasLimits = hasLimits || (name == "limits@openssh.com" && data == "1");
+    }
+
+    if (!hasLimits) {
+        becomeReady();
+        return;
+    }
+
+    auto packet = request(SSH_FXP_EXTENDED);
+    packet.putString("limits@openssh.com");
+
+    send(packet, [this](uint8_t type, SFTPPacketReader& limits) {
+        uint64_t maxPacketLength = 0;
+        uint64_t maxReadLength = 0;
+        uint64_t maxWriteLength = 0;
+
+        if (type == SSH_FXP_EXTENDED_REPLY && limits.getUint64(maxPacketLength) &&
+            limits.getUint64(maxReadLength) && limits.getUint64(maxWriteLength)) {
+            const uint64_t maxChunk = kMaxPacketLength / 2;
+            if (maxReadLength > 0) {
+                m_maxReadLength = static_cast<uint32_t>(std::min(maxReadLength, maxChunk));
+            }
+            if (maxWriteLength > 0) {
+                m_maxWriteLength = static_cast<uint32_t>(std::min(maxWriteLength, maxChunk));
+            }
+        }
+
+        if (m_state == State::Initializing) {
+            becomeReady();
+        }
+    });
+}
+
+void cts::SFTPNonBlockingClient::becomeReady() {
+    m_state = State::Ready;
+
+    while (!m_queued.empty()) {
+        auto operation = std::move(m_queued.front());
+        m_queued.pop_front();
+        operation();
+    }
+}
+
+void cts::SFTPNonBlockingClient::fail(const SFTPError& err) {
+    if (m_state == State::Failed) {
+        return;
+    }
+
+    m_state = State::Failed;
+    m_error = err;
+
+    // Every outstanding request is answered with a connection-lost status, so each operation
+    // finishes through its usual error path. Requests sent from here on are answered the same
+    // way straight away.
+    auto handlers = std::move(m_handlers);
+    m_handlers.clear();
+
+    SFTPPacketWriter lost(SSH_FXP_STATUS);
+    lost.putUint32(SSH_FX_CONNECTION_LOST).putString(err.getSSHErrorMsg()).putString("");
+    const std::string packet = lost.finish();
+
+    for (auto& handler : handlers) {
+        SFTPPacketReader reader(packet.data() + 5, packet.size() - 5);
+        handler.second(SSH_FXP_STATUS, reader);
+    }
+
+    while (!m_queued.empty()) {
+        auto operation = std::move(m_queued.front());
+        m_queued.pop_front();
+        operation();
+    }
+}
+
+void cts::SFTPNonBlockingClient::flushOutbox() {
+    while (m_state != State::Failed && m_outboxOffset < m_outbox.size()) {
+        const auto remaining = std::min<size_t>(m_outbox.size() - m_outboxOffset, 1024 * 1024);
+        const int written = ssh_channel_write(m_channel.get(), m_outbox.data() + m_outboxOffset,
+                                              static_cast<uint32_t>(remaining));
+        if (written == SSH_AGAIN || written == 0) {
+            break;  // Channel window or socket buffer full
+        }
+        if (written < 0) {
+            fail(cts::SFTPError(SSH_ERROR, SSH_FX_CONNECTION_LOST,
+                                ssh_get_error(m_sshSession.get())));
+            return;
+        }
+
+        m_outboxOffset += static_cast<size_t>(written);
+    }
+
+    if (m_outboxOffset == m_outbox.size()) {
+        m_outbox.clear();
+        m_outboxOffset = 0;
+    } else if (m_outboxOffset > m_outbox.size() / 2) {
+        m_outbox.erase(0, m_outboxOffset);
+        m_outboxOffset = 0;
+    }
+}
+
+void cts::SFTPNonBlockingClient::readIncoming() {
+    constexpr uint32_t kReadSize = 256 * 1024;
+
+    while (m_state != State::Failed) {
+        const auto used = m_inbox.size();
+        m_inbox.resize(used + kReadSize);
+        const int rc = ssh_channel_read_nonblocking(m_channel.get(), &m_inbox[used], kReadSize, 0);
+        m_inbox.resize(used + static_cast<size_t>(std::max(rc, 0)));
+
+        if (rc == SSH_EOF || (rc < 0 && rc != SSH_AGAIN)) {
+            fail(cts::SFTPError(SSH_ERROR, SSH_FX_CONNECTION_LOST,
+                                rc == SSH_EOF ? std::string("Server closed the SFTP channel")
+                                              : std::string(ssh_get_error(m_sshSession.get()))));
+            return;
+        }
+        if (rc <= 0) {
+            break;
+        }
+    }
+
+    size_t offset = 0;
+    while (m_state != State::Failed && m_inbox.size() - offset >= 4) {
+        SFTPPacketReader header(m_inbox.data() + offset, 4);
+        uint32_t length = 0;
+        header.getUint32(length);
+
+        if (length == 0 || length > kMaxPacketLength) {
+            fail(cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Invalid SFTP packet length"));
+            return;
+        }
+        if (m_inbox.size() - offset - 4 < length) {
+            break;
+        }
+
+        dispatch(m_inbox.data() + offset + 4, length);
+        offset += 4 + length;
+    }
+
+    if (m_state != State::Failed) {
+        m_inbox.erase(0, offset);
+    }
+}
+
+void cts::SFTPNonBlockingClient::dispatch(const char* data, const size_t size) {
+    SFTPPacketReader reader(data, size);
+    uint8_t type = 0;
+    reader.getUint8(type);
+
+    if (type == SSH_FXP_VERSION) {
+        if (m_state == State::Initializing) {
+            handleVersion(reader);
+        }
+        return;
+    }
+
+    uint32_t id = 0;
+    if (!reader.getUint32(id)) {
+        fail(cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Truncated SFTP packet"));
+        return;
+    }
+
+    auto it = m_handlers.find(id);
+    if (it == m_handlers.end()) {
+        return;  // Not ours, e.g. an answer that arrived after a failure
+    }
+
+    auto handler = std::move(it->second);
+    m_handlers.erase(it);
+    handler(type, reader);
+}
+
+uint32_t cts::SFTPNonBlockingClient::send(SFTPPacketWriter& packet, ResponseHandler handler) {
+    const auto id = m_nextId++;
+
+    if (m_state == State::Failed) {
+        SFTPPacketWriter lost(SSH_FXP_STATUS);
+        lost.putUint32(SSH_FX_CONNECTION_LOST).putString(m_error.getSSHErrorMsg()).putString("");
+        const std::string status = lost.finish();
+        SFTPPacketReader reader(status.data() + 5, status.size() - 5);
+        handler(SSH_FXP_STATUS, reader);
+        return id;
+    }
+
+    m_outbox += packet.finish();
+    m_handlers.emplace(id, std::move(handler));
+    return id;
+}
+
+void cts::SFTPNonBlockingClient::start(std::function<void()> operation) {
+    m_queued.push_back(std::move(operation));
+}
+
+void cts::SFTPNonBlockingClient::pumpPut(const std::shared_ptr<PutTransfer>& transfer) {
+    const auto maxInFlight = std::max(m_options.maxInFlightRequests, 1u);
+
+    while (!transfer->endOfFile && transfer->error.isOk() && transfer->outstanding < maxInFlight) {
+        auto& file = transfer->file;
+        file.read(transfer->buffer.data(), static_cast<std::streamsize>(transfer->buffer.size()));
+        const auto bytesRead = static_cast<size_t>(file.gcount());
+        transfer->endOfFile = !file;
+
+        if (file.bad()) {
+            transfer->error =
+                cts::SFTPError(SSH_OK, SSH_FX_FAILURE, "Failed to read from local file");
+            break;
+        }
+
+        if (bytesRead == 0) {
+            break;
+        }
+
+        auto packet = request(SSH_FXP_WRITE);
+        packet.putString(transfer->handle)
+            .putUint64(transfer->offset)
+            .putString(transfer->buffer.data(), bytesRead);
+        transfer->offset += bytesRead;
+        ++transfer->outstanding;
+
+        send(packet, [this, transfer](uint8_t type, SFTPPacketReader& reader) {
+            --transfer->outstanding;
+            const auto err = statusError(type, reader);
+            if (!err.isOk() && transfer->error.isOk()) {
+                transfer->error = cts::SFTPError(err.getSSHErrorCode(), err.getSFTPErrorCode(),
+                                                 "Failed to write to remote file [" +
+                                                     transfer->remoteFileName + "] " +
+                                                     err.getSSHErrorMsg());
+            }
+            pumpPut(transfer);
+        });
+    }
+
+    if ((transfer->endOfFile || !transfer->error.isOk()) && transfer->outstanding == 0 &&
+        !transfer->closing) {
+        transfer->closing = true;
+        closeHandle(transfer->handle, [transfer](const SFTPError& err) {
+            transfer->done(transfer->error.isOk() ? err : transfer->error);
+        });
+    }
+}
+
+void cts::SFTPNonBlockingClient::pumpGet(const std::shared_ptr<GetTransfer>& transfer) {
+    const auto maxInFlight = std::max(m_options.maxInFlightRequests, 1u);
+
+    while (!transfer->endOfFile && transfer->error.isOk() && transfer->outstanding < maxInFlight) {
+        readChunk(transfer, transfer->nextOffset, transfer->chunkSize);
+        transfer->nextOffset += transfer->chunkSize;
+    }
+
+    if ((transfer->endOfFile || !transfer->error.isOk()) && transfer->outstanding == 0 &&
+        !transfer->closing) {
+        transfer->closing = true;
+        closeHandle(transfer->handle, [transfer](const SFTPError& err) {
+            transfer->file.close();
+            transfer->done(transfer->error.isOk() ? err : transfer->error);
+        });
+    }
+}
+
+void cts::SFTPNonBlockingClient::readChunk(const std::shared_ptr<GetTransfer>& transfer,
+                                           const uint64_t offset, const uint32_t length) {
+    auto packet = request(SSH_FXP_READ);
+    packet.putString(transfer->handle).putUint64(offset).putUint32(length);
+    ++transfer->outstanding;
+
+    send(packet, [this, transfer, offset, length](uint8_t type, SFTPPacketReader& reader) {
+        --transfer->outstanding;
+
+        const char* data = nullptr;
+        uint32_t size = 0;
+
+        if (type == SSH_FXP_DATA && reader.getStringView(data, size) && size <= length) {
+            transfer->file.seekp(static_cast<std::streamoff>(offset));
+            transfer->file.write(data, size);
+            if (!transfer->file && transfer->error.isOk()) {
+                transfer->error = cts::SFTPError(
+                    SSH_OK, SSH_FX_FAILURE,
+                    "Failed to write to local file [" + transfer->localFileName + "]");
+            }
+
+            // A short read before the end of the file only covers part of the range, the rest
+            // is asked for again. At the end of the file that request comes back as EOF.
+            if (size > 0 && size < length && transfer->error.isOk()) {
+                readChunk(transfer, offset + size, length - size);
+            }
+        } else {
+            const auto err = statusError(type, reader);
+            if (err.getSFTPErrorCode() == SSH_FX_EOF) {
+                transfer->endOfFile = true;
+            } else if (transfer->error.isOk()) {
+                transfer->error = err.isOk() ? cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE,
+                                                              "Malformed read response")
+                                             : err;
+            }
+        }
+
+        pumpGet(transfer);
+    });
+}
+
+void cts::SFTPNonBlockingClient::readDirectory(const std::shared_ptr<Listing>& listing) {
+    auto packet = request(SSH_FXP_READDIR);
+    packet.putString(listing->handle);
+
+    send(packet, [this, listing](uint8_t type, SFTPPacketReader& reader) {
+        if (type != SSH_FXP_NAME) {
+            auto err = statusError(type, reader);
+            if (err.getSFTPErrorCode() == SSH_FX_EOF) {
+                err = cts::SFTPError();
+            }
+
+            closeHandle(listing->handle, [listing, err](const SFTPError&) {
+                listing->done(err, err.isOk() ? listing->entries : std::vector<SFTPAttributes>());
+            });
+            return;
+        }
+
+        uint32_t count = 0;
+        reader.getUint32(count);
+
+        for (uint32_t i = 0; i < count; ++i) {
+            auto* attributes =
+                static_cast<sftp_attributes>(std::calloc(1, sizeof(sftp_attributes_struct)));
+            if (!attributes) {
+                break;
+            }
+            listing->entries.emplace_back(attributes);
+
+            std::string name;
+            std::string longName;
+            if (!reader.getString(name) || !reader.getString(longName) ||
+                !reader.getAttributes(*attributes)) {
+                listing->entries.pop_back();
+                break;
+            }
+
+            attributes->name = strdup(name.c_str());
+            attributes->longname = strdup(longName.c_str());
+        }
+
+        readDirectory(listing);
+    });
+}
+
+void cts::SFTPNonBlockingClient::closeHandle(const std::string& handle, Callback done) {
+    auto packet = request(SSH_FXP_CLOSE);
+    packet.putString(handle);
+    send(packet, [done](uint8_t type, SFTPPacketReader& reader) {
+        done(statusError(type, reader));
+    });
+}
+
+cts::SFTPError cts::SFTPNonBlockingClient::statusError(const uint8_t type,
+                                                       SFTPPacketReader& reader) {
+    if (type != SSH_FXP_STATUS) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Unexpected SFTP response");
+    }
+
+    uint32_t code = 0;
+    std::string message;
+    if (!reader.getUint32(code)) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed SFTP status");
+    }
+    reader.getString(message);  // Missing in some version 3 servers
+
+    if (code == SSH_FX_OK) {
+        return cts::SFTPError();
+    }
+
+    const int sshCode = code == SSH_FX_CONNECTION_LOST ? SSH_ERROR : SSH_OK;
+    return cts::SFTPError(sshCode, static_cast<int>(code), message);
+}
+
+void cts::SFTPNonBlockingClient::SSHSessionDeleter::operator()(ssh_session session) const {
+    if (session) {
+        ssh_disconnect(session);
+        ssh_free(session);
+    }
+}
+
+void cts::SFTPNonBlockingClient::SSHChannelDeleter::operator()(ssh_channel channel) const {
+    if (channel) {
+        ssh_channel_free(channel);
+    }
+}
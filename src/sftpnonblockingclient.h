@@ -0,0 +1,207 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_NON_BLOCKING_CLIENT_H
+#define SFTP_NON_BLOCKING_CLIENT_H
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#ifdef _WIN32
+#include <io.h>
+#elif _POSIX_VERSION
+#include <sys/stat.h>  // mode_t
+#endif
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sftpattributes.h"
+#include "sftpconnectoptions.h"
+#include "sftperror.h"
+#include "sftppacket.h"
+
+namespace cts {
+
+// An SFTP client that never blocks on the network, so one thread can drive thousands of
+// sessions from its own poll/epoll loop. Watch fd() for readability, and for writability while
+// wantsWrite() is true, and call process() whenever either fires. Re-check wantsWrite() after
+// process() and after starting an operation.
+//
+// Operations can be started at any time, also before the session is ready, and any number of
+// them run concurrently. Their callbacks run from inside process(); they may start further
+// operations but must not disconnect or destroy the client.
+//
+// SFTP is spoken directly over an SSH channel rather than through libssh's sftp API, whose
+// calls block. Host name resolution in connect() and local file reads and writes, one chunk at
+// a time, still block.
+class SFTPNonBlockingClient {
+   public:
+    enum class State {
+        Disconnected,
+        Connecting,
+        Authenticating,
+        OpeningChannel,
+        StartingSubsystem,
+        Initializing,
+        Ready,
+        Failed
+    };
+
+    using Callback = std::function<void(const SFTPError&)>;
+    using StatCallback = std::function<void(const SFTPError&, const SFTPAttributes&)>;
+    using LsCallback = std::function<void(const SFTPError&, const std::vector<SFTPAttributes>&)>;
+
+    SFTPNonBlockingClient() = default;
+    ~SFTPNonBlockingClient();
+
+    // Starts connecting and returns without waiting for the server.
+    SFTPError connect(const std::string& host, const std::string& user, const std::string& pw,
+                      const ConnectOptions& options = ConnectOptions(), const uint16_t port = 22,
+                      const bool onlyKnownServers = true);
+
+    // Outstanding operations are dropped without calling their callbacks.
+    void disconnect();
+
+    // -1 until connect() has created the socket.
+    int fd() const;
+
+    bool wantsRead() const;
+
+    bool wantsWrite() const;
+
+    // Advances the handshake and every outstanding operation as far as possible without
+    // blocking. Returns the error that ended the session, if any.
+    SFTPError process();
+
+    State state() const { return m_state; }
+
+    size_t pendingOperations() const { return m_handlers.size() + m_queued.size(); }
+
+    void put(const std::string& localFileName, const std::string& remoteFileName, Callback done);
+
+    void get(const std::string& localFileName, const std::string& remoteFileName, Callback done);
+
+    void mkdir(const std::string& remoteDir, const mode_t permissions, Callback done);
+
+    void ls(const std::string& remoteDir, LsCallback done);
+
+    void rename(const std::string& oldRemoteName, const std::string& newRemoteName,
+                Callback done);
+
+    void rm(const std::string& remoteFileName, Callback done);
+
+    void rmdir(const std::string& remoteDirName, Callback done);
+
+    void stat(const std::string& remotePath, StatCallback done);
+
+   private:
+    SFTPNonBlockingClient(const SFTPNonBlockingClient&) = delete;
+    SFTPNonBlockingClient& operator=(const SFTPNonBlockingClient&) = delete;
+
+    struct SSHSessionDeleter {
+        void operator()(ssh_session session) const;
+    };
+
+    struct SSHChannelDeleter {
+        void operator()(ssh_channel channel) const;
+    };
+
+    using SSHSessionPtr = std::unique_ptr<ssh_session_struct, SSHSessionDeleter>;
+    using SSHChannelPtr = std::unique_ptr<ssh_channel_struct, SSHChannelDeleter>;
+
+    // Called with the response type and a reader positioned after the request id.
+    using ResponseHandler = std::function<void(uint8_t type, SFTPPacketReader& reader)>;
+
+    struct PutTransfer;
+    struct GetTransfer;
+    struct Listing;
+
+    bool advanceHandshake();
+
+    void handleVersion(SFTPPacketReader& reader);
+
+    void becomeReady();
+
+    void fail(const SFTPError& err);
+
+    void flushOutbox();
+
+    void readIncoming();
+
+    void dispatch(const char* data, const size_t size);
+
+    uint32_t send(SFTPPacketWriter& packet, ResponseHandler handler);
+
+    SFTPPacketWriter request(const uint8_t type) { return SFTPPacketWriter(type, m_nextId); }
+
+    void start(std::function<void()> operation);
+
+    void pumpPut(const std::shared_ptr<PutTransfer>& transfer);
+
+    void pumpGet(const std::shared_ptr<GetTransfer>& transfer);
+
+    void readChunk(const std::shared_ptr<GetTransfer>& transfer, const uint64_t offset,
+                   const uint32_t length);
+
+    void readDirectory(const std::shared_ptr<Listing>& listing);
+
+    void closeHandle(const std::string& handle, Callback done);
+
+    static SFTPError statusError(const uint8_t type, SFTPPacketReader& reader);
+
+    SSHSessionPtr m_sshSession;
+    SSHChannelPtr m_channel;
+    State m_state = State::Disconnected;
+    SFTPError m_error;
+
+    ConnectOptions m_options;
+    bool m_onlyKnownServers = true;
+
+    // Kept only until authentication has finished.
+    std::string m_password;
+
+    std::string m_inbox;
+    std::string m_outbox;
+    size_t m_outboxOffset = 0;
+
+    uint32_t m_nextId = 1;
+    std::unordered_map<uint32_t, ResponseHandler> m_handlers;
+    std::deque<std::function<void()>> m_queued;
+
+    uint32_t m_maxReadLength = kFallbackMaxChunkSize;
+    uint32_t m_maxWriteLength = kFallbackMaxChunkSize;
+
+    // libssh's limit for servers that do not announce limits@openssh.com.
+    static constexpr uint32_t kFallbackMaxChunkSize = 32 * 1024;
+
+    // Larger packets are treated as a protocol error rather than buffered.
+    static constexpr uint32_t kMaxPacketLength = 16 * 1024 * 1024;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_NON_BLOCKING_CLIENT_H */
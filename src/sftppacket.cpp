@@ -0,0 +1,228 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftppacket.h"
+
+cts::SFTPPacketWriter::SFTPPacketWriter(const uint8_t type) {
+    m_buffer.reserve(64);
+    putUint32(0);  // Length, filled in by finish()
+    putUint8(type);
+}
+
+cts::SFTPPacketWriter::SFTPPacketWriter(const uint8_t type, const uint32_t id)
+    : SFTPPacketWriter(type) {
+    putUint32(id);
+}
+
+cts::SFTPPacketWriter& cts::SFTPPacketWriter::putUint8(const uint8_t value) {
+    m_buffer.push_back(static_cast<char>(value));
+    return *this;
+}
+
+cts::SFTPPacketWriter& cts::SFTPPacketWriter::putUint32(const uint32_t value) {
+    const char bytes[] = {static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+                          static_cast<char>(value >> 8), static_cast<char>(value)};
+    m_buffer.append(bytes, sizeof(bytes));
+    return *this;
+}
+
+cts::SFTPPacketWriter& cts::SFTPPacketWriter::putUint64(const uint64_t value) {
+    putUint32(static_cast<uint32_t>(value >> 32));
+    putUint32(static_cast<uint32_t>(value));
+    return *this;
+}
+
+cts::SFTPPacketWriter& cts::SFTPPacketWriter::putString(const std::string& value) {
+    return putString(value.data(), value.size());
+}
+
+cts::SFTPPacketWriter& cts::SFTPPacketWriter::putString(const char* data, const size_t size) {
+    putUint32(static_cast<uint32_t>(size));
+    m_buffer.append(data, size);
+    return *this;
+}
+
+cts::SFTPPacketWriter& cts::SFTPPacketWriter::putPermissions(const uint32_t permissions) {
+    putUint32(SSH_FILEXFER_ATTR_PERMISSIONS);
+    putUint32(permissions);
+    return *this;
+}
+
+cts::SFTPPacketWriter& cts::SFTPPacketWriter::putEmptyAttributes() {
+    putUint32(0);
+    return *this;
+}
+
+cts::SFTPPacketWriter& cts::SFTPPacketWriter::putAttributes(
+    const sftp_attributes_struct& attributes) {
+    const uint32_t flags = attributes.flags &
+                           (SSH_FILEXFER_ATTR_SIZE | SSH_FILEXFER_ATTR_UIDGID |
+                            SSH_FILEXFER_ATTR_PERMISSIONS | SSH_FILEXFER_ATTR_ACMODTIME);
+    putUint32(flags);
+
+    if (flags & SSH_FILEXFER_ATTR_SIZE) {
+        putUint64(attributes.size);
+    }
+
+    if (flags & SSH_FILEXFER_ATTR_UIDGID) {
+        putUint32(attributes.uid);
+        putUint32(attributes.gid);
+    }
+
+    if (flags & SSH_FILEXFER_ATTR_PERMISSIONS) {
+        putUint32(attributes.permissions);
+    }
+
+    if (flags & SSH_FILEXFER_ATTR_ACMODTIME) {
+        putUint32(attributes.atime);
+        putUint32(attributes.mtime);
+    }
+
+    return *this;
+}
+
+std::string cts::SFTPPacketWriter::finish() {
+    const auto length = static_cast<uint32_t>(m_buffer.size() - 4);
+    m_buffer[0] = static_cast<char>(length >> 24);
+    m_buffer[1] = static_cast<char>(length >> 16);
+    m_buffer[2] = static_cast<char>(length >> 8);
+    m_buffer[3] = static_cast<char>(length);
+    return std::move(m_buffer);
+}
+
+bool cts::SFTPPacketReader::getUint8(uint8_t& value) {
+    if (m_size - m_offset < 1) {
+        return false;
+    }
+
+    value = static_cast<uint8_t>(m_data[m_offset]);
+    m_offset += 1;
+    return true;
+}
+
+bool cts::SFTPPacketReader::getUint32(uint32_t& value) {
+    if (m_size - m_offset < 4) {
+        return false;
+    }
+
+    const auto* bytes = reinterpret_cast<const unsigned char*>(m_data + m_offset);
+    value = static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 |
+            static_cast<uint32_t>(bytes[2]) << 8 | static_cast<uint32_t>(bytes[3]);
+    m_offset += 4;
+    return true;
+}
+
+bool cts::SFTPPacketReader::getUint64(uint64_t& value) {
+    uint32_t high = 0;
+    uint32_t low = 0;
+    if (!getUint32(high) || !getUint32(low)) {
+        return false;
+    }
+
+    value = static_cast<uint64_t>(high) << 32 | low;
+    return true;
+}
+
+bool cts::SFTPPacketReader::getString(std::string& value) {
+    const char* data = nullptr;
+    uint32_t size = 0;
+    if (!getStringView(data, size)) {
+        return false;
+    }
+
+    value.assign(data, size);
+    return true;
+}
+
+bool cts::SFTPPacketReader::getStringView(const char*& data, uint32_t& size) {
+    if (!getUint32(size) || m_size - m_offset < size) {
+        return false;
+    }
+
+    data = m_data + m_offset;
+    m_offset += size;
+    return true;
+}
+
+bool cts::SFTPPacketReader::getAttributes(sftp_attributes_struct& attributes) {
+    if (!getUint32(attributes.flags)) {
+        return false;
+    }
+
+    if ((attributes.flags & SSH_FILEXFER_ATTR_SIZE) && !getUint64(attributes.size)) {
+        return false;
+    }
+
+    if ((attributes.flags & SSH_FILEXFER_ATTR_UIDGID) &&
+        (!getUint32(attributes.uid) || !getUint32(attributes.gid))) {
+        return false;
+    }
+
+    if ((attributes.flags & SSH_FILEXFER_ATTR_PERMISSIONS) && !getUint32(attributes.permissions)) {
+        return false;
+    }
+
+    if (attributes.flags & SSH_FILEXFER_ATTR_ACMODTIME) {
+        if (!getUint32(attributes.atime) || !getUint32(attributes.mtime)) {
+            return false;
+        }
+        attributes.atime64 = attributes.atime;
+        attributes.mtime64 = attributes.mtime;
+    }
+
+    // Extended attributes are skipped, nothing in this library uses them.
+    if (attributes.flags & SSH_FILEXFER_ATTR_EXTENDED) {
+        uint32_t count = 0;
+        if (!getUint32(count)) {
+            return false;
+        }
+
+        std::string ignored;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!getString(ignored) || !getString(ignored)) {
+                return false;
+            }
+        }
+        attributes.flags &= ~static_cast<uint32_t>(SSH_FILEXFER_ATTR_EXTENDED);
+    }
+
+    // Version 3 has no type field, libssh derives it from the permissions the same way.
+    attributes.type = SSH_FILEXFER_TYPE_UNKNOWN;
+    if (attributes.flags & SSH_FILEXFER_ATTR_PERMISSIONS) {
+        switch (attributes.permissions & 0170000) {
+            case 0100000:
+                attributes.type = SSH_FILEXFER_TYPE_REGULAR;
+                break;
+            case 0040000:
+                attributes.type = SSH_FILEXFER_TYPE_DIRECTORY;
+                break;
+            case 0120000:
+                attributes.type = SSH_FILEXFER_TYPE_SYMLINK;
+                break;
+            default:
+                attributes.type = SSH_FILEXFER_TYPE_SPECIAL;
+                break;
+        }
+    }
+
+    return true;
+}
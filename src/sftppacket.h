@@ -0,0 +1,89 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_PACKET_H
+#define SFTP_PACKET_H
+
+#include <libssh/sftp.h>  // SSH_FXP_*, SSH_FILEXFER_ATTR_*
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace cts {
+
+// Builds one SFTP version 3 packet: the length prefix, the type byte and, for everything but
+// SSH_FXP_INIT, the request id. All integers are big endian.
+class SFTPPacketWriter {
+   public:
+    explicit SFTPPacketWriter(const uint8_t type);
+    SFTPPacketWriter(const uint8_t type, const uint32_t id);
+
+    SFTPPacketWriter& putUint8(const uint8_t value);
+    SFTPPacketWriter& putUint32(const uint32_t value);
+    SFTPPacketWriter& putUint64(const uint64_t value);
+    SFTPPacketWriter& putString(const std::string& value);
+    SFTPPacketWriter& putString(const char* data, const size_t size);
+
+    // Only the permissions attribute, which is all OPEN and MKDIR need.
+    SFTPPacketWriter& putPermissions(const uint32_t permissions);
+
+    SFTPPacketWriter& putEmptyAttributes();
+
+    // The version 3 fields of attributes, as SFTPPacketReader::getAttributes() reads them.
+    SFTPPacketWriter& putAttributes(const sftp_attributes_struct& attributes);
+
+    // Fills in the length prefix and hands over the packet.
+    std::string finish();
+
+   private:
+    std::string m_buffer;
+};
+
+// Reads the body of one packet, after the length prefix. Every get fails instead of reading
+// past the end, so a truncated or malicious packet cannot overrun the buffer.
+class SFTPPacketReader {
+   public:
+    SFTPPacketReader(const char* data, const size_t size) : m_data(data), m_size(size) {}
+
+    bool getUint8(uint8_t& value);
+    bool getUint32(uint32_t& value);
+    bool getUint64(uint64_t& value);
+    bool getString(std::string& value);
+
+    // Points into the packet instead of copying, for SSH_FXP_DATA payloads.
+    bool getStringView(const char*& data, uint32_t& size);
+
+    // Fills the fields a version 3 server sends; the caller owns the strings it allocates.
+    bool getAttributes(sftp_attributes_struct& attributes);
+
+    bool atEnd() const { return m_offset == m_size; }
+
+   private:
+    const char* m_data;
+    size_t m_size;
+    size_t m_offset = 0;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_PACKET_H */
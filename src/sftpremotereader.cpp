@@ -0,0 +1,142 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpremotereader.h"
+
+#include <algorithm>  // max
+#include <deque>
+
+bool cts::beginTailRead(sftp_file file, const uint64_t offset, const size_t length,
+                        const uint64_t nextOffset, sftp_aio* aio) {
+    sftp_aio tail = nullptr;
+    if (sftp_seek64(file, offset) < 0 || sftp_aio_begin_read(file, length, &tail) < 0) {
+        return false;
+    }
+    if (sftp_seek64(file, nextOffset) < 0) {
+        sftp_aio_free(tail);
+        return false;
+    }
+    *aio = tail;
+    return true;
+}
+
+cts::SFTPRemoteReader::SFTPRemoteReader(ssh_session sshSession, sftp_session sftpSession,
+                                        sftp_file file, const std::string& fileName,
+                                        const size_t chunkSize, const size_t maxInFlight)
+    : m_sshSession(sshSession),
+      m_sftpSession(sftpSession),
+      m_file(file),
+      m_fileName(fileName),
+      m_chunkSize(std::max<size_t>(chunkSize, 1)),
+      m_maxInFlight(std::max<size_t>(maxInFlight, 1)) {
+    if (!m_ring.allocate(m_chunkSize)) {
+        m_error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE, "Out of memory for read buffers");
+        m_ring.finish();
+        return;
+    }
+
+    m_thread = std::thread(&SFTPRemoteReader::run, this);
+}
+
+cts::SFTPRemoteReader::~SFTPRemoteReader() {
+    m_ring.stop();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+const cts::SFTPRemoteReader::Chunk* cts::SFTPRemoteReader::next() {
+    return m_ring.next();
+}
+
+void cts::SFTPRemoteReader::run() {
+    struct PendingRead {
+        sftp_aio aio;
+        uint64_t offset;
+        size_t length;
+    };
+
+    std::deque<PendingRead> reads;
+    uint64_t nextOffset = 0;
+    bool endOfFile = false;
+    size_t slot = kNoSlot;  // Kept for the next read when a read returns nothing
+
+    while (!m_ring.stopped()) {
+        while (!endOfFile && reads.size() < m_maxInFlight) {
+            sftp_aio aio = nullptr;
+            if (sftp_aio_begin_read(m_file, m_chunkSize, &aio) < 0) {
+                fail();
+                break;
+            }
+            reads.push_back({aio, nextOffset, m_chunkSize});
+            nextOffset += m_chunkSize;
+        }
+
+        if (!m_error.isOk() || reads.empty() ||
+            (slot == kNoSlot && !m_ring.takeFreeSlot(slot))) {
+            break;
+        }
+
+        PendingRead request = reads.front();
+        reads.pop_front();
+
+        auto& chunk = m_ring.chunk(slot);
+        const auto bytesRead =
+            sftp_aio_wait_read(&request.aio, m_ring.buffer(slot), m_chunkSize);
+        if (bytesRead <= 0) {
+            if (bytesRead < 0) {
+                fail();
+                break;
+            }
+            endOfFile = true;
+            continue;
+        }
+
+        chunk.offset = request.offset;
+        chunk.length = static_cast<size_t>(bytesRead);
+        m_ring.publish(slot);
+        slot = kNoSlot;
+
+        if (chunk.length < request.length) {
+            const auto tail = request.offset + chunk.length;
+            const auto remaining = request.length - chunk.length;
+            sftp_aio aio = nullptr;
+            if (!cts::beginTailRead(m_file, tail, remaining, nextOffset, &aio)) {
+                fail();
+                break;
+            }
+            reads.push_back({aio, tail, remaining});
+        }
+    }
+
+    for (auto& request : reads) {
+        sftp_aio_free(request.aio);
+    }
+
+    m_ring.finish();
+}
+
+void cts::SFTPRemoteReader::fail() {
+    m_error = cts::SFTPError(ssh_get_error_code(m_sshSession), sftp_get_error(m_sftpSession),
+                             "Failed to read from remote file [" + m_fileName + "] " +
+                                 ssh_get_error(m_sshSession));
+}
@@ -0,0 +1,94 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_REMOTE_READER_H
+#define SFTP_REMOTE_READER_H
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include <string>
+#include <thread>
+
+#include "sftpchunkring.h"
+#include "sftperror.h"
+
+namespace cts {
+
+// Starts a read of the length bytes at offset that a short read left out, then seeks file back
+// to nextOffset for the reads that follow. Later requests already cover their own ranges, so
+// only this tail is fetched again. aio is only set when everything succeeded.
+bool beginTailRead(sftp_file file, const uint64_t offset, const size_t length,
+                   const uint64_t nextOffset, sftp_aio* aio);
+
+// Reads a remote file for relay() on a thread of its own, keeping maxInFlight read requests
+// outstanding, so the source server keeps sending while the destination is being written.
+// Chunks reach the caller through a SFTPChunkRing and may arrive out of order after a short
+// read.
+class SFTPRemoteReader {
+   public:
+    struct Chunk {
+        const char* data = nullptr;
+        uint64_t offset = 0;
+        size_t length = 0;
+    };
+
+    // Only the reader's thread uses file and its session until the reader is destroyed.
+    SFTPRemoteReader(ssh_session sshSession, sftp_session sftpSession, sftp_file file,
+                     const std::string& fileName, const size_t chunkSize,
+                     const size_t maxInFlight);
+    ~SFTPRemoteReader();
+
+    // Blocks for the next chunk, which stays valid until the following call. nullptr at the
+    // end of the file or on error.
+    const Chunk* next();
+
+    // Valid once next() returned nullptr.
+    const SFTPError& error() const { return m_error; }
+
+   private:
+    SFTPRemoteReader(const SFTPRemoteReader&) = delete;
+    SFTPRemoteReader& operator=(const SFTPRemoteReader&) = delete;
+
+    void run();
+
+    void fail();
+
+    static constexpr size_t kNoSlot = ~size_t(0);
+
+    ssh_session m_sshSession;
+    sftp_session m_sftpSession;
+    sftp_file m_file;
+    const std::string m_fileName;
+    const size_t m_chunkSize;
+    const size_t m_maxInFlight;
+
+    // m_error is published by m_ring.finish().
+    SFTPChunkRing<Chunk> m_ring;
+    SFTPError m_error;
+
+    std::thread m_thread;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_REMOTE_READER_H */
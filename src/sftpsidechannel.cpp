@@ -0,0 +1,301 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpsidechannel.h"
+
+#include <algorithm>  // min
+
+cts::SFTPError cts::SFTPSideChannel::open() {
+    m_channel.reset(ssh_channel_new(m_session));
+    if (!m_channel || ssh_channel_open_session(m_channel.get()) != SSH_OK ||
+        ssh_channel_request_subsystem(m_channel.get(), "sftp") != SSH_OK) {
+        return channelError("Failed to open an SFTP channel");
+    }
+
+    std::string body;
+    if (!writePacket(SFTPPacketWriter(SSH_FXP_INIT).putUint32(3).finish()) ||
+        !readPacket(body)) {
+        return channelError("SFTP version exchange failed");
+    }
+
+    SFTPPacketReader reader(body.data(), body.size());
+    uint8_t type = 0;
+    uint32_t version = 0;
+    if (!reader.getUint8(type) || type != SSH_FXP_VERSION || !reader.getUint32(version)) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed SFTP version packet");
+    }
+
+    std::string name, data;
+    while (reader.getString(name) && reader.getString(data)) {
+        m_extensions[name] = data;
+    }
+
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPSideChannel::request(const std::string& packet, uint8_t& type,
+                                             std::string& body) {
+    auto err = send(packet);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    uint32_t id = 0;
+    err = receive(id, type, body);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    if (id != m_nextId - 1) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Unexpected SFTP reply");
+    }
+
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPSideChannel::send(const std::string& packet) {
+    if (!writePacket(packet)) {
+        return channelError("SFTP request failed");
+    }
+
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPSideChannel::receive(uint32_t& id, uint8_t& type, std::string& body) {
+    std::string reply;
+    if (!readPacket(reply)) {
+        return channelError("SFTP request failed");
+    }
+
+    SFTPPacketReader reader(reply.data(), reply.size());
+    if (!reader.getUint8(type) || !reader.getUint32(id)) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Truncated SFTP packet");
+    }
+
+    body = reply.substr(5);
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPSideChannel::requestStatus(const std::string& packet) {
+    uint8_t type = 0;
+    std::string body;
+    const auto err = request(packet, type, body);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    SFTPPacketReader reader(body.data(), body.size());
+    return statusError(type, reader);
+}
+
+cts::SFTPError cts::SFTPSideChannel::openFile(const std::string& path, const uint32_t flags,
+                                              const uint32_t permissions, std::string& handle) {
+    const auto packet = SFTPPacketWriter(SSH_FXP_OPEN, nextId())
+                            .putString(path)
+                            .putUint32(flags)
+                            .putPermissions(permissions)
+                            .finish();
+
+    uint8_t type = 0;
+    std::string body;
+    const auto err = request(packet, type, body);
+    if (!err.isOk()) {
+        return err;
+    }
+
+    SFTPPacketReader reader(body.data(), body.size());
+    if (type != SSH_FXP_HANDLE || !reader.getString(handle)) {
+        return statusError(type, reader);
+    }
+
+    return cts::SFTPError();
+}
+
+cts::SFTPError cts::SFTPSideChannel::closeFile(const std::string& handle) {
+    return requestStatus(SFTPPacketWriter(SSH_FXP_CLOSE, nextId()).putString(handle).finish());
+}
+
+cts::SFTPError cts::SFTPSideChannel::statusError(const uint8_t type, SFTPPacketReader& reader) {
+    if (type != SSH_FXP_STATUS) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Unexpected SFTP response");
+    }
+
+    uint32_t code = 0;
+    std::string message;
+    if (!reader.getUint32(code)) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_BAD_MESSAGE, "Malformed SFTP status");
+    }
+    reader.getString(message);  // Missing in some version 3 servers
+
+    if (code == SSH_FX_OK) {
+        return cts::SFTPError();
+    }
+
+    return cts::SFTPError(SSH_OK, static_cast<int>(code), message);
+}
+
+cts::SFTPError cts::SFTPSideChannel::channelError(const std::string& what) const {
+    return cts::SFTPError(ssh_get_error_code(m_session), SSH_FX_FAILURE,
+                          what + " " + ssh_get_error(m_session));
+}
+
+bool cts::SFTPSideChannel::readFully(char* data, uint32_t size) {
+    while (size > 0) {
+        const int bytesRead = ssh_channel_read(m_channel.get(), data, size, 0);
+        if (bytesRead <= 0) {
+            return false;
+        }
+        data += bytesRead;
+        size -= static_cast<uint32_t>(bytesRead);
+    }
+    return true;
+}
+
+bool cts::SFTPSideChannel::readPacket(std::string& body) {
+    uint8_t length[4];
+    if (!readFully(reinterpret_cast<char*>(length), sizeof(length))) {
+        return false;
+    }
+
+    const uint32_t size = uint32_t(length[0]) << 24 | uint32_t(length[1]) << 16 |
+                          uint32_t(length[2]) << 8 | uint32_t(length[3]);
+    if (size == 0 || size > kMaxPacketSize) {
+        return false;
+    }
+
+    body.resize(size);
+    return readFully(&body[0], size);
+}
+
+bool cts::SFTPSideChannel::writePacket(const std::string& packet) {
+    return ssh_channel_write(m_channel.get(), packet.data(),
+                             static_cast<uint32_t>(packet.size())) ==
+           static_cast<int>(packet.size());
+}
+
+void cts::SSHChannelDeleter::operator()(ssh_channel channel) const {
+    if (channel) {
+        ssh_channel_close(channel);
+        ssh_channel_free(channel);
+    }
+}
+
+std::string cts::shellQuote(const std::string& value) {
+    std::string quoted = "'";
+    for (const char c : value) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+cts::SSHChannelPtr cts::openExecChannel(ssh_session session, const std::string& command) {
+    SSHChannelPtr channel(ssh_channel_new(session));
+    if (!channel || ssh_channel_open_session(channel.get()) != SSH_OK ||
+        ssh_channel_request_exec(channel.get(), command.c_str()) != SSH_OK) {
+        return SSHChannelPtr();
+    }
+    return channel;
+}
+
+bool cts::pollExecChannel(ssh_channel channel, const ExecOutputSink& onOutput,
+                          std::string& errors) {
+    char buffer[32 * 1024];
+    for (int isStderr = 0; isStderr <= 1; ++isStderr) {
+        while (true) {
+            const int bytesRead =
+                ssh_channel_read_nonblocking(channel, buffer, sizeof(buffer), isStderr);
+            if (bytesRead == SSH_ERROR) {
+                return false;
+            }
+            if (bytesRead <= 0) {
+                break;  // Nothing buffered, or end of file
+            }
+
+            const auto count = static_cast<size_t>(bytesRead);
+            if (isStderr) {
+                if (errors.size() < 1024 * 1024) {
+                    errors.append(buffer, count);
+                }
+            } else if (!onOutput(buffer, count)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool cts::writeExecChannel(ssh_channel channel, const char* data, size_t size,
+                           const ExecOutputSink& onOutput, std::string& errors) {
+    while (size > 0) {
+        const auto count = static_cast<uint32_t>(std::min<size_t>(size, 32 * 1024));
+        const int written = ssh_channel_write(channel, data, count);
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+
+        if (!pollExecChannel(channel, onOutput, errors)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool cts::readExecChannel(ssh_channel channel, const ExecOutputSink& onOutput,
+                          std::string& errors) {
+    while (true) {
+        if (!pollExecChannel(channel, onOutput, errors)) {
+            return false;
+        }
+        if (ssh_channel_is_eof(channel)) {
+            return true;
+        }
+        if (ssh_channel_poll_timeout(channel, 100, 0) == SSH_ERROR) {
+            return false;
+        }
+    }
+}
+
+int cts::execChannelExitStatus(ssh_channel channel) {
+    uint32_t code = 0;
+    char* signal = nullptr;
+    if (ssh_channel_get_exit_state(channel, &code, &signal, nullptr) != SSH_OK) {
+        return -1;
+    }
+    if (signal) {
+        ssh_string_free_char(signal);
+        return -1;
+    }
+    return static_cast<int>(code);
+}
+
+bool cts::remoteCommandSucceeds(ssh_session session, const std::string& command) {
+    auto channel = openExecChannel(session, command);
+    if (!channel) {
+        return false;
+    }
+
+    std::string errors;
+    return readExecChannel(channel.get(), [](const char*, size_t) { return true; }, errors) &&
+           execChannelExitStatus(channel.get()) == 0;
+}
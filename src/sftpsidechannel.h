@@ -0,0 +1,140 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_SIDE_CHANNEL_H
+#define SFTP_SIDE_CHANNEL_H
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "sftperror.h"
+#include "sftppacket.h"
+
+namespace cts {
+
+// Closes and frees channels opened next to libssh's SFTP session.
+struct SSHChannelDeleter {
+    void operator()(ssh_channel channel) const;
+};
+
+using SSHChannelPtr = std::unique_ptr<ssh_channel_struct, SSHChannelDeleter>;
+
+// Single quotes value for the POSIX shell that runs exec channel commands.
+std::string shellQuote(const std::string& value);
+
+// A channel running command in the user's shell on the server, or null if it could not start.
+SSHChannelPtr openExecChannel(ssh_session session, const std::string& command);
+
+// Receives the stdout data of an exec channel. Returning false fails the read or write.
+using ExecOutputSink = std::function<bool(const char* data, size_t size)>;
+
+// Takes whatever stdout and stderr data already arrived, without waiting. Unread output would
+// close the channel window and stall the remote process, and with it our writes. stderr is
+// collected into errors, up to 1 MiB.
+bool pollExecChannel(ssh_channel channel, const ExecOutputSink& onOutput, std::string& errors);
+
+// Writes data to the command's stdin, polling its output between writes.
+bool writeExecChannel(ssh_channel channel, const char* data, size_t size,
+                      const ExecOutputSink& onOutput, std::string& errors);
+
+// Reads the command's output until it closes stdout.
+bool readExecChannel(ssh_channel channel, const ExecOutputSink& onOutput, std::string& errors);
+
+// The command's exit status once readExecChannel() saw its output end, -1 when the server
+// reported none or a signal ended the command.
+int execChannelExitStatus(ssh_channel channel);
+
+// Whether command runs on the server and exits with status 0.
+bool remoteCommandSucceeds(ssh_session session, const std::string& command);
+
+// A second SFTP channel on an SSH session that already carries libssh's SFTP session, spoken
+// to directly with SFTPPacketWriter and SFTPPacketReader. libssh's SFTP API cannot send
+// extended requests it does not know, so extensions such as check-file and copy-data go over
+// one of these. request() is synchronous; send() and receive() keep several requests
+// outstanding, as long as the replies they wait for fit into the channel window.
+class SFTPSideChannel {
+   public:
+    explicit SFTPSideChannel(ssh_session session) : m_session(session) {}
+
+    // Opens the channel, starts the sftp subsystem and exchanges versions.
+    SFTPError open();
+
+    // Whether the server listed the extension in its version packet.
+    bool hasExtension(const std::string& name) const { return m_extensions.count(name) > 0; }
+
+    uint32_t nextId() { return m_nextId++; }
+
+    // Sends a packet built with the id from nextId() and reads its reply: type and, in body,
+    // everything after the request id.
+    SFTPError request(const std::string& packet, uint8_t& type, std::string& body);
+
+    // Queues a packet without waiting for its reply.
+    SFTPError send(const std::string& packet);
+
+    // Reads the next reply, whichever request it answers.
+    SFTPError receive(uint32_t& id, uint8_t& type, std::string& body);
+
+    // Sends a request that is answered with SSH_FXP_STATUS and returns that status.
+    SFTPError requestStatus(const std::string& packet);
+
+    // SSH_FXP_OPEN with SSH_FXF_* flags.
+    SFTPError openFile(const std::string& path, const uint32_t flags, const uint32_t permissions,
+                       std::string& handle);
+
+    SFTPError closeFile(const std::string& handle);
+
+    // The error an SSH_FXP_STATUS reply stands for, or a protocol error for any other reply.
+    static SFTPError statusError(const uint8_t type, SFTPPacketReader& reader);
+
+    // Longest read to ask for, so that its SSH_FXP_DATA reply stays below kMaxPacketSize.
+    static constexpr uint32_t kMaxDataLength = 255 * 1024;
+
+   private:
+    SFTPSideChannel(const SFTPSideChannel&) = delete;
+    SFTPSideChannel& operator=(const SFTPSideChannel&) = delete;
+
+    SFTPError channelError(const std::string& what) const;
+
+    bool readFully(char* data, uint32_t size);
+
+    bool readPacket(std::string& body);
+
+    bool writePacket(const std::string& packet);
+
+    // Larger replies are treated as a broken stream rather than allocated.
+    static constexpr uint32_t kMaxPacketSize = 256 * 1024;
+
+    ssh_session m_session;
+    SSHChannelPtr m_channel;
+    std::map<std::string, std::string> m_extensions;
+    uint32_t m_nextId = 1;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_SIDE_CHANNEL_H */
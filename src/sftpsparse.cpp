@@ -0,0 +1,138 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpsparse.h"
+
+#include <cerrno>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SFTP_SPARSE_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SFTP_SPARSE_NEON 1
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool cts::isAllZero(const char* data, const size_t size) {
+    size_t i = 0;
+
+#if defined(SFTP_SPARSE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= size; i += 64) {
+        const auto* block = reinterpret_cast<const __m128i*>(data + i);
+        const __m128i any = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128(block), _mm_loadu_si128(block + 1)),
+            _mm_or_si128(_mm_loadu_si128(block + 2), _mm_loadu_si128(block + 3)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF) {
+            return false;
+        }
+    }
+#elif defined(SFTP_SPARSE_NEON)
+    for (; i + 64 <= size; i += 64) {
+        const auto* block = reinterpret_cast<const uint8_t*>(data + i);
+        const uint8x16_t any = vorrq_u8(vorrq_u8(vld1q_u8(block), vld1q_u8(block + 16)),
+                                        vorrq_u8(vld1q_u8(block + 32), vld1q_u8(block + 48)));
+        if (vmaxvq_u8(any) != 0) {
+            return false;
+        }
+    }
+#endif
+
+    for (; i < size; ++i) {
+        if (data[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+cts::SparseFileMap::SparseFileMap(const std::string& fileName) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    m_fd = ::open(fileName.c_str(), O_RDONLY);
+    struct stat status;
+    if (m_fd >= 0 && fstat(m_fd, &status) == 0) {
+        m_size = static_cast<uint64_t>(status.st_size);
+    }
+#else
+    (void)fileName;
+#endif
+}
+
+cts::SparseFileMap::~SparseFileMap() {
+#ifndef _WIN32
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+#endif
+}
+
+bool cts::SparseFileMap::nextData(const uint64_t offset, uint64_t& start, uint64_t& end) const {
+    start = offset;
+    end = std::numeric_limits<uint64_t>::max();
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    if (m_fd < 0) {
+        return true;
+    }
+
+    const off_t data = lseek(m_fd, static_cast<off_t>(offset), SEEK_DATA);
+    if (data < 0) {
+        // ENXIO: nothing but a hole up to the end of the file. Anything else means the file
+        // system cannot tell, and everything counts as data.
+        return errno != ENXIO;
+    }
+
+    const off_t hole = lseek(m_fd, data, SEEK_HOLE);
+    start = static_cast<uint64_t>(data);
+    if (hole > data) {
+        end = static_cast<uint64_t>(hole);
+    }
+#endif
+
+    return true;
+}
+
+bool cts::punchHole(const std::string& fileName, const uint64_t offset, const uint64_t length) {
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    const int fd = ::open(fileName.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    const bool punched = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                   static_cast<off_t>(offset), static_cast<off_t>(length)) == 0;
+    ::close(fd);
+    return punched;
+#else
+    (void)fileName;
+    (void)offset;
+    (void)length;
+    return false;
+#endif
+}
@@ -0,0 +1,62 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_SPARSE_H
+#define SFTP_SPARSE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace cts {
+
+// Whether every byte of data is zero, checked 64 bytes at a time with SSE2 or NEON.
+bool isAllZero(const char* data, const size_t size);
+
+// The data segments of a local file as SEEK_DATA and SEEK_HOLE report them. Platforms and file
+// systems without them show the whole file as one segment.
+class SparseFileMap {
+   public:
+    explicit SparseFileMap(const std::string& fileName);
+    ~SparseFileMap();
+
+    // The first segment that ends after offset, as [start, end). Without hole support end is
+    // UINT64_MAX. Returns false when only a hole, or nothing, follows offset.
+    bool nextData(const uint64_t offset, uint64_t& start, uint64_t& end) const;
+
+    uint64_t size() const { return m_size; }
+
+   private:
+    SparseFileMap(const SparseFileMap&) = delete;
+    SparseFileMap& operator=(const SparseFileMap&) = delete;
+
+    int m_fd = -1;
+    uint64_t m_size = 0;
+};
+
+// Deallocates [offset, offset + length) of a local file without changing its size. Returns
+// false where the platform or file system cannot, the caller then writes the zeros.
+bool punchHole(const std::string& fileName, const uint64_t offset, const uint64_t length);
+
+}  // namespace cts
+
+#endif /* SFTP_SPARSE_H */
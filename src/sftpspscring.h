@@ -0,0 +1,163 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_SPSC_RING_H
+#define SFTP_SPSC_RING_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cts {
+
+// Fixed capacity queue for exactly one producer thread and one consumer thread, without locks.
+// Each side only writes its own index, and the other side's index is cached so that most
+// calls touch no shared cache line at all. A consumer that finds the ring empty for longer
+// than a few yields sleeps until push() or wake(), so an idle side costs no wakeups.
+template <typename T>
+class SPSCRing {
+   public:
+    // The capacity is rounded up to a power of two.
+    explicit SPSCRing(const size_t capacity)
+        : m_slots(roundUp(capacity)), m_mask(m_slots.size() - 1) {}
+
+    // Producer only. False while the ring is full.
+    bool tryPush(const T& value) {
+        const size_t tail = m_tail.value.load(std::memory_order_relaxed);
+        if (tail - m_tail.cached == m_slots.size()) {
+            m_tail.cached = m_head.value.load(std::memory_order_acquire);
+            if (tail - m_tail.cached == m_slots.size()) {
+                return false;
+            }
+        }
+
+        m_slots[tail & m_mask] = value;
+        m_tail.value.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer only. tryPush() that wakes a consumer sleeping in pop().
+    bool push(const T& value) {
+        if (!tryPush(value)) {
+            return false;
+        }
+        wake();
+        return true;
+    }
+
+    // Consumer only. False while the ring is empty.
+    bool tryPop(T& value) {
+        const size_t head = m_head.value.load(std::memory_order_relaxed);
+        if (head == m_head.cached) {
+            m_head.cached = m_tail.value.load(std::memory_order_acquire);
+            if (head == m_head.cached) {
+                return false;
+            }
+        }
+
+        value = m_slots[head & m_mask];
+        m_head.value.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Waits for a value until stopped() returns true, then takes what was
+    // pushed before it stopped, if anything. Whoever makes stopped() true calls wake().
+    template <typename Stopped>
+    bool pop(T& value, Stopped stopped) {
+        for (unsigned int round = 0;; ++round) {
+            if (tryPop(value)) {
+                return true;
+            }
+            if (stopped()) {
+                return tryPop(value);
+            }
+
+            if (round < kSpinRounds) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // The fences pair with the one in wake(): either the producer sees a sleeper, or
+            // the predicate sees what it pushed.
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_wakeup.wait(lock, [&]() { return !empty() || stopped(); });
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Wakes a consumer sleeping in pop(), to look at the ring and stopped() again.
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_wakeup.notify_all();
+        }
+    }
+
+   private:
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
+
+    // Consumer only.
+    bool empty() const {
+        return m_head.value.load(std::memory_order_relaxed) ==
+               m_tail.value.load(std::memory_order_acquire);
+    }
+
+    static size_t roundUp(const size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    std::vector<T> m_slots;
+    const size_t m_mask;
+
+    // One side's index and its cached copy of the other side's, on a cache line of their own.
+    // Padded rather than aligned, as heap allocation only honours alignas from C++17 on.
+    struct Index {
+        char padding[64];
+        std::atomic<size_t> value{0};
+        size_t cached = 0;
+    };
+
+    Index m_tail;  // Written by the producer
+    Index m_head;  // Written by the consumer
+
+    // Yields before the consumer goes to sleep, which covers the common short wait.
+    static constexpr unsigned int kSpinRounds = 64;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::atomic<unsigned int> m_sleepers{0};
+};
+
+}  // namespace cts
+
+#endif /* SFTP_SPSC_RING_H */
@@ -0,0 +1,664 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftptarstream.h"
+
+#include <errno.h>
+#include <sys/stat.h>  // stat, mkdir
+#ifdef _WIN32
+#include <direct.h>  // _mkdir
+#endif
+
+#include <algorithm>  // any_of, min, fill
+#include <cstdlib>    // strtoull
+#include <cstring>    // memcpy, memset
+#include <fstream>
+#include <map>
+
+#include "sftpsidechannel.h"
+
+namespace {
+
+// The largest size the 11 octal digits of a ustar header hold.
+constexpr uint64_t kMaxUstarSize = 077777777777ull;
+
+void putOctal(char* field, const size_t width, uint64_t value) {
+    field[width - 1] = '\0';
+    for (size_t i = width - 1; i-- > 0;) {
+        field[i] = static_cast<char>('0' + (value & 7));
+        value >>= 3;
+    }
+}
+
+// Octal, or the base-256 form GNU tar uses for values that do not fit.
+uint64_t getNumber(const char* field, const size_t width) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(field);
+    if (bytes[0] & 0x80) {
+        uint64_t value = bytes[0] & 0x7F;
+        for (size_t i = 1; i < width; ++i) {
+            value = value << 8 | bytes[i];
+        }
+        return value;
+    }
+
+    size_t i = 0;
+    while (i < width && field[i] == ' ') {
+        ++i;
+    }
+
+    uint64_t value = 0;
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; ++i) {
+        value = value * 8 + static_cast<uint64_t>(field[i] - '0');
+    }
+    return value;
+}
+
+std::string getString(const char* field, const size_t width) {
+    return std::string(field, std::find(field, field + width, '\0'));
+}
+
+std::string paxRecord(const std::string& key, const std::string& value) {
+    // The length prefix counts its own digits.
+    const size_t base = key.size() + value.size() + 3;  // ' ', '=' and '\n'
+    size_t length = base + std::to_string(base).size();
+    while (length != base + std::to_string(length).size()) {
+        length = base + std::to_string(length).size();
+    }
+    return std::to_string(length) + " " + key + "=" + value + "\n";
+}
+
+// Splits name into the ustar prefix and name fields, if it fits them.
+bool splitName(const std::string& name, std::string& prefix, std::string& rest) {
+    if (name.size() <= 100) {
+        prefix.clear();
+        rest = name;
+        return true;
+    }
+
+    for (size_t slash = std::min<size_t>(name.size() - 1, 155); slash > 0; --slash) {
+        if (name[slash] == '/' && name.size() - slash - 1 <= 100 && slash + 1 < name.size()) {
+            prefix = name.substr(0, slash);
+            rest = name.substr(slash + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string normalizeName(std::string name) {
+    while (name.compare(0, 2, "./") == 0) {
+        name.erase(0, 2);
+    }
+    while (!name.empty() && name[name.size() - 1] == '/') {
+        name.erase(name.size() - 1);
+    }
+    return name;
+}
+
+// Relative and without "..", so it cannot name anything outside the directory.
+bool isContainedPath(const std::string& path) {
+    if (path.empty() || path[0] == '/') {
+        return false;
+    }
+
+    size_t start = 0;
+    while (true) {
+        const auto end = path.find('/', start);
+        if (path.compare(start, end == std::string::npos ? std::string::npos : end - start,
+                         "..") == 0) {
+            return false;
+        }
+        if (end == std::string::npos) {
+            return true;
+        }
+        start = end + 1;
+    }
+}
+
+std::string joinPath(const std::string& dir, const std::string& path) {
+    if (dir.empty()) {
+        return path;
+    }
+    return dir[dir.size() - 1] == '/' ? dir + path : dir + "/" + path;
+}
+
+cts::SFTPError tarError(ssh_session session, const std::string& what) {
+    return cts::SFTPError(ssh_get_error_code(session), SSH_FX_FAILURE,
+                          what + " " + ssh_get_error(session));
+}
+
+// Attaches tar's "tar: <name>: <message>" lines to the files they name.
+void assignErrors(const std::string& errors, const std::map<std::string, size_t>& index,
+                  std::vector<cts::FileTransferResult>& results) {
+    size_t start = 0;
+    while (start < errors.size()) {
+        auto end = errors.find('\n', start);
+        if (end == std::string::npos) {
+            end = errors.size();
+        }
+        const std::string line = errors.substr(start, end - start);
+        start = end + 1;
+
+        const size_t from = line.compare(0, 5, "tar: ") == 0 ? 5 : 0;
+        for (auto colon = line.find(':', from); colon != std::string::npos;
+             colon = line.find(':', colon + 1)) {
+            const auto it = index.find(normalizeName(line.substr(from, colon - from)));
+            if (it != index.end()) {
+                if (results[it->second].error.isOk()) {
+                    results[it->second].error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE, line);
+                }
+                break;
+            }
+        }
+    }
+}
+
+// Results in the order of paths, with the ones that cannot be transferred already failed, and
+// an index from normalized name to result for the rest.
+std::vector<cts::FileTransferResult> prepareResults(const std::vector<std::string>& paths,
+                                                    std::map<std::string, size_t>& index) {
+    std::vector<cts::FileTransferResult> results;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        results.push_back({paths[i], cts::SFTPError()});
+
+        const auto name = normalizeName(paths[i]);
+        if (!isContainedPath(name)) {
+            results[i].error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                              "Not a path inside the directory: " + paths[i]);
+        } else {
+            index[name] = i;
+        }
+    }
+    return results;
+}
+
+}  // namespace
+
+cts::TarWriter::TarWriter(Sink sink) : m_sink(std::move(sink)) {}
+
+bool cts::TarWriter::beginFile(const std::string& name, const uint64_t size, const uint32_t mode,
+                               const int64_t mtime) {
+    std::string prefix, rest;
+    const bool fits = splitName(name, prefix, rest);
+
+    if (!fits || size > kMaxUstarSize) {
+        std::string records;
+        if (!fits) {
+            records += paxRecord("path", name);
+            prefix.clear();
+            rest = name.substr(0, 100);
+        }
+        if (size > kMaxUstarSize) {
+            records += paxRecord("size", std::to_string(size));
+        }
+
+        if (!writeHeader("././@PaxHeader", "", records.size(), 0644, mtime, 'x') ||
+            !append(records.data(), records.size()) || !pad(records.size())) {
+            return false;
+        }
+    }
+
+    m_entrySize = size;
+    m_remaining = size;
+    return writeHeader(rest, prefix, size > kMaxUstarSize ? 0 : size, mode, mtime, '0');
+}
+
+bool cts::TarWriter::writeData(const char* data, const size_t size) {
+    const auto count = static_cast<size_t>(std::min<uint64_t>(size, m_remaining));
+    m_remaining -= count;
+    return append(data, count) && (m_remaining > 0 || pad(m_entrySize));
+}
+
+bool cts::TarWriter::finish() {
+    const char zeros[2 * kBlockSize] = {};
+    return append(zeros, sizeof(zeros)) && flush();
+}
+
+bool cts::TarWriter::writeHeader(const std::string& name, const std::string& prefix,
+                                 const uint64_t size, const uint32_t mode, const int64_t mtime,
+                                 const char type) {
+    char header[kBlockSize] = {};
+    std::memcpy(header, name.data(), std::min<size_t>(name.size(), 100));
+    putOctal(header + 100, 8, mode & 07777);
+    putOctal(header + 108, 8, 0);  // uid
+    putOctal(header + 116, 8, 0);  // gid
+    putOctal(header + 124, 12, size);
+    putOctal(header + 136, 12, mtime > 0 ? static_cast<uint64_t>(mtime) : 0);
+    header[156] = type;
+    std::memcpy(header + 257, "ustar", 6);
+    std::memcpy(header + 263, "00", 2);
+    std::memcpy(header + 345, prefix.data(), std::min<size_t>(prefix.size(), 155));
+
+    // The checksum is computed with its own field as spaces.
+    std::memset(header + 148, ' ', 8);
+    uint64_t checksum = 0;
+    for (const char c : header) {
+        checksum += static_cast<unsigned char>(c);
+    }
+    putOctal(header + 148, 7, checksum);
+
+    return append(header, sizeof(header));
+}
+
+bool cts::TarWriter::append(const char* data, const size_t size) {
+    if (m_failed) {
+        return false;
+    }
+
+    // Large pieces go straight to the sink instead of through the buffer.
+    if (size >= kFlushSize) {
+        if (!flush() || !m_sink(data, size)) {
+            m_failed = true;
+            return false;
+        }
+        return true;
+    }
+
+    m_buffer.append(data, size);
+    return m_buffer.size() < kFlushSize || flush();
+}
+
+bool cts::TarWriter::pad(const uint64_t size) {
+    const char zeros[kBlockSize] = {};
+    return append(zeros, static_cast<size_t>((kBlockSize - size % kBlockSize) % kBlockSize));
+}
+
+bool cts::TarWriter::flush() {
+    if (m_failed) {
+        return false;
+    }
+    if (!m_buffer.empty() && !m_sink(m_buffer.data(), m_buffer.size())) {
+        m_failed = true;
+    }
+    m_buffer.clear();
+    return !m_failed;
+}
+
+cts::TarReader::TarReader(std::function<bool(const Entry&)> onEntry,
+                          std::function<bool(const char* data, size_t size)> onData,
+                          std::function<bool()> onEnd)
+    : m_onEntry(std::move(onEntry)), m_onData(std::move(onData)), m_onEnd(std::move(onEnd)) {}
+
+bool cts::TarReader::feed(const char* data, size_t size) {
+    while (size > 0 && m_state != State::Finished && m_state != State::Failed) {
+        if (m_state == State::Header) {
+            const size_t count = std::min(size, sizeof(m_header) - m_headerSize);
+            std::memcpy(m_header + m_headerSize, data, count);
+            m_headerSize += count;
+            data += count;
+            size -= count;
+
+            if (m_headerSize == sizeof(m_header)) {
+                m_headerSize = 0;
+                if (!parseHeader()) {
+                    m_state = State::Failed;
+                }
+            }
+            continue;
+        }
+
+        const uint64_t left = m_remaining > 0 ? m_remaining : m_padding;
+        const auto count = static_cast<size_t>(std::min<uint64_t>(size, left));
+        if (m_remaining > 0) {
+            if (m_state == State::FileData && !m_onData(data, count)) {
+                m_state = State::Failed;
+                break;
+            }
+            if (m_state == State::MetaData) {
+                m_meta.append(data, count);
+            }
+            m_remaining -= count;
+        } else {
+            m_padding -= count;
+        }
+        data += count;
+        size -= count;
+
+        if (m_remaining == 0 && m_padding == 0 && !endData()) {
+            m_state = State::Failed;
+        }
+    }
+
+    return m_state != State::Failed;
+}
+
+bool cts::TarReader::parseHeader() {
+    if (std::all_of(m_header, m_header + sizeof(m_header), [](char c) { return c == '\0'; })) {
+        if (++m_zeroBlocks == 2) {
+            m_state = State::Finished;
+        }
+        return true;
+    }
+    m_zeroBlocks = 0;
+
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < sizeof(m_header); ++i) {
+        checksum += i >= 148 && i < 156 ? ' ' : static_cast<unsigned char>(m_header[i]);
+    }
+    if (checksum != getNumber(m_header + 148, 8)) {
+        return false;
+    }
+
+    const char type = m_header[156] == '\0' ? '0' : m_header[156];
+    const uint64_t headerSize = getNumber(m_header + 124, 12);
+
+    if (type == 'x' || type == 'L') {
+        if (headerSize > 1024 * 1024) {
+            return false;  // Far beyond any real name or attribute set
+        }
+        m_state = State::MetaData;
+        m_metaType = type;
+        m_meta.clear();
+        m_remaining = headerSize;
+    } else if (type == 'g') {
+        m_state = State::Skip;  // Global pax attributes carry nothing needed here
+        m_remaining = headerSize;
+    } else {
+        Entry entry;
+        entry.type = type == '7' ? '0' : type;  // Contiguous files are plain files
+        entry.size = m_hasNextSize ? m_nextSize : headerSize;
+        entry.mode = static_cast<uint32_t>(getNumber(m_header + 100, 8));
+
+        if (!m_nextName.empty()) {
+            entry.name = m_nextName;
+        } else {
+            const auto name = getString(m_header, 100);
+            const bool posix = std::memcmp(m_header + 257, "ustar", 6) == 0;
+            const auto prefix = posix ? getString(m_header + 345, 155) : std::string();
+            entry.name = prefix.empty() ? name : prefix + "/" + name;
+        }
+        m_nextName.clear();
+        m_hasNextSize = false;
+
+        if (!m_onEntry(entry)) {
+            return false;
+        }
+
+        m_state = entry.type == '0' ? State::FileData : State::Skip;
+        m_remaining = entry.size;
+    }
+
+    m_padding = (kBlockSize - m_remaining % kBlockSize) % kBlockSize;
+    return m_remaining > 0 || endData();
+}
+
+void cts::TarReader::parsePaxRecords() {
+    size_t position = 0;
+    while (position < m_meta.size()) {
+        const auto space = m_meta.find(' ', position);
+        if (space == std::string::npos) {
+            return;
+        }
+
+        const auto length = std::strtoull(m_meta.c_str() + position, nullptr, 10);
+        if (length <= space - position || position + length > m_meta.size()) {
+            return;
+        }
+
+        const auto record = m_meta.substr(space + 1, position + length - space - 2);
+        const auto equals = record.find('=');
+        if (equals != std::string::npos) {
+            const auto key = record.substr(0, equals);
+            const auto value = record.substr(equals + 1);
+            if (key == "path") {
+                m_nextName = value;
+            } else if (key == "size") {
+                m_nextSize = std::strtoull(value.c_str(), nullptr, 10);
+                m_hasNextSize = true;
+            }
+        }
+        position += length;
+    }
+}
+
+bool cts::TarReader::endData() {
+    const auto state = m_state;
+    m_state = State::Header;
+
+    if (state == State::FileData) {
+        return m_onEnd();
+    }
+
+    if (state == State::MetaData) {
+        if (m_metaType == 'x') {
+            parsePaxRecords();
+        } else {
+            m_nextName = m_meta.substr(0, m_meta.find('\0'));
+        }
+        m_meta.clear();
+    }
+    return true;
+}
+
+bool cts::createParentDirectories(const std::string& path) {
+    for (auto slash = path.find('/', 1); slash != std::string::npos;
+         slash = path.find('/', slash + 1)) {
+        const auto dir = path.substr(0, slash);
+#ifdef _WIN32
+        const int rc = _mkdir(dir.c_str());
+#else
+        const int rc = ::mkdir(dir.c_str(), 0755);
+#endif
+        if (rc != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool cts::remoteTarAvailable(ssh_session session) {
+    return remoteCommandSucceeds(session, "tar --version");
+}
+
+std::pair<cts::SFTPError, std::vector<cts::FileTransferResult>> cts::tarPut(
+    ssh_session session, const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) {
+    std::map<std::string, size_t> index;
+    auto results = prepareResults(paths, index);
+
+    const auto dir = shellQuote(remoteDir.empty() ? "." : remoteDir);
+    auto channel = openExecChannel(session, "mkdir -p -- " + dir + " && exec tar -xf - -C " + dir);
+    if (!channel) {
+        return {tarError(session, "Failed to start tar on the server"), results};
+    }
+
+    std::string errors;
+    const ExecOutputSink ignoreOutput = [](const char*, size_t) { return true; };
+    TarWriter writer([&](const char* data, size_t size) {
+        return writeExecChannel(channel.get(), data, size, ignoreOutput, errors);
+    });
+
+    std::vector<char> buffer(256 * 1024);
+    bool streamed = true;
+
+    for (const auto& entry : index) {
+        auto& result = results[entry.second];
+        const auto localFileName = joinPath(localDir, entry.first);
+
+        struct stat info;
+        std::ifstream file(localFileName, std::ios::binary);
+        if (!file || ::stat(localFileName.c_str(), &info) != 0 ||
+            (info.st_mode & S_IFMT) != S_IFREG) {
+            result.error = cts::SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                                          "Failed to open local file: " + localFileName);
+            continue;
+        }
+
+        auto remaining = static_cast<uint64_t>(info.st_size);
+        streamed = writer.beginFile(entry.first, remaining, static_cast<uint32_t>(info.st_mode),
+                                    static_cast<int64_t>(info.st_mtime));
+
+        while (streamed && remaining > 0) {
+            const auto count = static_cast<size_t>(std::min<uint64_t>(buffer.size(), remaining));
+            file.read(buffer.data(), static_cast<std::streamsize>(count));
+            if (static_cast<size_t>(file.gcount()) < count) {
+                // The header already promised the old size, so the entry is completed with
+                // zeros and the file reported instead.
+                std::fill(buffer.begin() + file.gcount(), buffer.begin() + count, '\0');
+                result.error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                              "Local file changed while being sent: " +
+                                                  localFileName);
+            }
+            streamed = writer.writeData(buffer.data(), count);
+            remaining -= count;
+        }
+
+        if (!streamed) {
+            break;
+        }
+    }
+
+    streamed = streamed && writer.finish();
+    ssh_channel_send_eof(channel.get());
+    const bool complete = readExecChannel(channel.get(), ignoreOutput, errors);
+    const int status = complete ? execChannelExitStatus(channel.get()) : -1;
+
+    assignErrors(errors, index, results);
+
+    if (!streamed) {
+        return {tarError(session, "Failed to stream files to tar on the server"), results};
+    }
+
+    // A tar that gave up, say after "Unexpected EOF", never got to the files it did not name,
+    // so only a clean exit confirms them.
+    if (status != 0) {
+        const auto failure = "tar exited with status " + std::to_string(status) +
+                             " on the server before confirming this file";
+        for (const auto& entry : index) {
+            auto& result = results[entry.second];
+            if (result.error.isOk()) {
+                result.error = cts::SFTPError(SSH_OK, SSH_FX_FAILURE, failure);
+            }
+        }
+        return {cts::SFTPError(SSH_OK, SSH_FX_FAILURE, "tar failed on the server: " + errors),
+                results};
+    }
+
+    return {cts::SFTPError(), results};
+}
+
+std::pair<cts::SFTPError, std::vector<cts::FileTransferResult>> cts::tarGet(
+    ssh_session session, const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir) {
+    std::map<std::string, size_t> index;
+    auto results = prepareResults(paths, index);
+
+    // Names are read from stdin, NUL separated, so neither the command line length nor odd
+    // characters limit them. The "./" keeps names starting with '-' from looking like options.
+    const auto dir = shellQuote(remoteDir.empty() ? "." : remoteDir);
+    auto channel = openExecChannel(session, "cd -- " + dir + " && exec tar --null -cf - -T -");
+    if (!channel) {
+        return {tarError(session, "Failed to start tar on the server"), results};
+    }
+
+    std::vector<bool> received(results.size(), false);
+    std::ofstream file;
+    size_t current = results.size();  // None
+
+    TarReader reader(
+        [&](const TarReader::Entry& entry) {
+            current = results.size();
+            const auto it = index.find(normalizeName(entry.name));
+            if (entry.type != '0' || it == index.end()) {
+                return true;  // Directories are created as needed, anything else is skipped
+            }
+
+            const auto localFileName = joinPath(localDir, it->first);
+            file.clear();
+            if (createParentDirectories(localFileName)) {
+                file.open(localFileName, std::ios::binary | std::ios::trunc);
+            }
+            if (!file.is_open()) {
+                results[it->second].error = cts::SFTPError(
+                    SSH_OK, SSH_FX_FAILURE, "Failed to open local file: " + localFileName);
+                return true;
+            }
+
+            current = it->second;
+            return true;
+        },
+        [&](const char* data, size_t size) {
+            if (current < results.size() &&
+                !file.write(data, static_cast<std::streamsize>(size))) {
+                results[current].error =
+                    cts::SFTPError(SSH_OK, SSH_FX_FAILURE, "Failed to write local file");
+                file.close();
+                current = results.size();
+            }
+            return true;
+        },
+        [&]() {
+            if (current < results.size()) {
+                file.close();
+                received[current] = !file.fail();
+                current = results.size();
+            }
+            return true;
+        });
+
+    std::string errors;
+    const ExecOutputSink feed = [&](const char* data, size_t size) {
+        return reader.feed(data, size);
+    };
+
+    std::string names;
+    for (const auto& entry : index) {
+        names += "./" + entry.first;
+        names += '\0';
+    }
+
+    const bool requested =
+        writeExecChannel(channel.get(), names.data(), names.size(), feed, errors) &&
+        ssh_channel_send_eof(channel.get()) == SSH_OK;
+    const bool complete = requested && readExecChannel(channel.get(), feed, errors);
+    const int status = complete ? execChannelExitStatus(channel.get()) : -1;
+
+    assignErrors(errors, index, results);
+
+    for (const auto& entry : index) {
+        auto& result = results[entry.second];
+        if (result.error.isOk() && !received[entry.second]) {
+            result.error = cts::SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                                          "Not received from the server: " + entry.first);
+        }
+    }
+
+    if (!complete || !reader.finished()) {
+        return {complete ? cts::SFTPError(SSH_OK, SSH_FX_BAD_MESSAGE,
+                                          "Incomplete archive from tar on the server: " + errors)
+                         : tarError(session, "Failed to read from tar on the server"),
+                results};
+    }
+
+    // A file missing on the server already explains a failed exit. Without one, tar hit an
+    // error that the archive does not show, so the transfer as a whole fails.
+    const bool explained = std::any_of(results.begin(), results.end(),
+                                       [](const FileTransferResult& result) {
+                                           return !result.error.isOk();
+                                       });
+    if (status != 0 && !explained) {
+        return {cts::SFTPError(SSH_OK, SSH_FX_FAILURE, "tar failed on the server: " + errors),
+                results};
+    }
+
+    return {cts::SFTPError(), results};
+}
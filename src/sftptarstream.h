@@ -0,0 +1,154 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_TAR_STREAM_H
+#define SFTP_TAR_STREAM_H
+
+#include <libssh/libssh.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sftperror.h"
+#include "sftptransferoptions.h"
+
+namespace cts {
+
+// Writes a POSIX ustar archive to a sink as it is produced, buffering small writes. Names that
+// do not fit the ustar fields and files of 8 GiB or more get a pax extended header.
+class TarWriter {
+   public:
+    // Returns false when the data could not be delivered.
+    using Sink = std::function<bool(const char* data, size_t size)>;
+
+    explicit TarWriter(Sink sink);
+
+    // Starts a regular file; exactly size bytes must follow through writeData(), which pads
+    // the entry once the last of them arrived.
+    bool beginFile(const std::string& name, const uint64_t size, const uint32_t mode,
+                   const int64_t mtime);
+
+    bool writeData(const char* data, const size_t size);
+
+    // Writes the end of archive marker and flushes.
+    bool finish();
+
+   private:
+    bool writeHeader(const std::string& name, const std::string& prefix, const uint64_t size,
+                     const uint32_t mode, const int64_t mtime, const char type);
+
+    bool append(const char* data, const size_t size);
+
+    // Zeros up to the next block boundary after an entry of size bytes.
+    bool pad(const uint64_t size);
+
+    bool flush();
+
+    Sink m_sink;
+    std::string m_buffer;
+    uint64_t m_entrySize = 0;
+    uint64_t m_remaining = 0;
+    bool m_failed = false;
+
+    static constexpr size_t kBlockSize = 512;
+    static constexpr size_t kFlushSize = 64 * 1024;
+};
+
+// Parses a ustar, pax or GNU tar archive pushed to it in pieces of any size.
+class TarReader {
+   public:
+    struct Entry {
+        std::string name;
+        char type = '0';  // '0' regular file, '5' directory, ...
+        uint64_t size = 0;
+        uint32_t mode = 0;
+    };
+
+    // Each callback returns false to stop parsing. onData only sees the contents of regular
+    // files, and onEnd follows the last of it.
+    TarReader(std::function<bool(const Entry&)> onEntry,
+              std::function<bool(const char* data, size_t size)> onData,
+              std::function<bool()> onEnd);
+
+    // False on a malformed archive or when a callback stopped parsing.
+    bool feed(const char* data, size_t size);
+
+    // The end of archive marker was seen.
+    bool finished() const { return m_state == State::Finished; }
+
+   private:
+    enum class State { Header, FileData, MetaData, Skip, Finished, Failed };
+
+    bool parseHeader();
+
+    void parsePaxRecords();
+
+    bool endData();
+
+    std::function<bool(const Entry&)> m_onEntry;
+    std::function<bool(const char*, size_t)> m_onData;
+    std::function<bool()> m_onEnd;
+
+    static constexpr size_t kBlockSize = 512;
+
+    State m_state = State::Header;
+    char m_header[kBlockSize];
+    size_t m_headerSize = 0;
+    unsigned int m_zeroBlocks = 0;
+
+    char m_metaType = 0;  // 'x' or 'L' while their data is collected in m_meta
+    std::string m_meta;
+    std::string m_nextName;  // From a pax or GNU long name header, for the next entry
+    uint64_t m_nextSize = 0;
+    bool m_hasNextSize = false;
+
+    uint64_t m_remaining = 0;  // Data bytes left in the current entry
+    uint64_t m_padding = 0;
+};
+
+// Creates the missing local directories above path.
+bool createParentDirectories(const std::string& path);
+
+// Whether the session can run tar through an exec channel.
+bool remoteTarAvailable(ssh_session session);
+
+// Streams the files at localDir/path as one tar archive into a tar process that unpacks it in
+// remoteDir, creating it and any missing parents. Per file errors come from what the remote
+// tar reports. When tar exits with an error, the files it did not name are failed too and the
+// returned error is set, as it is when the stream itself failed.
+std::pair<SFTPError, std::vector<FileTransferResult>> tarPut(
+    ssh_session session, const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir);
+
+// Has the remote tar pack remoteDir/path for every path into one stream and unpacks it into
+// localDir. Only the requested paths are written, whatever else the archive holds.
+std::pair<SFTPError, std::vector<FileTransferResult>> tarGet(
+    ssh_session session, const std::string& localDir, const std::vector<std::string>& paths,
+    const std::string& remoteDir);
+
+}  // namespace cts
+
+#endif /* SFTP_TAR_STREAM_H */
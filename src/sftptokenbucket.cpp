@@ -0,0 +1,69 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftptokenbucket.h"
+
+#include <algorithm>  // min
+#include <thread>
+
+cts::TokenBucket::TokenBucket(const double bytesPerSecond, const double burstBytes) {
+    setRate(bytesPerSecond, burstBytes);
+}
+
+void cts::TokenBucket::setRate(const double bytesPerSecond, const double burstBytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    refill(Clock::now());
+    m_rate = bytesPerSecond > 0 ? bytesPerSecond : 0;
+    m_burst = burstBytes > 0 ? burstBytes : m_rate / 4;
+    m_tokens = std::min(m_tokens, m_burst);
+}
+
+double cts::TokenBucket::rate() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_rate;
+}
+
+void cts::TokenBucket::consume(const uint64_t bytes) {
+    std::chrono::duration<double> wait(0);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_rate <= 0) {
+            return;
+        }
+
+        refill(Clock::now());
+        m_tokens -= static_cast<double>(bytes);
+        if (m_tokens >= 0) {
+            return;
+        }
+
+        wait = std::chrono::duration<double>(-m_tokens / m_rate);
+    }
+
+    std::this_thread::sleep_for(wait);
+}
+
+void cts::TokenBucket::refill(const Clock::time_point now) {
+    const std::chrono::duration<double> elapsed = now - m_lastRefill;
+    m_lastRefill = now;
+    m_tokens = std::min(m_burst, m_tokens + elapsed.count() * m_rate);
+}
@@ -0,0 +1,60 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_TOKEN_BUCKET_H
+#define SFTP_TOKEN_BUCKET_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace cts {
+
+// Thread safe token bucket rate limiter in bytes per second. consume() takes what it needs
+// even when that leaves the bucket in debt and then sleeps the debt off, so chunks larger
+// than the burst size still pass and concurrent callers share the rate fairly.
+class TokenBucket {
+   public:
+    // A rate of 0 means unlimited. The burst defaults to a quarter second at full rate.
+    explicit TokenBucket(const double bytesPerSecond = 0, const double burstBytes = 0);
+
+    void setRate(const double bytesPerSecond, const double burstBytes = 0);
+
+    double rate() const;
+
+    void consume(const uint64_t bytes);
+
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    void refill(const Clock::time_point now);
+
+    mutable std::mutex m_mutex;
+    double m_rate = 0;
+    double m_burst = 0;
+    double m_tokens = 0;
+    Clock::time_point m_lastRefill = Clock::now();
+};
+
+}  // namespace cts
+
+#endif /* SFTP_TOKEN_BUCKET_H */
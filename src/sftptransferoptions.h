@@ -0,0 +1,104 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_TRANSFER_OPTIONS_H
+#define SFTP_TRANSFER_OPTIONS_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "sftpchecksum.h"
+#include "sftperror.h"
+
+namespace cts {
+
+// What one SFTPClient::put() or SFTPClient::get() moved, for TransferOptions::onStats.
+struct TransferStats {
+    uint64_t bytes = 0;      // File data, without what resumeOffset skipped
+    uint64_t wireBytes = 0;  // What crossed the channel for it, below bytes when compressed
+    bool zstd = false;       // Went through zstd over an exec channel
+    std::chrono::milliseconds elapsed{0};
+
+    // wireBytes / bytes, 1.0 for data sent as is.
+    double compressionRatio() const {
+        return bytes > 0 ? static_cast<double>(wireBytes) / static_cast<double>(bytes) : 1.0;
+    }
+};
+
+// Per call settings for SFTPClient::put() and SFTPClient::get().
+struct TransferOptions {
+    // 0 uses ConnectOptions::chunkSize.
+    unsigned int chunkSize = 0;
+
+    // Called after every chunk the server acknowledged, with the bytes transferred so far.
+    // Returning false stops the transfer with an SFTPError for which isCancelled() is true.
+    // zstd transfers, see below, report 0 until the whole file arrived.
+    std::function<bool(uint64_t transferred)> progress;
+
+    // Continue an earlier transfer of the same file from this offset instead of starting over.
+    // put() then keeps the remote file and get() the local one, and both skip what lies before
+    // it.
+    uint64_t resumeOffset = 0;
+
+    // Hash the file while it streams through put() or get(), so no second pass over it is
+    // needed. onChecksum receives the hex digest of the whole file once the transfer is done.
+    ChecksumAlgorithm checksum = ChecksumAlgorithm::None;
+    std::function<void(const std::string& digest)> onChecksum;
+
+    // Compare the digest with the server's hash of the remote file, see remoteChecksum(). A
+    // difference fails with an SFTPError for which isChecksumMismatch() is true. Servers that
+    // cannot hash the file, and CRC32C, which no server computes, skip the comparison.
+    bool verifyChecksum = false;
+
+    // Keep sparse files sparse. put() skips the holes SEEK_DATA/SEEK_HOLE find in the local
+    // file and chunks that are all zeros, seeking the remote handle past them, and get()
+    // leaves or punches holes for chunks of zeros instead of writing them.
+    bool sparse = false;
+
+    // Stream the file through zstd over an exec channel instead of SFTP, for links where
+    // bandwidth rather than CPU is the limit. put() compresses on zstdThreads cores, 0 using all
+    // of them, for a zstd process on the server that writes the remote file. get() has zstd on
+    // the server compress with as many threads and decompresses locally. Levels run from 1 to
+    // 19. The transfer falls back to SFTP when the server has no zstd, the library was built
+    // without libzstd, resumeOffset is set or get() is asked to keep the file sparse. A zstd
+    // transfer cannot be resumed: progress reports 0 until it is complete, and after a failure
+    // it starts over, also under a RetryPolicy.
+    bool zstd = false;
+    int zstdLevel = 3;
+    unsigned int zstdThreads = 0;
+
+    // Called when put(), putBuffer() or get() returns, also after a failure, with what it
+    // transferred.
+    std::function<void(const TransferStats& stats)> onStats;
+};
+
+// The outcome for one file of a multi-file transfer.
+struct FileTransferResult {
+    std::string path;
+    SFTPError error;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_TRANSFER_OPTIONS_H */
@@ -0,0 +1,230 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftptransferscheduler.h"
+
+#include <algorithm>  // max, find
+
+cts::SFTPTransferScheduler::SFTPTransferScheduler(const double globalBytesPerSecond)
+    : m_globalBucket(globalBytesPerSecond) {}
+
+cts::SFTPTransferScheduler::~SFTPTransferScheduler() { stop(); }
+
+cts::SFTPError cts::SFTPTransferScheduler::addHost(const std::string& host, const std::string& user,
+                                                   const std::string& pw,
+                                                   const ConnectOptions& options,
+                                                   const unsigned int sessions,
+                                                   const double bytesPerSecond,
+                                                   const uint16_t port,
+                                                   const bool onlyKnownServers) {
+    std::unique_ptr<Host> entry(new Host());
+    entry->bucket.setRate(bytesPerSecond);
+
+    for (unsigned int i = 0; i < std::max(sessions, 1u); ++i) {
+        std::unique_ptr<SFTPClient> client(new SFTPClient());
+        const auto err = client->connect(host, user, pw, options, port, onlyKnownServers);
+        if (!err.isOk()) {
+            return err;
+        }
+        entry->clients.push_back(std::move(client));
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopping || m_hosts.count(host) > 0) {
+        return cts::SFTPError(SSH_ERROR, SSH_FX_FAILURE, "Host already added: " + host);
+    }
+
+    Host& added = *entry;
+    for (const auto& client : added.clients) {
+        const SFTPClient& session = *client;
+        added.workers.emplace_back([this, &added, &session]() { workerLoop(added, session); });
+    }
+    m_hosts[host] = std::move(entry);
+
+    return cts::SFTPError();
+}
+
+void cts::SFTPTransferScheduler::setGlobalBandwidth(const double bytesPerSecond) {
+    m_globalBucket.setRate(bytesPerSecond);
+}
+
+void cts::SFTPTransferScheduler::setHostBandwidth(const std::string& host,
+                                                  const double bytesPerSecond) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_hosts.find(host);
+    if (it != m_hosts.end()) {
+        it->second->bucket.setRate(bytesPerSecond);
+    }
+}
+
+std::future<cts::SFTPTransferScheduler::Result> cts::SFTPTransferScheduler::submit(
+    const Job& job) {
+    auto entry = std::make_shared<Entry>();
+    entry->job = job;
+    auto future = entry->promise.get_future();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const auto it = m_hosts.find(job.host);
+    if (m_stopping || it == m_hosts.end()) {
+        lock.unlock();
+        entry->result.error = m_stopping ? cts::SFTPError(SSH_OK, cts::SFTPError::kCancelled,
+                                                          "Scheduler stopped")
+                                         : cts::SFTPError(SSH_ERROR, SSH_FX_NO_CONNECTION,
+                                                          "Unknown host: " + job.host);
+        entry->promise.set_value(entry->result);
+        return future;
+    }
+
+    Host& host = *it->second;
+    entry->sequence = m_nextSequence++;
+    entry->enqueuedAt = Clock::now();
+    host.queue.push(entry);
+    ++m_metrics.queued;
+
+    preemptFor(host, job.priority);
+    lock.unlock();
+    m_workAvailable.notify_all();
+
+    return future;
+}
+
+cts::SFTPTransferScheduler::Metrics cts::SFTPTransferScheduler::metrics() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_metrics;
+}
+
+void cts::SFTPTransferScheduler::stop() {
+    std::vector<std::shared_ptr<Entry>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        for (auto& host : m_hosts) {
+            auto& queue = host.second->queue;
+            while (!queue.empty()) {
+                dropped.push_back(queue.top());
+                queue.pop();
+            }
+        }
+        m_metrics.queued = 0;
+    }
+    m_workAvailable.notify_all();
+
+    for (auto& entry : dropped) {
+        entry->result.error =
+            cts::SFTPError(SSH_OK, cts::SFTPError::kCancelled, "Scheduler stopped");
+        entry->promise.set_value(entry->result);
+    }
+
+    for (auto& host : m_hosts) {
+        for (auto& worker : host.second->workers) {
+            worker.join();
+        }
+        host.second->workers.clear();
+    }
+}
+
+void cts::SFTPTransferScheduler::preemptFor(Host& host, const int priority) {
+    if (host.running.size() < host.workers.size()) {
+        return;  // A session is free
+    }
+
+    std::shared_ptr<Entry> victim;
+    for (const auto& running : host.running) {
+        if (!running->preempt && running->job.priority < priority &&
+            (!victim || running->job.priority < victim->job.priority)) {
+            victim = running;
+        }
+    }
+
+    if (victim) {
+        victim->preempt = true;
+    }
+}
+
+void cts::SFTPTransferScheduler::workerLoop(Host& host, const SFTPClient& client) {
+    while (true) {
+        std::shared_ptr<Entry> entry;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_workAvailable.wait(lock, [&]() { return m_stopping || !host.queue.empty(); });
+            if (m_stopping) {
+                return;
+            }
+
+            entry = host.queue.top();
+            host.queue.pop();
+            host.running.push_back(entry);
+            entry->preempt = false;
+            entry->result.queueTime += std::chrono::duration_cast<std::chrono::milliseconds>(
+                Clock::now() - entry->enqueuedAt);
+
+            --m_metrics.queued;
+            ++m_metrics.running;
+        }
+
+        // The buckets are charged for what the server acknowledged since the last chunk.
+        uint64_t charged = entry->result.bytes;
+        TransferOptions options;
+        options.resumeOffset = entry->result.bytes;
+        options.progress = [&](uint64_t transferred) {
+            const auto delta = transferred > charged ? transferred - charged : 0;
+            charged = transferred;
+            entry->result.bytes = transferred;
+
+            host.bucket.consume(delta);
+            m_globalBucket.consume(delta);
+
+            return !entry->preempt && !m_stopping;
+        };
+
+        const auto started = Clock::now();
+        const auto& job = entry->job;
+        const auto err = job.direction == Direction::Put
+                             ? client.put(job.localFileName, job.remoteFileName, options)
+                             : client.get(job.localFileName, job.remoteFileName, options);
+        entry->result.transferTime +=
+            std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started);
+        entry->result.error = err;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            host.running.erase(std::find(host.running.begin(), host.running.end(), entry));
+            --m_metrics.running;
+
+            if (err.isCancelled() && entry->preempt && !m_stopping) {
+                ++entry->result.preemptions;
+                ++m_metrics.preemptions;
+                ++m_metrics.queued;
+                entry->enqueuedAt = Clock::now();
+                host.queue.push(entry);
+                m_workAvailable.notify_all();
+                continue;
+            }
+
+            ++m_metrics.completed;
+            m_metrics.totalQueueTime += entry->result.queueTime;
+            m_metrics.maxQueueTime = std::max(m_metrics.maxQueueTime, entry->result.queueTime);
+        }
+
+        entry->promise.set_value(entry->result);
+    }
+}
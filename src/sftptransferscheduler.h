@@ -0,0 +1,149 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_TRANSFER_SCHEDULER_H
+#define SFTP_TRANSFER_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sftpclient.h"
+#include "sftptokenbucket.h"
+
+namespace cts {
+
+// Queues put()/get() jobs per host and runs them on that host's sessions, highest priority
+// first and in submission order within a priority. Bandwidth is capped by token buckets, one
+// for all hosts and one per host, charged after every acknowledged chunk.
+//
+// When a job arrives while every session of its host is busy with lower priority work, the
+// lowest priority running transfer is preempted: it stops after its current chunk, goes back
+// to the queue and later resumes where it stopped.
+class SFTPTransferScheduler {
+   public:
+    enum class Direction { Put, Get };
+
+    struct Job {
+        std::string host;  // As passed to addHost()
+        Direction direction = Direction::Put;
+        std::string localFileName;
+        std::string remoteFileName;
+        int priority = 0;  // Higher runs first
+    };
+
+    struct Result {
+        SFTPError error;
+        std::chrono::milliseconds queueTime{0};  // Total wait, including after preemptions
+        std::chrono::milliseconds transferTime{0};
+        uint64_t bytes = 0;
+        unsigned int preemptions = 0;
+    };
+
+    struct Metrics {
+        size_t queued = 0;
+        size_t running = 0;
+        uint64_t completed = 0;
+        uint64_t preemptions = 0;
+        std::chrono::milliseconds totalQueueTime{0};
+        std::chrono::milliseconds maxQueueTime{0};
+    };
+
+    // A bandwidth of 0 is unlimited.
+    explicit SFTPTransferScheduler(const double globalBytesPerSecond = 0);
+    ~SFTPTransferScheduler();
+
+    // Opens sessions to host, each served by one worker thread.
+    SFTPError addHost(const std::string& host, const std::string& user, const std::string& pw,
+                      const ConnectOptions& options = ConnectOptions(),
+                      const unsigned int sessions = 2, const double bytesPerSecond = 0,
+                      const uint16_t port = 22, const bool onlyKnownServers = true);
+
+    void setGlobalBandwidth(const double bytesPerSecond);
+
+    void setHostBandwidth(const std::string& host, const double bytesPerSecond);
+
+    std::future<Result> submit(const Job& job);
+
+    Metrics metrics() const;
+
+    // Queued jobs complete as cancelled, running ones stop after their current chunk.
+    void stop();
+
+   private:
+    SFTPTransferScheduler(const SFTPTransferScheduler&) = delete;
+    SFTPTransferScheduler& operator=(const SFTPTransferScheduler&) = delete;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Job job;
+        uint64_t sequence = 0;
+        std::promise<Result> promise;
+        Clock::time_point enqueuedAt;
+        Result result;
+        std::atomic<bool> preempt{false};
+    };
+
+    struct EntryOrder {
+        bool operator()(const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) const {
+            if (a->job.priority != b->job.priority) {
+                return a->job.priority < b->job.priority;
+            }
+            return a->sequence > b->sequence;
+        }
+    };
+
+    struct Host {
+        std::vector<std::unique_ptr<SFTPClient>> clients;
+        std::vector<std::thread> workers;
+        TokenBucket bucket;
+        std::priority_queue<std::shared_ptr<Entry>, std::vector<std::shared_ptr<Entry>>,
+                            EntryOrder>
+            queue;
+        std::vector<std::shared_ptr<Entry>> running;
+    };
+
+    void preemptFor(Host& host, const int priority);
+
+    void workerLoop(Host& host, const SFTPClient& client);
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_workAvailable;
+    std::map<std::string, std::unique_ptr<Host>> m_hosts;
+    TokenBucket m_globalBucket;
+    std::atomic<bool> m_stopping{false};
+    uint64_t m_nextSequence = 0;
+    Metrics m_metrics;
+};
+
+}  // namespace cts
+
+#endif /* SFTP_TRANSFER_SCHEDULER_H */
@@ -0,0 +1,343 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "sftpzstdstream.h"
+
+#ifdef SFTPCLIENTPP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>  // min, max
+#include <cstdio>     // remove, rename
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>  // MoveFileExA
+#endif
+
+#include "sftpsidechannel.h"
+
+#ifdef SFTPCLIENTPP_HAVE_ZSTD
+
+namespace {
+
+// Levels above this need --ultra on zstd's command line.
+constexpr int kMaxZstdLevel = 19;
+
+// Read from the local file per call into the compressor, which hands its workers jobs of a few
+// MiB each.
+constexpr size_t kZstdInputSize = 1024 * 1024;
+
+struct ZstdCCtxDeleter {
+    void operator()(ZSTD_CCtx* context) const { ZSTD_freeCCtx(context); }
+};
+
+struct ZstdDCtxDeleter {
+    void operator()(ZSTD_DCtx* context) const { ZSTD_freeDCtx(context); }
+};
+
+// A download in progress, removed unless it replaced its target.
+class ZstdPartialFile {
+   public:
+    explicit ZstdPartialFile(const std::string& name) : m_name(name) {}
+    ~ZstdPartialFile() {
+        if (!m_replaced) {
+            std::remove(m_name.c_str());
+        }
+    }
+
+    const std::string& name() const { return m_name; }
+
+    bool replace(const std::string& target) {
+#ifdef _WIN32
+        m_replaced = MoveFileExA(m_name.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        m_replaced = std::rename(m_name.c_str(), target.c_str()) == 0;
+#endif
+        return m_replaced;
+    }
+
+   private:
+    ZstdPartialFile(const ZstdPartialFile&) = delete;
+    ZstdPartialFile& operator=(const ZstdPartialFile&) = delete;
+
+    const std::string m_name;
+    bool m_replaced = false;
+};
+
+int zstdCompressionLevel(const cts::TransferOptions& options) {
+    return std::max(1, std::min(options.zstdLevel, kMaxZstdLevel));
+}
+
+cts::SFTPError zstdChannelError(ssh_session session, const std::string& what) {
+    return cts::SFTPError(ssh_get_error_code(session), SSH_FX_FAILURE,
+                          what + " " + ssh_get_error(session));
+}
+
+}  // namespace
+
+bool cts::zstdSupported() { return true; }
+
+std::pair<cts::SFTPError, cts::TransferStats> cts::zstdPut(ssh_session session,
+                                                           const std::string& localFileName,
+                                                           const std::string& remoteFileName,
+                                                           const TransferOptions& options,
+                                                           Checksum& checksum) {
+    TransferStats stats;
+    stats.zstd = true;
+
+    std::ifstream file(localFileName, std::ios::binary);
+    if (!file) {
+        return {SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                          "Failed to open local file: " + localFileName),
+                stats};
+    }
+
+    // The content checksum lets the remote zstd catch corruption on its own. libzstd built
+    // without threads rejects nbWorkers and compresses on this thread instead.
+    std::unique_ptr<ZSTD_CCtx, ZstdCCtxDeleter> context(ZSTD_createCCtx());
+    if (!context ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(context.get(), ZSTD_c_compressionLevel,
+                                            zstdCompressionLevel(options))) ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(context.get(), ZSTD_c_checksumFlag, 1))) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE, "Failed to set up the zstd compressor"), stats};
+    }
+    const unsigned int threads = options.zstdThreads > 0
+                                     ? options.zstdThreads
+                                     : std::max(std::thread::hardware_concurrency(), 1u);
+    ZSTD_CCtx_setParameter(context.get(), ZSTD_c_nbWorkers, static_cast<int>(threads));
+
+    // zstd writes through -o like SFTP creates files, owner only, and keeps runs of zeros
+    // sparse.
+    auto channel = openExecChannel(
+        session, "umask 077 && exec zstd -d -q -f -o " + shellQuote(remoteFileName));
+    if (!channel) {
+        return {zstdChannelError(session, "Failed to start zstd on the server"), stats};
+    }
+
+    const ExecOutputSink ignoreOutput = [](const char*, size_t) { return true; };
+    std::vector<char> input(kZstdInputSize);
+    std::vector<char> output(ZSTD_CStreamOutSize());
+    std::string errors;
+
+    bool last = false;
+    while (!last) {
+        file.read(input.data(), static_cast<std::streamsize>(input.size()));
+        if (file.bad()) {
+            return {SFTPError(SSH_OK, SSH_FX_FAILURE,
+                              "Failed to read local file: " + localFileName),
+                    stats};
+        }
+        const auto count = static_cast<size_t>(file.gcount());
+        last = count < input.size();
+        checksum.update(input.data(), count);
+
+        // Without ZSTD_e_end the compressor may hold on to input until its jobs fill up.
+        ZSTD_inBuffer in = {input.data(), count, 0};
+        const auto mode = last ? ZSTD_e_end : ZSTD_e_continue;
+        bool consumed = false;
+        while (!consumed) {
+            ZSTD_outBuffer out = {output.data(), output.size(), 0};
+            const size_t remaining = ZSTD_compressStream2(context.get(), &out, &in, mode);
+            if (ZSTD_isError(remaining)) {
+                return {SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                  std::string("zstd compression failed: ") +
+                                      ZSTD_getErrorName(remaining)),
+                        stats};
+            }
+
+            // zstd that exited early, say for a missing directory, explains why on stderr.
+            if (out.pos > 0 &&
+                !writeExecChannel(channel.get(), output.data(), out.pos, ignoreOutput, errors)) {
+                return {errors.empty()
+                            ? zstdChannelError(session, "Failed to stream to zstd on the server")
+                            : SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                        "zstd failed on the server: " + errors),
+                        stats};
+            }
+            stats.wireBytes += out.pos;
+            consumed = last ? remaining == 0 : in.pos == in.size;
+        }
+
+        // Nothing counts as acknowledged before zstd on the server exits cleanly, as a broken
+        // frame leaves no remote file to resume, so progress stays at 0 until then.
+        stats.bytes += count;
+        if (options.progress && !options.progress(0)) {
+            return {SFTPError(SSH_OK, SFTPError::kCancelled, "Transfer cancelled"), stats};
+        }
+    }
+
+    ssh_channel_send_eof(channel.get());
+    if (!readExecChannel(channel.get(), ignoreOutput, errors)) {
+        return {zstdChannelError(session, "Failed to stream to zstd on the server"), stats};
+    }
+    if (execChannelExitStatus(channel.get()) != 0) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE, "zstd failed on the server: " + errors),
+                stats};
+    }
+
+    if (options.progress) {
+        options.progress(stats.bytes);
+    }
+    return {SFTPError(), stats};
+}
+
+std::pair<cts::SFTPError, cts::TransferStats> cts::zstdGet(ssh_session session,
+                                                           const std::string& localFileName,
+                                                           const std::string& remoteFileName,
+                                                           const TransferOptions& options,
+                                                           Checksum& checksum) {
+    TransferStats stats;
+    stats.zstd = true;
+
+    std::unique_ptr<ZSTD_DCtx, ZstdDCtxDeleter> context(ZSTD_createDCtx());
+    if (!context) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE, "Failed to set up the zstd decompressor"),
+                stats};
+    }
+
+    // The stream goes to a file next to localFileName, which only replaces it once everything
+    // arrived, so a missing remote file or a failed transfer leaves the local one as it was.
+    // Declared before the stream so that the stream is closed before the file is removed.
+    ZstdPartialFile partial(localFileName + ".zstdpart");
+    std::ofstream file(partial.name(), std::ios::binary);
+    if (!file) {
+        return {SFTPError(SSH_OK, SSH_FX_NO_SUCH_FILE,
+                          "Failed to open local file: " + partial.name()),
+                stats};
+    }
+
+    // -T0 has zstd use every core of the server.
+    auto channel = openExecChannel(
+        session, "exec zstd -q -c -T" + std::to_string(options.zstdThreads) + " -" +
+                     std::to_string(zstdCompressionLevel(options)) + " -- " +
+                     shellQuote(remoteFileName));
+    if (!channel) {
+        return {zstdChannelError(session, "Failed to start zstd on the server"), stats};
+    }
+
+    std::vector<char> output(ZSTD_DStreamOutSize());
+    size_t pending = 0;  // 0 once a frame is complete
+    SFTPError failure;
+    const ExecOutputSink feed = [&](const char* data, size_t size) {
+        stats.wireBytes += size;
+
+        // A full output buffer can leave decompressed data behind in the context.
+        ZSTD_inBuffer in = {data, size, 0};
+        bool full = false;
+        while (in.pos < in.size || full) {
+            ZSTD_outBuffer out = {output.data(), output.size(), 0};
+            const size_t consumed = in.pos;
+            const size_t result = ZSTD_decompressStream(context.get(), &out, &in);
+            if (ZSTD_isError(result)) {
+                failure = SFTPError(SSH_OK, SSH_FX_BAD_MESSAGE,
+                                    std::string("Corrupt zstd stream from the server: ") +
+                                        ZSTD_getErrorName(result));
+                return false;
+            }
+
+            // After the end of a frame, a call that finds nothing to do already asks for the
+            // header of the next one.
+            if (in.pos > consumed || out.pos > 0) {
+                pending = result;
+            }
+
+            if (!file.write(output.data(), static_cast<std::streamsize>(out.pos))) {
+                failure = SFTPError(SSH_OK, SSH_FX_FAILURE,
+                                    "Failed to write local file: " + localFileName);
+                return false;
+            }
+            checksum.update(output.data(), out.pos);
+            stats.bytes += out.pos;
+            full = out.pos == out.size;
+        }
+
+        // The partial file is removed on failure, so nothing is reported before it replaced
+        // localFileName.
+        if (options.progress && !options.progress(0)) {
+            failure = SFTPError(SSH_OK, SFTPError::kCancelled, "Transfer cancelled");
+            return false;
+        }
+        return true;
+    };
+
+    // Once reading stopped early the exit status would wait for a process that is stuck on a
+    // full channel window, so it is only asked for after a complete read.
+    std::string errors;
+    const bool complete = readExecChannel(channel.get(), feed, errors);
+    if (!failure.isOk()) {
+        return {failure, stats};
+    }
+    if (!complete) {
+        return {zstdChannelError(session, "Failed to read from zstd on the server"), stats};
+    }
+    if (execChannelExitStatus(channel.get()) != 0) {
+        const int code =
+            errors.find("No such file") != std::string::npos ? SSH_FX_NO_SUCH_FILE : SSH_FX_FAILURE;
+        return {SFTPError(SSH_OK, code, "zstd failed on the server: " + errors), stats};
+    }
+    if (pending != 0) {
+        return {SFTPError(SSH_OK, SSH_FX_BAD_MESSAGE, "Incomplete zstd stream from the server"),
+                stats};
+    }
+
+    file.close();
+    if (!file) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE, "Failed to write local file: " + localFileName),
+                stats};
+    }
+    if (!partial.replace(localFileName)) {
+        return {SFTPError(SSH_OK, SSH_FX_FAILURE,
+                          "Failed to replace local file: " + localFileName),
+                stats};
+    }
+
+    if (options.progress) {
+        options.progress(stats.bytes);
+    }
+    return {SFTPError(), stats};
+}
+
+#else
+
+bool cts::zstdSupported() { return false; }
+
+std::pair<cts::SFTPError, cts::TransferStats> cts::zstdPut(ssh_session, const std::string&,
+                                                           const std::string&,
+                                                           const TransferOptions&, Checksum&) {
+    return {SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED, "Built without libzstd"), TransferStats()};
+}
+
+std::pair<cts::SFTPError, cts::TransferStats> cts::zstdGet(ssh_session, const std::string&,
+                                                           const std::string&,
+                                                           const TransferOptions&, Checksum&) {
+    return {SFTPError(SSH_OK, SSH_FX_OP_UNSUPPORTED, "Built without libzstd"), TransferStats()};
+}
+
+#endif
+
+bool cts::remoteZstdAvailable(ssh_session session) {
+    return remoteCommandSucceeds(session, "zstd --version");
+}
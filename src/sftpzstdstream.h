@@ -0,0 +1,65 @@
+// MIT License
+//
+// Copyright (c) 2025 Carson Smith
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef SFTP_ZSTD_STREAM_H
+#define SFTP_ZSTD_STREAM_H
+
+#include <libssh/libssh.h>
+
+#include <string>
+#include <utility>
+
+#include "sftpchecksum.h"
+#include "sftperror.h"
+#include "sftptransferoptions.h"
+
+namespace cts {
+
+// Whether the library was built with libzstd (SFTPCLIENTPP_HAVE_ZSTD), which the zstd transfer
+// mode of TransferOptions needs.
+bool zstdSupported();
+
+// Whether the session can run zstd through an exec channel.
+bool remoteZstdAvailable(ssh_session session);
+
+// Compresses localFileName with libzstd's multi-threaded streaming compressor, which works on
+// chunks of the file in parallel on options.zstdThreads cores, and streams the frame into a
+// zstd process on the server that writes remoteFileName. checksum is fed the file as it is
+// read. options.progress gets 0 while the stream runs, since a cut off frame leaves nothing on
+// the server to resume from, and the file size once zstd there exited cleanly. A failed
+// transfer has to start over. elapsed is left to the caller.
+std::pair<SFTPError, TransferStats> zstdPut(ssh_session session, const std::string& localFileName,
+                                            const std::string& remoteFileName,
+                                            const TransferOptions& options, Checksum& checksum);
+
+// Has zstd on the server compress remoteFileName and decompresses the stream into
+// localFileName, feeding checksum as the data is written. The data lands in
+// localFileName.zstdpart first, which replaces localFileName only after a complete stream and
+// is removed otherwise. options.progress gets 0 until then and the file size after, so a
+// failed transfer has to start over.
+std::pair<SFTPError, TransferStats> zstdGet(ssh_session session, const std::string& localFileName,
+                                            const std::string& remoteFileName,
+                                            const TransferOptions& options, Checksum& checksum);
+
+}  // namespace cts
+
+#endif /* SFTP_ZSTD_STREAM_H */